@@ -0,0 +1,663 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "header/APU.h"
+#include "header/CPU.h"
+#include "header/StateBuffer.h"
+
+// Bits that always read back as 1, from NR10 to 0xFF2F
+static constexpr BYTE READ_MASKS[0x20] =
+{
+	0x80, 0x3F, 0x00, 0xFF, 0xBF,
+	0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+	0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+	0xFF, 0xFF, 0x00, 0x00, 0xBF,
+	0x00, 0x00, 0x70,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// The eight steps of each square wave duty cycle: 12.5%, 25%, 50% and 75%
+static constexpr BYTE DUTY_CYCLES[4][8] =
+{
+	{ 0, 0, 0, 0, 0, 0, 0, 1 },
+	{ 1, 0, 0, 0, 0, 0, 0, 1 },
+	{ 1, 0, 0, 0, 0, 1, 1, 1 },
+	{ 0, 1, 1, 1, 1, 1, 1, 0 },
+};
+
+APU::APU() :
+	m_ioMemory(nullptr),
+	m_powered(false),
+	m_lastSyncCycle(0),
+	m_frameSequencerCycle(FRAME_SEQUENCER_PERIOD),
+	m_frameSequencerStep(0),
+	m_left(),
+	m_right(),
+	m_frameStartCycle(0),
+	m_sampleRate(DEFAULT_SAMPLE_RATE),
+	m_rateAdjustment(1.0),
+	m_appliedRateAdjustment(1.0),
+	m_outputEnabled(true),
+	m_registersOnly(false)
+{
+	// Channels are saved as they are, so the padding between their fields has to be cleared too
+	memset(m_channels, 0, sizeof(m_channels));
+	memset(m_outputLeft, 0, sizeof(m_outputLeft));
+	memset(m_outputRight, 0, sizeof(m_outputRight));
+	SetSampleRate(DEFAULT_SAMPLE_RATE);
+}
+
+void APU::Initialize(BYTE* ioMemory)
+{
+	m_ioMemory = ioMemory;
+}
+
+void APU::Reset()
+{
+	memset(m_channels, 0, sizeof(m_channels));
+	memset(m_outputLeft, 0, sizeof(m_outputLeft));
+	memset(m_outputRight, 0, sizeof(m_outputRight));
+	memset(m_ioMemory + NR10, 0, LAST_REGISTER - NR10 + 1);
+	m_left.Clear();
+	m_right.Clear();
+
+	m_lastSyncCycle = 0;
+	m_frameStartCycle = 0;
+	m_frameSequencerCycle = FRAME_SEQUENCER_PERIOD;
+	m_frameSequencerStep = 0;
+
+	// Written directly rather than as the program would, since writing NRx4 would trigger the channels again
+	struct RegisterValue
+	{
+		WORD address;
+		BYTE value;
+	};
+
+	static constexpr RegisterValue BOOT_REGISTERS[] =
+	{
+		{ NR52, 0xF1 }, { 0x10, 0x80 }, { 0x11, 0xBF }, { 0x12, 0xF3 }, { 0x14, 0xBF },
+		{ 0x16, 0x3F }, { 0x17, 0x00 }, { 0x19, 0xBF }, { 0x1A, 0x7F }, { 0x1B, 0xFF },
+		{ 0x1C, 0x9F }, { 0x1E, 0xBF }, { 0x20, 0xFF }, { 0x21, 0x00 }, { 0x22, 0x00 },
+		{ 0x23, 0xBF }, { NR50, 0x77 }, { NR51, 0xF3 },
+	};
+
+	for (const RegisterValue& bootRegister : BOOT_REGISTERS)
+	{
+		const bool isTrigger = bootRegister.address < NR50 && (bootRegister.address - NR10) % 5 == 4;
+		WriteRegister(bootRegister.address, isTrigger ? bootRegister.value & ~BIT_7 : bootRegister.value, 0);
+		m_ioMemory[bootRegister.address] = bootRegister.value;
+	}
+
+	// The boot chime is still on channel 1, its envelope has faded out by now
+	m_channels[SQUARE_1].enabled = true;
+	m_channels[SQUARE_1].envelopeVolume = 0;
+}
+
+void APU::CatchUp(uint64_t clockCycle)
+{
+	while (m_lastSyncCycle < clockCycle)
+	{
+		// The frame sequencer changes volumes and can silence channels, so the channels stop at each of its steps.
+		// They also stop before the blip buffers run out of room, in case nobody ends the frame in time.
+		const uint64_t frameEnd = m_frameStartCycle + MAX_FRAME_CYCLES;
+		const uint64_t segmentEnd = std::min({ clockCycle, m_frameSequencerCycle, frameEnd });
+		if (!m_registersOnly)
+		{
+			for (int i = 0; i < CHANNEL_COUNT; ++i)
+			{
+				RunChannel(i, segmentEnd);
+			}
+		}
+		m_lastSyncCycle = segmentEnd;
+
+		if (segmentEnd == m_frameSequencerCycle)
+		{
+			StepFrameSequencer(segmentEnd);
+			m_frameSequencerCycle += FRAME_SEQUENCER_PERIOD;
+		}
+
+		if (segmentEnd == frameEnd)
+		{
+			FinishBlipFrame(segmentEnd);
+		}
+	}
+}
+
+void APU::EndFrame(uint64_t clockCycle)
+{
+	CatchUp(clockCycle);
+	FinishBlipFrame(clockCycle);
+}
+
+void APU::FinishBlipFrame(uint64_t clockCycle)
+{
+	// Frames run with the output off are thrown away, the buffers carry on from where the output stopped
+	if (m_outputEnabled && !m_registersOnly)
+	{
+		const uint32_t frameCycles = static_cast<uint32_t>(clockCycle - m_frameStartCycle);
+		m_left.EndFrame(frameCycles);
+		m_right.EndFrame(frameCycles);
+
+		if (GetSamplesAvailable() > MAX_BUFFERED_SAMPLES)
+		{
+			DropSamples(GetSamplesAvailable() - MAX_BUFFERED_SAMPLES);
+		}
+	}
+
+	m_frameStartCycle = clockCycle;
+
+	// The ratio only changes between frames, every step in a frame has to be placed with the same one
+	if (m_rateAdjustment != m_appliedRateAdjustment)
+	{
+		m_left.SetRatio(CPU::CLOCKSPEED, m_sampleRate * m_rateAdjustment);
+		m_right.SetRatio(CPU::CLOCKSPEED, m_sampleRate * m_rateAdjustment);
+		m_appliedRateAdjustment = m_rateAdjustment;
+	}
+}
+
+BYTE APU::ReadRegister(WORD address) const
+{
+	if (address >= WAVE_RAM)
+	{
+		return m_ioMemory[address];
+	}
+
+	if (address == NR52)
+	{
+		BYTE status = (m_ioMemory[NR52] & BIT_7) | READ_MASKS[NR52 - NR10];
+		for (int i = 0; i < CHANNEL_COUNT; ++i)
+		{
+			status |= m_channels[i].enabled ? (1 << i) : 0;
+		}
+		return status;
+	}
+
+	return m_ioMemory[address] | READ_MASKS[address - NR10];
+}
+
+void APU::WriteRegister(WORD address, BYTE data, uint64_t clockCycle)
+{
+	if (address >= WAVE_RAM)
+	{
+		m_ioMemory[address] = data;
+		UpdateOutput(WAVE, clockCycle);
+		return;
+	}
+
+	if (address == NR52)
+	{
+		const bool power = data & BIT_7;
+		if (!power && m_powered)
+		{
+			PowerOff();
+		}
+		else if (power && !m_powered)
+		{
+			m_powered = true;
+			m_frameSequencerStep = 0;
+		}
+
+		m_ioMemory[NR52] = data & BIT_7;
+		UpdateOutputs(clockCycle);
+		return;
+	}
+
+	// Every register but NR52 is read only while the APU is off
+	if (!m_powered)
+	{
+		return;
+	}
+
+	m_ioMemory[address] = data;
+	if (address == NR50 || address == NR51)
+	{
+		UpdateOutputs(clockCycle);
+		return;
+	}
+
+	if (address > NR52)
+	{
+		return;
+	}
+
+	const int index = (address - NR10) / 5;
+	Channel& channel = m_channels[index];
+	switch ((address - NR10) % 5)
+	{
+	case 0:
+		if (index == SQUARE_1)
+		{
+			channel.sweepPeriod = (data >> 4) & 0x07;
+			channel.sweepNegate = data & BIT_3;
+			channel.sweepShift = data & 0x07;
+		}
+		else if (index == WAVE)
+		{
+			channel.dacEnabled = data & BIT_7;
+			channel.enabled = channel.enabled && channel.dacEnabled;
+		}
+		break;
+	case 1:
+		channel.lengthCounter = index == WAVE ? 256 - data : 64 - (data & 0x3F);
+		break;
+	case 2:
+		// The wave channel's volume is read as it plays, the others turn their DAC off with the top five bits clear
+		if (index != WAVE)
+		{
+			channel.dacEnabled = (data & 0xF8) != 0;
+			channel.enabled = channel.enabled && channel.dacEnabled;
+		}
+		break;
+	case 3:
+		channel.frequency = (channel.frequency & 0x700) | data;
+		break;
+	case 4:
+		channel.frequency = (channel.frequency & 0xFF) | ((data & 0x07) << 8);
+		channel.lengthEnabled = data & BIT_6;
+		if (data & BIT_7)
+		{
+			Trigger(index, clockCycle);
+		}
+		break;
+	}
+
+	UpdateOutput(index, clockCycle);
+}
+
+void APU::ResetDivider(uint64_t clockCycle)
+{
+	// Bit 12 of the divider is set for the second half of each frame sequencer period, clearing it is a falling edge
+	if (m_frameSequencerCycle - clockCycle <= FRAME_SEQUENCER_PERIOD / 2)
+	{
+		StepFrameSequencer(clockCycle);
+	}
+
+	m_frameSequencerCycle = clockCycle + FRAME_SEQUENCER_PERIOD;
+}
+
+void APU::SetSampleRate(int sampleRate)
+{
+	// Room for a little more than a frame past what can be left waiting
+	const int capacity = MAX_BUFFERED_SAMPLES + sampleRate / 50;
+	m_sampleRate = sampleRate;
+	m_left.SetRates(CPU::CLOCKSPEED, sampleRate * m_rateAdjustment, capacity);
+	m_right.SetRates(CPU::CLOCKSPEED, sampleRate * m_rateAdjustment, capacity);
+	m_appliedRateAdjustment = m_rateAdjustment;
+
+	// The buffers start from silence, so every channel's level has to be added again
+	memset(m_outputLeft, 0, sizeof(m_outputLeft));
+	memset(m_outputRight, 0, sizeof(m_outputRight));
+	if (m_ioMemory)
+	{
+		UpdateOutputs(m_lastSyncCycle);
+	}
+}
+
+void APU::SetQuality(BlipBuffer::Quality quality)
+{
+	m_left.SetQuality(quality);
+	m_right.SetQuality(quality);
+}
+
+void APU::SetOutputEnabled(bool enabled)
+{
+	if (enabled == m_outputEnabled)
+	{
+		return;
+	}
+
+	m_outputEnabled = enabled;
+	if (enabled)
+	{
+		UpdateOutputs(m_lastSyncCycle);
+	}
+}
+
+void APU::SetRegistersOnly(bool registersOnly)
+{
+	if (registersOnly == m_registersOnly)
+	{
+		return;
+	}
+
+	m_registersOnly = registersOnly;
+	if (!registersOnly)
+	{
+		// The timers stood still, they pick up from now rather than running through everything they missed
+		for (Channel& channel : m_channels)
+		{
+			channel.timerCycle = std::max(channel.timerCycle, m_lastSyncCycle);
+		}
+		UpdateOutputs(m_lastSyncCycle);
+	}
+}
+
+int APU::ReadSamples(int16_t* out, int count)
+{
+	const int read = m_left.ReadSamples(out, count, 2);
+	m_right.ReadSamples(out + 1, read, 2);
+	return read;
+}
+
+void APU::SaveState(StateBuffer& state) const
+{
+	state.Write(m_channels);
+	state.Write(m_powered);
+	state.Write(m_lastSyncCycle);
+	state.Write(m_frameSequencerCycle);
+	state.Write(m_frameSequencerStep);
+}
+
+void APU::LoadState(StateBuffer& state)
+{
+	state.Read(m_channels);
+	state.Read(m_powered);
+	state.Read(m_lastSyncCycle);
+	state.Read(m_frameSequencerCycle);
+	state.Read(m_frameSequencerStep);
+
+	// The output carries on from what is already in the buffers rather than jumping back in time with the state
+	m_frameStartCycle = m_lastSyncCycle;
+	UpdateOutputs(m_lastSyncCycle);
+}
+
+void APU::RunChannel(int index, uint64_t clockCycle)
+{
+	Channel& channel = m_channels[index];
+	if (channel.timerCycle > clockCycle)
+	{
+		return;
+	}
+
+	const uint64_t period = GetTimerPeriod(index);
+	const uint64_t steps = (clockCycle - channel.timerCycle) / period + 1;
+
+	// A silent channel's timer still runs, but only where it ends up matters
+	if (!channel.enabled || !m_outputEnabled)
+	{
+		if (index == NOISE && channel.enabled)
+		{
+			const bool narrow = m_ioMemory[NR43] & BIT_3;
+			for (uint64_t i = 0; i < steps; ++i)
+			{
+				channel.lfsr = StepNoise(channel.lfsr, narrow);
+			}
+		}
+		else
+		{
+			channel.position = static_cast<int>((channel.position + steps) & (index == WAVE ? 31 : 7));
+		}
+
+		channel.timerCycle += steps * period;
+		return;
+	}
+
+	for (uint64_t i = 0; i < steps; ++i)
+	{
+		if (index == NOISE)
+		{
+			channel.lfsr = StepNoise(channel.lfsr, m_ioMemory[NR43] & BIT_3);
+		}
+		else
+		{
+			channel.position = (channel.position + 1) & (index == WAVE ? 31 : 7);
+		}
+
+		UpdateOutput(index, channel.timerCycle);
+		channel.timerCycle += period;
+	}
+}
+
+WORD APU::StepNoise(WORD lfsr, bool narrow)
+{
+	// The XOR of the two low bits is shifted in at bit 14, and also at bit 6 in 7-bit mode
+	const WORD feedback = (lfsr ^ (lfsr >> 1)) & 0x01;
+	lfsr = (lfsr >> 1) | (feedback << 14);
+	if (narrow)
+	{
+		lfsr = (lfsr & ~BIT_6) | (feedback << 6);
+	}
+	return lfsr;
+}
+
+int APU::GetTimerPeriod(int index) const
+{
+	const Channel& channel = m_channels[index];
+	switch (index)
+	{
+	case SQUARE_1:
+	case SQUARE_2:
+		return (2048 - channel.frequency) * 4;
+	case WAVE:
+		return (2048 - channel.frequency) * 2;
+	default:
+	{
+		const BYTE polynomial = m_ioMemory[NR43];
+		const int divisor = (polynomial & 0x07) ? (polynomial & 0x07) * 16 : 8;
+		return divisor << (polynomial >> 4);
+	}
+	}
+}
+
+int APU::GetChannelLevel(int index) const
+{
+	const Channel& channel = m_channels[index];
+	if (!channel.enabled || !channel.dacEnabled)
+	{
+		return 0;
+	}
+
+	switch (index)
+	{
+	case SQUARE_1:
+	case SQUARE_2:
+		return DUTY_CYCLES[m_ioMemory[GetRegisterBase(index) + 1] >> 6][channel.position] ? channel.envelopeVolume : 0;
+	case WAVE:
+	{
+		// Volume codes 1 to 3 shift the 4-bit sample right by 0 to 2, code 0 mutes it
+		const int volumeCode = (m_ioMemory[NR32] >> 5) & 0x03;
+		const BYTE samples = m_ioMemory[WAVE_RAM + channel.position / 2];
+		const int sample = (channel.position & 1) ? (samples & 0x0F) : (samples >> 4);
+		return volumeCode ? sample >> (volumeCode - 1) : 0;
+	}
+	default:
+		return (channel.lfsr & 0x01) ? 0 : channel.envelopeVolume;
+	}
+}
+
+void APU::UpdateOutput(int index, uint64_t clockCycle)
+{
+	if (!m_outputEnabled || m_registersOnly)
+	{
+		return;
+	}
+
+	const int level = m_powered ? GetChannelLevel(index) : 0;
+	const BYTE masterVolume = m_ioMemory[NR50];
+	const BYTE panning = m_ioMemory[NR51];
+	const int left = (panning & (0x10 << index)) ? level * (((masterVolume >> 4) & 0x07) + 1) * AMPLITUDE_SCALE : 0;
+	const int right = (panning & (0x01 << index)) ? level * ((masterVolume & 0x07) + 1) * AMPLITUDE_SCALE : 0;
+
+	const uint32_t clockTime = static_cast<uint32_t>(clockCycle - m_frameStartCycle);
+	if (left != m_outputLeft[index])
+	{
+		m_left.AddDelta(clockTime, left - m_outputLeft[index]);
+		m_outputLeft[index] = left;
+	}
+	if (right != m_outputRight[index])
+	{
+		m_right.AddDelta(clockTime, right - m_outputRight[index]);
+		m_outputRight[index] = right;
+	}
+}
+
+void APU::UpdateOutputs(uint64_t clockCycle)
+{
+	for (int i = 0; i < CHANNEL_COUNT; ++i)
+	{
+		UpdateOutput(i, clockCycle);
+	}
+}
+
+void APU::StepFrameSequencer(uint64_t clockCycle)
+{
+	if (!m_powered)
+	{
+		return;
+	}
+
+	// Length counters on every other step, sweep on steps 2 and 6 and envelopes on step 7
+	if (m_frameSequencerStep % 2 == 0)
+	{
+		for (Channel& channel : m_channels)
+		{
+			ClockLength(channel);
+		}
+	}
+	if (m_frameSequencerStep == 2 || m_frameSequencerStep == 6)
+	{
+		ClockSweep();
+	}
+	if (m_frameSequencerStep == 7)
+	{
+		ClockEnvelope(m_channels[SQUARE_1]);
+		ClockEnvelope(m_channels[SQUARE_2]);
+		ClockEnvelope(m_channels[NOISE]);
+	}
+
+	m_frameSequencerStep = (m_frameSequencerStep + 1) & 0x07;
+	UpdateOutputs(clockCycle);
+}
+
+void APU::ClockLength(Channel& channel)
+{
+	if (channel.lengthEnabled && channel.lengthCounter > 0 && --channel.lengthCounter == 0)
+	{
+		channel.enabled = false;
+	}
+}
+
+void APU::ClockEnvelope(Channel& channel)
+{
+	if (channel.envelopePeriod == 0 || --channel.envelopeTimer > 0)
+	{
+		return;
+	}
+
+	channel.envelopeTimer = channel.envelopePeriod;
+	if (channel.envelopeIncrease && channel.envelopeVolume < 15)
+	{
+		++channel.envelopeVolume;
+	}
+	else if (!channel.envelopeIncrease && channel.envelopeVolume > 0)
+	{
+		--channel.envelopeVolume;
+	}
+}
+
+void APU::ClockSweep()
+{
+	Channel& channel = m_channels[SQUARE_1];
+	if (--channel.sweepTimer > 0)
+	{
+		return;
+	}
+
+	// A period of 0 is treated as 8 for the timer, but doesn't sweep
+	channel.sweepTimer = channel.sweepPeriod ? channel.sweepPeriod : 8;
+	if (!channel.sweepEnabled || channel.sweepPeriod == 0)
+	{
+		return;
+	}
+
+	const int frequency = CalculateSweepFrequency();
+	if (frequency <= 2047 && channel.sweepShift != 0)
+	{
+		channel.sweepFrequency = frequency;
+		channel.frequency = frequency;
+		m_ioMemory[NR10 + 3] = frequency & 0xFF;
+		m_ioMemory[NR10 + 4] = (m_ioMemory[NR10 + 4] & ~0x07) | (frequency >> 8);
+
+		// The new frequency is checked for overflow straight away, but not used
+		CalculateSweepFrequency();
+	}
+}
+
+int APU::CalculateSweepFrequency()
+{
+	Channel& channel = m_channels[SQUARE_1];
+	const int change = channel.sweepFrequency >> channel.sweepShift;
+	const int frequency = channel.sweepNegate ? channel.sweepFrequency - change : channel.sweepFrequency + change;
+	if (frequency > 2047)
+	{
+		channel.enabled = false;
+	}
+	return frequency;
+}
+
+void APU::Trigger(int index, uint64_t clockCycle)
+{
+	Channel& channel = m_channels[index];
+	channel.enabled = channel.dacEnabled;
+	if (channel.lengthCounter == 0)
+	{
+		channel.lengthCounter = index == WAVE ? 256 : 64;
+	}
+
+	channel.timerCycle = clockCycle + GetTimerPeriod(index);
+	if (index == WAVE)
+	{
+		channel.position = 0;
+		return;
+	}
+
+	const BYTE envelope = m_ioMemory[GetRegisterBase(index) + 2];
+	channel.envelopeVolume = envelope >> 4;
+	channel.envelopeIncrease = envelope & BIT_3;
+	channel.envelopePeriod = envelope & 0x07;
+	channel.envelopeTimer = channel.envelopePeriod;
+
+	if (index == NOISE)
+	{
+		channel.lfsr = 0x7FFF;
+	}
+	else if (index == SQUARE_1)
+	{
+		channel.sweepFrequency = channel.frequency;
+		channel.sweepTimer = channel.sweepPeriod ? channel.sweepPeriod : 8;
+		channel.sweepEnabled = channel.sweepPeriod != 0 || channel.sweepShift != 0;
+		if (channel.sweepShift != 0)
+		{
+			CalculateSweepFrequency();
+		}
+	}
+}
+
+void APU::PowerOff()
+{
+	// Every register is cleared, wave RAM is kept
+	memset(m_ioMemory + NR10, 0, NR52 - NR10);
+	for (Channel& channel : m_channels)
+	{
+		const uint64_t timerCycle = channel.timerCycle;
+		memset(&channel, 0, sizeof(channel));
+		channel.timerCycle = timerCycle;
+	}
+	m_powered = false;
+}
+
+void APU::DropSamples(int count)
+{
+	int16_t discarded[512 * 2];
+	while (count > 0)
+	{
+		const int read = ReadSamples(discarded, std::min(count, 512));
+		if (read == 0)
+		{
+			break;
+		}
+		count -= read;
+	}
+}
@@ -0,0 +1,44 @@
+#include "stdafx.h"
+
+#include "header/AudioStream.h"
+
+AudioStream::AudioStream(EmulationThread::AudioQueue& queue) :
+	m_queue(queue),
+	m_chunk(),
+	m_lastLeft(0),
+	m_lastRight(0)
+{
+	initialize(2, EmulationThread::AUDIO_SAMPLE_RATE);
+}
+
+AudioStream::~AudioStream()
+{
+	// The stream's thread has to finish calling onGetData before the members go away
+	stop();
+}
+
+bool AudioStream::onGetData(Chunk& data)
+{
+	const size_t count = m_queue.Pop(m_chunk, CHUNK_SAMPLES * 2);
+	if (count > 0)
+	{
+		m_lastLeft = m_chunk[count - 2];
+		m_lastRight = m_chunk[count - 1];
+	}
+
+	// Running dry holds the last sample rather than dropping to zero, which would click. Returning false would stop the stream.
+	for (size_t i = count; i < CHUNK_SAMPLES * 2; i += 2)
+	{
+		m_chunk[i] = m_lastLeft;
+		m_chunk[i + 1] = m_lastRight;
+	}
+
+	data.samples = m_chunk;
+	data.sampleCount = CHUNK_SAMPLES * 2;
+	return true;
+}
+
+void AudioStream::onSeek(sf::Time)
+{
+	// A live stream has nowhere to seek to
+}
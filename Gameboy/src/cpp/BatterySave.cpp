@@ -0,0 +1,294 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+
+#include "header/BatterySave.h"
+#include "header/Cartridge.h"
+#include "header/MemoryBankControllers.h"
+
+BatterySave::BatterySave() :
+	m_cartridge(nullptr),
+	m_path(),
+	m_ramSize(0),
+	m_clockCatchUp(true),
+	m_thread(),
+	m_writeImage(),
+	m_image(),
+	m_pending(false),
+	m_flushRequested(false),
+	m_stopping(false),
+	m_lastChange()
+{
+}
+
+BatterySave::~BatterySave()
+{
+	Detach();
+}
+
+void BatterySave::Attach(Cartridge* cart)
+{
+	Detach();
+
+	if (!cart->IsValid() || !cart->HasBattery())
+	{
+		return;
+	}
+
+	BYTE* ram = nullptr;
+	int ramSize = cart->DumpRam(ram);
+	// Some cartridges only have a clock, then the save is just the footer
+	int imageSize = ramSize + (cart->HasClock() ? CLOCK_FOOTER_SIZE : 0);
+	if (imageSize == 0)
+	{
+		return;
+	}
+
+	m_cartridge = cart;
+	m_path = GetSavePath(cart->GetFilePath());
+	m_ramSize = ramSize;
+
+	// A save from another emulator may be shorter or longer, as much as fits is used
+	std::ifstream in(m_path, std::ios_base::in | std::ios_base::binary);
+	if (in)
+	{
+		std::vector<BYTE> data(imageSize);
+		in.read(reinterpret_cast<char*>(data.data()), imageSize);
+		int size = static_cast<int>(in.gcount());
+		cart->LoadRam(data.data(), std::min(size, ramSize));
+		if (cart->HasClock())
+		{
+			ReadClockFooter(data.data() + ramSize, size - ramSize);
+		}
+	}
+
+	m_image.assign(ram, ram + ramSize);
+	m_image.resize(imageSize);
+	// Anything marked before the save was loaded is already in the image
+	cart->CopyDirtyRam(m_image.data());
+	if (cart->HasClock())
+	{
+		WriteClockFooter();
+	}
+
+	m_pending = false;
+	m_flushRequested = false;
+	m_stopping = false;
+	m_thread = std::thread(&BatterySave::Run, this);
+}
+
+void BatterySave::Detach()
+{
+	if (!m_cartridge)
+	{
+		return;
+	}
+
+	Flush();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_wake.notify_one();
+	m_thread.join();
+
+	m_cartridge = nullptr;
+}
+
+void BatterySave::Update()
+{
+	if (!m_cartridge)
+	{
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+	if (!lock.owns_lock())
+	{
+		return;
+	}
+
+	if (m_cartridge->CopyDirtyRam(m_image.data()))
+	{
+		if (m_cartridge->HasClock())
+		{
+			WriteClockFooter();
+		}
+
+		m_lastChange = std::chrono::steady_clock::now();
+		if (!m_pending)
+		{
+			m_pending = true;
+			m_wake.notify_one();
+		}
+	}
+}
+
+void BatterySave::Flush()
+{
+	if (!m_cartridge)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_cartridge->CopyDirtyRam(m_image.data()))
+	{
+		m_pending = true;
+	}
+
+	// The clock moved on even if the RAM didn't change
+	if (m_cartridge->HasClock())
+	{
+		WriteClockFooter();
+		m_pending = true;
+	}
+
+	if (m_pending)
+	{
+		m_flushRequested = true;
+		m_wake.notify_one();
+	}
+}
+
+std::string BatterySave::GetSavePath(const std::string& romPath)
+{
+	return std::filesystem::path(romPath).replace_extension(".sav").string();
+}
+
+void BatterySave::Run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true)
+	{
+		if (m_pending && (m_flushRequested || m_stopping || std::chrono::steady_clock::now() >= m_lastChange + WRITE_DELAY))
+		{
+			// The image is copied so the lock is not held while the file is written
+			m_writeImage = m_image;
+			m_pending = false;
+			m_flushRequested = false;
+
+			lock.unlock();
+			bool written = WriteFile(m_writeImage);
+			lock.lock();
+
+			// A failed write is tried again later, unless we are shutting down
+			if (!written && !m_stopping)
+			{
+				m_pending = true;
+				m_lastChange = std::chrono::steady_clock::now();
+			}
+			continue;
+		}
+
+		if (m_stopping)
+		{
+			break;
+		}
+
+		if (m_pending)
+		{
+			m_wake.wait_until(lock, m_lastChange + WRITE_DELAY);
+		}
+		else
+		{
+			m_wake.wait(lock);
+		}
+	}
+}
+
+bool BatterySave::WriteFile(const std::vector<BYTE>& image) const
+{
+	const std::string tempPath = m_path + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		out.write(reinterpret_cast<const char*>(image.data()), image.size());
+		if (!out)
+		{
+			std::cerr << "Unable to write " << tempPath << std::endl;
+			return false;
+		}
+	}
+
+	// Replaces the old save in one step, the old one stays whole until then
+	std::error_code errorCode;
+	std::filesystem::rename(tempPath, m_path, errorCode);
+	if (errorCode)
+	{
+		std::cerr << "Unable to replace " << m_path << ": " << errorCode.message() << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+void BatterySave::WriteClockFooter()
+{
+	ClockRegisters current;
+	ClockRegisters latched;
+	m_cartridge->GetClock(current, latched);
+
+	BYTE* footer = m_image.data() + m_ramSize;
+	const ClockRegisters* registers[] = { &current, &latched };
+	for (const ClockRegisters* clock : registers)
+	{
+		WriteLittleEndian(footer + 0, clock->seconds, 4);
+		WriteLittleEndian(footer + 4, clock->minutes, 4);
+		WriteLittleEndian(footer + 8, clock->hours, 4);
+		WriteLittleEndian(footer + 12, clock->daysLow, 4);
+		WriteLittleEndian(footer + 16, clock->daysHigh, 4);
+		footer += 20;
+	}
+	WriteLittleEndian(footer, static_cast<uint64_t>(std::time(nullptr)), 8);
+}
+
+void BatterySave::ReadClockFooter(const BYTE* footer, int size)
+{
+	// Saves without a footer keep the clock where the cartridge starts it
+	if (size < SHORT_CLOCK_FOOTER_SIZE)
+	{
+		return;
+	}
+
+	ClockRegisters current;
+	ClockRegisters latched;
+	ClockRegisters* registers[] = { &current, &latched };
+	for (ClockRegisters* clock : registers)
+	{
+		clock->seconds = static_cast<BYTE>(ReadLittleEndian(footer + 0, 4) & 0x3F);
+		clock->minutes = static_cast<BYTE>(ReadLittleEndian(footer + 4, 4) & 0x3F);
+		clock->hours = static_cast<BYTE>(ReadLittleEndian(footer + 8, 4) & 0x1F);
+		clock->daysLow = static_cast<BYTE>(ReadLittleEndian(footer + 12, 4));
+		clock->daysHigh = static_cast<BYTE>(ReadLittleEndian(footer + 16, 4) & 0xC1);
+		footer += 20;
+	}
+	m_cartridge->SetClock(current, latched);
+
+	int64_t timestamp = static_cast<int64_t>(ReadLittleEndian(footer, size >= CLOCK_FOOTER_SIZE ? 8 : 4));
+	int64_t now = static_cast<int64_t>(std::time(nullptr));
+	if (m_clockCatchUp && timestamp > 0 && now > timestamp)
+	{
+		m_cartridge->AdvanceClock(static_cast<uint64_t>(now - timestamp));
+	}
+}
+
+void BatterySave::WriteLittleEndian(BYTE* out, uint64_t value, int size)
+{
+	for (int i = 0; i < size; ++i)
+	{
+		out[i] = static_cast<BYTE>(value >> (8 * i));
+	}
+}
+
+uint64_t BatterySave::ReadLittleEndian(const BYTE* in, int size)
+{
+	uint64_t value = 0;
+	for (int i = 0; i < size; ++i)
+	{
+		value |= static_cast<uint64_t>(in[i]) << (8 * i);
+	}
+	return value;
+}
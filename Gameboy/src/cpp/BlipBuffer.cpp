@@ -0,0 +1,197 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "header/BlipBuffer.h"
+#include "header/Debug.h"
+
+// MSVC doesn't define __SSE2__, it has _M_X64 on x64, where SSE2 is always there, and _M_IX86_FP on 32-bit x86
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BLIP_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLIP_SSE2
+#endif
+
+BlipBuffer::BlipBuffer() :
+	m_factor(0),
+	m_offset(0),
+	m_maxSamples(0),
+	m_buffer(),
+	m_integrator(0),
+	m_quality(Quality::NORMAL),
+	m_kernel(nullptr),
+	m_kernelWidth(0)
+{
+	SetQuality(Quality::NORMAL);
+}
+
+void BlipBuffer::SetRates(double clockRate, double sampleRate, int maxSamples)
+{
+	SetRatio(clockRate, sampleRate);
+	m_maxSamples = maxSamples;
+	m_buffer.assign(maxSamples + MAX_KERNEL_WIDTH, 0);
+	Clear();
+}
+
+void BlipBuffer::SetRatio(double clockRate, double sampleRate)
+{
+	m_factor = static_cast<uint64_t>(sampleRate / clockRate * double(1ull << TIME_BITS) + 0.5);
+}
+
+void BlipBuffer::Clear()
+{
+	m_offset = 0;
+	m_integrator = 0;
+	std::fill(m_buffer.begin(), m_buffer.end(), 0);
+}
+
+void BlipBuffer::SetQuality(Quality quality)
+{
+	m_quality = quality;
+	m_kernel = &GetKernel(quality);
+	m_kernelWidth = GetKernelWidth(quality);
+}
+
+void BlipBuffer::AddDelta(uint32_t clockTime, int delta)
+{
+	const uint64_t position = m_offset + clockTime * m_factor;
+	const size_t index = static_cast<size_t>(position >> TIME_BITS);
+	DEBUG_ASSERT(index + m_kernelWidth <= m_buffer.size(), "Blip buffer overflow, samples need to be read");
+	DEBUG_ASSERT(delta >= INT16_MIN && delta <= INT16_MAX, "Blip buffer deltas have to fit in 16 bits");
+	if (index + m_kernelWidth > m_buffer.size())
+	{
+		return;
+	}
+
+	const int phase = static_cast<int>(position >> (TIME_BITS - PHASE_BITS)) & (PHASE_COUNT - 1);
+	const int32_t* kernel = (*m_kernel)[phase];
+	int32_t* out = &m_buffer[index];
+
+	// madd multiplies the 16-bit halves of each lane in pairs and adds them. The high half of every delta lane is
+	// zero, so each lane comes out as the tap times the delta, whatever the tap's sign extension left in its high half.
+#if defined(BLIP_AVX2)
+	const __m256i deltas = _mm256_set1_epi32(delta & 0xFFFF);
+	for (int i = 0; i < m_kernelWidth; i += 8)
+	{
+		const __m256i taps = _mm256_load_si256(reinterpret_cast<const __m256i*>(kernel + i));
+		__m256i* samples = reinterpret_cast<__m256i*>(out + i);
+		_mm256_storeu_si256(samples, _mm256_add_epi32(_mm256_loadu_si256(samples), _mm256_madd_epi16(taps, deltas)));
+	}
+#elif defined(BLIP_SSE2)
+	const __m128i deltas = _mm_set1_epi32(delta & 0xFFFF);
+	for (int i = 0; i < m_kernelWidth; i += 4)
+	{
+		const __m128i taps = _mm_load_si128(reinterpret_cast<const __m128i*>(kernel + i));
+		__m128i* samples = reinterpret_cast<__m128i*>(out + i);
+		_mm_storeu_si128(samples, _mm_add_epi32(_mm_loadu_si128(samples), _mm_madd_epi16(taps, deltas)));
+	}
+#else
+	for (int i = 0; i < m_kernelWidth; ++i)
+	{
+		out[i] += delta * kernel[i];
+	}
+#endif
+}
+
+void BlipBuffer::EndFrame(uint32_t clockTime)
+{
+	m_offset += clockTime * m_factor;
+	DEBUG_ASSERT(GetSamplesAvailable() <= m_maxSamples, "Blip buffer overflow, samples need to be read");
+}
+
+int BlipBuffer::ReadSamples(int16_t* out, int count, int stride)
+{
+	count = std::min(count, GetSamplesAvailable());
+
+	int32_t sum = m_integrator;
+	for (int i = 0; i < count; ++i)
+	{
+		int32_t sample = sum >> KERNEL_BITS;
+		sample = std::max<int32_t>(INT16_MIN, std::min<int32_t>(INT16_MAX, sample));
+		out[i * stride] = static_cast<int16_t>(sample);
+
+		sum += m_buffer[i];
+		sum -= sample << (KERNEL_BITS - HIGH_PASS_SHIFT);
+	}
+	m_integrator = sum;
+
+	RemoveSamples(count);
+	return count;
+}
+
+void BlipBuffer::RemoveSamples(int count)
+{
+	count = std::min(count, GetSamplesAvailable());
+	if (count <= 0)
+	{
+		return;
+	}
+
+	// The steps past the samples removed are still waiting, along with the tails of the latest ones
+	const int remaining = GetSamplesAvailable() - count + MAX_KERNEL_WIDTH;
+	memmove(m_buffer.data(), m_buffer.data() + count, remaining * sizeof(int32_t));
+	memset(m_buffer.data() + remaining, 0, count * sizeof(int32_t));
+	m_offset -= static_cast<uint64_t>(count) << TIME_BITS;
+}
+
+const BlipBuffer::Kernel& BlipBuffer::GetKernel(Quality quality)
+{
+	alignas(32) static Kernel kernels[static_cast<int>(Quality::COUNT)];
+	static const bool built = []()
+	{
+		// Blackman windowed sincs cut off below the Nyquist frequency, one row per sub-sample phase. The fewer the taps,
+		// the wider the window's transition, so the cutoff comes down to keep aliasing out.
+		static constexpr double CUTOFFS[] = { 0.75, 0.9, 0.95 };
+		for (int q = 0; q < static_cast<int>(Quality::COUNT); ++q)
+		{
+			const int width = GetKernelWidth(static_cast<Quality>(q));
+			BuildKernel(kernels[q], width, CUTOFFS[q]);
+		}
+		return true;
+	}();
+	(void)built;
+
+	return kernels[static_cast<int>(quality)];
+}
+
+void BlipBuffer::BuildKernel(Kernel& kernel, int width, double cutoff)
+{
+	const double pi = 3.14159265358979323846;
+	const double halfWidth = width / 2.0;
+	for (int phase = 0; phase < PHASE_COUNT; ++phase)
+	{
+		double taps[MAX_KERNEL_WIDTH];
+		double total = 0.0;
+		for (int i = 0; i < width; ++i)
+		{
+			const double t = i - halfWidth + 1.0 - double(phase) / PHASE_COUNT;
+			const double x = pi * cutoff * t;
+			const double sinc = t == 0.0 ? 1.0 : std::sin(x) / x;
+			const double w = (t + halfWidth) / width;
+			const double window = 0.42 - 0.5 * std::cos(2.0 * pi * w) + 0.08 * std::cos(4.0 * pi * w);
+			taps[i] = sinc * std::max(0.0, window);
+			total += taps[i];
+		}
+
+		// Rounding is corrected on the largest tap, so every phase sums to exactly one
+		int sum = 0;
+		int largest = 0;
+		for (int i = 0; i < width; ++i)
+		{
+			kernel[phase][i] = static_cast<int32_t>(std::lround(taps[i] / total * (1 << KERNEL_BITS)));
+			sum += kernel[phase][i];
+			largest = kernel[phase][i] > kernel[phase][largest] ? i : largest;
+		}
+		kernel[phase][largest] += (1 << KERNEL_BITS) - sum;
+
+		// The padding past a narrow kernel is never read, but is cleared all the same
+		for (int i = width; i < MAX_KERNEL_WIDTH; ++i)
+		{
+			kernel[phase][i] = 0;
+		}
+	}
+}
@@ -0,0 +1,91 @@
+#include "stdafx.h"
+
+#include <algorithm>
+
+#include "header/Breakpoints.h"
+
+void Breakpoints::AddBreakpoint(WORD address, int bank)
+{
+	if (address >= 0x8000)
+	{
+		bank = ANY_BANK;
+	}
+
+	RemoveBreakpoint(address, bank);
+	m_breakpoints.push_back({ address, bank });
+	m_breakpointAddresses.set(address);
+}
+
+void Breakpoints::RemoveBreakpoint(WORD address, int bank)
+{
+	if (address >= 0x8000)
+	{
+		bank = ANY_BANK;
+	}
+
+	m_breakpoints.erase(std::remove_if(m_breakpoints.begin(), m_breakpoints.end(),
+		[&](const Breakpoint& breakpoint) { return breakpoint.address == address && breakpoint.bank == bank; }), m_breakpoints.end());
+
+	bool anyLeft = std::any_of(m_breakpoints.begin(), m_breakpoints.end(), [&](const Breakpoint& breakpoint) { return breakpoint.address == address; });
+	m_breakpointAddresses.set(address, anyLeft);
+}
+
+void Breakpoints::AddWatchpoint(WORD first, WORD last, BYTE access)
+{
+	if (first > last)
+	{
+		std::swap(first, last);
+	}
+
+	RemoveWatchpoint(first, last, access);
+	m_watchpoints.push_back({ first, last, access });
+}
+
+void Breakpoints::RemoveWatchpoint(WORD first, WORD last, BYTE access)
+{
+	if (first > last)
+	{
+		std::swap(first, last);
+	}
+
+	m_watchpoints.erase(std::remove_if(m_watchpoints.begin(), m_watchpoints.end(),
+		[&](const Watchpoint& watchpoint) { return watchpoint.first == first && watchpoint.last == last && watchpoint.access == access; }), m_watchpoints.end());
+}
+
+void Breakpoints::Clear()
+{
+	m_breakpoints.clear();
+	m_watchpoints.clear();
+	m_breakpointAddresses.reset();
+}
+
+bool Breakpoints::IsBreakpoint(WORD address, int bank) const
+{
+	if (!m_breakpointAddresses.test(address))
+	{
+		return false;
+	}
+
+	return std::any_of(m_breakpoints.begin(), m_breakpoints.end(), [&](const Breakpoint& breakpoint)
+	{
+		return breakpoint.address == address && (breakpoint.bank == ANY_BANK || breakpoint.bank == bank);
+	});
+}
+
+bool Breakpoints::IsWatched(WORD address, BYTE access) const
+{
+	return std::any_of(m_watchpoints.begin(), m_watchpoints.end(), [&](const Watchpoint& watchpoint)
+	{
+		return (watchpoint.access & access) && address >= watchpoint.first && address <= watchpoint.last;
+	});
+}
+
+bool Breakpoints::IsPageWatched(BYTE page, BYTE access) const
+{
+	const WORD pageFirst = page << 8;
+	const WORD pageLast = pageFirst | 0xFF;
+	return std::any_of(m_watchpoints.begin(), m_watchpoints.end(), [&](const Watchpoint& watchpoint)
+	{
+		return (watchpoint.access & access) && watchpoint.first <= pageLast && watchpoint.last >= pageFirst;
+	});
+}
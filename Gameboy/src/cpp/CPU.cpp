@@ -1,10 +1,16 @@
 #include "stdafx.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include <SFML/Graphics/RenderTarget.hpp>
 
 #include "header/CPU.h"
 #include "header/Cartridge.h"
 #include "header/Debug.h"
+#include "header/MemoryBankControllers.h"
+#include "header/SerialDevices.h"
+#include "header/StateBuffer.h"
 
 void CPU::DumpGPU(sf::RenderTarget& renderWindow)
 {
@@ -34,14 +40,26 @@ CPU::CPU(sf::RenderTarget* screen) :
 	m_dmaTransferProgress(),
 	m_ppu(screen),
 	m_clockCycles(0),
-	m_dividerCounter(0),
+	m_totalClockCycles(0),
+	m_scheduler(),
+	m_dividerResetCycle(0),
+	m_timerCounter(0),
+	m_timerSyncCycle(0),
+	m_timerOverflowCycle(0),
 	m_isHalted(false),
 	m_isStopped(false),
 	m_cartridge(nullptr),
 	m_interruptEnableRegister(0x00),
 	m_interruptMasterEnableFlag(false),
 	m_interruptMasterTimer(0xFF),
-	m_isRunning(false)
+	m_isRunning(false),
+	m_serialDevice(nullptr),
+	m_joypad(),
+	m_debugBreakpointHit(false),
+	m_debugStop(),
+	m_resumeAddress(-1),
+	m_stopCycle(0),
+	m_tracing(false)
 {
 	m_internalRAM = new BYTE[CPU_RAM];
 	m_oam = new BYTE[OAM];
@@ -49,7 +67,10 @@ CPU::CPU(sf::RenderTarget* screen) :
 	m_hram = new BYTE[HRAM];
 
 	m_ppu.Initialize(this, m_io, m_oam);
+	m_apu.Initialize(m_io);
 	SetupOpcodes();
+	std::copy(m_opcodes, m_opcodes + 256, m_instructions);
+	UpdateTraps();
 }
 
 CPU::~CPU()
@@ -63,6 +84,8 @@ CPU::~CPU()
 void CPU::AddCartridge(Cartridge* cart)
 {
 	m_cartridge = cart;
+	// Breakpoints in ROM trap the opcodes the cartridge has there
+	UpdateTraps();
 }
 
 void CPU::PowerOn()
@@ -78,38 +101,47 @@ void CPU::PowerOn()
 
 	m_dmaTransferProgress.active = false;
 	m_clockCycles = 0;
-	m_dividerCounter = 0;
+	m_totalClockCycles = 0;
+	m_scheduler.Reset();
+	// The cartridge's clock has its own battery, only the cycle count it follows starts over
+	if (m_cartridge)
+	{
+		m_cartridge->RebaseClock(0);
+	}
+	m_ppu.Reset();
+	m_dividerResetCycle = 0;
+	m_timerCounter = 0;
+	m_timerSyncCycle = 0;
 	m_isHalted = false;
 	m_isStopped = false;
 	m_interruptEnableRegister = 0x00;
 	m_interruptMasterEnableFlag = false;
 	m_interruptMasterTimer = 0xFF;
+	m_debugBreakpointHit = false;
+	m_debugStop.reason = DebugStop::NONE;
+	m_resumeAddress = -1;
+	UpdateTraps();
 
-	m_timerCounter = CLOCKSPEED / FREQUENCY_0;
+	// Memory starts out cleared so that every run from power on is the same
+	memset(m_internalRAM, 0, CPU_RAM);
+	memset(m_oam, 0, OAM);
+	memset(m_io, 0, IO);
+	memset(m_hram, 0, HRAM);
+
+	// The timer registers are read back before they are written below
+	m_io[TIMER_CONTROL] = 0x00;
+	m_io[TIMER_MODULO] = 0x00;
 
 	Write(0xFF00, 0xCF);
+	Write(0xFF02, 0x7E);
 	Write(0xFF05, 0x00);
 	Write(0xFF06, 0x00);
 	Write(0xFF07, 0x00);
-	Write(0xFF10, 0x80);
-	Write(0xFF11, 0xBF);
-	Write(0xFF12, 0xF3);
-	Write(0xFF14, 0xBF);
-	Write(0xFF16, 0x3F);
-	Write(0xFF17, 0x00);
-	Write(0xFF19, 0xBF);
-	Write(0xFF1A, 0x7F);
-	Write(0xFF1B, 0xFF);
-	Write(0xFF1C, 0x9F);
-	Write(0xFF1E, 0xBF);
-	Write(0xFF20, 0xFF);
-	Write(0xFF21, 0x00);
-	Write(0xFF22, 0x00);
-	Write(0xFF23, 0xBF);
-	Write(0xFF24, 0x77);
-	Write(0xFF25, 0xF3);
-	Write(0xFF26, 0xF1);
+	// The audio registers are set by the APU, writing them here would trigger the channels
+	m_apu.Reset();
 	Write(0xFF40, 0x91);
+	// STAT was cleared with the rest of I/O, this sets its unused bit and the PPU fills in the mode
+	Write(0xFF41, 0x00);
 	Write(0xFF42, 0x00);
 	Write(0xFF43, 0x00);
 	Write(0xFF44, 0x00);
@@ -119,43 +151,354 @@ void CPU::PowerOn()
 	Write(0xFF49, 0xFF);
 	Write(0xFF4A, 0x00);
 	Write(0xFF4B, 0x00);
+
+	SchedulePPUEvent();
+}
+
+void CPU::SaveState(StateBuffer& state)
+{
+	// Pending cycles are applied first so the state lands on an instruction boundary with every component in sync
+	FlushClockCycles();
+	SyncPPU();
+	SyncAPU();
+	CatchUpDMATransfer(m_totalClockCycles);
+
+	state.BeginWrite();
+	state.WriteBytes(registers, sizeof(registers));
+	state.Write(m_totalClockCycles);
+	m_scheduler.SaveState(state);
+	// Written field by field, the struct's padding would make identical machines save different states
+	state.Write(m_dmaTransferProgress.from);
+	state.Write(m_dmaTransferProgress.currentIndex);
+	state.Write(m_dmaTransferProgress.startCycle);
+	state.Write(m_dmaTransferProgress.active);
+
+	state.Write(m_dividerResetCycle);
+	state.Write(m_timerCounter);
+	state.Write(m_timerSyncCycle);
+	state.Write(m_timerOverflowCycle);
+
+	state.Write(m_interruptMasterEnableFlag);
+	state.Write(m_interruptMasterTimer);
+	state.Write(m_interruptEnableRegister);
+	state.Write(m_isHalted);
+	state.Write(m_isStopped);
+	// The buttons held are read back through P1 whenever the game selects their group
+	state.Write(m_joypad);
+
+	state.WriteBytes(m_internalRAM, CPU_RAM);
+	state.WriteBytes(m_oam, OAM);
+	state.WriteBytes(m_io, IO);
+	state.WriteBytes(m_hram, HRAM);
+
+	m_ppu.SaveState(state);
+	m_apu.SaveState(state);
+	m_cartridge->SaveState(state);
+}
+
+void CPU::LoadState(StateBuffer& state)
+{
+	state.BeginRead();
+	state.ReadBytes(registers, sizeof(registers));
+	state.Read(m_totalClockCycles);
+	m_scheduler.LoadState(state);
+	state.Read(m_dmaTransferProgress.from);
+	state.Read(m_dmaTransferProgress.currentIndex);
+	state.Read(m_dmaTransferProgress.startCycle);
+	state.Read(m_dmaTransferProgress.active);
+
+	state.Read(m_dividerResetCycle);
+	state.Read(m_timerCounter);
+	state.Read(m_timerSyncCycle);
+	state.Read(m_timerOverflowCycle);
+
+	state.Read(m_interruptMasterEnableFlag);
+	state.Read(m_interruptMasterTimer);
+	state.Read(m_interruptEnableRegister);
+	state.Read(m_isHalted);
+	state.Read(m_isStopped);
+	state.Read(m_joypad);
+
+	state.ReadBytes(m_internalRAM, CPU_RAM);
+	state.ReadBytes(m_oam, OAM);
+	state.ReadBytes(m_io, IO);
+	state.ReadBytes(m_hram, HRAM);
+
+	m_ppu.LoadState(state);
+	m_apu.LoadState(state);
+	m_cartridge->LoadState(state);
+
+	m_clockCycles = 0;
+	m_resumeAddress = -1;
+	// The state may have a transfer running from a different page
+	UpdateTraps();
+}
+
+CPU::RegisterSnapshot CPU::GetRegisters() const
+{
+	RegisterSnapshot snapshot;
+	snapshot.AF = AF.pair;
+	snapshot.BC = BC.pair;
+	snapshot.DE = DE.pair;
+	snapshot.HL = HL.pair;
+	snapshot.SP = SP.pair;
+	snapshot.PC = PC.pair;
+	return snapshot;
+}
+
+bool CPU::ConsumeDebugBreakpoint()
+{
+	bool hit = m_debugBreakpointHit;
+	m_debugBreakpointHit = false;
+	return hit;
+}
+
+void CPU::SetBreakpoints(const Breakpoints& breakpoints)
+{
+	m_breakpoints = breakpoints;
+	m_resumeAddress = -1;
+	UpdateTraps();
+}
+
+void CPU::SetTracing(bool enabled)
+{
+	if (enabled && !m_tracing)
+	{
+		m_trace.Clear();
+	}
+
+	m_tracing = enabled;
+	UpdateTraps();
+}
+
+bool CPU::ConsumeDebugStop(DebugStop& stop)
+{
+	if (m_debugStop.reason == DebugStop::NONE)
+	{
+		return false;
+	}
+
+	stop = m_debugStop;
+	m_debugStop.reason = DebugStop::NONE;
+	return true;
+}
+
+void CPU::UpdateTraps()
+{
+	memset(m_readTraps, 0, sizeof(m_readTraps));
+	memset(m_writeTraps, 0, sizeof(m_writeTraps));
+
+	// LY, STAT and the audio registers need the PPU or APU brought up to date before they are read, CycleRead lets HRAM past
+	m_readTraps[0xFF] = TRAP_SYNC;
+	if (m_dmaTransferProgress.active)
+	{
+		SetDMATraps(true);
+	}
+
+	for (int page = 0; page < 0x100; ++page)
+	{
+		if (m_breakpoints.IsPageWatched(static_cast<BYTE>(page), Breakpoints::WATCH_READ))
+		{
+			m_readTraps[page] |= TRAP_WATCH;
+		}
+		if (m_breakpoints.IsPageWatched(static_cast<BYTE>(page), Breakpoints::WATCH_WRITE))
+		{
+			m_writeTraps[page] |= TRAP_WATCH;
+		}
+	}
+
+	std::copy(m_instructions, m_instructions + 256, m_opcodes);
+
+	BYTE* rom = nullptr;
+	int romSize = m_cartridge && m_cartridge->IsValid() ? m_cartridge->DumpRom(rom) : 0;
+	for (const Breakpoints::Breakpoint& breakpoint : m_breakpoints.GetBreakpoints())
+	{
+		// Code in RAM can change, so every opcode has to be trapped
+		if (breakpoint.address >= 0x8000 || !rom)
+		{
+			std::fill(m_opcodes, m_opcodes + 256, &CPU::BreakpointTrap);
+			break;
+		}
+
+		// ROM can't change, only the opcodes it has at the breakpoint in the banks that could be mapped there are trapped
+		int firstBank = breakpoint.bank == Breakpoints::ANY_BANK ? 0 : breakpoint.bank;
+		int lastBank = breakpoint.bank == Breakpoints::ANY_BANK ? romSize / ROM_BANK_SIZE - 1 : breakpoint.bank;
+		for (int bank = firstBank; bank <= lastBank; ++bank)
+		{
+			int offset = bank * ROM_BANK_SIZE + (breakpoint.address & (ROM_BANK_SIZE - 1));
+			if (offset < romSize)
+			{
+				m_opcodes[rom[offset]] = &CPU::BreakpointTrap;
+			}
+		}
+	}
+
+	if (m_tracing)
+	{
+		std::copy(m_opcodes, m_opcodes + 256, m_tracedOpcodes);
+		std::fill(m_opcodes, m_opcodes + 256, &CPU::TraceTrap);
+	}
+}
+
+void CPU::SetDMATraps(bool trapped)
+{
+	// The source is never in echo RAM by now, but writes through the echo reach it as well
+	BYTE page = m_dmaTransferProgress.from >> 8;
+	BYTE echoPage = page >= 0xC0 && page < 0xDE ? page + 0x20 : page;
+	if (trapped)
+	{
+		m_writeTraps[page] |= TRAP_DMA;
+		m_writeTraps[echoPage] |= TRAP_DMA;
+	}
+	else
+	{
+		m_writeTraps[page] &= ~TRAP_DMA;
+		m_writeTraps[echoPage] &= ~TRAP_DMA;
+	}
+}
+
+BYTE CPU::TrappedRead(WORD address, BYTE traps)
+{
+	if (traps & TRAP_SYNC)
+	{
+		// LY and STAT change with the PPU mode
+		if (address == 0xFF41 || address == 0xFF44)
+		{
+			SyncPPU();
+		}
+		// Channels turn themselves off when their length runs out
+		else if (IsAPURegister(address))
+		{
+			SyncAPU();
+		}
+	}
+
+	BYTE value = Read(address);
+	m_clockCycles = 4;
+
+	if ((traps & TRAP_WATCH) && m_breakpoints.IsWatched(address, Breakpoints::WATCH_READ))
+	{
+		StopRun(DebugStop::READ_WATCHPOINT, address, Breakpoints::ANY_BANK, value);
+	}
+	return value;
+}
+
+void CPU::TrappedWrite(WORD address, BYTE data, BYTE traps)
+{
+	// Bytes the transfer hasn't reached yet need to see this write, bytes it already copied must not
+	if ((traps & TRAP_DMA) && m_dmaTransferProgress.active && IsDMASourceAddress(address))
+	{
+		CatchUpDMATransfer(m_totalClockCycles);
+	}
+
+	Write(address, data);
+
+	if ((traps & TRAP_WATCH) && m_breakpoints.IsWatched(address, Breakpoints::WATCH_WRITE))
+	{
+		StopRun(DebugStop::WRITE_WATCHPOINT, address, Breakpoints::ANY_BANK, data);
+	}
+}
+
+void CPU::BreakpointTrap(BYTE opcode)
+{
+	WORD address = PC - 1;
+	int bank = address < 0x8000 && m_cartridge ? m_cartridge->GetRomBank(address) : MemoryBankController::NO_ROM_BANK;
+	if (bank == MemoryBankController::NO_ROM_BANK)
+	{
+		bank = Breakpoints::ANY_BANK;
+	}
+	if (m_breakpoints.IsBreakpoint(address, bank) && m_resumeAddress != address)
+	{
+		// The fetch is undone, so the instruction runs from the start once the run carries on
+		PC = address;
+		m_clockCycles = 0;
+		m_resumeAddress = address;
+		if (m_tracing)
+		{
+			m_trace.RemoveLast();
+		}
+		StopRun(DebugStop::BREAKPOINT, address, bank, opcode);
+		return;
+	}
+
+	m_resumeAddress = -1;
+	(this->*m_instructions[opcode])(opcode);
+}
+
+void CPU::TraceTrap(BYTE opcode)
+{
+	// PC has already moved past the opcode
+	const WORD address = PC - 1;
+	const int length = InstructionTrace::GetLength(opcode);
+
+	InstructionTrace::Record& record = m_trace.Add();
+	record.cycleLow = static_cast<uint32_t>(m_totalClockCycles);
+	record.cycleHigh = static_cast<WORD>(m_totalClockCycles >> 32);
+	record.pc = address;
+	const int bank = address < 0x8000 && m_cartridge ? m_cartridge->GetRomBank(address) : MemoryBankController::NO_ROM_BANK;
+	record.bank = bank == MemoryBankController::NO_ROM_BANK ? InstructionTrace::NO_BANK : static_cast<WORD>(bank);
+	record.af = AF.pair;
+	record.bc = BC.pair;
+	record.de = DE.pair;
+	record.hl = HL.pair;
+	record.sp = SP.pair;
+	record.bytes[0] = opcode;
+	record.bytes[1] = length > 1 ? Read(PC) : 0;
+	record.bytes[2] = length > 2 ? Read(PC + 1) : 0;
+	record.flags = (m_interruptMasterEnableFlag ? InstructionTrace::FLAG_IME : 0) | (m_isHalted ? InstructionTrace::FLAG_HALTED : 0);
+
+	(this->*m_tracedOpcodes[opcode])(opcode);
+}
+
+void CPU::StopRun(DebugStop::Reason reason, WORD address, int bank, BYTE value)
+{
+	// The first stop of an instruction is the one reported
+	if (m_debugStop.reason == DebugStop::NONE)
+	{
+		m_debugStop.reason = reason;
+		m_debugStop.address = address;
+		m_debugStop.bank = bank;
+		m_debugStop.value = value;
+	}
+	m_stopCycle = 0;
 }
 
 void CPU::WriteJoypad(const Joypad& joypad)
+{
+	m_joypad = joypad;
+	UpdateJoypadRegister(m_io[0x00]);
+}
+
+void CPU::UpdateJoypadRegister(BYTE select)
 {
 	// Joypad address is 0xFF00, but that is 0x0000 since memory is split up
 	const BYTE joypadRegisterAddress = 0x0000;
 	BYTE oldJoypadRegister = m_io[joypadRegisterAddress];
-	BYTE joypadRegister = oldJoypadRegister;
 
 	// Note that, rather unconventionally for the Game Boy, a button being pressed is seen as the corresponding bit being 0, not 1.
 	// If bit 5 is 0, the lower nibble contains start/select/b/a
 	// if bit 4 is 0, the lower nibble contains down/up/left/right
-
-	if (!(joypadRegister & BIT_5))
+	// With both selected a bit is 0 if the button from either group is pressed, with neither it reads 1.
+	BYTE pressed = 0;
+	if (!(select & BIT_5))
 	{
-		joypadRegister = 0xD0
-			| (joypad.a		 ? 0 : BIT_0)
-			| (joypad.b		 ? 0 : BIT_1)
-			| (joypad.select ? 0 : BIT_2)
-			| (joypad.start	 ? 0 : BIT_3);
+		pressed |= (m_joypad.a		? BIT_0 : 0)
+				|  (m_joypad.b		? BIT_1 : 0)
+				|  (m_joypad.select	? BIT_2 : 0)
+				|  (m_joypad.start	? BIT_3 : 0);
 	}
-	else if (!(joypadRegister & BIT_4))
+	if (!(select & BIT_4))
 	{
-		joypadRegister = 0xE0
-			| (joypad.right ? 0 : BIT_0)
-			| (joypad.left	? 0 : BIT_1)
-			| (joypad.up	? 0 : BIT_2)
-			| (joypad.down	? 0 : BIT_3);
-	}
-	else
-	{
-		joypadRegister = 0xCF;		// reset the register
+		pressed |= (m_joypad.right	? BIT_0 : 0)
+				|  (m_joypad.left	? BIT_1 : 0)
+				|  (m_joypad.up		? BIT_2 : 0)
+				|  (m_joypad.down	? BIT_3 : 0);
 	}
 
+	BYTE joypadRegister = 0xC0 | (select & (BIT_4 | BIT_5)) | (~pressed & 0x0F);
 	m_io[joypadRegisterAddress] = joypadRegister;
 
-	if (joypadRegister != 0xCF && ((oldJoypadRegister & 0xFF) ^ (joypadRegister & 0xFF)) & (oldJoypadRegister & 0xFF))
+	if (oldJoypadRegister & ~joypadRegister & 0x0F)
 	{
 		// old joypad had a 1 that was swapped to a 0. This triggers a joypad interrupt
 		RequestInterrupt(INTERRUPT_JOYPAD);
@@ -183,6 +526,54 @@ void CPU::CPU_Step()
 	}
 }
 
+unsigned long CPU::RunFor(unsigned long clockCycles)
+{
+	// Pending cycles haven't been flushed yet, but they have been executed
+	const uint64_t startCycles = m_totalClockCycles + m_clockCycles;
+
+	m_stopCycle = startCycles + clockCycles;
+	while (m_totalClockCycles + m_clockCycles < m_stopCycle)
+	{
+		CPU_Step();
+	}
+
+	return static_cast<unsigned long>((m_totalClockCycles + m_clockCycles) - startCycles);
+}
+
+unsigned long CPU::RunFrame()
+{
+	const uint64_t startCycles = m_totalClockCycles + m_clockCycles;
+
+	// A frame that completed outside of RunFrame shouldn't end this one immediately
+	m_ppu.ConsumeFrameCompleted();
+
+	m_stopCycle = startCycles + CYCLES_PER_FRAME;
+	while (m_totalClockCycles + m_clockCycles < m_stopCycle)
+	{
+		CPU_Step();
+
+		if (m_ppu.ConsumeFrameCompleted())
+		{
+			break;
+		}
+	}
+	unsigned long executedCycles = static_cast<unsigned long>((m_totalClockCycles + m_clockCycles) - startCycles);
+
+	m_apu.EndFrame(m_totalClockCycles);
+	// Keeps the clock current for battery saves, which read it between frames
+	if (m_cartridge)
+	{
+		m_cartridge->SyncClock(m_totalClockCycles);
+	}
+	return executedCycles;
+}
+
+void CPU::SetRenderer(PPU::Renderer renderer)
+{
+	SyncPPU();
+	m_ppu.SetRenderer(renderer);
+}
+
 inline void CPU::SetFlagIf(BYTE flag, bool condition)
 {
 	if (condition)
@@ -276,107 +667,286 @@ void CPU::SpinCycle(int numMachineCycles)
 
 void CPU::FlushClockCycles()
 {
-	m_totalClockCycles += m_clockCycles;
 	if (m_clockCycles)
 	{
-		if (m_dmaTransferProgress.active)
+		m_totalClockCycles += m_clockCycles;
+		if (m_scheduler.GetNextEventCycle() <= m_totalClockCycles)
 		{
-			int cycleCount = m_clockCycles / 4;
-			for (int i = 0; i < cycleCount; ++i)
-			{
-				++m_dmaTransferProgress.currentIndex;
-				if (m_dmaTransferProgress.currentIndex < 0xA0)
-				{
-					m_oam[m_dmaTransferProgress.currentIndex] = Read(m_dmaTransferProgress.from + m_dmaTransferProgress.currentIndex);
-				}
-				else
-				{
-					m_dmaTransferProgress.active = false;
-					break;
-				}
-			}
+			ProcessScheduledEvents();
 		}
-
-		TimerStep(m_clockCycles);
-		m_ppu.Step(m_clockCycles);
 	}
 
 	m_clockCycles = 0;
 }
 
-void CPU::TimerStep(int cycles)
+void CPU::ProcessScheduledEvents()
 {
-	// The divider counter is incremented at a rate of 16384 Hz
-	// The CPU has a clockspeed of 4194304 Hz
-	// Every 256 cycles, the divider counter is incremented
-	WORD increment = m_dividerCounter + cycles;
-	if (increment > 255)
+	Scheduler::Event event;
+	while (m_scheduler.PopDueEvent(m_totalClockCycles, event))
 	{
-		++m_io[DIVIDER_REGISTER];
+		switch (event)
+		{
+		case Scheduler::Event::PPU:
+			SyncPPU();
+			SchedulePPUEvent();
+			break;
+		case Scheduler::Event::TIMER_OVERFLOW:
+			TimerOverflow();
+			break;
+		case Scheduler::Event::DMA_TRANSFER:
+			// Nothing observed the transfer while it was running, so this copies all 160 bytes at once
+			CatchUpDMATransfer(m_dmaTransferProgress.startCycle + DMA_LENGTH * DMA_CYCLES_PER_BYTE);
+			m_dmaTransferProgress.active = false;
+			SetDMATraps(false);
+			break;
+		case Scheduler::Event::SERIAL_TRANSFER:
+			SerialTransfer();
+			break;
+		default:
+			DEBUG_ASSERT(false, "Unhandled scheduler event");
+			break;
+		}
 	}
-	m_dividerCounter = (increment & 0xFF);
+}
 
-	// The divider register always increments, but the timer counter only increments if it is enabled
-	// Bit 2 of the timer control register determines if the timer is enabled
-	if (m_io[TIMER_CONTROL] & BIT_2)
+void CPU::SyncPPU()
+{
+	m_ppu.CatchUp(m_totalClockCycles);
+}
+
+void CPU::SchedulePPUEvent()
+{
+	m_scheduler.Schedule(Scheduler::Event::PPU, m_ppu.GetNextEventCycle());
+}
+
+void CPU::StartDMATransfer(BYTE sourcePage)
+{
+	// Restarting a transfer keeps whatever the previous one had copied so far
+	CatchUpDMATransfer(m_totalClockCycles);
+	if (m_dmaTransferProgress.active)
 	{
-		m_timerCounter -= cycles;
-		if (m_timerCounter <= 0)
-		{
-			SetFrequency();
-			BYTE timaRegister = m_io[TIMER_COUNTER];
+		SetDMATraps(false);
+	}
 
-			// When the TIMA register overflows, it is reset to the value specified by the TMA register
-			// An interrupt is then requested
-			if (timaRegister == 0xFF)
-			{
-				timaRegister = m_io[TIMER_MODULO];
-				RequestInterrupt(INTERRUPT_TIMER);
-			}
-			else
-			{
-				++timaRegister;
-			}
+	// Sources above 0xDFFF read from the echo of work RAM
+	if (sourcePage > 0xDF)
+	{
+		sourcePage -= 0x20;
+	}
+
+	m_dmaTransferProgress.from = sourcePage << 8;
+	m_dmaTransferProgress.currentIndex = 0;
+	m_dmaTransferProgress.startCycle = m_totalClockCycles + DMA_SETUP_CYCLES;
+	m_dmaTransferProgress.active = true;
+	SetDMATraps(true);
+
+	m_scheduler.Schedule(Scheduler::Event::DMA_TRANSFER, m_dmaTransferProgress.startCycle + DMA_LENGTH * DMA_CYCLES_PER_BYTE);
+}
+
+void CPU::CatchUpDMATransfer(uint64_t clockCycle)
+{
+	if (!m_dmaTransferProgress.active || clockCycle <= m_dmaTransferProgress.startCycle)
+	{
+		return;
+	}
+
+	uint64_t bytesDue = (clockCycle - m_dmaTransferProgress.startCycle) / DMA_CYCLES_PER_BYTE;
+	WORD target = bytesDue < DMA_LENGTH ? static_cast<WORD>(bytesDue) : DMA_LENGTH;
+	WORD index = m_dmaTransferProgress.currentIndex;
+	WORD from = m_dmaTransferProgress.from;
+
+	if (index >= target)
+	{
+		return;
+	}
+
+	// The PPU has to see OAM as it was before these bytes land
+	SyncPPU();
 
-			m_io[TIMER_COUNTER] = timaRegister;
+	if (from >= 0xC000)
+	{
+		// Work RAM is the usual source and can be block copied
+		memcpy(&m_oam[index], &m_internalRAM[from - 0xC000 + index], target - index);
+	}
+	else
+	{
+		for (; index < target; ++index)
+		{
+			m_oam[index] = Read(from + index);
 		}
 	}
+
+	m_dmaTransferProgress.currentIndex = target;
+	m_ppu.InvalidateSprites();
+}
+
+bool CPU::IsDMASourceAddress(WORD address) const
+{
+	if (address >= 0xE000 && address < 0xFE00)
+	{
+		address -= 0x2000;
+	}
+
+	return address >= m_dmaTransferProgress.from && address < m_dmaTransferProgress.from + DMA_LENGTH;
+}
+
+WORD CPU::GetInternalCounter(uint64_t clockCycle) const
+{
+	return static_cast<WORD>(clockCycle - m_dividerResetCycle);
+}
+
+BYTE CPU::GetTimerCounter(uint64_t clockCycle) const
+{
+	if (!IsTimerEnabled())
+	{
+		return m_timerCounter;
+	}
+
+	// Every falling edge of the selected bit is a multiple of the period since the counter was reset.
+	// The overflow event always runs before TIMA could pass 0xFF, so this can't wrap.
+	uint64_t period = GetTimerPeriod();
+	uint64_t increments = (clockCycle - m_dividerResetCycle) / period - (m_timerSyncCycle - m_dividerResetCycle) / period;
+
+	return static_cast<BYTE>(m_timerCounter + increments);
 }
 
-BYTE CPU::GetFrequency() const
+bool CPU::IsTimerEnabled() const
 {
-	BYTE frequency = m_io[TIMER_CONTROL];
+	// Bit 2 of the timer control register determines if the timer is enabled
+	return m_io[TIMER_CONTROL] & BIT_2;
+}
 
+uint64_t CPU::GetTimerPeriod() const
+{
 	// Bits 0 and Bits 1 set the value for the frequency.
-	// Bit 2 is the enable bit
+	BYTE counterBit = TIMER_COUNTER_BITS[m_io[TIMER_CONTROL] & (BIT_0 | BIT_1)];
+	return 1ull << (counterBit + 1);
+}
 
-	return (frequency & (BIT_0 | BIT_1));
+bool CPU::IsTimerInputHigh(uint64_t clockCycle) const
+{
+	return IsTimerEnabled() && (GetInternalCounter(clockCycle) & (GetTimerPeriod() >> 1));
 }
 
-void CPU::SetFrequency()
+void CPU::SyncTimer()
 {
-	BYTE f = GetFrequency();
+	m_timerCounter = GetTimerCounter(m_totalClockCycles);
+	m_timerSyncCycle = m_totalClockCycles;
+}
 
-	int frequency;
-	switch (f)
+void CPU::IncrementTimerCounter()
+{
+	// When the TIMA register overflows, it is reset to the value specified by the TMA register
+	// An interrupt is then requested
+	if (m_timerCounter == 0xFF)
 	{
-	case 0:
-		frequency = FREQUENCY_0;
-		break;
-	case 1:
-		frequency = FREQUENCY_1;
-		break;
-	case 2:
-		frequency = FREQUENCY_2;
+		m_timerCounter = m_io[TIMER_MODULO];
+		RequestInterrupt(INTERRUPT_TIMER);
+	}
+	else
+	{
+		++m_timerCounter;
+	}
+}
+
+void CPU::ScheduleTimerOverflow()
+{
+	if (!IsTimerEnabled())
+	{
+		m_scheduler.Cancel(Scheduler::Event::TIMER_OVERFLOW);
+		return;
+	}
+
+	// TIMA overflows on the falling edge that takes it past 0xFF
+	uint64_t period = GetTimerPeriod();
+	uint64_t elapsedIncrements = (m_timerSyncCycle - m_dividerResetCycle) / period;
+	uint64_t remainingIncrements = 0x100 - m_timerCounter;
+
+	m_timerOverflowCycle = m_dividerResetCycle + (elapsedIncrements + remainingIncrements) * period;
+	m_scheduler.Schedule(Scheduler::Event::TIMER_OVERFLOW, m_timerOverflowCycle);
+}
+
+void CPU::TimerOverflow()
+{
+	m_timerCounter = m_io[TIMER_MODULO];
+	m_timerSyncCycle = m_timerOverflowCycle;
+	RequestInterrupt(INTERRUPT_TIMER);
+
+	ScheduleTimerOverflow();
+}
+
+void CPU::WriteTimerRegister(WORD internalAddress, BYTE data)
+{
+	SyncTimer();
+
+	// Both resetting the counter and changing TAC can cause a falling edge on the timer input
+	bool wasInputHigh = IsTimerInputHigh(m_totalClockCycles);
+
+	switch (internalAddress)
+	{
+	case DIVIDER_REGISTER:
+		// DIV resets to 0 when written to, no matter the value. The frame sequencer runs from the same counter.
+		SyncAPU();
+		m_apu.ResetDivider(m_totalClockCycles);
+		m_dividerResetCycle = m_totalClockCycles;
 		break;
-	case 3:
-		frequency = FREQUENCY_3;
+	case TIMER_COUNTER:
+		m_timerCounter = data;
 		break;
-	default:
-		frequency = FREQUENCY_0;
+	case TIMER_MODULO:
+	case TIMER_CONTROL:
+		m_io[internalAddress] = data;
 		break;
 	}
-	m_timerCounter = CLOCKSPEED / frequency;
+
+	if (wasInputHigh && !IsTimerInputHigh(m_totalClockCycles))
+	{
+		IncrementTimerCounter();
+	}
+
+	ScheduleTimerOverflow();
+}
+
+void CPU::WriteSerialControl(BYTE data)
+{
+	// Only the start and clock select bits exist, the others always read as 1
+	m_io[SERIAL_CONTROL] = data | 0x7E;
+
+	if (m_serialDevice)
+	{
+		m_serialDevice->SetListening((data & SERIAL_TRANSFER_START) && !(data & SERIAL_INTERNAL_CLOCK), m_io[SERIAL_DATA], m_totalClockCycles);
+	}
+
+	if (!(data & SERIAL_TRANSFER_START))
+	{
+		m_scheduler.Cancel(Scheduler::Event::SERIAL_TRANSFER);
+		return;
+	}
+
+	// With the external clock the transfer waits on the other side, which is checked at the same rate
+	m_scheduler.Schedule(Scheduler::Event::SERIAL_TRANSFER, m_totalClockCycles + SERIAL_TRANSFER_CYCLES);
+}
+
+void CPU::SerialTransfer()
+{
+	BYTE incoming = SerialDevice::DISCONNECTED;
+	if (m_io[SERIAL_CONTROL] & SERIAL_INTERNAL_CLOCK)
+	{
+		if (m_serialDevice)
+		{
+			incoming = m_serialDevice->TransferInternalClock(m_io[SERIAL_DATA], m_totalClockCycles);
+		}
+	}
+	else if (!m_serialDevice || !m_serialDevice->TransferExternalClock(m_io[SERIAL_DATA], incoming, m_totalClockCycles))
+	{
+		// Nothing has clocked the byte yet, with nothing plugged in this waits forever like the hardware does
+		m_scheduler.Schedule(Scheduler::Event::SERIAL_TRANSFER, m_totalClockCycles + SERIAL_TRANSFER_CYCLES);
+		return;
+	}
+
+	m_io[SERIAL_DATA] = incoming;
+	m_io[SERIAL_CONTROL] &= ~SERIAL_TRANSFER_START;
+	RequestInterrupt(INTERRUPT_SERIAL);
 }
 
 bool CPU::IsInterruptEnabled(BYTE interrupt) const
@@ -411,6 +981,9 @@ void CPU::ServiceInterrupts()
 			// 4 final cycles to update the PC register
 			m_clockCycles += 12;
 			PushStack(PC);
+
+			// Pushing runs the clock, which can raise more interrupts that must not be lost when IF is written back
+			interruptFlag = m_io[0x0F];
 		}
 
 		if (interruptsToProcess & INTERRUPT_VBLANK)
@@ -495,6 +1068,12 @@ BYTE CPU::Read(WORD address) const
 	// Reading from Object attribute memory
 	if (address < 0xFEA0)
 	{
+		// OAM belongs to the DMA while a transfer is running
+		if (m_dmaTransferProgress.active)
+		{
+			return 0xFF;
+		}
+
 		MEMORY_ADDRESS internalAddress = address - 0xFE00;
 		return m_oam[internalAddress];
 	}
@@ -521,6 +1100,21 @@ BYTE CPU::Read(WORD address) const
 		//	$FF70			WRAM Bank Select
 
 		MEMORY_ADDRESS internalAddress = address - 0xFF00;
+
+		// The timer registers are derived from the clock cycle count when they are read
+		if (internalAddress == DIVIDER_REGISTER)
+		{
+			return GetInternalCounter(m_totalClockCycles) >> 8;
+		}
+		else if (internalAddress == TIMER_COUNTER)
+		{
+			return GetTimerCounter(m_totalClockCycles);
+		}
+		else if (IsAPURegister(address))
+		{
+			return m_apu.ReadRegister(internalAddress);
+		}
+
 		return m_io[internalAddress];
 	}
 
@@ -548,6 +1142,14 @@ BYTE CPU::CycleRead(WORD address)
 		FlushClockCycles();
 	}
 
+	// Only pages with registers to sync or watchpoints are trapped, every other read goes straight through
+	// HRAM and IE share their page with the registers but have nothing to sync, so code running from HRAM stays on the fast path
+	BYTE traps = m_readTraps[address >> 8];
+	if (traps && (traps != TRAP_SYNC || address < 0xFF80))
+	{
+		return TrappedRead(address, traps);
+	}
+
 	BYTE value = Read(address);
 	m_clockCycles = 4;
 	return value;
@@ -574,6 +1176,8 @@ void CPU::Write(WORD address, BYTE data)
 	{
 		if (m_cartridge)
 		{
+			// The clock has to be up to date before it is latched
+			m_cartridge->SyncClock(m_totalClockCycles);
 			m_cartridge->WriteMemory(address, data);
 		}
 		return;
@@ -583,6 +1187,7 @@ void CPU::Write(WORD address, BYTE data)
 	if (address < 0xA000)
 	{
 		MEMORY_ADDRESS internalAddress = address - 0x8000;
+		SyncPPU();
 		m_ppu.WriteVRAM(internalAddress, data);
 		return;
 	}
@@ -592,6 +1197,7 @@ void CPU::Write(WORD address, BYTE data)
 	{
 		if (m_cartridge)
 		{
+			m_cartridge->SyncClock(m_totalClockCycles);
 			m_cartridge->WriteMemory(address, data);
 		}
 		return;
@@ -616,11 +1222,15 @@ void CPU::Write(WORD address, BYTE data)
 	// Writing to Object attribute memory
 	if (address < 0xFEA0)
 	{
-		// OAM memory is only accessable during HBLANK or VBLANK periods
-		if (m_io[PPU::STAT_REG] > 1)
+		// OAM memory is only accessable during HBLANK or VBLANK periods, or with the LCD off, and never during a DMA
+		// transfer. STAT only has the current mode once the PPU is brought up to date.
+		SyncPPU();
+		const bool oamAccessible = (m_io[PPU::STAT_REG] & PPU::STAT_MODE) < static_cast<BYTE>(PPU::GPUMode::OAMLOAD) || !(m_io[PPU::LCDC_BYTE] & PPU::LCD_ENABLE);
+		if (oamAccessible && !m_dmaTransferProgress.active)
 		{
 			MEMORY_ADDRESS internalAddress = address - 0xFE00;
 			m_oam[internalAddress] = data;
+			m_ppu.InvalidateSprites();
 		}
 
 		return;
@@ -648,33 +1258,60 @@ void CPU::Write(WORD address, BYTE data)
 		//	$FF70			WRAM Bank Select
 
 		MEMORY_ADDRESS internalAddress = address - 0xFF00;
-		if (address == 0xFF02)
+
+		// Everything the PPU has drawn up to now used the old register values
+		const bool isPPURegister = IsPPURegister(address);
+		if (isPPURegister)
 		{
-			// A value of 0x81 indicates there is something to be transfered
-			// For our purposes that means a character should be written to the console
+			SyncPPU();
+		}
 
-			if (data == 0x81)
-			{
-				std::cout << static_cast<char>(m_io[0x01]);
-			}
+		if (address == 0xFF00)
+		{
+			// Only the select bits are written, the buttons of the selected groups are read back through the rest
+			UpdateJoypadRegister(data);
+		}
+		else if (address == 0xFF02)
+		{
+			WriteSerialControl(data);
 		}
-		else if (address == 0xFF04 || address == 0xFF44)
+		else if (address >= 0xFF04 && address <= 0xFF07)
 		{
-			// These registers reset to 0 when written to
+			WriteTimerRegister(internalAddress, data);
+		}
+		else if (IsAPURegister(address))
+		{
+			SyncAPU();
+			m_apu.WriteRegister(internalAddress, data, m_totalClockCycles);
+		}
+		else if (address == 0xFF41)
+		{
+			// The mode and coincidence bits belong to the PPU, and the unused top bit always reads as 1
+			m_io[internalAddress] = BIT_7 | (data & ~(BIT_7 | PPU::STAT_READ_ONLY)) | (m_io[internalAddress] & PPU::STAT_READ_ONLY);
+		}
+		else if (address == 0xFF44)
+		{
+			// This register resets to 0 when written to
 			m_io[internalAddress] = 0x00;
 		}
 		else if (address == 0xFF46)
 		{
 			// The DMA register initiates a transfer from RAM to OAM
-			m_dmaTransferProgress.from = data << 8;
-			m_dmaTransferProgress.currentIndex = 0;
-			m_dmaTransferProgress.active = true;
+			m_io[internalAddress] = data;
+			StartDMATransfer(data);
 		}
 		else
 		{
 			m_io[internalAddress] = data;
 		}
 
+		// Writing LY moves the next VBLANK, and LY, LYC or turning the LCD off can change STAT
+		if (isPPURegister)
+		{
+			m_ppu.UpdateStatus();
+			SchedulePPUEvent();
+		}
+
 		return;
 	}
 
@@ -689,7 +1326,10 @@ void CPU::Write(WORD address, BYTE data)
 	// Writing to the interrupt enable register
 	if (address == 0xFFFF)
 	{
+		// The PPU only raises the interrupts that are enabled when it reaches them
+		SyncPPU();
 		m_interruptEnableRegister = data;
+		SchedulePPUEvent();
 		return;
 	}
 }
@@ -701,7 +1341,16 @@ void CPU::CycleWrite(WORD address, BYTE data)
 		FlushClockCycles();
 	}
 
-	Write(address, data);
+	// The pages of a running DMA transfer's source and of watchpoints are trapped
+	BYTE traps = m_writeTraps[address >> 8];
+	if (traps)
+	{
+		TrappedWrite(address, data, traps);
+	}
+	else
+	{
+		Write(address, data);
+	}
 	m_clockCycles = 4;
 }
 
@@ -934,7 +1583,7 @@ void CPU::SetupOpcodes()
 	m_opcodes[0x3D] = &CPU::DEC_R;
 	m_opcodes[0x3E] = &CPU::LD_R_n8;
 	m_opcodes[0x3F] = &CPU::CCF;
-	m_opcodes[0x40] = &CPU::LD_R_R;
+	m_opcodes[0x40] = &CPU::LD_B_B;
 	m_opcodes[0x41] = &CPU::LD_R_R;
 	m_opcodes[0x42] = &CPU::LD_R_R;
 	m_opcodes[0x43] = &CPU::LD_R_R;
@@ -1569,6 +2218,11 @@ void CPU::LD_R_R(BYTE opcode)
 	registers[targetRegister].hi = value;
 }
 
+void CPU::LD_B_B(BYTE opcode)
+{
+	m_debugBreakpointHit = true;
+}
+
 void CPU::LD_R_n8(BYTE opcode)
 {
 	BYTE targetRegister = ((opcode >> 4) + 1) & 3;
@@ -1623,7 +2277,7 @@ void CPU::LD_A_BC(BYTE opcode)
 
 void CPU::LD_A_DE(BYTE opcode)
 {
-	REGISTER_A = Read(DE);
+	REGISTER_A = CycleRead(DE);
 }
 
 void CPU::LDI_HL_A(BYTE opcode)
@@ -1,38 +1,65 @@
 #include "stdafx.h"
 
-#include <fstream>
+#include <algorithm>
+#include <vector>
 
 #include "header/Cartridge.h"
 #include "header/MemoryBankControllers.h"
+#include "header/RomFile.h"
+#include "header/StateBuffer.h"
 
 Cartridge::Cartridge()
-	: m_mbc(nullptr)
+	: m_mbc(nullptr),
+	m_header(),
+	m_hasBattery(false),
+	m_hasClock(false)
 {
 
 }
 
 void Cartridge::OpenFile(std::string filePath)
 {
-	std::ifstream in(filePath, std::ios_base::in | std::ios_base::binary);
-
-	int length;
-	in.seekg(0, std::ios::end);
-	length = in.tellg();
-	in.seekg(0, std::ios::beg);
+	delete m_mbc;
+	m_mbc = nullptr;
+	m_hasBattery = false;
+	m_hasClock = false;
+	m_header = HeaderInfo();
+	m_filePath = filePath;
 
-	if (length > 0x4000)
+	// Archives are decompressed into the buffer the memory bank controller copies the ROM from
+	// RomFile has already said why the file couldn't be read
+	std::vector<char> buffer;
+	if (!RomFile::Read(filePath, buffer))
 	{
-		char* buffer = new char[length];
-		in.read(buffer, length);
-		in.close();
+		return;
+	}
 
-		CartridgeHeader* header = reinterpret_cast<CartridgeHeader*>(&buffer[0x100]);
-		m_mbc = MemoryBankControllerFactory::CreateMemoryBank(header->cartridgeType, header->romSize, header->ramSize, buffer, length);
+	if (buffer.size() <= 0x4000 || !ReadHeader(reinterpret_cast<const BYTE*>(buffer.data()), buffer.size(), m_header))
+	{
+		std::cerr << filePath << " is too small to be a ROM" << std::endl;
+		return;
+	}
 
-		m_title = std::string(reinterpret_cast<char*>(header->titleSection.title));
+	// Still loaded, like on a flash cart, but anything odd is worth knowing when a game misbehaves
+	if (!m_header.headerChecksumValid)
+	{
+		std::cerr << filePath << " has a bad header checksum, a real Game Boy would not start it" << std::endl;
+	}
+	if (!m_header.sizeValid)
+	{
+		std::cerr << filePath << " is " << buffer.size() << " bytes, which is not what its header says" << std::endl;
+	}
 
-		delete[] buffer;
+	m_mbc = MemoryBankControllerFactory::CreateMemoryBank(m_header.cartridgeType, m_header.romSizeCode, m_header.ramSizeCode, buffer.data(), static_cast<int>(buffer.size()));
+	if (!m_mbc)
+	{
+		std::cerr << filePath << " uses cartridge type " << std::hex << std::uppercase << static_cast<int>(m_header.cartridgeType)
+			<< std::dec << std::nouppercase << "h, which isn't supported" << std::endl;
+		return;
 	}
+
+	m_hasBattery = IsBatteryType(m_header.cartridgeType);
+	m_hasClock = m_mbc->HasClock();
 }
 
 Cartridge::~Cartridge()
@@ -42,7 +69,7 @@ Cartridge::~Cartridge()
 
 BYTE Cartridge::ReadMemory(WORD address)
 {
-	return m_mbc->ReadMemory(address);
+	return m_mbc->Read(address);
 }
 
 void Cartridge::WriteMemory(WORD address, BYTE data)
@@ -54,3 +81,158 @@ int Cartridge::DumpRom(BYTE*& rom) const
 {
 	return m_mbc->DumpRom(rom);
 }
+
+int Cartridge::GetRomBank(WORD address) const
+{
+	return m_mbc->GetRomBank(address);
+}
+
+int Cartridge::DumpRam(BYTE*& ram) const
+{
+	return m_mbc->DumpRam(ram);
+}
+
+void Cartridge::LoadRam(const BYTE* data, int size)
+{
+	m_mbc->LoadRam(data, size);
+}
+
+bool Cartridge::CopyDirtyRam(BYTE* image)
+{
+	return m_mbc->CopyDirtyRam(image);
+}
+
+void Cartridge::SyncClock(uint64_t clockCycle)
+{
+	if (m_hasClock)
+	{
+		m_mbc->SyncClock(clockCycle);
+	}
+}
+
+void Cartridge::RebaseClock(uint64_t clockCycle)
+{
+	if (m_hasClock)
+	{
+		m_mbc->RebaseClock(clockCycle);
+	}
+}
+
+void Cartridge::GetClock(ClockRegisters& current, ClockRegisters& latched) const
+{
+	m_mbc->GetClock(current, latched);
+}
+
+void Cartridge::SetClock(const ClockRegisters& current, const ClockRegisters& latched)
+{
+	m_mbc->SetClock(current, latched);
+}
+
+void Cartridge::AdvanceClock(uint64_t seconds)
+{
+	m_mbc->AdvanceClock(seconds);
+}
+
+bool Cartridge::ReadHeader(const BYTE* rom, size_t size, HeaderInfo& info)
+{
+	if (size < HEADER_END)
+	{
+		return false;
+	}
+
+	// MMM01 multicarts start in their menu at the end of the ROM, and only the menu's header describes the cart
+	size_t headerStart = HEADER_START;
+	if (MemoryBankController_MMM01::IsMulticart(reinterpret_cast<const char*>(rom), static_cast<int>(size)))
+	{
+		headerStart += size - 0x8000;
+	}
+	const CartridgeHeader* header = reinterpret_cast<const CartridgeHeader*>(rom + headerStart);
+	info.cartridgeType = header->cartridgeType;
+	info.romSizeCode = header->romSize;
+	info.ramSizeCode = header->ramSize;
+	info.isColor = header->titleSection.cgbTitle.cgbFlag & 0x80;
+
+	// The title fills its field without a terminator when it is long enough, and colour games give up the last byte
+	const char* title = reinterpret_cast<const char*>(header->titleSection.title);
+	size_t titleLength = info.isColor ? sizeof(header->titleSection.cgbTitle.title) : sizeof(header->titleSection.title);
+	titleLength = std::find(title, title + titleLength, '\0') - title;
+	info.title.assign(title, titleLength);
+	while (!info.title.empty() && info.title.back() == ' ')
+	{
+		info.title.pop_back();
+	}
+
+	// The header checksum covers the title to the version number
+	BYTE headerChecksum = 0;
+	for (size_t address = 0x134; address < 0x14D; ++address)
+	{
+		headerChecksum = headerChecksum - rom[headerStart - HEADER_START + address] - 1;
+	}
+	info.headerChecksumValid = headerChecksum == header->headerChecksum;
+
+	// The global checksum is the sum of every byte except its own two
+	uint16_t globalChecksum = 0;
+	for (size_t address = 0; address < size; ++address)
+	{
+		globalChecksum += rom[address];
+	}
+	globalChecksum -= header->globalChecksum[0] + header->globalChecksum[1];
+	info.globalChecksumValid = globalChecksum == ((header->globalChecksum[0] << 8) | header->globalChecksum[1]);
+
+	info.sizeValid = GetRomSize(header->romSize) == size;
+	return true;
+}
+
+size_t Cartridge::GetRomSize(BYTE romSizeCode)
+{
+	if (romSizeCode <= 0x08)
+	{
+		return static_cast<size_t>(0x8000) << romSizeCode;
+	}
+
+	switch (romSizeCode)
+	{
+	case 0x52:
+		return 72 * 0x4000;
+	case 0x53:
+		return 80 * 0x4000;
+	case 0x54:
+		return 96 * 0x4000;
+	default:
+		return 0;
+	}
+}
+
+bool Cartridge::IsBatteryType(BYTE cartridgeType)
+{
+	switch (cartridgeType)
+	{
+	case 0x03:	// MBC1+RAM+BATTERY
+	case 0x06:	// MBC2+BATTERY
+	case 0x09:	// ROM+RAM+BATTERY
+	case 0x0D:	// MMM01+RAM+BATTERY
+	case 0x0F:	// MBC3+TIMER+BATTERY
+	case 0x10:	// MBC3+TIMER+RAM+BATTERY
+	case 0x13:	// MBC3+RAM+BATTERY
+	case 0x1B:	// MBC5+RAM+BATTERY
+	case 0x1E:	// MBC5+RUMBLE+RAM+BATTERY
+	case 0x20:	// MBC6
+	case 0x22:	// MBC7+SENSOR+RUMBLE+RAM+BATTERY
+	case 0xFC:	// POCKET CAMERA
+	case 0xFE:	// HuC3
+	case 0xFF:	// HuC1+RAM+BATTERY
+		return true;
+	default:
+		return false;
+	}
+}
+
+void Cartridge::SaveState(StateBuffer& state) const
+{
+	m_mbc->SaveState(state);
+}
+
+void Cartridge::LoadState(StateBuffer& state)
+{
+	m_mbc->LoadState(state);
+}
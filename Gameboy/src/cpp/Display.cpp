@@ -0,0 +1,56 @@
+#include "stdafx.h"
+
+#include <SFML/Graphics/Sprite.hpp>
+
+#include "header/Display.h"
+
+Display::Display() :
+	m_pixelBuffer(),
+	m_texture()
+{
+	m_pixelBuffer.create(SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+void Display::Draw(sf::RenderTarget& target, const BYTE* frameBuffer)
+{
+	// The texture needs a graphics context, so it is only created once there is something to draw
+	if (m_texture.getSize().x == 0)
+	{
+		m_texture.create(SCREEN_WIDTH, SCREEN_HEIGHT);
+	}
+
+	for (int y = 0; y < SCREEN_HEIGHT; y++)
+	{
+		for (int x = 0; x < SCREEN_WIDTH; x++)
+		{
+			m_pixelBuffer.setPixel(x, y, GetColour(frameBuffer[y * SCREEN_WIDTH + x]));
+		}
+	}
+
+	m_texture.update(m_pixelBuffer);
+
+	sf::Vector2 screenSize = target.getView().getSize();
+	sf::Sprite drawSprite(m_texture);
+	drawSprite.setScale(
+		screenSize.x / SCREEN_WIDTH,
+		screenSize.y / SCREEN_HEIGHT
+	);
+	drawSprite.setPosition(0, 19);
+
+	target.draw(drawSprite);
+}
+
+const sf::Color& Display::GetColour(BYTE shade)
+{
+	// The gameboy handles four different colours. Black (Pixel OFF), White (Pixel ON),
+	// Dark Grey (33% ON) and Light Grey (66% ON).
+	static const sf::Color colourPalette[4] =
+	{
+		sf::Color(0xFF, 0xFF, 0xFF, 0xFF),
+		sf::Color(0xAA, 0xAA, 0xAA, 0xFF),
+		sf::Color(0x55, 0x55, 0x55, 0xFF),
+		sf::Color(0x00, 0x00, 0x00, 0xFF)
+	};
+
+	return colourPalette[shade & 0x3];
+}
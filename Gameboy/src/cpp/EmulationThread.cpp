@@ -0,0 +1,246 @@
+#include "stdafx.h"
+
+#include <algorithm>
+
+#include "header/EmulationThread.h"
+
+EmulationThread::EmulationThread() :
+	m_sm83(nullptr),
+	m_cartridge(nullptr),
+	m_thread(),
+	m_running(false),
+	m_frames(),
+	m_joypadQueue(),
+	m_movie(),
+	m_moviePlaying(false),
+	m_batterySave(),
+	m_runAhead(),
+	m_runAheadFrames(0),
+	m_speed(0.0),
+	m_audioQueue(),
+	m_audioSamples(AUDIO_QUEUE_SIZE),
+	m_audioRateAdjustment(1.0),
+	m_audioQuality(BlipBuffer::Quality::NORMAL)
+{
+	m_sm83.SetAudioSampleRate(AUDIO_SAMPLE_RATE);
+}
+
+EmulationThread::~EmulationThread()
+{
+	Eject();
+}
+
+void EmulationThread::Start(Cartridge* cart)
+{
+	Eject();
+
+	m_cartridge = cart;
+	m_batterySave.Attach(cart);
+	m_sm83.AddCartridge(cart);
+	m_sm83.PowerOn();
+
+	m_movie = Movie();
+	m_moviePlaying = false;
+
+	Resume();
+}
+
+void EmulationThread::Resume()
+{
+	m_running = true;
+	m_thread = std::thread(&EmulationThread::Run, this);
+}
+
+void EmulationThread::Stop()
+{
+	m_running = false;
+	if (m_thread.joinable())
+	{
+		m_thread.join();
+	}
+
+	m_batterySave.Flush();
+}
+
+void EmulationThread::Eject()
+{
+	Stop();
+	m_batterySave.Detach();
+	m_cartridge = nullptr;
+}
+
+void EmulationThread::SetSerialDevice(SerialDevice* device)
+{
+	// The thread is paused so the device never changes in the middle of a transfer
+	bool wasRunning = IsRunning();
+	Stop();
+	m_sm83.SetSerialDevice(device);
+	if (wasRunning)
+	{
+		Resume();
+	}
+}
+
+void EmulationThread::SetTracing(bool enabled)
+{
+	bool wasRunning = IsRunning();
+	Stop();
+	m_sm83.SetTracing(enabled);
+	if (wasRunning)
+	{
+		Resume();
+	}
+}
+
+bool EmulationThread::SaveTrace(const std::string& filePath)
+{
+	bool wasRunning = IsRunning();
+	Stop();
+	bool saved = m_sm83.GetTrace().Save(filePath);
+	if (wasRunning)
+	{
+		Resume();
+	}
+
+	return saved;
+}
+
+void EmulationThread::StartRecording()
+{
+	if (!m_cartridge)
+	{
+		return;
+	}
+
+	// The thread is paused so the movie starts exactly on a frame boundary
+	Stop();
+	m_moviePlaying = false;
+	m_movie.BeginRecording(m_sm83, *m_cartridge);
+	Resume();
+}
+
+bool EmulationThread::StopRecording(const std::string& filePath)
+{
+	if (!m_movie.IsRecording())
+	{
+		return false;
+	}
+
+	bool wasRunning = IsRunning();
+	Stop();
+	bool saved = m_movie.StopRecording(filePath);
+	if (wasRunning)
+	{
+		Resume();
+	}
+
+	return saved;
+}
+
+bool EmulationThread::PlayMovie(const std::string& filePath)
+{
+	if (!m_cartridge)
+	{
+		return false;
+	}
+
+	Stop();
+	bool playing = m_movie.Load(filePath) && m_movie.BeginPlayback(m_sm83, *m_cartridge);
+	m_moviePlaying = playing;
+
+	// The movie brings its own RAM, which must not end up in the player's save. Saving stays off until the ROM is opened again.
+	if (playing)
+	{
+		m_batterySave.Detach();
+	}
+	Resume();
+
+	return playing;
+}
+
+bool EmulationThread::SendJoypad(const Joypad& joypad)
+{
+	return m_joypadQueue.Push(joypad);
+}
+
+const BYTE* EmulationThread::GetLatestFrame()
+{
+	m_frames.Consume();
+	return m_frames.GetReadBuffer().data();
+}
+
+void EmulationThread::Run()
+{
+	std::chrono::steady_clock::time_point nextFrame = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::duration busyTime(0);
+	int emulatedFrames = 0;
+	int sampledFrames = 0;
+
+	while (m_running.load(std::memory_order_relaxed))
+	{
+		// Every change is applied in order so that presses shorter than a frame still reach the game
+		Joypad joypad;
+		while (m_joypadQueue.Pop(joypad))
+		{
+			if (!m_movie.IsPlaying())
+			{
+				m_sm83.WriteJoypad(joypad);
+				m_movie.RecordJoypad(joypad);
+			}
+		}
+
+		if (m_movie.IsPlaying() && !m_movie.PlayFrame(m_sm83))
+		{
+			m_moviePlaying = false;
+		}
+
+		std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+
+		m_runAhead.SetFrames(m_runAheadFrames.load(std::memory_order_relaxed));
+		m_sm83.SetAudioQuality(m_audioQuality.load(std::memory_order_relaxed));
+		emulatedFrames += m_runAhead.RunFrame(m_sm83, m_frames.GetWriteBuffer().data());
+		m_frames.Publish();
+		m_movie.EndFrame();
+		QueueAudio();
+		m_batterySave.Update();
+
+		busyTime += std::chrono::steady_clock::now() - frameStart;
+		if (++sampledFrames == SPEED_SAMPLE_FRAMES)
+		{
+			std::chrono::duration<double> emulatedTime = emulatedFrames * FRAME_PERIOD;
+			std::chrono::duration<double> busySeconds = busyTime;
+			m_speed.store(emulatedTime.count() / busySeconds.count(), std::memory_order_relaxed);
+
+			busyTime = std::chrono::steady_clock::duration(0);
+			emulatedFrames = 0;
+			sampledFrames = 0;
+		}
+
+		// Frames are paced against the Game Boy's refresh rate, if we fall behind by more than a frame we don't try to catch up
+		nextFrame += FRAME_PERIOD;
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now > nextFrame + FRAME_PERIOD)
+		{
+			nextFrame = now;
+		}
+
+		std::this_thread::sleep_until(nextFrame);
+	}
+}
+
+void EmulationThread::QueueAudio()
+{
+	// Measured before this frame's samples go in, the lowest the queue gets between the player's reads
+	const size_t queued = m_audioQueue.GetSize() / 2;
+	const double error = (double(AUDIO_TARGET_SAMPLES) - double(queued)) / AUDIO_TARGET_SAMPLES;
+	const double ratio = 1.0 + MAX_RATE_ADJUSTMENT * std::clamp(error, -1.0, 1.0);
+	m_sm83.SetAudioRateAdjustment(ratio);
+	m_audioRateAdjustment.store(ratio, std::memory_order_relaxed);
+
+	// The samples are always read, or the APU would keep them and drop them itself a moment later
+	const int count = m_sm83.ReadAudioSamples(m_audioSamples.data(), static_cast<int>(m_audioSamples.size() / 2));
+	if (queued <= AUDIO_MAX_SAMPLES)
+	{
+		m_audioQueue.Push(m_audioSamples.data(), count * 2);
+	}
+}
@@ -0,0 +1,433 @@
+#include "stdafx.h"
+
+#include <cstring>
+#include <utility>
+
+#include "header/Hash.h"
+
+// The carry-less multiplication and SHA paths are built on any x86 target and only taken if CPUID reports the
+// instructions, so a build for a baseline CPU still gets them. GCC and Clang compile each one for its instructions
+// through a target attribute, MSVC compiles intrinsics for any instruction set without being asked.
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define HASH_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#define HASH_TARGET(features) __attribute__((target(features)))
+#else
+#define HASH_TARGET(features)
+#endif
+
+struct HashFeatures
+{
+	bool carrylessMultiply;
+	bool sha;
+};
+
+static void ReadCPUID(uint32_t leaf, uint32_t subleaf, uint32_t registers[4])
+{
+#if defined(_MSC_VER)
+	int values[4];
+	__cpuidex(values, static_cast<int>(leaf), static_cast<int>(subleaf));
+	for (int i = 0; i < 4; ++i)
+	{
+		registers[i] = static_cast<uint32_t>(values[i]);
+	}
+#else
+	__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+static const HashFeatures& GetHashFeatures()
+{
+	static const HashFeatures features = []()
+	{
+		// EAX, EBX, ECX, EDX
+		uint32_t highestLeaf[4];
+		uint32_t leaf1[4];
+		uint32_t leaf7[4] = {};
+		ReadCPUID(0, 0, highestLeaf);
+		ReadCPUID(1, 0, leaf1);
+		if (highestLeaf[0] >= 7)
+		{
+			ReadCPUID(7, 0, leaf7);
+		}
+
+		const bool ssse3 = leaf1[2] & (1u << 9);
+		const bool sse41 = leaf1[2] & (1u << 19);
+		HashFeatures result;
+		result.carrylessMultiply = sse41 && (leaf1[2] & (1u << 1));
+		result.sha = ssse3 && sse41 && (leaf7[1] & (1u << 29));
+		return result;
+	}();
+	return features;
+}
+
+// Folds whole 16 byte blocks with carry-less multiplication, size must be at least 64
+HASH_TARGET("pclmul,sse4.1") static uint32_t CRC32Fold(const BYTE* data, size_t size, uint32_t crc)
+{
+	// Folding constants for the reflected polynomial, from Intel's "Fast CRC Computation Using PCLMULQDQ"
+	const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+	const __m128i k5 = _mm_set_epi64x(0, 0x0163CD6124);
+	const __m128i polynomial = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+	const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	// Four lanes are folded 64 bytes at a time, then into one
+	__m128i x1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), _mm_cvtsi32_si128(static_cast<int>(crc)));
+	__m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+	__m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32));
+	__m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48));
+	data += 64;
+	size -= 64;
+
+	for (; size >= 64; data += 64, size -= 64)
+	{
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x00), _mm_clmulepi64_si128(x1, k1k2, 0x11)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+		x2 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x00), _mm_clmulepi64_si128(x2, k1k2, 0x11)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)));
+		x3 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x00), _mm_clmulepi64_si128(x3, k1k2, 0x11)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)));
+		x4 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x00), _mm_clmulepi64_si128(x4, k1k2, 0x11)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48)));
+	}
+
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x2);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x3);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x4);
+
+	for (; size >= 16; data += 16, size -= 16)
+	{
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+	}
+
+	// 128 bits down to 64, then a Barrett reduction to 32
+	__m128i x2r = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2r);
+	x2r = _mm_srli_si128(x1, 4);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00), x2r);
+
+	x2r = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), polynomial, 0x10);
+	x2r = _mm_clmulepi64_si128(_mm_and_si128(x2r, low32), polynomial, 0x00);
+	x1 = _mm_xor_si128(x1, x2r);
+
+	return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+// Four of the 80 rounds. Each group finishes the schedule for the next group and starts it for later ones, the
+// registers take turns holding the message words as the Intel SHA extensions guide lays out.
+template <int GROUP>
+HASH_TARGET("sha,ssse3,sse4.1") static inline void SHA1RoundGroup(__m128i& abcd, __m128i (&e)[2], __m128i (&message)[4])
+{
+	__m128i& current = e[GROUP & 1];
+	const __m128i words = message[GROUP & 3];
+
+	current = GROUP == 0 ? _mm_add_epi32(current, words) : _mm_sha1nexte_epu32(current, words);
+	e[(GROUP + 1) & 1] = abcd;
+	if (GROUP >= 3 && GROUP <= 18)
+	{
+		message[(GROUP + 1) & 3] = _mm_sha1msg2_epu32(message[(GROUP + 1) & 3], words);
+	}
+	abcd = _mm_sha1rnds4_epu32(abcd, current, GROUP / 5);
+	if (GROUP >= 1 && GROUP <= 16)
+	{
+		message[(GROUP + 3) & 3] = _mm_sha1msg1_epu32(message[(GROUP + 3) & 3], words);
+	}
+	if (GROUP >= 2 && GROUP <= 17)
+	{
+		message[(GROUP + 2) & 3] = _mm_xor_si128(message[(GROUP + 2) & 3], words);
+	}
+}
+
+template <int... GROUPS>
+HASH_TARGET("sha,ssse3,sse4.1") static inline void SHA1Rounds(std::integer_sequence<int, GROUPS...>, __m128i& abcd, __m128i (&e)[2], __m128i (&message)[4])
+{
+	(SHA1RoundGroup<GROUPS>(abcd, e, message), ...);
+}
+
+HASH_TARGET("sha,ssse3,sse4.1") static void SHA1BlocksSHA(uint32_t state[5], const BYTE* data, size_t blockCount)
+{
+	// The words are big endian and the instructions want them in the opposite order in the register
+	const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090A0B0C0D0E0FULL);
+
+	__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1B);
+	__m128i e[2] = { _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0), _mm_setzero_si128() };
+
+	for (; blockCount > 0; --blockCount, data += 64)
+	{
+		const __m128i abcdSaved = abcd;
+		const __m128i eSaved = e[0];
+
+		__m128i message[4];
+		for (int i = 0; i < 4; ++i)
+		{
+			message[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 16)), byteSwap);
+		}
+
+		SHA1Rounds(std::make_integer_sequence<int, 20>(), abcd, e, message);
+
+		e[0] = _mm_sha1nexte_epu32(e[0], eSaved);
+		abcd = _mm_add_epi32(abcd, abcdSaved);
+	}
+
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = static_cast<uint32_t>(_mm_extract_epi32(e[0], 3));
+}
+#endif
+
+uint32_t Hash::CRC32(const BYTE* data, size_t size)
+{
+	// Reflected CRC-32 as used by zip and png. Without carry-less multiplication, 8 bytes are done per step using one
+	// table for each byte's position.
+	static const CRC32Tables tables = BuildCRC32Tables();
+
+	uint32_t crc = 0xFFFFFFFF;
+
+#if defined(HASH_X86)
+	if (size >= 64 && GetHashFeatures().carrylessMultiply)
+	{
+		size_t folded = size & ~size_t(15);
+		crc = CRC32Fold(data, folded, crc);
+		data += folded;
+		size -= folded;
+	}
+#endif
+
+	for (; size >= 8; data += 8, size -= 8)
+	{
+		uint32_t low = ReadUInt32(data) ^ crc;
+		uint32_t high = ReadUInt32(data + 4);
+		crc = tables[7][low & 0xFF] ^ tables[6][(low >> 8) & 0xFF] ^ tables[5][(low >> 16) & 0xFF] ^ tables[4][low >> 24]
+			^ tables[3][high & 0xFF] ^ tables[2][(high >> 8) & 0xFF] ^ tables[1][(high >> 16) & 0xFF] ^ tables[0][high >> 24];
+	}
+
+	for (; size > 0; ++data, --size)
+	{
+		crc = tables[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+	}
+
+	return crc ^ 0xFFFFFFFF;
+}
+
+Hash::CRC32Tables Hash::BuildCRC32Tables()
+{
+	CRC32Tables tables;
+	for (uint32_t i = 0; i < 256; ++i)
+	{
+		uint32_t value = i;
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			value = (value & 1) ? (value >> 1) ^ 0xEDB88320 : value >> 1;
+		}
+		tables[0][i] = value;
+	}
+
+	// Each further table is the CRC of its byte followed by another zero byte
+	for (int table = 1; table < 8; ++table)
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t previous = tables[table - 1][i];
+			tables[table][i] = tables[0][previous & 0xFF] ^ (previous >> 8);
+		}
+	}
+
+	return tables;
+}
+
+Hash::SHA1Digest Hash::SHA1(const BYTE* data, size_t size)
+{
+	uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+	size_t blockCount = size / 64;
+	SHA1Blocks(state, data, blockCount);
+
+	// The rest of the data, a 1 bit, zeros and the length in bits fill one or two last blocks
+	BYTE last[128] = {};
+	size_t remaining = size - blockCount * 64;
+	memcpy(last, data + blockCount * 64, remaining);
+	last[remaining] = 0x80;
+	size_t lastSize = remaining < 56 ? 64 : 128;
+	uint64_t bitCount = static_cast<uint64_t>(size) * 8;
+	for (int i = 0; i < 8; ++i)
+	{
+		last[lastSize - 1 - i] = static_cast<BYTE>(bitCount >> (8 * i));
+	}
+	SHA1Blocks(state, last, lastSize / 64);
+
+	SHA1Digest digest;
+	for (int i = 0; i < 5; ++i)
+	{
+		digest[i * 4 + 0] = static_cast<BYTE>(state[i] >> 24);
+		digest[i * 4 + 1] = static_cast<BYTE>(state[i] >> 16);
+		digest[i * 4 + 2] = static_cast<BYTE>(state[i] >> 8);
+		digest[i * 4 + 3] = static_cast<BYTE>(state[i]);
+	}
+	return digest;
+}
+
+void Hash::SHA1Blocks(uint32_t state[5], const BYTE* data, size_t blockCount)
+{
+#if defined(HASH_X86)
+	if (GetHashFeatures().sha)
+	{
+		SHA1BlocksSHA(state, data, blockCount);
+		return;
+	}
+#endif
+
+	for (; blockCount > 0; --blockCount, data += 64)
+	{
+		// The message schedule is kept as a rolling window of 16 words
+		uint32_t w[16];
+		for (int i = 0; i < 16; ++i)
+		{
+			w[i] = ReadUInt32BigEndian(data + i * 4);
+		}
+
+		uint32_t a = state[0];
+		uint32_t b = state[1];
+		uint32_t c = state[2];
+		uint32_t d = state[3];
+		uint32_t e = state[4];
+
+		for (int round = 0; round < 80; ++round)
+		{
+			if (round >= 16)
+			{
+				w[round & 15] = RotateLeft32(w[(round + 13) & 15] ^ w[(round + 8) & 15] ^ w[(round + 2) & 15] ^ w[round & 15], 1);
+			}
+
+			uint32_t f;
+			uint32_t k;
+			if (round < 20)
+			{
+				f = (b & c) | (~b & d);
+				k = 0x5A827999;
+			}
+			else if (round < 40)
+			{
+				f = b ^ c ^ d;
+				k = 0x6ED9EBA1;
+			}
+			else if (round < 60)
+			{
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8F1BBCDC;
+			}
+			else
+			{
+				f = b ^ c ^ d;
+				k = 0xCA62C1D6;
+			}
+
+			uint32_t temp = RotateLeft32(a, 5) + f + e + k + w[round & 15];
+			e = d;
+			d = c;
+			c = RotateLeft32(b, 30);
+			b = a;
+			a = temp;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+	}
+}
+
+uint64_t Hash::XXHash64(const BYTE* data, size_t size, uint64_t seed)
+{
+	const BYTE* end = data + size;
+	uint64_t hash;
+
+	// Four lanes are mixed 32 bytes at a time, then merged
+	if (size >= 32)
+	{
+		uint64_t lane1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+		uint64_t lane2 = seed + XXH_PRIME64_2;
+		uint64_t lane3 = seed;
+		uint64_t lane4 = seed - XXH_PRIME64_1;
+
+		const BYTE* limit = end - 32;
+		do
+		{
+			lane1 = XXHashRound(lane1, ReadUInt64(data));
+			lane2 = XXHashRound(lane2, ReadUInt64(data + 8));
+			lane3 = XXHashRound(lane3, ReadUInt64(data + 16));
+			lane4 = XXHashRound(lane4, ReadUInt64(data + 24));
+			data += 32;
+		} while (data <= limit);
+
+		hash = RotateLeft(lane1, 1) + RotateLeft(lane2, 7) + RotateLeft(lane3, 12) + RotateLeft(lane4, 18);
+		hash = XXHashMergeRound(hash, lane1);
+		hash = XXHashMergeRound(hash, lane2);
+		hash = XXHashMergeRound(hash, lane3);
+		hash = XXHashMergeRound(hash, lane4);
+	}
+	else
+	{
+		hash = seed + XXH_PRIME64_5;
+	}
+
+	hash += size;
+
+	for (; data + 8 <= end; data += 8)
+	{
+		hash ^= XXHashRound(0, ReadUInt64(data));
+		hash = RotateLeft(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+
+	if (data + 4 <= end)
+	{
+		hash ^= ReadUInt32(data) * XXH_PRIME64_1;
+		hash = RotateLeft(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		data += 4;
+	}
+
+	for (; data < end; ++data)
+	{
+		hash ^= *data * XXH_PRIME64_5;
+		hash = RotateLeft(hash, 11) * XXH_PRIME64_1;
+	}
+
+	// Final avalanche
+	hash ^= hash >> 33;
+	hash *= XXH_PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= XXH_PRIME64_3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+uint64_t Hash::XXHashRound(uint64_t accumulator, uint64_t input)
+{
+	accumulator += input * XXH_PRIME64_2;
+	accumulator = RotateLeft(accumulator, 31);
+	return accumulator * XXH_PRIME64_1;
+}
+
+uint64_t Hash::XXHashMergeRound(uint64_t accumulator, uint64_t value)
+{
+	accumulator ^= XXHashRound(0, value);
+	return accumulator * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t Hash::ReadUInt64(const BYTE* data)
+{
+	// Assembled byte by byte so the hash is the same on any host, compilers turn this into a single load
+	return uint64_t(ReadUInt32(data)) | (uint64_t(ReadUInt32(data + 4)) << 32);
+}
+
+uint32_t Hash::ReadUInt32(const BYTE* data)
+{
+	return uint32_t(data[0]) | (uint32_t(data[1]) << 8) | (uint32_t(data[2]) << 16) | (uint32_t(data[3]) << 24);
+}
+
+uint32_t Hash::ReadUInt32BigEndian(const BYTE* data)
+{
+	return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | uint32_t(data[3]);
+}
@@ -0,0 +1,782 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <thread>
+#include <vector>
+
+#include "header/Headless.h"
+#include "header/Cartridge.h"
+#include "header/CPU.h"
+#include "header/Hash.h"
+#include "header/InstructionTrace.h"
+#include "header/LinkCable.h"
+#include "header/MemoryBankControllers.h"
+#include "header/Movie.h"
+#include "header/Netplay.h"
+#include "header/RegressionRunner.h"
+#include "header/RomLibrary.h"
+#include "header/StateBuffer.h"
+#include "header/TestRomRunner.h"
+
+bool Headless::RunCommandLine(int argc, char* argv[], int& exitCode)
+{
+	if (argc < 2)
+	{
+		return false;
+	}
+
+	std::string mode = argv[1];
+	if (mode == "--benchmark")
+	{
+		if (argc < 3)
+		{
+			PrintUsage();
+			exitCode = 1;
+			return true;
+		}
+
+		int frames = argc > 3 ? std::atoi(argv[3]) : 3600;
+		exitCode = RunBenchmark(argv[2], frames);
+		return true;
+	}
+
+	if (mode == "--benchmark-apu")
+	{
+		int seconds = argc > 2 ? std::atoi(argv[2]) : 60;
+		exitCode = RunAPUBenchmark(seconds, argc > 3 ? argv[3] : "");
+		return true;
+	}
+
+	if (mode == "--play-movie")
+	{
+		if (argc < 4)
+		{
+			PrintUsage();
+			exitCode = 1;
+			return true;
+		}
+
+		exitCode = RunMovie(argv[2], argv[3]);
+		return true;
+	}
+
+	if (mode == "--link")
+	{
+		if (argc < 4)
+		{
+			PrintUsage();
+			exitCode = 1;
+			return true;
+		}
+
+		int frames = argc > 4 ? std::atoi(argv[4]) : 3600;
+		exitCode = RunLinked(argv[2], argv[3], frames);
+		return true;
+	}
+
+	if (mode == "--netplay")
+	{
+		if (argc < 5)
+		{
+			PrintUsage();
+			exitCode = 1;
+			return true;
+		}
+
+		int frames = argc > 5 ? std::atoi(argv[5]) : 3600;
+		std::string remote = argv[4];
+		size_t colon = remote.rfind(':');
+		if (colon == std::string::npos)
+		{
+			PrintUsage();
+			exitCode = 1;
+			return true;
+		}
+
+		exitCode = Netplay::RunSession(argv[2], static_cast<uint16_t>(std::atoi(argv[3])), remote.substr(0, colon),
+			static_cast<uint16_t>(std::atoi(remote.c_str() + colon + 1)), frames);
+		return true;
+	}
+
+	if (mode == "--netplay-stress")
+	{
+		if (argc < 3)
+		{
+			PrintUsage();
+			exitCode = 1;
+			return true;
+		}
+
+		int rollbackFrames = argc > 3 ? std::atoi(argv[3]) : Netplay::MAX_ROLLBACK_FRAMES;
+		int frames = argc > 4 ? std::atoi(argv[4]) : 3600;
+		exitCode = Netplay::RunStress(argv[2], rollbackFrames, frames);
+		return true;
+	}
+
+	if (mode == "--regress")
+	{
+		if (argc < 3)
+		{
+			PrintUsage();
+			exitCode = 1;
+			return true;
+		}
+
+		int interval = 60;
+		bool update = false;
+		for (int i = 3; i < argc; ++i)
+		{
+			std::string argument = argv[i];
+			if (argument == "--update")
+			{
+				update = true;
+			}
+			else
+			{
+				interval = std::atoi(argv[i]);
+			}
+		}
+
+		exitCode = RegressionRunner::Run(argv[2], interval, update);
+		return true;
+	}
+
+	if (mode == "--test-rom" || mode == "--test-roms")
+	{
+		if (argc < 3)
+		{
+			PrintUsage();
+			exitCode = 1;
+			return true;
+		}
+
+		if (mode == "--test-rom")
+		{
+			int timeoutSeconds = argc > 3 ? std::atoi(argv[3]) : TestRomRunner::DEFAULT_TIMEOUT_SECONDS;
+			exitCode = TestRomRunner::RunRom(argv[2], timeoutSeconds);
+		}
+		else
+		{
+			int jobs = argc > 3 ? std::atoi(argv[3]) : 0;
+			int timeoutSeconds = argc > 4 ? std::atoi(argv[4]) : TestRomRunner::DEFAULT_TIMEOUT_SECONDS;
+			exitCode = TestRomRunner::RunDirectory(argv[0], argv[2], jobs, timeoutSeconds);
+		}
+		return true;
+	}
+
+	if (mode == "--library")
+	{
+		if (argc < 3)
+		{
+			PrintUsage();
+			exitCode = 1;
+			return true;
+		}
+
+		exitCode = RunLibrary(argv[2]);
+		return true;
+	}
+
+	if (mode == "--trace")
+	{
+		if (argc < 5)
+		{
+			PrintUsage();
+			exitCode = 1;
+			return true;
+		}
+
+		exitCode = RunTrace(argv[2], std::atoi(argv[3]), argv[4]);
+		return true;
+	}
+
+	if (mode == "--decode-trace")
+	{
+		if (argc < 3)
+		{
+			PrintUsage();
+			exitCode = 1;
+			return true;
+		}
+
+		InstructionTrace trace;
+		if (!trace.Load(argv[2]))
+		{
+			std::cerr << "Not an instruction trace: " << argv[2] << std::endl;
+			exitCode = 1;
+			return true;
+		}
+
+		trace.Decode(std::cout);
+		exitCode = 0;
+		return true;
+	}
+
+	if (mode == "--debug")
+	{
+		if (argc < 5)
+		{
+			PrintUsage();
+			exitCode = 1;
+			return true;
+		}
+
+		Breakpoints breakpoints;
+		for (int i = 4; i < argc; ++i)
+		{
+			if (!ParseBreakpoint(argv[i], breakpoints))
+			{
+				std::cerr << "Not a breakpoint or watchpoint: " << argv[i] << std::endl;
+				PrintUsage();
+				exitCode = 1;
+				return true;
+			}
+		}
+
+		exitCode = RunDebug(argv[2], std::atoi(argv[3]), breakpoints);
+		return true;
+	}
+
+	if (mode == "--help")
+	{
+		PrintUsage();
+		exitCode = 0;
+		return true;
+	}
+
+	return false;
+}
+
+int Headless::RunBenchmark(const std::string& romPath, int frames)
+{
+	if (frames <= 0)
+	{
+		std::cerr << "Frame count must be positive" << std::endl;
+		return 1;
+	}
+
+	struct RendererBenchmark
+	{
+		const char* name;
+		PPU::Renderer renderer;
+		bool outputEnabled;
+	};
+
+	// Without video and audio is how an instance nobody watches runs, such as one driven by a training script
+	const RendererBenchmark renderers[] =
+	{
+		{ "scanline",				PPU::Renderer::SCANLINE,	true },
+		{ "pixel fifo",				PPU::Renderer::PIXEL_FIFO,	true },
+		{ "scanline, no a/v",		PPU::Renderer::SCANLINE,	false },
+		{ "pixel fifo, no a/v",		PPU::Renderer::PIXEL_FIFO,	false },
+	};
+
+	std::cout << "Running " << frames << " frames of " << romPath << std::endl;
+	for (const RendererBenchmark& benchmark : renderers)
+	{
+		double stateSeconds = 0.0;
+		double framesPerSecond = BenchmarkRenderer(romPath, frames, benchmark.renderer, benchmark.outputEnabled, stateSeconds);
+		if (framesPerSecond < 0)
+		{
+			std::cerr << "Unable to load " << romPath << std::endl;
+			return 1;
+		}
+
+		// Run-ahead of N frames keeps up while N + 1 frames and one state save and load fit in a frame
+		double frameSeconds = 1.0 / framesPerSecond;
+		int maxRunAheadFrames = std::max(0, static_cast<int>((1.0 / FRAMES_PER_SECOND - stateSeconds) / frameSeconds) - 1);
+
+		std::cout << std::left << std::setw(20) << benchmark.name
+			<< std::fixed << std::setprecision(1) << framesPerSecond << " frames/s, "
+			<< std::setprecision(2) << framesPerSecond / FRAMES_PER_SECOND << "x real time, "
+			<< "state save and load " << std::setprecision(1) << stateSeconds * 1000000.0 << " us, "
+			<< "run-ahead headroom " << maxRunAheadFrames << " frames" << std::endl;
+	}
+
+	return 0;
+}
+
+int Headless::RunMovie(const std::string& romPath, const std::string& moviePath)
+{
+	Cartridge cart;
+	cart.OpenFile(romPath);
+	if (!cart.IsValid())
+	{
+		std::cerr << "Unable to load " << romPath << std::endl;
+		return 1;
+	}
+
+	Movie movie;
+	if (!movie.Load(moviePath))
+	{
+		std::cerr << "Unable to load " << moviePath << std::endl;
+		return 1;
+	}
+
+	CPU sm83(nullptr);
+	sm83.AddCartridge(&cart);
+	sm83.PowerOn();
+	sm83.SetAudioEnabled(false);
+	if (!movie.BeginPlayback(sm83, cart))
+	{
+		std::cerr << moviePath << " was recorded with a different ROM or is corrupt" << std::endl;
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	while (movie.PlayFrame(sm83))
+	{
+		sm83.RunFrame();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	// The CRC of the last frame lets runs of the same movie be compared between builds
+	std::cout << movie.GetFrameCount() << " frames in " << std::fixed << std::setprecision(3) << elapsed.count() << " s, "
+		<< std::setprecision(1) << movie.GetFrameCount() / elapsed.count() << " frames/s, last frame CRC32 "
+		<< std::hex << std::setw(8) << std::setfill('0') << Hash::CRC32(sm83.GetFrameBuffer(), SCREEN_WIDTH * SCREEN_HEIGHT) << std::dec << std::endl;
+
+	return 0;
+}
+
+int Headless::RunLinked(const std::string& firstRomPath, const std::string& secondRomPath, int frames)
+{
+	if (frames <= 0)
+	{
+		std::cerr << "Frame count must be positive" << std::endl;
+		return 1;
+	}
+
+	Cartridge carts[2];
+	carts[0].OpenFile(firstRomPath);
+	carts[1].OpenFile(secondRomPath);
+	for (int i = 0; i < 2; ++i)
+	{
+		if (!carts[i].IsValid())
+		{
+			std::cerr << "Unable to load " << (i == 0 ? firstRomPath : secondRomPath) << std::endl;
+			return 1;
+		}
+	}
+
+	CPU linked[2] = { CPU(nullptr), CPU(nullptr) };
+	CPU independent[2] = { CPU(nullptr), CPU(nullptr) };
+	for (int i = 0; i < 2; ++i)
+	{
+		linked[i].AddCartridge(&carts[i]);
+		linked[i].PowerOn();
+		linked[i].SetAudioEnabled(false);
+		independent[i].AddCartridge(&carts[i]);
+		independent[i].PowerOn();
+		independent[i].SetAudioEnabled(false);
+	}
+
+	LinkCable cable;
+	auto linkedStart = std::chrono::steady_clock::now();
+	cable.RunFrames(linked[0], linked[1], frames);
+	std::chrono::duration<double> linkedElapsed = std::chrono::steady_clock::now() - linkedStart;
+
+	// The same pair without the cable shows what the synchronization costs
+	auto run = [frames](CPU& sm83)
+	{
+		for (int i = 0; i < frames; ++i)
+		{
+			sm83.RunFrame();
+		}
+	};
+	auto independentStart = std::chrono::steady_clock::now();
+	std::thread secondThread(run, std::ref(independent[1]));
+	run(independent[0]);
+	secondThread.join();
+	std::chrono::duration<double> independentElapsed = std::chrono::steady_clock::now() - independentStart;
+
+	std::cout << std::fixed << std::setprecision(1)
+		<< "linked       " << frames / linkedElapsed.count() << " frames/s per instance" << std::endl
+		<< "independent  " << frames / independentElapsed.count() << " frames/s per instance" << std::endl;
+
+	for (int i = 0; i < 2; ++i)
+	{
+		std::cout << "instance " << i + 1 << " last frame CRC32 " << std::hex << std::setw(8) << std::setfill('0')
+			<< Hash::CRC32(linked[i].GetFrameBuffer(), SCREEN_WIDTH * SCREEN_HEIGHT) << std::dec << std::setfill(' ') << std::endl;
+	}
+
+	return 0;
+}
+
+int Headless::RunAPUBenchmark(int seconds, const std::string& romPath)
+{
+	if (seconds <= 0)
+	{
+		std::cerr << "Seconds must be positive" << std::endl;
+		return 1;
+	}
+
+	struct QualityBenchmark
+	{
+		const char* name;
+		BlipBuffer::Quality quality;
+	};
+
+	const QualityBenchmark qualities[] =
+	{
+		{ "apu fast",	BlipBuffer::Quality::FAST },
+		{ "apu normal",	BlipBuffer::Quality::NORMAL },
+		{ "apu high",	BlipBuffer::Quality::HIGH },
+	};
+
+	const int frames = static_cast<int>(seconds * FRAMES_PER_SECOND);
+	std::cout << "Running the APU for " << seconds << " emulated seconds at " << APU::DEFAULT_SAMPLE_RATE << " Hz" << std::endl;
+	for (const QualityBenchmark& benchmark : qualities)
+	{
+		const double realTime = BenchmarkAPU(frames, benchmark.quality);
+		std::cout << std::left << std::setw(13) << benchmark.name
+			<< std::fixed << std::setprecision(1) << realTime << "x real time, "
+			<< std::setprecision(2) << 100.0 / realTime << "% of a frame" << std::endl;
+	}
+
+	if (romPath.empty())
+	{
+		return 0;
+	}
+
+	const int romFrames = std::min(frames, 3600);
+	double withOutput = BenchmarkAudioOutput(romPath, romFrames, true);
+	double withoutOutput = BenchmarkAudioOutput(romPath, romFrames, false);
+	if (withOutput < 0 || withoutOutput < 0)
+	{
+		std::cerr << "Unable to load " << romPath << std::endl;
+		return 1;
+	}
+
+	std::cout << std::setprecision(1)
+		<< "audio on     " << withOutput << " frames/s" << std::endl
+		<< "audio off    " << withoutOutput << " frames/s" << std::endl;
+	return 0;
+}
+
+double Headless::BenchmarkAPU(int frames, BlipBuffer::Quality quality)
+{
+	// The I/O registers from 0xFF00, only the audio ones are used
+	BYTE io[0x80] = {};
+	APU apu;
+	apu.Initialize(io);
+	apu.Reset();
+	apu.SetQuality(quality);
+
+	// Every channel playing at once with sweep and envelopes running, the most work the APU is ever given
+	static constexpr BYTE WAVE_PATTERN[] =
+	{
+		0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF, 0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10,
+	};
+	for (WORD i = 0; i < sizeof(WAVE_PATTERN); ++i)
+	{
+		apu.WriteRegister(0x30 + i, WAVE_PATTERN[i], 0);
+	}
+
+	static constexpr BYTE REGISTERS[][2] =
+	{
+		{ 0x24, 0x77 }, { 0x25, 0xFF },
+		{ 0x10, 0x79 }, { 0x11, 0x80 }, { 0x12, 0x0F }, { 0x13, 0x00 }, { 0x14, 0x87 },
+		{ 0x16, 0x40 }, { 0x17, 0xF1 }, { 0x18, 0x80 }, { 0x19, 0x86 },
+		{ 0x1A, 0x80 }, { 0x1C, 0x20 }, { 0x1D, 0x00 }, { 0x1E, 0x87 },
+		{ 0x21, 0xF2 }, { 0x22, 0x24 }, { 0x23, 0x80 },
+	};
+
+	std::vector<int16_t> samples(APU::DEFAULT_SAMPLE_RATE * 2);
+	uint64_t clockCycle = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; ++i)
+	{
+		// Triggered again every second so the sweep and envelopes never settle
+		if (i % 60 == 0)
+		{
+			for (const auto& reg : REGISTERS)
+			{
+				apu.WriteRegister(reg[0], reg[1], clockCycle);
+			}
+		}
+
+		// Samples are read a frame at a time, as the player does
+		clockCycle += CPU::CYCLES_PER_FRAME;
+		apu.EndFrame(clockCycle);
+		apu.ReadSamples(samples.data(), static_cast<int>(samples.size() / 2));
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	return frames / FRAMES_PER_SECOND / elapsed.count();
+}
+
+double Headless::BenchmarkAudioOutput(const std::string& romPath, int frames, bool outputEnabled)
+{
+	Cartridge cart;
+	cart.OpenFile(romPath);
+	if (!cart.IsValid())
+	{
+		return -1.0;
+	}
+
+	CPU sm83(nullptr);
+	sm83.AddCartridge(&cart);
+	sm83.PowerOn();
+	sm83.SetAudioOutputEnabled(outputEnabled);
+
+	std::vector<int16_t> samples(APU::DEFAULT_SAMPLE_RATE * 2);
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; ++i)
+	{
+		sm83.RunFrame();
+		sm83.ReadAudioSamples(samples.data(), static_cast<int>(samples.size() / 2));
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	return frames / elapsed.count();
+}
+
+double Headless::BenchmarkRenderer(const std::string& romPath, int frames, PPU::Renderer renderer, bool outputEnabled,
+	double& stateSeconds)
+{
+	Cartridge cart;
+	cart.OpenFile(romPath);
+	if (!cart.IsValid())
+	{
+		return -1.0;
+	}
+
+	CPU sm83(nullptr);
+	sm83.AddCartridge(&cart);
+	sm83.PowerOn();
+	sm83.SetRenderer(renderer);
+	sm83.SetVideoEnabled(outputEnabled);
+	sm83.SetAudioEnabled(outputEnabled);
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; ++i)
+	{
+		sm83.RunFrame();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	// Run-ahead saves and loads once per frame
+	StateBuffer state;
+	auto stateStart = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; ++i)
+	{
+		sm83.SaveState(state);
+		sm83.LoadState(state);
+	}
+	std::chrono::duration<double> stateElapsed = std::chrono::steady_clock::now() - stateStart;
+	stateSeconds = stateElapsed.count() / frames;
+
+	return frames / elapsed.count();
+}
+
+int Headless::RunLibrary(const std::string& directory)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	RomLibrary library(directory);
+	int read = library.Scan();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	// H, G and S mark a bad header checksum, global checksum and size, M a cartridge type there's no controller for
+	int supported = 0;
+	for (const RomLibrary::Entry& entry : library.GetEntries())
+	{
+		if (entry.romSize == 0)
+		{
+			std::cout << "Not a ROM: " << entry.path << std::endl;
+			continue;
+		}
+
+		bool isSupported = MemoryBankControllerFactory::IsSupported(entry.header.cartridgeType);
+		supported += isSupported;
+
+		std::cout << std::hex << std::setfill('0') << std::setw(8) << entry.crc32 << ' ';
+		for (BYTE byte : entry.sha1)
+		{
+			std::cout << std::setw(2) << static_cast<int>(byte);
+		}
+		std::cout << std::dec << std::setfill(' ') << ' '
+			<< (entry.header.headerChecksumValid ? ' ' : 'H')
+			<< (entry.header.globalChecksumValid ? ' ' : 'G')
+			<< (entry.header.sizeValid ? ' ' : 'S')
+			<< (isSupported ? ' ' : 'M')
+			<< ' ' << std::left << std::setw(16) << entry.header.title << std::right << ' ' << entry.path << std::endl;
+	}
+
+	std::cout << library.GetEntries().size() << " ROMs, " << read << " read in " << std::fixed << std::setprecision(3)
+		<< elapsed.count() << " s, " << supported << " with a supported cartridge type" << std::endl;
+	return 0;
+}
+
+int Headless::RunDebug(const std::string& romPath, int frames, const Breakpoints& breakpoints)
+{
+	Cartridge cart;
+	cart.OpenFile(romPath);
+	if (!cart.IsValid())
+	{
+		return 1;
+	}
+
+	CPU sm83(nullptr);
+	sm83.AddCartridge(&cart);
+	sm83.PowerOn();
+	sm83.SetBreakpoints(breakpoints);
+
+	// A run that stops partway through a frame carries on with the rest of it
+	int stops = 0;
+	int frame = 0;
+	while (frame < frames && stops < MAX_DEBUG_STOPS)
+	{
+		sm83.RunFrame();
+
+		CPU::DebugStop stop;
+		if (!sm83.ConsumeDebugStop(stop))
+		{
+			++frame;
+			continue;
+		}
+
+		++stops;
+		CPU::RegisterSnapshot registers = sm83.GetRegisters();
+		std::cout << std::hex << std::uppercase << std::setfill('0');
+		switch (stop.reason)
+		{
+		case CPU::DebugStop::BREAKPOINT:
+			std::cout << "break ";
+			if (stop.bank == Breakpoints::ANY_BANK)
+			{
+				std::cout << "   ";
+			}
+			else
+			{
+				std::cout << std::setw(2) << stop.bank << ':';
+			}
+			std::cout << std::setw(4) << stop.address << "    ";
+			break;
+		case CPU::DebugStop::READ_WATCHPOINT:
+			std::cout << "read  " << std::setw(4) << stop.address << '=' << std::setw(2) << static_cast<int>(stop.value) << ' ';
+			break;
+		default:
+			std::cout << "write " << std::setw(4) << stop.address << '=' << std::setw(2) << static_cast<int>(stop.value) << ' ';
+			break;
+		}
+
+		std::cout << " AF=" << std::setw(4) << registers.AF << " BC=" << std::setw(4) << registers.BC << " DE=" << std::setw(4) << registers.DE
+			<< " HL=" << std::setw(4) << registers.HL << " SP=" << std::setw(4) << registers.SP << " PC=" << std::setw(4) << registers.PC
+			<< std::dec << std::nouppercase << std::setfill(' ') << " frame " << frame << " cycle " << sm83.GetTotalClockCycles() << std::endl;
+	}
+
+	if (stops == MAX_DEBUG_STOPS)
+	{
+		std::cout << "Stopped after " << MAX_DEBUG_STOPS << " hits" << std::endl;
+	}
+	return 0;
+}
+
+int Headless::RunTrace(const std::string& romPath, int frames, const std::string& tracePath)
+{
+	Cartridge cart;
+	cart.OpenFile(romPath);
+	if (!cart.IsValid())
+	{
+		return 1;
+	}
+
+	CPU sm83(nullptr);
+	sm83.AddCartridge(&cart);
+	sm83.PowerOn();
+
+	// The same frames are timed without the trace first, so the cost of tracing can be seen
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; ++i)
+	{
+		sm83.RunFrame();
+	}
+	std::chrono::duration<double> untraced = std::chrono::steady_clock::now() - start;
+
+	sm83.PowerOn();
+	sm83.SetTracing(true);
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; ++i)
+	{
+		sm83.RunFrame();
+	}
+	std::chrono::duration<double> traced = std::chrono::steady_clock::now() - start;
+
+	const InstructionTrace& trace = sm83.GetTrace();
+	std::cout << std::fixed << std::setprecision(1) << frames / untraced.count() << " frames/s untraced, "
+		<< frames / traced.count() << " frames/s traced, last " << trace.GetCount() << " instructions kept" << std::endl;
+	return trace.Save(tracePath) ? 0 : 1;
+}
+
+bool Headless::ParseBreakpoint(const std::string& text, Breakpoints& breakpoints)
+{
+	auto parseHex = [](const std::string& digits, int& value)
+	{
+		if (digits.empty() || digits.size() > 4 || digits.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+		{
+			return false;
+		}
+		value = std::stoi(digits, nullptr, 16);
+		return true;
+	};
+
+	// Watchpoints are r:, w: or rw: followed by an address or a range of them
+	size_t colon = text.find(':');
+	std::string prefix = colon == std::string::npos ? "" : text.substr(0, colon);
+	if (prefix == "r" || prefix == "w" || prefix == "rw")
+	{
+		std::string range = text.substr(colon + 1);
+		size_t dash = range.find('-');
+		int first;
+		int last;
+		if (!parseHex(range.substr(0, dash), first) || !parseHex(dash == std::string::npos ? range : range.substr(dash + 1), last))
+		{
+			return false;
+		}
+
+		BYTE access = (prefix != "w" ? Breakpoints::WATCH_READ : 0) | (prefix != "r" ? Breakpoints::WATCH_WRITE : 0);
+		breakpoints.AddWatchpoint(static_cast<WORD>(first), static_cast<WORD>(last), access);
+		return true;
+	}
+
+	// Breakpoints are an address, with the ROM bank in front of it if it should only stop in that one
+	int bank = Breakpoints::ANY_BANK;
+	int address;
+	if ((colon != std::string::npos && !parseHex(prefix, bank)) || !parseHex(colon == std::string::npos ? text : text.substr(colon + 1), address))
+	{
+		return false;
+	}
+
+	breakpoints.AddBreakpoint(static_cast<WORD>(address), bank);
+	return true;
+}
+
+void Headless::PrintUsage()
+{
+	std::cout << "Usage:" << std::endl
+		<< "  Gameboy                             Open the emulator window" << std::endl
+		<< "  Gameboy --benchmark <rom> [frames]  Time the ROM headless with each renderer, with and without video and audio" << std::endl
+		<< "  Gameboy --benchmark-apu [seconds] [rom]" << std::endl
+		<< "                                      Time the APU alone at each quality, then the ROM with audio on and off" << std::endl
+		<< "  Gameboy --play-movie <rom> <movie>  Play a recorded movie headless as fast as possible" << std::endl
+		<< "  Gameboy --link <rom> <rom> [frames] Run two instances connected by a link cable, each on its own thread" << std::endl
+		<< "  Gameboy --netplay <rom> <port> <address>:<port> [frames]" << std::endl
+		<< "                                      Play a netplay session against another process with scripted input" << std::endl
+		<< "  Gameboy --netplay-stress <rom> [rollback frames] [frames]" << std::endl
+		<< "                                      Roll back every frame and report how many frames per second the core sustains" << std::endl
+		<< "  Gameboy --regress <directory> [interval] [--update]" << std::endl
+		<< "                                      Check the frames of every movie in the directory against its golden files" << std::endl
+		<< "  Gameboy --test-rom <rom> [seconds]  Run a Blargg or Mooneye test ROM and report whether it passed" << std::endl
+		<< "  Gameboy --test-roms <directory> [jobs] [seconds]" << std::endl
+		<< "                                      Run every test ROM in the directory, each in its own process" << std::endl
+		<< "  Gameboy --library <directory>       Index every ROM in the directory, only reading files changed since last time" << std::endl
+		<< "  Gameboy --trace <rom> <frames> <trace>" << std::endl
+		<< "                                      Run the ROM with every instruction traced and write out the last ones" << std::endl
+		<< "  Gameboy --decode-trace <trace>      Print a trace as text with each instruction disassembled" << std::endl
+		<< "  Gameboy --debug <rom> <frames> <point>..." << std::endl
+		<< "                                      Print the registers at every breakpoint and watchpoint hit, points are" << std::endl
+		<< "                                      [bank:]address breakpoints or r:, w: or rw: then first[-last] watchpoints, in hex" << std::endl;
+}
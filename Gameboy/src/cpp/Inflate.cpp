@@ -0,0 +1,417 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "header/Inflate.h"
+
+// Lengths and distances are a base plus some extra bits, indexed by the symbol after the literals
+static constexpr uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static constexpr BYTE LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static constexpr uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static constexpr BYTE DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// The order the lengths of the code length codes are stored in, rarely used ones last
+static constexpr BYTE CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+Inflate::Inflate(std::istream& in, uint64_t compressedSize) :
+	m_in(in),
+	m_remainingInput(compressedSize),
+	m_chunk(CHUNK_SIZE),
+	m_chunkPosition(0),
+	m_chunkEnd(0),
+	m_bits(0),
+	m_bitCount(0),
+	m_paddingBits(0),
+	m_error(false)
+{
+}
+
+bool Inflate::Decompress(BYTE* out, size_t outSize)
+{
+	HuffmanTable literals;
+	HuffmanTable distances;
+	size_t position = 0;
+
+	bool lastBlock = false;
+	while (!lastBlock && !m_error)
+	{
+		lastBlock = ReadBits(1);
+		bool decoded = false;
+		switch (ReadBits(2))
+		{
+		case 0:
+			decoded = InflateStored(out, outSize, position);
+			break;
+		case 1:
+		{
+			// The fixed tables never change, so they are only built once
+			static const FixedTables fixed = BuildFixedTables();
+			decoded = InflateCodes(fixed.literals, fixed.distances, out, outSize, position);
+			break;
+		}
+		case 2:
+			decoded = ReadDynamicTables(literals, distances) && InflateCodes(literals, distances, out, outSize, position);
+			break;
+		}
+
+		if (!decoded)
+		{
+			return false;
+		}
+	}
+
+	return !m_error && position == outSize;
+}
+
+bool Inflate::InflateStored(BYTE* out, size_t outSize, size_t& position)
+{
+	// Stored blocks start on a byte boundary
+	ConsumeBits(m_bitCount & 7);
+	uint32_t length = ReadBits(16);
+	uint32_t lengthComplement = ReadBits(16);
+	if (m_error || length != (~lengthComplement & 0xFFFF) || length > outSize - position)
+	{
+		return false;
+	}
+
+	// Whole bytes that were already shifted into the bit buffer come first, then the chunk, then the stream
+	while (length > 0 && m_bitCount - m_paddingBits >= 8)
+	{
+		out[position++] = static_cast<BYTE>(ReadBits(8));
+		--length;
+	}
+
+	size_t fromChunk = std::min<size_t>(length, m_chunkEnd - m_chunkPosition);
+	memcpy(out + position, m_chunk.data() + m_chunkPosition, fromChunk);
+	m_chunkPosition += fromChunk;
+	position += fromChunk;
+	length -= static_cast<uint32_t>(fromChunk);
+
+	if (length > m_remainingInput)
+	{
+		return false;
+	}
+
+	m_in.read(reinterpret_cast<char*>(out + position), length);
+	if (static_cast<uint32_t>(m_in.gcount()) != length)
+	{
+		return false;
+	}
+	m_remainingInput -= length;
+	position += length;
+
+	return true;
+}
+
+bool Inflate::InflateCodes(const HuffmanTable& literals, const HuffmanTable& distances, BYTE* out, size_t outSize, size_t& position)
+{
+	while (!m_error)
+	{
+		int symbol = Decode(literals);
+		if (symbol < 0)
+		{
+			return false;
+		}
+
+		if (symbol < 256)
+		{
+			if (position == outSize)
+			{
+				return false;
+			}
+			out[position++] = static_cast<BYTE>(symbol);
+			continue;
+		}
+
+		if (symbol == 256)
+		{
+			return true;
+		}
+
+		symbol -= 257;
+		if (symbol >= 29)
+		{
+			return false;
+		}
+		size_t length = LENGTH_BASE[symbol] + ReadBits(LENGTH_EXTRA[symbol]);
+
+		symbol = Decode(distances);
+		if (symbol < 0 || symbol >= MAX_DISTANCE_CODES)
+		{
+			return false;
+		}
+		size_t distance = DISTANCE_BASE[symbol] + ReadBits(DISTANCE_EXTRA[symbol]);
+
+		if (distance > position || length > outSize - position)
+		{
+			return false;
+		}
+
+		// A distance shorter than the length repeats the bytes just written, which has to go byte by byte
+		BYTE* destination = out + position;
+		const BYTE* source = destination - distance;
+		if (distance >= length)
+		{
+			memcpy(destination, source, length);
+		}
+		else
+		{
+			for (size_t i = 0; i < length; ++i)
+			{
+				destination[i] = source[i];
+			}
+		}
+		position += length;
+	}
+
+	return false;
+}
+
+bool Inflate::ReadDynamicTables(HuffmanTable& literals, HuffmanTable& distances)
+{
+	int literalCount = ReadBits(5) + 257;
+	int distanceCount = ReadBits(5) + 1;
+	int codeLengthCount = ReadBits(4) + 4;
+	if (literalCount > 286 || distanceCount > MAX_DISTANCE_CODES)
+	{
+		return false;
+	}
+
+	BYTE lengths[MAX_LITERAL_CODES + MAX_DISTANCE_CODES] = {};
+	for (int i = 0; i < codeLengthCount; ++i)
+	{
+		lengths[CODE_LENGTH_ORDER[i]] = static_cast<BYTE>(ReadBits(3));
+	}
+
+	HuffmanTable codeLengths;
+	if (!codeLengths.Build(lengths, 19))
+	{
+		return false;
+	}
+
+	// Both tables' lengths are stored as one run, repeats may cross from one into the other
+	int index = 0;
+	int total = literalCount + distanceCount;
+	while (index < total)
+	{
+		int symbol = Decode(codeLengths);
+		if (symbol < 0)
+		{
+			return false;
+		}
+
+		if (symbol < 16)
+		{
+			lengths[index++] = static_cast<BYTE>(symbol);
+			continue;
+		}
+
+		BYTE repeated = 0;
+		int repeat;
+		if (symbol == 16)
+		{
+			if (index == 0)
+			{
+				return false;
+			}
+			repeated = lengths[index - 1];
+			repeat = 3 + ReadBits(2);
+		}
+		else if (symbol == 17)
+		{
+			repeat = 3 + ReadBits(3);
+		}
+		else
+		{
+			repeat = 11 + ReadBits(7);
+		}
+
+		if (index + repeat > total)
+		{
+			return false;
+		}
+		memset(lengths + index, repeated, repeat);
+		index += repeat;
+	}
+
+	// Without an end of block code the block could never end
+	if (m_error || lengths[256] == 0)
+	{
+		return false;
+	}
+
+	return literals.Build(lengths, literalCount) && distances.Build(lengths + literalCount, distanceCount);
+}
+
+Inflate::FixedTables Inflate::BuildFixedTables()
+{
+	FixedTables fixed;
+	BYTE lengths[MAX_LITERAL_CODES];
+	memset(lengths, 8, 144);
+	memset(lengths + 144, 9, 112);
+	memset(lengths + 256, 7, 24);
+	memset(lengths + 280, 8, 8);
+	fixed.literals.Build(lengths, MAX_LITERAL_CODES);
+
+	memset(lengths, 5, MAX_DISTANCE_CODES);
+	fixed.distances.Build(lengths, MAX_DISTANCE_CODES);
+	return fixed;
+}
+
+bool Inflate::HuffmanTable::Build(const BYTE* lengths, int count)
+{
+	memset(counts, 0, sizeof(counts));
+	for (int symbol = 0; symbol < count; ++symbol)
+	{
+		counts[lengths[symbol]]++;
+	}
+	counts[0] = 0;
+
+	// Each length can have as many codes as the shorter ones left unused
+	int left = 1;
+	for (int length = 1; length <= MAX_BITS; ++length)
+	{
+		left = (left << 1) - counts[length];
+		if (left < 0)
+		{
+			return false;
+		}
+	}
+
+	uint16_t offsets[MAX_BITS + 1];
+	uint16_t nextCode[MAX_BITS + 1];
+	offsets[1] = 0;
+	nextCode[1] = 0;
+	for (int length = 1; length < MAX_BITS; ++length)
+	{
+		offsets[length + 1] = offsets[length] + counts[length];
+		nextCode[length + 1] = (nextCode[length] + counts[length]) << 1;
+	}
+
+	memset(fast, 0, sizeof(fast));
+	for (int symbol = 0; symbol < count; ++symbol)
+	{
+		int length = lengths[symbol];
+		if (length == 0)
+		{
+			continue;
+		}
+
+		symbols[offsets[length]++] = static_cast<uint16_t>(symbol);
+
+		// Codes are stored most significant bit first, but the bit buffer is read from the other end
+		uint16_t code = nextCode[length]++;
+		if (length <= FAST_BITS)
+		{
+			int reversed = 0;
+			for (int bit = 0; bit < length; ++bit)
+			{
+				reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+			}
+
+			for (int entry = reversed; entry < (1 << FAST_BITS); entry += 1 << length)
+			{
+				fast[entry] = static_cast<uint16_t>((symbol << 4) | length);
+			}
+		}
+	}
+
+	return true;
+}
+
+int Inflate::Decode(const HuffmanTable& table)
+{
+	if (m_bitCount < MAX_BITS)
+	{
+		Refill();
+	}
+
+	uint16_t entry = table.fast[m_bits & ((1 << FAST_BITS) - 1)];
+	if (entry)
+	{
+		ConsumeBits(entry & 0xF);
+		return entry >> 4;
+	}
+
+	// Canonical codes of one length are consecutive, so the code's index among them gives the symbol
+	uint64_t bits = m_bits;
+	int code = 0;
+	int first = 0;
+	int index = 0;
+	for (int length = 1; length <= MAX_BITS; ++length)
+	{
+		code |= bits & 1;
+		bits >>= 1;
+		int count = table.counts[length];
+		if (code - first < count)
+		{
+			ConsumeBits(length);
+			return table.symbols[index + code - first];
+		}
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+uint32_t Inflate::ReadBits(int count)
+{
+	if (m_bitCount < count)
+	{
+		Refill();
+	}
+
+	uint32_t value = static_cast<uint32_t>(m_bits & ((1ULL << count) - 1));
+	ConsumeBits(count);
+	return value;
+}
+
+void Inflate::ConsumeBits(int count)
+{
+	m_bits >>= count;
+	m_bitCount -= count;
+	if (m_bitCount < m_paddingBits)
+	{
+		m_error = true;
+	}
+}
+
+void Inflate::Refill()
+{
+	while (m_bitCount <= 56)
+	{
+		if (m_chunkPosition == m_chunkEnd && !ReadChunk())
+		{
+			// Only lookahead may use the padding, so this never has to add more than a few bytes of it
+			if (m_paddingBits >= 64)
+			{
+				m_error = true;
+				return;
+			}
+			m_bitCount += 8;
+			m_paddingBits += 8;
+			continue;
+		}
+
+		m_bits |= static_cast<uint64_t>(m_chunk[m_chunkPosition++]) << m_bitCount;
+		m_bitCount += 8;
+	}
+}
+
+bool Inflate::ReadChunk()
+{
+	size_t size = static_cast<size_t>(std::min<uint64_t>(CHUNK_SIZE, m_remainingInput));
+	if (size == 0)
+	{
+		return false;
+	}
+
+	m_in.read(reinterpret_cast<char*>(m_chunk.data()), size);
+	m_chunkPosition = 0;
+	m_chunkEnd = static_cast<size_t>(m_in.gcount());
+	m_remainingInput -= m_chunkEnd;
+	return m_chunkEnd > 0;
+}
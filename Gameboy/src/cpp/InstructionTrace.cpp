@@ -0,0 +1,289 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "header/InstructionTrace.h"
+
+InstructionTrace::InstructionTrace(size_t capacity) :
+	m_capacity(1),
+	m_next(0),
+	m_count(0)
+{
+	while (m_capacity < capacity)
+	{
+		m_capacity <<= 1;
+	}
+}
+
+void InstructionTrace::Clear()
+{
+	m_records.resize(m_capacity);
+	m_next = 0;
+	m_count = 0;
+}
+
+void InstructionTrace::RemoveLast()
+{
+	if (m_count)
+	{
+		m_next = (m_next - 1) & (m_capacity - 1);
+		--m_count;
+	}
+}
+
+bool InstructionTrace::Save(const std::string& filePath) const
+{
+	std::ofstream out(filePath, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+	const uint32_t version = FILE_VERSION;
+	const uint16_t byteOrder = FILE_BYTE_ORDER;
+	const uint16_t recordSize = sizeof(Record);
+	const uint32_t count = static_cast<uint32_t>(m_count);
+	out.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+	out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+	out.write(reinterpret_cast<const char*>(&byteOrder), sizeof(byteOrder));
+	out.write(reinterpret_cast<const char*>(&recordSize), sizeof(recordSize));
+	out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+	// The ring is written in at most two pieces, the part after the oldest record and the part before it
+	size_t oldest = (m_next - m_count) & (m_capacity - 1);
+	size_t firstPart = std::min(m_count, m_capacity - oldest);
+	out.write(reinterpret_cast<const char*>(m_records.data() + oldest), firstPart * sizeof(Record));
+	out.write(reinterpret_cast<const char*>(m_records.data()), (m_count - firstPart) * sizeof(Record));
+
+	if (!out)
+	{
+		std::cerr << "Unable to write " << filePath << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool InstructionTrace::Load(const std::string& filePath)
+{
+	std::ifstream in(filePath, std::ios_base::in | std::ios_base::binary);
+	char magic[sizeof(FILE_MAGIC)];
+	uint32_t version;
+	uint16_t byteOrder;
+	uint16_t recordSize;
+	uint32_t count;
+	if (!in.read(magic, sizeof(magic)) || memcmp(magic, FILE_MAGIC, sizeof(magic)) != 0 ||
+		!in.read(reinterpret_cast<char*>(&version), sizeof(version)) || version != FILE_VERSION ||
+		!in.read(reinterpret_cast<char*>(&byteOrder), sizeof(byteOrder)) || byteOrder != FILE_BYTE_ORDER ||
+		!in.read(reinterpret_cast<char*>(&recordSize), sizeof(recordSize)) || recordSize != sizeof(Record) ||
+		!in.read(reinterpret_cast<char*>(&count), sizeof(count)) || count > MAX_FILE_RECORDS)
+	{
+		return false;
+	}
+
+	m_capacity = 1;
+	while (m_capacity < count)
+	{
+		m_capacity <<= 1;
+	}
+
+	Clear();
+	if (!in.read(reinterpret_cast<char*>(m_records.data()), static_cast<std::streamsize>(count) * sizeof(Record)))
+	{
+		return false;
+	}
+
+	m_count = count;
+	m_next = count & (m_capacity - 1);
+	return true;
+}
+
+void InstructionTrace::Decode(std::ostream& out) const
+{
+	out << std::hex << std::uppercase << std::setfill('0');
+	for (size_t i = 0; i < m_count; ++i)
+	{
+		const Record& record = GetRecord(i);
+
+		// Run-ahead and rollback load earlier states, which shows up as the clock going backwards
+		if (i > 0 && record.GetCycle() < GetRecord(i - 1).GetCycle())
+		{
+			out << "-- state loaded --" << std::endl;
+		}
+
+		out << std::dec << std::setfill(' ') << std::setw(12) << record.GetCycle() << std::hex << std::setfill('0') << ' ';
+		if (record.bank == NO_BANK)
+		{
+			out << "   ";
+		}
+		else
+		{
+			out << std::setw(2) << record.bank << ':';
+		}
+		out << std::setw(4) << record.pc << "  ";
+
+		int length = GetLength(record.bytes[0]);
+		for (int b = 0; b < 3; ++b)
+		{
+			if (b < length)
+			{
+				out << std::setw(2) << static_cast<int>(record.bytes[b]) << ' ';
+			}
+			else
+			{
+				out << "   ";
+			}
+		}
+
+		std::string instruction = Disassemble(record.bytes, record.pc);
+		out << ' ' << instruction << std::string(instruction.size() < 20 ? 20 - instruction.size() : 1, ' ')
+			<< "AF=" << std::setw(4) << record.af << " BC=" << std::setw(4) << record.bc << " DE=" << std::setw(4) << record.de
+			<< " HL=" << std::setw(4) << record.hl << " SP=" << std::setw(4) << record.sp
+			<< ((record.flags & FLAG_IME) ? " IME" : "") << ((record.flags & FLAG_HALTED) ? " HALT" : "") << std::endl;
+	}
+	out << std::dec << std::nouppercase << std::setfill(' ');
+}
+
+int InstructionTrace::GetLength(BYTE opcode)
+{
+	// The SM83 has no instructions longer than three bytes, CB prefixed ones are always two
+	static constexpr BYTE LENGTHS[256] =
+	{
+		1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+		2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+		2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+		2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+		1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+		2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+		2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+	};
+	return LENGTHS[opcode];
+}
+
+std::string InstructionTrace::Disassemble(const BYTE* bytes, WORD address)
+{
+	static const char* const R[8] = { "b", "c", "d", "e", "h", "l", "[hl]", "a" };
+	static const char* const RP[4] = { "bc", "de", "hl", "sp" };
+	static const char* const RP_STACK[4] = { "bc", "de", "hl", "af" };
+	static const char* const CONDITIONS[4] = { "nz", "z", "nc", "c" };
+	static const char* const ALU[8] = { "add a, ", "adc a, ", "sub a, ", "sbc a, ", "and a, ", "xor a, ", "or a, ", "cp a, " };
+	static const char* const ROTATES[8] = { "rlc ", "rrc ", "rl ", "rr ", "sla ", "sra ", "swap ", "srl " };
+	static const char* const MISC[8] = { "rlca", "rrca", "rla", "rra", "daa", "cpl", "scf", "ccf" };
+
+	auto hex = [](int value, int digits)
+	{
+		std::ostringstream text;
+		text << '$' << std::hex << std::setw(digits) << std::setfill('0') << value;
+		return text.str();
+	};
+
+	const BYTE opcode = bytes[0];
+	const std::string n8 = hex(bytes[1], 2);
+	const std::string high = hex(0xFF00 | bytes[1], 4);
+	const std::string n16 = hex(bytes[1] | (bytes[2] << 8), 4);
+	const std::string e8 = std::to_string(static_cast<SIGNED_BYTE>(bytes[1]));
+	const std::string relative = hex(static_cast<WORD>(address + 2 + static_cast<SIGNED_BYTE>(bytes[1])), 4);
+
+	// Opcodes are decoded from their fields, x is the top two bits, y the middle three and z the bottom three
+	const int x = opcode >> 6;
+	const int y = (opcode >> 3) & 7;
+	const int z = opcode & 7;
+	const int p = y >> 1;
+	const int q = y & 1;
+
+	switch (x)
+	{
+	case 0:
+		switch (z)
+		{
+		case 0:
+			if (y == 0) return "nop";
+			if (y == 1) return "ld [" + n16 + "], sp";
+			if (y == 2) return "stop";
+			if (y == 3) return "jr " + relative;
+			return std::string("jr ") + CONDITIONS[y - 4] + ", " + relative;
+		case 1:
+			return q ? std::string("add hl, ") + RP[p] : std::string("ld ") + RP[p] + ", " + n16;
+		case 2:
+		{
+			static const char* const INDIRECT[4] = { "[bc]", "[de]", "[hl+]", "[hl-]" };
+			return q ? std::string("ld a, ") + INDIRECT[p] : std::string("ld ") + INDIRECT[p] + ", a";
+		}
+		case 3:
+			return std::string(q ? "dec " : "inc ") + RP[p];
+		case 4:
+			return std::string("inc ") + R[y];
+		case 5:
+			return std::string("dec ") + R[y];
+		case 6:
+			return std::string("ld ") + R[y] + ", " + n8;
+		default:
+			return MISC[y];
+		}
+	case 1:
+		if (y == 6 && z == 6)
+		{
+			return "halt";
+		}
+		return std::string("ld ") + R[y] + ", " + R[z];
+	case 2:
+		return ALU[y] + std::string(R[z]);
+	}
+
+	switch (z)
+	{
+	case 0:
+		if (y < 4) return std::string("ret ") + CONDITIONS[y];
+		if (y == 4) return "ldh [" + high + "], a";
+		if (y == 5) return "add sp, " + e8;
+		if (y == 6) return "ldh a, [" + high + "]";
+		return "ld hl, sp" + std::string(static_cast<SIGNED_BYTE>(bytes[1]) < 0 ? "" : "+") + e8;
+	case 1:
+		if (!q) return std::string("pop ") + RP_STACK[p];
+		if (p == 0) return "ret";
+		if (p == 1) return "reti";
+		if (p == 2) return "jp hl";
+		return "ld sp, hl";
+	case 2:
+		if (y < 4) return std::string("jp ") + CONDITIONS[y] + ", " + n16;
+		if (y == 4) return "ldh [c], a";
+		if (y == 5) return "ld [" + n16 + "], a";
+		if (y == 6) return "ldh a, [c]";
+		return "ld a, [" + n16 + "]";
+	case 3:
+		if (y == 0) return "jp " + n16;
+		if (y == 6) return "di";
+		if (y == 7) return "ei";
+		if (y == 1)
+		{
+			const BYTE cb = bytes[1];
+			const int operation = cb >> 6;
+			const int bit = (cb >> 3) & 7;
+			if (operation == 0) return ROTATES[bit] + std::string(R[cb & 7]);
+			static const char* const BIT_OPERATIONS[4] = { "", "bit ", "res ", "set " };
+			return BIT_OPERATIONS[operation] + std::to_string(bit) + ", " + R[cb & 7];
+		}
+		break;
+	case 4:
+		if (y < 4) return std::string("call ") + CONDITIONS[y] + ", " + n16;
+		break;
+	case 5:
+		if (!q) return std::string("push ") + RP_STACK[p];
+		if (p == 0) return "call " + n16;
+		break;
+	case 6:
+		return ALU[y] + n8;
+	case 7:
+		return "rst " + hex(y * 8, 2);
+	}
+
+	// The opcodes that don't exist lock up the CPU
+	return "db " + hex(opcode, 2);
+}
@@ -0,0 +1,200 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "header/CPU.h"
+#include "header/LinkCable.h"
+
+SerialDevice_LinkCable::SerialDevice_LinkCable() :
+	m_cable(nullptr),
+	m_other(nullptr),
+	m_pluggedIn(false),
+	m_clockCycle(0),
+	m_driving(false),
+	m_driveCycle(0),
+	m_driveOutgoing(DISCONNECTED),
+	m_resolved(false),
+	m_driveIncoming(DISCONNECTED),
+	m_windows(),
+	m_answered(false),
+	m_answerIncoming(DISCONNECTED)
+{
+}
+
+SerialDevice_LinkCable::~SerialDevice_LinkCable()
+{
+}
+
+BYTE SerialDevice_LinkCable::TransferInternalClock(BYTE outgoing, uint64_t clockCycle)
+{
+	std::unique_lock<std::mutex> lock(m_cable->m_mutex);
+	SerialDevice_LinkCable& other = *m_other;
+	if (!m_pluggedIn || !other.m_pluggedIn)
+	{
+		m_clockCycle = clockCycle;
+		return DISCONNECTED;
+	}
+
+	m_driving = true;
+	m_driveCycle = clockCycle;
+	m_driveOutgoing = outgoing;
+	m_resolved = false;
+	PublishClockCycle(clockCycle);
+
+	// Whether the other side was listening is only known once it has run up to the transfer, and it resolves the
+	// transfer itself when it gets there
+	if (other.m_clockCycle >= clockCycle)
+	{
+		Resolve(*this, other);
+	}
+	m_cable->m_changed.wait(lock, [&]() { return m_resolved || !other.m_pluggedIn; });
+	m_driving = false;
+
+	return m_resolved ? m_driveIncoming : DISCONNECTED;
+}
+
+bool SerialDevice_LinkCable::TransferExternalClock(BYTE, BYTE& incoming, uint64_t clockCycle)
+{
+	std::unique_lock<std::mutex> lock(m_cable->m_mutex);
+	SerialDevice_LinkCable& other = *m_other;
+	PublishClockCycle(clockCycle);
+
+	// Running ahead of the other side would let it answer on a cycle this side has already gone past
+	m_cable->m_changed.wait(lock, [&]() { return m_answered || !m_pluggedIn || !other.m_pluggedIn || other.m_clockCycle >= clockCycle; });
+
+	// An answer always comes from a cycle this side had published, so it is never later than this one
+	if (!m_answered)
+	{
+		return false;
+	}
+
+	m_answered = false;
+	incoming = m_answerIncoming;
+	return true;
+}
+
+void SerialDevice_LinkCable::SetListening(bool listening, BYTE outgoing, uint64_t clockCycle)
+{
+	std::lock_guard<std::mutex> lock(m_cable->m_mutex);
+	PublishClockCycle(clockCycle);
+
+	// The driving side may not have reached the windows yet, so they stay until it has run past them
+	m_windows.erase(std::remove_if(m_windows.begin(), m_windows.end(),
+		[&](const ListenWindow& window) { return window.end <= m_other->m_clockCycle; }), m_windows.end());
+
+	bool open = !m_windows.empty() && m_windows.back().end == NEVER;
+	if (listening)
+	{
+		// Writing SC again while a transfer is waiting doesn't restart it
+		if (!open && !m_answered)
+		{
+			m_windows.push_back({ clockCycle, NEVER, outgoing });
+		}
+	}
+	else
+	{
+		if (open)
+		{
+			m_windows.back().end = clockCycle;
+		}
+		m_answered = false;
+	}
+}
+
+void SerialDevice_LinkCable::AdvanceTo(uint64_t clockCycle)
+{
+	std::lock_guard<std::mutex> lock(m_cable->m_mutex);
+	PublishClockCycle(clockCycle);
+}
+
+void SerialDevice_LinkCable::Unplug()
+{
+	std::lock_guard<std::mutex> lock(m_cable->m_mutex);
+	m_pluggedIn = false;
+	m_cable->m_changed.notify_all();
+}
+
+void SerialDevice_LinkCable::PlugIn(LinkCable* cable, SerialDevice_LinkCable* other, uint64_t clockCycle)
+{
+	m_cable = cable;
+	m_other = other;
+	m_pluggedIn = true;
+	m_clockCycle = clockCycle;
+	m_driving = false;
+	m_resolved = false;
+	m_windows.clear();
+	m_answered = false;
+}
+
+void SerialDevice_LinkCable::PublishClockCycle(uint64_t clockCycle)
+{
+	m_clockCycle = clockCycle;
+
+	SerialDevice_LinkCable& other = *m_other;
+	if (other.m_driving && !other.m_resolved && clockCycle >= other.m_driveCycle)
+	{
+		Resolve(other, *this);
+	}
+	m_cable->m_changed.notify_all();
+}
+
+void SerialDevice_LinkCable::Resolve(SerialDevice_LinkCable& driver, SerialDevice_LinkCable& listener)
+{
+	const uint64_t cycle = driver.m_driveCycle;
+	driver.m_driveIncoming = DISCONNECTED;
+	driver.m_resolved = true;
+
+	for (ListenWindow& window : listener.m_windows)
+	{
+		if (window.start <= cycle && cycle < window.end)
+		{
+			// The transfer ends the window. A window that was already closed has nobody left to take the byte.
+			if (window.end == NEVER)
+			{
+				listener.m_answered = true;
+				listener.m_answerIncoming = driver.m_driveOutgoing;
+			}
+			window.end = cycle;
+			driver.m_driveIncoming = window.outgoing;
+			break;
+		}
+	}
+
+	listener.m_cable->m_changed.notify_all();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+LinkCable::LinkCable() :
+	m_ends(),
+	m_mutex(),
+	m_changed()
+{
+}
+
+void LinkCable::RunFrames(CPU& first, CPU& second, int frames)
+{
+	m_ends[0].PlugIn(this, &m_ends[1], first.GetTotalClockCycles());
+	m_ends[1].PlugIn(this, &m_ends[0], second.GetTotalClockCycles());
+	first.SetSerialDevice(&m_ends[0]);
+	second.SetSerialDevice(&m_ends[1]);
+
+	// Publishing the clock once a frame is enough to let a transfer the other side didn't listen to time out
+	auto run = [frames](CPU& sm83, SerialDevice_LinkCable& end)
+	{
+		for (int i = 0; i < frames; ++i)
+		{
+			sm83.RunFrame();
+			end.AdvanceTo(sm83.GetTotalClockCycles());
+		}
+		end.Unplug();
+	};
+
+	std::thread secondThread(run, std::ref(second), std::ref(m_ends[1]));
+	run(first, m_ends[0]);
+	secondThread.join();
+
+	first.SetSerialDevice(nullptr);
+	second.SetSerialDevice(nullptr);
+}
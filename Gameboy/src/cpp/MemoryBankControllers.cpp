@@ -1,12 +1,21 @@
 #include "stdafx.h"
+#include <algorithm>
+#include <cstring>
+
 #include "header/MemoryBankControllers.h"
 #include "header/Debug.h"
+#include "header/StateBuffer.h"
 
 MemoryBankController::MemoryBankController() :
     m_romSize(0),
     m_ramSize(0),
     m_rom(nullptr),
-    m_ram(nullptr)
+    m_ram(nullptr),
+    m_romMap(),
+    m_romMapBanks(),
+    m_dirtyPages(),
+    m_ramDirty(false),
+    m_loadedRam()
 {
 }
 
@@ -18,6 +27,8 @@ void MemoryBankController::Initialize(char* cartridgeBuffer, int bufferSize, int
     m_ram = new BYTE[ramSize];
 
     memset(m_ram, 0, ramSize);
+    m_dirtyPages.assign((ramSize + RAM_PAGE_SIZE - 1) / RAM_PAGE_SIZE, false);
+    m_loadedRam.resize(ramSize);
 
     int i = 0;
     for (; i < bufferSize && i < romSize; i++)
@@ -29,6 +40,26 @@ void MemoryBankController::Initialize(char* cartridgeBuffer, int bufferSize, int
     {
         m_rom[i] = 0x00;
     }
+
+    MapRom(0x0000, 0);
+    MapRom(0x4000, 1);
+}
+
+void MemoryBankController::MapRom(WORD address, int bank, int bankSize)
+{
+    int romOffset = bank * bankSize;
+    for (int slot = address / ROM_SLOT_SIZE; slot < (address + bankSize) / ROM_SLOT_SIZE; slot++)
+    {
+        m_romMap[slot] = m_rom + romOffset % m_romSize;
+        m_romMapBanks[slot] = (romOffset % m_romSize) / ROM_BANK_SIZE;
+        romOffset += ROM_SLOT_SIZE;
+    }
+}
+
+void MemoryBankController::MapOther(WORD address, const BYTE* data)
+{
+    m_romMap[address / ROM_SLOT_SIZE] = data;
+    m_romMapBanks[address / ROM_SLOT_SIZE] = NO_ROM_BANK;
 }
 
 MemoryBankController::~MemoryBankController()
@@ -37,6 +68,54 @@ MemoryBankController::~MemoryBankController()
     delete[] m_ram;
 }
 
+void MemoryBankController::SaveState(StateBuffer& state) const
+{
+    state.WriteBytes(m_ram, m_ramSize);
+}
+
+void MemoryBankController::LoadState(StateBuffer& state)
+{
+    // A state loaded from a file changes the battery save as much as the game writing would
+    state.ReadBytes(m_loadedRam.data(), m_ramSize);
+    for (int page = 0; page * RAM_PAGE_SIZE < m_ramSize; page++)
+    {
+        int offset = page * RAM_PAGE_SIZE;
+        int size = std::min(RAM_PAGE_SIZE, m_ramSize - offset);
+        if (memcmp(m_ram + offset, m_loadedRam.data() + offset, size) != 0)
+        {
+            memcpy(m_ram + offset, m_loadedRam.data() + offset, size);
+            m_dirtyPages[page] = true;
+            m_ramDirty = true;
+        }
+    }
+}
+
+void MemoryBankController::LoadRam(const BYTE* data, int size)
+{
+    memcpy(m_ram, data, std::min(size, m_ramSize));
+}
+
+bool MemoryBankController::CopyDirtyRam(BYTE* image)
+{
+    if (!m_ramDirty)
+    {
+        return false;
+    }
+
+    for (int page = 0; page * RAM_PAGE_SIZE < m_ramSize; page++)
+    {
+        if (m_dirtyPages[page])
+        {
+            int offset = page * RAM_PAGE_SIZE;
+            memcpy(image + offset, m_ram + offset, std::min(RAM_PAGE_SIZE, m_ramSize - offset));
+            m_dirtyPages[page] = false;
+        }
+    }
+
+    m_ramDirty = false;
+    return true;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////
 
 MemoryBankController_None::MemoryBankController_None(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize)
@@ -64,16 +143,6 @@ MemoryBankController_None::~MemoryBankController_None()
 
 BYTE MemoryBankController_None::ReadMemory(WORD address)
 {
-    // 0x0000 - 0x7FFF is the cartridge ROM
-    if (address < 0x8000)
-    {
-        DEBUG_ASSERT_N(address < m_romSize);
-        if (address < m_romSize)
-        {
-            return m_rom[address];
-        }
-    }
-
     // 0xA000 to 0xBFFF is the cartridge RAM
     if (address >= 0xA000 && address <= 0xC000)
     {
@@ -98,7 +167,7 @@ void MemoryBankController_None::WriteMemory(WORD address, BYTE data)
         DEBUG_ASSERT_N(ramAddress < m_ramSize);
         if (ramAddress < m_ramSize)
         {
-            m_ram[ramAddress] = data;
+            WriteRam(ramAddress, data);
         }
         return;
     }
@@ -135,30 +204,6 @@ MemoryBankController_MBC1::~MemoryBankController_MBC1()
 
 BYTE MemoryBankController_MBC1::ReadMemory(WORD address)
 {
-    // This area always contains the first 16KBytes of the cartridge ROM.
-    if (address < 0x4000)
-    {
-        DEBUG_ASSERT_N(address < m_romSize);
-        if (address < m_romSize)
-        {
-            return m_rom[address];
-        }
-    }
-
-    // This area may contain any of the further 16KByte banks of the ROM,
-    // allowing to address up to 125 ROM Banks (almost 2MByte).
-    // 
-    // As described below, bank numbers 20h, 40h, and 60h cannot be used, resulting in the odd amount of 125 banks.
-    if (address >= 0x4000 && address < 0x8000)
-    {
-        MEMORY_ADDRESS romAddress = address - 0x4000 + (ROM_BANK_SIZE * m_romBank);
-        DEBUG_ASSERT_N(romAddress < m_romSize);
-        if (romAddress < m_romSize)
-        {
-            return m_rom[romAddress];
-        }
-    }
-
     // This area is used to address external RAM in the cartridge (if any).
     // External RAM is often battery buffered, allowing to store game positions or high score tables,
     // even if the gameboy is turned off, or if the cartridge is removed from the gameboy.
@@ -219,6 +264,7 @@ void MemoryBankController_MBC1::WriteMemory(WORD address, BYTE data)
 
         m_romBank &= 0xE0;  // clear bits
         m_romBank |= data;  // set new bits
+        MapRom(0x4000, m_romBank);
         return;
     }
 
@@ -235,6 +281,7 @@ void MemoryBankController_MBC1::WriteMemory(WORD address, BYTE data)
         {
             m_romBank &= 0x1F;          // clear bits
             m_romBank |= (data << 5);   // set new bits
+            MapRom(0x4000, m_romBank);
         }
         return;
     }
@@ -252,6 +299,7 @@ void MemoryBankController_MBC1::WriteMemory(WORD address, BYTE data)
         if (IsRAMBankMode())
         {
             m_romBank &= 0x1F;  // clear bits as ram bank uses same 2 bits
+            MapRom(0x4000, m_romBank);
         }
 
         return;
@@ -271,7 +319,7 @@ void MemoryBankController_MBC1::WriteMemory(WORD address, BYTE data)
             DEBUG_ASSERT_N(ramAddress < m_ramSize);
             if (ramAddress < m_ramSize)
             {
-                m_ram[ramAddress] = data;
+                WriteRam(ramAddress, data);
             }
         }
 
@@ -281,6 +329,25 @@ void MemoryBankController_MBC1::WriteMemory(WORD address, BYTE data)
     DEBUG_ASSERT(false, "Reading from invalid memory");
 }
 
+void MemoryBankController_MBC1::SaveState(StateBuffer& state) const
+{
+    MemoryBankController::SaveState(state);
+    state.Write(m_ramEnabled);
+    state.Write(m_ramBank);
+    state.Write(m_romBank);
+    state.Write(m_bankMode);
+}
+
+void MemoryBankController_MBC1::LoadState(StateBuffer& state)
+{
+    MemoryBankController::LoadState(state);
+    state.Read(m_ramEnabled);
+    state.Read(m_ramBank);
+    state.Read(m_romBank);
+    state.Read(m_bankMode);
+    MapRom(0x4000, m_romBank);
+}
+
 //////////////////////////////////////////////////////////////////////////////////////
 
 MemoryBankController_MBC2::MemoryBankController_MBC2(char* cartridgeBuffer, int bufferSize, int romSize) :
@@ -307,25 +374,6 @@ MemoryBankController_MBC2::~MemoryBankController_MBC2()
 BYTE MemoryBankController_MBC2::ReadMemory(WORD address)
 {
     // All very similar to MBC1
-    if (address < 0x4000)
-    {
-        DEBUG_ASSERT_N(address < m_romSize);
-        if (address < m_romSize)
-        {
-            return m_rom[address];
-        }
-    }
-
-    if (address >= 0x4000 && address < 0x8000)
-    {
-        MEMORY_ADDRESS romAddress = address - 0x4000 + (ROM_BANK_SIZE * m_romBank);
-        DEBUG_ASSERT_N(romAddress < m_romSize);
-        if (romAddress < m_romSize)
-        {
-            return m_rom[romAddress];
-        }
-    }
-
     // MBC2 doesnt support external RAM, instead it includes 512 half - bytes of RAM (built into the MBC2 chip itself).
     // It still requires an external battery to save data during power - off though.
     // As the data consists of 4 - bit values, only the lower 4 bits of the bytes in this memory area are used.
@@ -373,6 +421,7 @@ void MemoryBankController_MBC2::WriteMemory(WORD address, BYTE data)
         if (validAddress)
         {
             m_romBank = data;
+            MapRom(0x4000, m_romBank);
             return;
         }
     }
@@ -391,7 +440,7 @@ void MemoryBankController_MBC2::WriteMemory(WORD address, BYTE data)
             DEBUG_ASSERT_N(ramAddress < m_ramSize);
             if (ramAddress < m_ramSize)
             {
-                m_ram[ramAddress] = data;
+                WriteRam(ramAddress, data);
             }
         }
     }
@@ -399,18 +448,34 @@ void MemoryBankController_MBC2::WriteMemory(WORD address, BYTE data)
     DEBUG_ASSERT(false, "Writing to invalid memory");
 }
 
+void MemoryBankController_MBC2::SaveState(StateBuffer& state) const
+{
+    MemoryBankController::SaveState(state);
+    state.Write(m_romBank);
+    state.Write(m_ramEnabled);
+}
+
+void MemoryBankController_MBC2::LoadState(StateBuffer& state)
+{
+    MemoryBankController::LoadState(state);
+    state.Read(m_romBank);
+    state.Read(m_ramEnabled);
+    MapRom(0x4000, m_romBank);
+}
+
 //////////////////////////////////////////////////////////////////////////////////////
 
-MemoryBankController_MBC3::MemoryBankController_MBC3(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize) :
+MemoryBankController_MBC3::MemoryBankController_MBC3(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize, bool hasClock) :
     m_ramAndTimerEnabled(0x00),
     m_romBank(0x01),
     m_isRTCMode(false),
+    m_hasClock(hasClock),
     m_ramBank(0x00),
-    m_rtc_s(0x00),
-    m_rtc_m(0x00),
-    m_rtc_h(0x00),
-    m_rtc_dl(0x00),
-    m_rtc_dh(0x00)
+    m_rtc(),
+    m_latchedRtc(),
+    m_lastLatchWrite(0xFF),
+    m_rtcSyncCycle(0),
+    m_rtcSubSecondCycles(0)
 {
     // Max 2 mb of rom, 32 kb ram
     DEBUG_ASSERT_N(romSize <= 0x20'0000);
@@ -435,25 +500,6 @@ MemoryBankController_MBC3::~MemoryBankController_MBC3()
 
 BYTE MemoryBankController_MBC3::ReadMemory(WORD address)
 {
-    if (address < 0x4000)
-    {
-        DEBUG_ASSERT_N(address < m_romSize);
-        if (address < m_romSize)
-        {
-            return m_rom[address];
-        }
-    }
-
-    if (address >= 0x4000 && address < 0x8000)
-    {
-        MEMORY_ADDRESS romAddress = address - 0x4000 + (ROM_BANK_SIZE * m_romBank);
-        DEBUG_ASSERT_N(romAddress < m_romSize);
-        if (romAddress < m_romSize)
-        {
-            return m_rom[romAddress];
-        }
-    }
-
     if (address >= 0xA000 && address <= 0xC000)
     {
         DEBUG_ASSERT_N(m_ramAndTimerEnabled);
@@ -474,15 +520,15 @@ BYTE MemoryBankController_MBC3::ReadMemory(WORD address)
                 switch (m_ramBank)
                 {
                 case 0x08:
-                    return m_rtc_s;
+                    return m_latchedRtc.seconds;
                 case 0x09:
-                    return m_rtc_m;
+                    return m_latchedRtc.minutes;
                 case 0x0A:
-                    return m_rtc_h;
+                    return m_latchedRtc.hours;
                 case 0x0B:
-                    return m_rtc_dl;
+                    return m_latchedRtc.daysLow;
                 case 0x0C:
-                    return m_rtc_dh;
+                    return m_latchedRtc.daysHigh;
                 }
 
                 DEBUG_ASSERT(false, "Invalid byte");
@@ -512,6 +558,7 @@ void MemoryBankController_MBC3::WriteMemory(WORD address, BYTE data)
 
         m_romBank &= 0x80;  // clear bits
         m_romBank |= data;  // set new bits
+        MapRom(0x4000, m_romBank);
         return;
     }
 
@@ -525,7 +572,7 @@ void MemoryBankController_MBC3::WriteMemory(WORD address, BYTE data)
         {
             m_isRTCMode = false;
         }
-        else if (data < 0x0C)
+        else if (data <= 0x0C)
         {
             m_isRTCMode = true;
         }
@@ -543,7 +590,11 @@ void MemoryBankController_MBC3::WriteMemory(WORD address, BYTE data)
     // This can be proven by reading the latched(frozen) time from the RTC registers, and then unlatch the registers to show the clock itself continues to tick in background.
     if (address >= 0x6000 && address < 0x8000)
     {
-        // TODO: ???
+        if (m_lastLatchWrite == 0x00 && data == 0x01)
+        {
+            m_latchedRtc = m_rtc;
+        }
+        m_lastLatchWrite = data;
         return;
     }
 
@@ -559,27 +610,30 @@ void MemoryBankController_MBC3::WriteMemory(WORD address, BYTE data)
                 DEBUG_ASSERT_N(ramAddress < m_ramSize);
                 if (ramAddress < m_ramSize)
                 {
-                    m_ram[ramAddress] = data;
+                    WriteRam(ramAddress, data);
                 }
             }
             else
             {
+                // Writes set the running clock, the game sees them after the next latch
                 switch (m_ramBank)
                 {
                 case 0x08:
-                    m_rtc_s = data;
+                    // Writing the seconds also restarts the current second
+                    m_rtc.seconds = data & 0x3F;
+                    m_rtcSubSecondCycles = 0;
                     return;
                 case 0x09:
-                    m_rtc_m = data;
+                    m_rtc.minutes = data & 0x3F;
                     return;
                 case 0x0A:
-                    m_rtc_h = data;
+                    m_rtc.hours = data & 0x1F;
                     return;
                 case 0x0B:
-                    m_rtc_dl = data;
+                    m_rtc.daysLow = data;
                     return;
                 case 0x0C:
-                    m_rtc_dh = data;
+                    m_rtc.daysHigh = data & (RTC_DAY_CARRY | RTC_HALT | RTC_DAY_HIGH_BIT);
                     return;
                 }
 
@@ -591,6 +645,144 @@ void MemoryBankController_MBC3::WriteMemory(WORD address, BYTE data)
     DEBUG_ASSERT(false, "Writing to invalid memory");
 }
 
+void MemoryBankController_MBC3::SaveState(StateBuffer& state) const
+{
+    MemoryBankController::SaveState(state);
+    state.Write(m_ramAndTimerEnabled);
+    state.Write(m_ramBank);
+    state.Write(m_romBank);
+    state.Write(m_isRTCMode);
+    state.Write(m_rtc);
+    state.Write(m_latchedRtc);
+    state.Write(m_lastLatchWrite);
+    state.Write(m_rtcSyncCycle);
+    state.Write(m_rtcSubSecondCycles);
+}
+
+void MemoryBankController_MBC3::LoadState(StateBuffer& state)
+{
+    MemoryBankController::LoadState(state);
+    state.Read(m_ramAndTimerEnabled);
+    state.Read(m_ramBank);
+    state.Read(m_romBank);
+    state.Read(m_isRTCMode);
+    state.Read(m_rtc);
+    state.Read(m_latchedRtc);
+    state.Read(m_lastLatchWrite);
+    state.Read(m_rtcSyncCycle);
+    state.Read(m_rtcSubSecondCycles);
+    MapRom(0x4000, m_romBank);
+}
+
+void MemoryBankController_MBC3::SyncClock(uint64_t clockCycle)
+{
+    if (!m_hasClock || clockCycle <= m_rtcSyncCycle)
+    {
+        return;
+    }
+
+    uint64_t elapsed = clockCycle - m_rtcSyncCycle;
+    m_rtcSyncCycle = clockCycle;
+    if (IsClockHalted())
+    {
+        return;
+    }
+
+    m_rtcSubSecondCycles += elapsed;
+    if (m_rtcSubSecondCycles >= RTC_CYCLES_PER_SECOND)
+    {
+        AdvanceClock(m_rtcSubSecondCycles / RTC_CYCLES_PER_SECOND);
+        m_rtcSubSecondCycles %= RTC_CYCLES_PER_SECOND;
+    }
+}
+
+void MemoryBankController_MBC3::RebaseClock(uint64_t clockCycle)
+{
+    m_rtcSyncCycle = clockCycle;
+}
+
+void MemoryBankController_MBC3::GetClock(ClockRegisters& current, ClockRegisters& latched) const
+{
+    current = m_rtc;
+    latched = m_latchedRtc;
+}
+
+void MemoryBankController_MBC3::SetClock(const ClockRegisters& current, const ClockRegisters& latched)
+{
+    m_rtc = current;
+    m_latchedRtc = latched;
+    m_rtcSubSecondCycles = 0;
+}
+
+void MemoryBankController_MBC3::AdvanceClock(uint64_t seconds)
+{
+    if (IsClockHalted())
+    {
+        return;
+    }
+
+    // Registers the game set out of range count up to where their bits wrap without a carry, which only ticking
+    // one second at a time gets right
+    while (seconds > 0 && (m_rtc.seconds >= 60 || m_rtc.minutes >= 60 || m_rtc.hours >= 24))
+    {
+        TickSecond();
+        --seconds;
+    }
+
+    if (seconds == 0)
+    {
+        return;
+    }
+
+    uint64_t total = seconds + m_rtc.seconds + 60 * (m_rtc.minutes + 60 * static_cast<uint64_t>(m_rtc.hours));
+    m_rtc.seconds = static_cast<BYTE>(total % 60);
+    total /= 60;
+    m_rtc.minutes = static_cast<BYTE>(total % 60);
+    total /= 60;
+    m_rtc.hours = static_cast<BYTE>(total % 24);
+    AddDays(total / 24);
+}
+
+void MemoryBankController_MBC3::AddDays(uint64_t days)
+{
+    // The day counter is 9 bits, overflowing sets the carry which stays set until the game clears it
+    days += m_rtc.daysLow | ((m_rtc.daysHigh & RTC_DAY_HIGH_BIT) << 8);
+    if (days >= 512)
+    {
+        m_rtc.daysHigh |= RTC_DAY_CARRY;
+        days %= 512;
+    }
+    m_rtc.daysLow = static_cast<BYTE>(days);
+    m_rtc.daysHigh = (m_rtc.daysHigh & ~RTC_DAY_HIGH_BIT) | static_cast<BYTE>(days >> 8);
+}
+
+void MemoryBankController_MBC3::TickSecond()
+{
+    // Each counter only compares for its own limit, past it the counter runs until its bits overflow
+    m_rtc.seconds = (m_rtc.seconds + 1) & 0x3F;
+    if (m_rtc.seconds != 60)
+    {
+        return;
+    }
+    m_rtc.seconds = 0;
+
+    m_rtc.minutes = (m_rtc.minutes + 1) & 0x3F;
+    if (m_rtc.minutes != 60)
+    {
+        return;
+    }
+    m_rtc.minutes = 0;
+
+    m_rtc.hours = (m_rtc.hours + 1) & 0x1F;
+    if (m_rtc.hours != 24)
+    {
+        return;
+    }
+    m_rtc.hours = 0;
+
+    AddDays(1);
+}
+
 //////////////////////////////////////////////////////////////////////////////////////
 
 MemoryBankController_MBC5::MemoryBankController_MBC5(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize) :
@@ -613,6 +805,7 @@ MemoryBankController_MBC5::MemoryBankController_MBC5(char* cartridgeBuffer, int
     }
 
     Initialize(cartridgeBuffer, bufferSize, romSize, ramSize);
+    MapRom(0x4000, m_romBank);
 }
 
 MemoryBankController_MBC5::~MemoryBankController_MBC5()
@@ -621,25 +814,6 @@ MemoryBankController_MBC5::~MemoryBankController_MBC5()
 
 BYTE MemoryBankController_MBC5::ReadMemory(WORD address)
 {
-    if (address < 0x4000)
-    {
-        DEBUG_ASSERT_N(address < m_romSize);
-        if (address < m_romSize)
-        {
-            return m_rom[address];
-        }
-    }
-
-    if (address >= 0x4000 && address < 0x8000)
-    {
-        MEMORY_ADDRESS romAddress = address - 0x4000 + (ROM_BANK_SIZE * m_romBank);
-        DEBUG_ASSERT_N(romAddress < m_romSize);
-        if (romAddress < m_romSize)
-        {
-            return m_rom[romAddress];
-        }
-    }
-
     if (address >= 0xA000 && address <= 0xC000)
     {
         DEBUG_ASSERT_N(m_ramEnabled);
@@ -672,6 +846,7 @@ void MemoryBankController_MBC5::WriteMemory(WORD address, BYTE data)
     {
         m_romBank &= 0x0100;  // clear bits
         m_romBank |= data;    // set new bits
+        MapRom(0x4000, m_romBank);
         return;
     }
 
@@ -680,6 +855,7 @@ void MemoryBankController_MBC5::WriteMemory(WORD address, BYTE data)
         data &= 0x01;
         m_romBank &= 0x00FF;        // clear bits
         m_romBank |= (data << 8);   // set new bits
+        MapRom(0x4000, m_romBank);
         return;
     }
 
@@ -701,7 +877,7 @@ void MemoryBankController_MBC5::WriteMemory(WORD address, BYTE data)
             DEBUG_ASSERT_N(ramAddress < m_ramSize);
             if (ramAddress < m_ramSize)
             {
-                m_ram[ramAddress] = data;
+                WriteRam(ramAddress, data);
             }
         }
 
@@ -711,74 +887,1475 @@ void MemoryBankController_MBC5::WriteMemory(WORD address, BYTE data)
     DEBUG_ASSERT(false, "Writing to invalid memory");
 }
 
+void MemoryBankController_MBC5::SaveState(StateBuffer& state) const
+{
+    MemoryBankController::SaveState(state);
+    state.Write(m_ramEnabled);
+    state.Write(m_ramBank);
+    state.Write(m_romBank);
+}
+
+void MemoryBankController_MBC5::LoadState(StateBuffer& state)
+{
+    MemoryBankController::LoadState(state);
+    state.Read(m_ramEnabled);
+    state.Read(m_ramBank);
+    state.Read(m_romBank);
+    MapRom(0x4000, m_romBank);
+}
+
 //////////////////////////////////////////////////////////////////////////////////////
 
-MemoryBankController* MemoryBankControllerFactory::CreateMemoryBank(BYTE type, BYTE romSize, BYTE ramSize, char* cartridgeBuffer, int bufferLength)
+MemoryBankController_MBC1M::MemoryBankController_MBC1M(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize) :
+    m_ramEnabled(0x00),
+    m_lowerBank(0x01),
+    m_upperBank(0x00),
+    m_bankMode(0x00)
 {
-    int actualRomSize = 0x8000 * (1 << romSize);
-    int actualRamSize = 0;
+    // Max 32 kb ram, multicarts are always 1 mb of rom
+    DEBUG_ASSERT_N(ramSize <= 0x8000);
 
-    switch (ramSize)
+    if (ramSize > 0x8000)
     {
-    case 0x00:
-    case 0x01:
-        actualRamSize = 0;
-        break;
-    case 0x02:
-        actualRamSize = 0x2000;
-        break;
-    case 0x03:
-        actualRamSize = 0x8000;
-        break;
-    case 0x04:
-        actualRamSize = 0x2'0000;
-        break;
-    case 0x05:
-        actualRamSize = 0x1'0000;
-        break;
+        ramSize = 0x8000;
     }
 
-    MemoryBankController* mbc = nullptr;
-    switch (type)
+    Initialize(cartridgeBuffer, bufferSize, romSize, ramSize);
+    MapBanks();
+}
+
+MemoryBankController_MBC1M::~MemoryBankController_MBC1M()
+{
+}
+
+bool MemoryBankController_MBC1M::IsMulticart(const char* cartridgeBuffer, int bufferSize)
+{
+    // Nintendo's logo in the header of the second game, at bank 10h
+    const int logoAddress = 0x104;
+    const int logoSize = 0x30;
+    const int secondGame = 0x10 * ROM_BANK_SIZE;
+    return bufferSize == 0x10'0000 && memcmp(cartridgeBuffer + logoAddress, cartridgeBuffer + secondGame + logoAddress, logoSize) == 0;
+}
+
+BYTE MemoryBankController_MBC1M::ReadMemory(WORD address)
+{
+    if (address >= 0xA000 && address < 0xC000)
     {
-    case 0x00:
-        actualRamSize = 0;
-        [[fallthrough]];
-    case 0x08:
-    case 0x09:
-        mbc = new MemoryBankController_None(cartridgeBuffer, bufferLength, actualRomSize, actualRamSize);
-        break;
-    case 0x01:
-        actualRamSize = 0;
-        [[fallthrough]];
-    case 0x02:
-    case 0x03:
-        mbc = new MemoryBankController_MBC1(cartridgeBuffer, bufferLength, actualRomSize, actualRamSize);
-        break;
-    case 0x05:
-    case 0x06:
-        mbc = new MemoryBankController_MBC2(cartridgeBuffer, bufferLength, actualRomSize);
-        break;
-    case 0x0F:
-    case 0x11:
-        actualRamSize = 0;
-        [[fallthrough]];
-    case 0x10:
-    case 0x12:
-    case 0x13:
-        mbc = new MemoryBankController_MBC3(cartridgeBuffer, bufferLength, actualRomSize, actualRamSize);
-        break;
-    case 0x19:
-    case 0x1C:
-        actualRamSize = 0;
-        [[fallthrough]];
-    case 0x1A:
-    case 0x1B:
-    case 0x1D:
-    case 0x1E:
-        mbc = new MemoryBankController_MBC5(cartridgeBuffer, bufferLength, actualRomSize, actualRamSize);
-        break;
+        if (m_ramEnabled && m_ramSize > 0)
+        {
+            return m_ram[GetRamAddress(address)];
+        }
+
+        return 0xFF;
     }
 
-    return mbc;
+    DEBUG_ASSERT(false, "Reading from invalid memory");
+    return 0xFF;
+}
+
+void MemoryBankController_MBC1M::WriteMemory(WORD address, BYTE data)
+{
+    if (address < 0x2000)
+    {
+        m_ramEnabled = (data & 0x0F) == 0x0A;
+        return;
+    }
+
+    // The bank is checked for zero before the fifth bit is dropped, so writing 10h maps a game's first bank at 4000-7FFF
+    if (address < 0x4000)
+    {
+        m_lowerBank = data & 0x1F;
+        if (m_lowerBank == 0x00)
+        {
+            m_lowerBank = 0x01;
+        }
+        MapBanks();
+        return;
+    }
+
+    if (address < 0x6000)
+    {
+        m_upperBank = data & 0x03;
+        MapBanks();
+        return;
+    }
+
+    // In mode 1 the upper bank also picks the game mapped at 0000-3FFF, and the RAM bank
+    if (address < 0x8000)
+    {
+        m_bankMode = data & 0x01;
+        MapBanks();
+        return;
+    }
+
+    if (address >= 0xA000 && address < 0xC000)
+    {
+        if (m_ramEnabled && m_ramSize > 0)
+        {
+            WriteRam(GetRamAddress(address), data);
+        }
+        return;
+    }
+
+    DEBUG_ASSERT(false, "Writing to invalid memory");
+}
+
+void MemoryBankController_MBC1M::MapBanks()
+{
+    MapRom(0x0000, m_bankMode ? m_upperBank << 4 : 0);
+    MapRom(0x4000, (m_upperBank << 4) | (m_lowerBank & 0x0F));
+}
+
+void MemoryBankController_MBC1M::SaveState(StateBuffer& state) const
+{
+    MemoryBankController::SaveState(state);
+    state.Write(m_ramEnabled);
+    state.Write(m_lowerBank);
+    state.Write(m_upperBank);
+    state.Write(m_bankMode);
+}
+
+void MemoryBankController_MBC1M::LoadState(StateBuffer& state)
+{
+    MemoryBankController::LoadState(state);
+    state.Read(m_ramEnabled);
+    state.Read(m_lowerBank);
+    state.Read(m_upperBank);
+    state.Read(m_bankMode);
+    MapBanks();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+MemoryBankController_MBC6::MemoryBankController_MBC6(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize) :
+    m_ramEnabled(0x00),
+    m_ramBanks(),
+    // Until the game picks its banks 4000-7FFF shows bank 1, as on every other controller
+    m_romBanks{ 0x02, 0x03 },
+    m_romSelects(),
+    m_erasedFlash(BANK_SIZE, 0xFF)
+{
+    // Max 1 mb of rom, 32 kb ram
+    DEBUG_ASSERT_N(romSize <= 0x10'0000);
+    DEBUG_ASSERT_N(ramSize <= 0x8000);
+
+    if (romSize > 0x10'0000)
+    {
+        romSize = 0x10'0000;
+    }
+
+    if (ramSize > 0x8000)
+    {
+        ramSize = 0x8000;
+    }
+
+    Initialize(cartridgeBuffer, bufferSize, romSize, ramSize);
+    MapBanks();
+}
+
+MemoryBankController_MBC6::~MemoryBankController_MBC6()
+{
+}
+
+BYTE MemoryBankController_MBC6::ReadMemory(WORD address)
+{
+    if (address >= 0xA000 && address < 0xC000)
+    {
+        if (m_ramEnabled && m_ramSize > 0)
+        {
+            return m_ram[GetRamAddress(address)];
+        }
+
+        return 0xFF;
+    }
+
+    DEBUG_ASSERT(false, "Reading from invalid memory");
+    return 0xFF;
+}
+
+void MemoryBankController_MBC6::WriteMemory(WORD address, BYTE data)
+{
+    if (address < 0x0400)
+    {
+        m_ramEnabled = (data & 0x0F) == 0x0A;
+        return;
+    }
+
+    if (address < 0x0800)
+    {
+        m_ramBanks[0] = data & 0x07;
+        return;
+    }
+
+    if (address < 0x0C00)
+    {
+        m_ramBanks[1] = data & 0x07;
+        return;
+    }
+
+    // 0C00-1FFF control writing to flash
+    if (address < 0x2000)
+    {
+        return;
+    }
+
+    // 2000-2FFF sets up 4000-5FFF and 3000-3FFF sets up 6000-7FFF, the bank number first and then ROM or flash
+    if (address < 0x4000)
+    {
+        int half = (address - 0x2000) / 0x1000;
+        if (address & 0x0800)
+        {
+            m_romSelects[half] = data;
+        }
+        else
+        {
+            m_romBanks[half] = data & 0x7F;
+        }
+        MapBanks();
+        return;
+    }
+
+    if (address < 0x8000)
+    {
+        return;
+    }
+
+    if (address >= 0xA000 && address < 0xC000)
+    {
+        if (m_ramEnabled && m_ramSize > 0)
+        {
+            WriteRam(GetRamAddress(address), data);
+        }
+        return;
+    }
+
+    DEBUG_ASSERT(false, "Writing to invalid memory");
+}
+
+void MemoryBankController_MBC6::MapBanks()
+{
+    for (int half = 0; half < 2; half++)
+    {
+        WORD address = 0x4000 + half * BANK_SIZE;
+        if (m_romSelects[half] == SELECT_FLASH)
+        {
+            MapOther(address, m_erasedFlash.data());
+        }
+        else
+        {
+            MapRom(address, m_romBanks[half], BANK_SIZE);
+        }
+    }
+}
+
+int MemoryBankController_MBC6::GetRamAddress(WORD address) const
+{
+    int half = (address - 0xA000) / RAM_HALF_BANK_SIZE;
+    return (m_ramBanks[half] * RAM_HALF_BANK_SIZE + (address & (RAM_HALF_BANK_SIZE - 1))) % m_ramSize;
+}
+
+void MemoryBankController_MBC6::SaveState(StateBuffer& state) const
+{
+    MemoryBankController::SaveState(state);
+    state.Write(m_ramEnabled);
+    state.Write(m_ramBanks);
+    state.Write(m_romBanks);
+    state.Write(m_romSelects);
+}
+
+void MemoryBankController_MBC6::LoadState(StateBuffer& state)
+{
+    MemoryBankController::LoadState(state);
+    state.Read(m_ramEnabled);
+    state.Read(m_ramBanks);
+    state.Read(m_romBanks);
+    state.Read(m_romSelects);
+    MapBanks();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+MemoryBankController_MBC7::MemoryBankController_MBC7(char* cartridgeBuffer, int bufferSize, int romSize) :
+    m_ramEnabled(0x00),
+    m_registersEnabled(0x00),
+    m_romBank(0x01),
+    m_accelerometerX(ACCELEROMETER_CENTER),
+    m_accelerometerY(ACCELEROMETER_CENTER),
+    m_accelerometerErased(false),
+    m_eepromPins(0x00),
+    m_eepromDataOut(EEPROM_DATA_OUT),
+    m_eepromState(EepromState::IDLE),
+    m_eepromBits(0),
+    m_eepromShift(0x0000),
+    m_eepromCommand(0x0000),
+    m_eepromWriteEnabled(false)
+{
+    // Max 2 mb of rom
+    DEBUG_ASSERT_N(romSize <= 0x20'0000);
+
+    if (romSize > 0x20'0000)
+    {
+        romSize = 0x20'0000;
+    }
+
+    // The EEPROM takes the place of RAM in the battery save, a blank one is all ones
+    Initialize(cartridgeBuffer, bufferSize, romSize, EEPROM_SIZE);
+    memset(m_ram, 0xFF, EEPROM_SIZE);
+}
+
+MemoryBankController_MBC7::~MemoryBankController_MBC7()
+{
+}
+
+BYTE MemoryBankController_MBC7::ReadMemory(WORD address)
+{
+    if (address >= 0xA000 && address < 0xC000)
+    {
+        // The registers repeat every 100h through A000-AFFF, B000-BFFF is open bus
+        if (address >= 0xB000 || !m_ramEnabled || !m_registersEnabled)
+        {
+            return 0xFF;
+        }
+
+        switch ((address >> 4) & 0x0F)
+        {
+        case 0x2:
+            return m_accelerometerX & 0xFF;
+        case 0x3:
+            return m_accelerometerX >> 8;
+        case 0x4:
+            return m_accelerometerY & 0xFF;
+        case 0x5:
+            return m_accelerometerY >> 8;
+        case 0x6:
+            // There is no Z axis
+            return 0x00;
+        case 0x8:
+            return m_eepromPins | m_eepromDataOut;
+        default:
+            return 0xFF;
+        }
+    }
+
+    DEBUG_ASSERT(false, "Reading from invalid memory");
+    return 0xFF;
+}
+
+void MemoryBankController_MBC7::WriteMemory(WORD address, BYTE data)
+{
+    if (address < 0x2000)
+    {
+        m_ramEnabled = (data & 0x0F) == 0x0A;
+        return;
+    }
+
+    if (address < 0x4000)
+    {
+        m_romBank = data & 0x7F;
+        MapRom(0x4000, m_romBank);
+        return;
+    }
+
+    if (address < 0x6000)
+    {
+        m_registersEnabled = data == 0x40;
+        return;
+    }
+
+    if (address < 0x8000)
+    {
+        return;
+    }
+
+    if (address >= 0xA000 && address < 0xC000)
+    {
+        if (address >= 0xB000 || !m_ramEnabled || !m_registersEnabled)
+        {
+            return;
+        }
+
+        switch ((address >> 4) & 0x0F)
+        {
+        case 0x0:
+            if (data == 0x55)
+            {
+                m_accelerometerErased = true;
+                m_accelerometerX = 0x8000;
+                m_accelerometerY = 0x8000;
+            }
+            return;
+        case 0x1:
+            if (data == 0xAA && m_accelerometerErased)
+            {
+                m_accelerometerErased = false;
+                m_accelerometerX = ACCELEROMETER_CENTER;
+                m_accelerometerY = ACCELEROMETER_CENTER;
+            }
+            return;
+        case 0x8:
+            WriteEeprom(data);
+            return;
+        }
+        return;
+    }
+
+    DEBUG_ASSERT(false, "Writing to invalid memory");
+}
+
+void MemoryBankController_MBC7::WriteEeprom(BYTE pins)
+{
+    bool risingClock = (pins & EEPROM_CLOCK) && !(m_eepromPins & EEPROM_CLOCK);
+    m_eepromPins = pins & (EEPROM_CHIP_SELECT | EEPROM_CLOCK | EEPROM_DATA_IN);
+
+    // Dropping chip select abandons whatever command was under way
+    if (!(pins & EEPROM_CHIP_SELECT))
+    {
+        m_eepromState = EepromState::IDLE;
+        m_eepromDataOut = EEPROM_DATA_OUT;
+        return;
+    }
+
+    if (!risingClock)
+    {
+        return;
+    }
+
+    WORD bit = (pins & EEPROM_DATA_IN) ? 1 : 0;
+    switch (m_eepromState)
+    {
+    case EepromState::IDLE:
+        // Every command starts with a 1, zeros before it are ignored
+        if (bit)
+        {
+            m_eepromState = EepromState::COMMAND;
+            m_eepromShift = 0x0000;
+            m_eepromBits = 0;
+        }
+        break;
+    case EepromState::COMMAND:
+        m_eepromShift = (m_eepromShift << 1) | bit;
+        if (++m_eepromBits == EEPROM_COMMAND_BITS)
+        {
+            RunEepromCommand();
+        }
+        break;
+    case EepromState::DATA:
+        m_eepromShift = (m_eepromShift << 1) | bit;
+        if (++m_eepromBits == 16)
+        {
+            FinishEepromWrite();
+        }
+        break;
+    case EepromState::READ:
+        // Most significant bit first
+        m_eepromDataOut = (m_eepromShift >> 15) & EEPROM_DATA_OUT;
+        m_eepromShift <<= 1;
+        if (--m_eepromBits == 0)
+        {
+            m_eepromState = EepromState::IDLE;
+        }
+        break;
+    }
+}
+
+void MemoryBankController_MBC7::RunEepromCommand()
+{
+    // Two opcode bits then the address, the 93LC56 has 128 words so the top address bit is ignored
+    int opcode = (m_eepromShift >> 8) & 0x03;
+    int wordAddress = m_eepromShift & 0x7F;
+    m_eepromState = EepromState::IDLE;
+    m_eepromDataOut = EEPROM_DATA_OUT;
+
+    switch (opcode)
+    {
+    case 0x0:
+        // Commands that don't need an address use its top two bits as more opcode
+        switch ((m_eepromShift >> 6) & 0x03)
+        {
+        case 0x0:
+            m_eepromWriteEnabled = false;
+            break;
+        case 0x1:
+            // Write all
+            m_eepromCommand = m_eepromShift;
+            m_eepromShift = 0x0000;
+            m_eepromBits = 0;
+            m_eepromState = EepromState::DATA;
+            break;
+        case 0x2:
+            // Erase all
+            if (m_eepromWriteEnabled)
+            {
+                for (int i = 0; i < EEPROM_SIZE / 2; i++)
+                {
+                    WriteEepromWord(i, 0xFFFF);
+                }
+            }
+            break;
+        case 0x3:
+            m_eepromWriteEnabled = true;
+            break;
+        }
+        break;
+    case 0x1:
+        // Write, the word follows
+        m_eepromCommand = m_eepromShift;
+        m_eepromShift = 0x0000;
+        m_eepromBits = 0;
+        m_eepromState = EepromState::DATA;
+        break;
+    case 0x2:
+        // Read, a dummy zero comes out before the word
+        m_eepromShift = m_ram[wordAddress * 2] | (m_ram[wordAddress * 2 + 1] << 8);
+        m_eepromBits = 16;
+        m_eepromDataOut = 0x00;
+        m_eepromState = EepromState::READ;
+        break;
+    case 0x3:
+        // Erase
+        if (m_eepromWriteEnabled)
+        {
+            WriteEepromWord(wordAddress, 0xFFFF);
+        }
+        break;
+    }
+}
+
+void MemoryBankController_MBC7::FinishEepromWrite()
+{
+    // Writes finish at once, so the chip reports itself ready straight away
+    m_eepromState = EepromState::IDLE;
+    m_eepromDataOut = EEPROM_DATA_OUT;
+    if (!m_eepromWriteEnabled)
+    {
+        return;
+    }
+
+    if (((m_eepromCommand >> 8) & 0x03) == 0x0)
+    {
+        for (int i = 0; i < EEPROM_SIZE / 2; i++)
+        {
+            WriteEepromWord(i, m_eepromShift);
+        }
+    }
+    else
+    {
+        WriteEepromWord(m_eepromCommand & 0x7F, m_eepromShift);
+    }
+}
+
+void MemoryBankController_MBC7::WriteEepromWord(int wordAddress, WORD value)
+{
+    // Little endian, as other emulators save it
+    WriteRam(wordAddress * 2, value & 0xFF);
+    WriteRam(wordAddress * 2 + 1, value >> 8);
+}
+
+void MemoryBankController_MBC7::SaveState(StateBuffer& state) const
+{
+    MemoryBankController::SaveState(state);
+    state.Write(m_ramEnabled);
+    state.Write(m_registersEnabled);
+    state.Write(m_romBank);
+    state.Write(m_accelerometerX);
+    state.Write(m_accelerometerY);
+    state.Write(m_accelerometerErased);
+    state.Write(m_eepromPins);
+    state.Write(m_eepromDataOut);
+    state.Write(m_eepromState);
+    state.Write(m_eepromBits);
+    state.Write(m_eepromShift);
+    state.Write(m_eepromCommand);
+    state.Write(m_eepromWriteEnabled);
+}
+
+void MemoryBankController_MBC7::LoadState(StateBuffer& state)
+{
+    MemoryBankController::LoadState(state);
+    state.Read(m_ramEnabled);
+    state.Read(m_registersEnabled);
+    state.Read(m_romBank);
+    state.Read(m_accelerometerX);
+    state.Read(m_accelerometerY);
+    state.Read(m_accelerometerErased);
+    state.Read(m_eepromPins);
+    state.Read(m_eepromDataOut);
+    state.Read(m_eepromState);
+    state.Read(m_eepromBits);
+    state.Read(m_eepromShift);
+    state.Read(m_eepromCommand);
+    state.Read(m_eepromWriteEnabled);
+    MapRom(0x4000, m_romBank);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+MemoryBankController_HuC1::MemoryBankController_HuC1(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize) :
+    m_infraredMode(0x00),
+    m_romBank(0x01),
+    m_ramBank(0x00)
+{
+    // Max 1 mb of rom, 32 kb ram
+    DEBUG_ASSERT_N(romSize <= 0x10'0000);
+    DEBUG_ASSERT_N(ramSize <= 0x8000);
+
+    if (romSize > 0x10'0000)
+    {
+        romSize = 0x10'0000;
+    }
+
+    if (ramSize > 0x8000)
+    {
+        ramSize = 0x8000;
+    }
+
+    Initialize(cartridgeBuffer, bufferSize, romSize, ramSize);
+}
+
+MemoryBankController_HuC1::~MemoryBankController_HuC1()
+{
+}
+
+BYTE MemoryBankController_HuC1::ReadMemory(WORD address)
+{
+    if (address >= 0xA000 && address < 0xC000)
+    {
+        // The receiver never sees any light
+        if (m_infraredMode)
+        {
+            return 0xC0;
+        }
+
+        if (m_ramSize > 0)
+        {
+            return m_ram[(address - 0xA000 + RAM_BANK_SIZE * m_ramBank) % m_ramSize];
+        }
+
+        return 0xFF;
+    }
+
+    DEBUG_ASSERT(false, "Reading from invalid memory");
+    return 0xFF;
+}
+
+void MemoryBankController_HuC1::WriteMemory(WORD address, BYTE data)
+{
+    // There is no RAM enable, instead 0Eh maps the infrared port and anything else maps RAM
+    if (address < 0x2000)
+    {
+        m_infraredMode = (data & 0x0F) == 0x0E;
+        return;
+    }
+
+    if (address < 0x4000)
+    {
+        m_romBank = data & 0x3F;
+        if (m_romBank == 0x00)
+        {
+            m_romBank = 0x01;
+        }
+        MapRom(0x4000, m_romBank);
+        return;
+    }
+
+    if (address < 0x6000)
+    {
+        m_ramBank = data & 0x03;
+        return;
+    }
+
+    if (address < 0x8000)
+    {
+        return;
+    }
+
+    if (address >= 0xA000 && address < 0xC000)
+    {
+        // Writes in infrared mode switch the LED, which nothing is watching
+        if (!m_infraredMode && m_ramSize > 0)
+        {
+            WriteRam((address - 0xA000 + RAM_BANK_SIZE * m_ramBank) % m_ramSize, data);
+        }
+        return;
+    }
+
+    DEBUG_ASSERT(false, "Writing to invalid memory");
+}
+
+void MemoryBankController_HuC1::SaveState(StateBuffer& state) const
+{
+    MemoryBankController::SaveState(state);
+    state.Write(m_infraredMode);
+    state.Write(m_romBank);
+    state.Write(m_ramBank);
+}
+
+void MemoryBankController_HuC1::LoadState(StateBuffer& state)
+{
+    MemoryBankController::LoadState(state);
+    state.Read(m_infraredMode);
+    state.Read(m_romBank);
+    state.Read(m_ramBank);
+    MapRom(0x4000, m_romBank);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+MemoryBankController_HuC3::MemoryBankController_HuC3(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize) :
+    m_mode(MODE_RAM_READ),
+    m_romBank(0x01),
+    m_ramBank(0x00),
+    m_clockCommand(0x00),
+    m_clockResult(0x00),
+    m_clockAddress(0x00),
+    m_clockMemory(),
+    m_seconds(0),
+    m_minutes(0),
+    m_days(0),
+    m_clockSyncCycle(0),
+    m_clockSubSecondCycles(0)
+{
+    // Max 2 mb of rom, 32 kb ram
+    DEBUG_ASSERT_N(romSize <= 0x20'0000);
+    DEBUG_ASSERT_N(ramSize <= 0x8000);
+
+    if (romSize > 0x20'0000)
+    {
+        romSize = 0x20'0000;
+    }
+
+    if (ramSize > 0x8000)
+    {
+        ramSize = 0x8000;
+    }
+
+    Initialize(cartridgeBuffer, bufferSize, romSize, ramSize);
+}
+
+MemoryBankController_HuC3::~MemoryBankController_HuC3()
+{
+}
+
+BYTE MemoryBankController_HuC3::ReadMemory(WORD address)
+{
+    if (address >= 0xA000 && address < 0xC000)
+    {
+        switch (m_mode)
+        {
+        case MODE_RAM_READ:
+        case MODE_RAM_WRITE:
+            if (m_ramSize > 0)
+            {
+                return m_ram[(address - 0xA000 + RAM_BANK_SIZE * m_ramBank) % m_ramSize];
+            }
+            return 0xFF;
+        case MODE_CLOCK_RESULT:
+            // The command is echoed in the upper nibble
+            return (m_clockCommand & 0xF0) | m_clockResult;
+        case MODE_CLOCK_SEMAPHORE:
+            // Commands finish as soon as they are run, so the clock is always ready
+            return 0x01;
+        case MODE_INFRARED:
+            return 0xC0;
+        default:
+            return 0xFF;
+        }
+    }
+
+    DEBUG_ASSERT(false, "Reading from invalid memory");
+    return 0xFF;
+}
+
+void MemoryBankController_HuC3::WriteMemory(WORD address, BYTE data)
+{
+    if (address < 0x2000)
+    {
+        m_mode = data & 0x0F;
+        return;
+    }
+
+    if (address < 0x4000)
+    {
+        m_romBank = data & 0x7F;
+        if (m_romBank == 0x00)
+        {
+            m_romBank = 0x01;
+        }
+        MapRom(0x4000, m_romBank);
+        return;
+    }
+
+    if (address < 0x6000)
+    {
+        m_ramBank = data & 0x03;
+        return;
+    }
+
+    if (address < 0x8000)
+    {
+        return;
+    }
+
+    if (address >= 0xA000 && address < 0xC000)
+    {
+        switch (m_mode)
+        {
+        case MODE_RAM_WRITE:
+            if (m_ramSize > 0)
+            {
+                WriteRam((address - 0xA000 + RAM_BANK_SIZE * m_ramBank) % m_ramSize, data);
+            }
+            return;
+        case MODE_CLOCK_COMMAND:
+            m_clockCommand = data;
+            return;
+        case MODE_CLOCK_SEMAPHORE:
+            // Clearing bit 0 runs the command
+            if (!(data & 0x01))
+            {
+                RunClockCommand();
+            }
+            return;
+        default:
+            return;
+        }
+    }
+
+    DEBUG_ASSERT(false, "Writing to invalid memory");
+}
+
+void MemoryBankController_HuC3::RunClockCommand()
+{
+    BYTE argument = m_clockCommand & 0x0F;
+    switch (m_clockCommand >> 4)
+    {
+    case 0x1:
+        // Read a nibble and move to the next
+        m_clockResult = m_clockMemory[m_clockAddress++];
+        break;
+    case 0x3:
+        // Write a nibble and move to the next
+        m_clockMemory[m_clockAddress++] = argument;
+        break;
+    case 0x4:
+        m_clockAddress = (m_clockAddress & 0xF0) | argument;
+        break;
+    case 0x5:
+        m_clockAddress = (m_clockAddress & 0x0F) | (argument << 4);
+        break;
+    case 0x6:
+        switch (argument)
+        {
+        case 0x0:
+            ReadTime();
+            break;
+        case 0x1:
+            WriteTime();
+            break;
+        case 0x2:
+            // Status, always ready
+            m_clockResult = 0x01;
+            break;
+        }
+        break;
+    }
+}
+
+void MemoryBankController_HuC3::ReadTime()
+{
+    for (int i = 0; i < 3; i++)
+    {
+        m_clockMemory[i] = (m_minutes >> (i * 4)) & 0x0F;
+        m_clockMemory[3 + i] = (m_days >> (i * 4)) & 0x0F;
+    }
+}
+
+void MemoryBankController_HuC3::WriteTime()
+{
+    int minutes = 0;
+    int days = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        minutes |= m_clockMemory[i] << (i * 4);
+        days |= m_clockMemory[3 + i] << (i * 4);
+    }
+
+    m_seconds = 0;
+    m_minutes = static_cast<WORD>(minutes % MINUTES_PER_DAY);
+    m_days = static_cast<WORD>(days);
+    m_clockSubSecondCycles = 0;
+}
+
+void MemoryBankController_HuC3::SyncClock(uint64_t clockCycle)
+{
+    if (clockCycle <= m_clockSyncCycle)
+    {
+        return;
+    }
+
+    m_clockSubSecondCycles += clockCycle - m_clockSyncCycle;
+    m_clockSyncCycle = clockCycle;
+    if (m_clockSubSecondCycles >= CLOCK_CYCLES_PER_SECOND)
+    {
+        AdvanceClock(m_clockSubSecondCycles / CLOCK_CYCLES_PER_SECOND);
+        m_clockSubSecondCycles %= CLOCK_CYCLES_PER_SECOND;
+    }
+}
+
+void MemoryBankController_HuC3::RebaseClock(uint64_t clockCycle)
+{
+    m_clockSyncCycle = clockCycle;
+}
+
+void MemoryBankController_HuC3::GetClock(ClockRegisters& current, ClockRegisters& latched) const
+{
+    current.seconds = m_seconds;
+    current.minutes = m_minutes % 60;
+    current.hours = static_cast<BYTE>(m_minutes / 60);
+    current.daysLow = m_days & 0xFF;
+    current.daysHigh = static_cast<BYTE>(m_days >> 8);
+    // Nothing is latched, the game reads the clock through its memory
+    latched = current;
+}
+
+void MemoryBankController_HuC3::SetClock(const ClockRegisters& current, const ClockRegisters& latched)
+{
+    m_seconds = current.seconds % 60;
+    m_minutes = static_cast<WORD>((current.hours * 60 + current.minutes) % MINUTES_PER_DAY);
+    m_days = static_cast<WORD>(current.daysLow | ((current.daysHigh & 0x0F) << 8));
+    m_clockSubSecondCycles = 0;
+}
+
+void MemoryBankController_HuC3::AdvanceClock(uint64_t seconds)
+{
+    uint64_t totalSeconds = m_seconds + seconds;
+    m_seconds = static_cast<BYTE>(totalSeconds % 60);
+
+    uint64_t totalMinutes = m_minutes + totalSeconds / 60;
+    m_minutes = static_cast<WORD>(totalMinutes % MINUTES_PER_DAY);
+    m_days = static_cast<WORD>((m_days + totalMinutes / MINUTES_PER_DAY) & DAY_MASK);
+}
+
+void MemoryBankController_HuC3::SaveState(StateBuffer& state) const
+{
+    MemoryBankController::SaveState(state);
+    state.Write(m_mode);
+    state.Write(m_romBank);
+    state.Write(m_ramBank);
+    state.Write(m_clockCommand);
+    state.Write(m_clockResult);
+    state.Write(m_clockAddress);
+    state.Write(m_clockMemory);
+    state.Write(m_seconds);
+    state.Write(m_minutes);
+    state.Write(m_days);
+    state.Write(m_clockSyncCycle);
+    state.Write(m_clockSubSecondCycles);
+}
+
+void MemoryBankController_HuC3::LoadState(StateBuffer& state)
+{
+    MemoryBankController::LoadState(state);
+    state.Read(m_mode);
+    state.Read(m_romBank);
+    state.Read(m_ramBank);
+    state.Read(m_clockCommand);
+    state.Read(m_clockResult);
+    state.Read(m_clockAddress);
+    state.Read(m_clockMemory);
+    state.Read(m_seconds);
+    state.Read(m_minutes);
+    state.Read(m_days);
+    state.Read(m_clockSyncCycle);
+    state.Read(m_clockSubSecondCycles);
+    MapRom(0x4000, m_romBank);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+MemoryBankController_MMM01::MemoryBankController_MMM01(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize) :
+    m_ramEnabled(0x00),
+    m_locked(false),
+    m_romBankLow(0x00),
+    m_romBankMid(0x00),
+    m_romBankHigh(0x00),
+    m_romBankMask(0x00),
+    m_ramBankLow(0x00),
+    m_ramBankHigh(0x00),
+    m_ramBankMask(0x00),
+    m_bankMode(0x00),
+    m_bankModeLocked(false)
+{
+    // Max 8 mb of rom, 128 kb ram
+    DEBUG_ASSERT_N(romSize <= 0x80'0000);
+    DEBUG_ASSERT_N(ramSize <= 0x2'0000);
+
+    if (romSize > 0x80'0000)
+    {
+        romSize = 0x80'0000;
+    }
+
+    if (ramSize > 0x2'0000)
+    {
+        ramSize = 0x2'0000;
+    }
+
+    Initialize(cartridgeBuffer, bufferSize, romSize, ramSize);
+    MapBanks();
+}
+
+MemoryBankController_MMM01::~MemoryBankController_MMM01()
+{
+}
+
+bool MemoryBankController_MMM01::IsMulticart(const char* cartridgeBuffer, int bufferSize)
+{
+    const int menuStart = bufferSize - 0x8000;
+    const int logoAddress = 0x104;
+    const int logoSize = 0x30;
+    if (bufferSize < 0x1'0000 || bufferSize % 0x8000 != 0)
+    {
+        return false;
+    }
+
+    BYTE menuType = cartridgeBuffer[menuStart + 0x147];
+    return menuType >= 0x0B && menuType <= 0x0D && memcmp(cartridgeBuffer + logoAddress, cartridgeBuffer + menuStart + logoAddress, logoSize) == 0;
+}
+
+BYTE MemoryBankController_MMM01::ReadMemory(WORD address)
+{
+    if (address >= 0xA000 && address < 0xC000)
+    {
+        if (m_ramEnabled && m_ramSize > 0)
+        {
+            return m_ram[GetRamAddress(address)];
+        }
+
+        return 0xFF;
+    }
+
+    DEBUG_ASSERT(false, "Reading from invalid memory");
+    return 0xFF;
+}
+
+void MemoryBankController_MMM01::WriteMemory(WORD address, BYTE data)
+{
+    // Once locked, only the parts of each register an MBC1 has can still be written
+    if (address < 0x2000)
+    {
+        m_ramEnabled = (data & 0x0F) == 0x0A;
+        if (!m_locked)
+        {
+            m_ramBankMask = (data >> 4) & 0x03;
+            m_locked = data & 0x40;
+            MapBanks();
+        }
+        return;
+    }
+
+    if (address < 0x4000)
+    {
+        BYTE fixedBits = m_locked ? m_romBankMask << 1 : 0x00;
+        m_romBankLow = (m_romBankLow & fixedBits) | (data & 0x1F & ~fixedBits);
+        if (!m_locked)
+        {
+            m_romBankMid = (data >> 5) & 0x03;
+        }
+        MapBanks();
+        return;
+    }
+
+    if (address < 0x6000)
+    {
+        BYTE fixedBits = m_locked ? m_ramBankMask : 0x00;
+        m_ramBankLow = (m_ramBankLow & fixedBits) | (data & 0x03 & ~fixedBits);
+        if (!m_locked)
+        {
+            m_ramBankHigh = (data >> 2) & 0x03;
+            m_romBankHigh = (data >> 4) & 0x03;
+            m_bankModeLocked = data & 0x40;
+        }
+        MapBanks();
+        return;
+    }
+
+    if (address < 0x8000)
+    {
+        if (!m_bankModeLocked)
+        {
+            m_bankMode = data & 0x01;
+        }
+        if (!m_locked)
+        {
+            m_romBankMask = (data >> 2) & 0x0F;
+        }
+        MapBanks();
+        return;
+    }
+
+    if (address >= 0xA000 && address < 0xC000)
+    {
+        if (m_ramEnabled && m_ramSize > 0)
+        {
+            WriteRam(GetRamAddress(address), data);
+        }
+        return;
+    }
+
+    DEBUG_ASSERT(false, "Writing to invalid memory");
+}
+
+void MemoryBankController_MMM01::MapBanks()
+{
+    if (!m_locked)
+    {
+        int lastBank = m_romSize / ROM_BANK_SIZE - 1;
+        MapRom(0x0000, lastBank - 1);
+        MapRom(0x4000, lastBank);
+        return;
+    }
+
+    // The game's bank 0 is wherever the menu's fixed bits put it, and like on an MBC1 it can't be mapped twice
+    int outerBank = (m_romBankMid << 5) | (m_romBankHigh << 7);
+    BYTE fixedBits = m_romBankMask << 1;
+    int lowBank = m_romBankLow;
+    if ((lowBank & ~fixedBits & 0x1F) == 0)
+    {
+        lowBank |= 0x01;
+    }
+
+    MapRom(0x0000, outerBank | (m_romBankLow & fixedBits));
+    MapRom(0x4000, outerBank | lowBank);
+}
+
+int MemoryBankController_MMM01::GetRamAddress(WORD address) const
+{
+    // As on an MBC1, the game's RAM bank only applies in mode 1
+    int bank = (m_bankMode ? m_ramBankLow : m_ramBankLow & m_ramBankMask) | (m_ramBankHigh << 2);
+    return (address - 0xA000 + RAM_BANK_SIZE * bank) % m_ramSize;
+}
+
+void MemoryBankController_MMM01::SaveState(StateBuffer& state) const
+{
+    MemoryBankController::SaveState(state);
+    state.Write(m_ramEnabled);
+    state.Write(m_locked);
+    state.Write(m_romBankLow);
+    state.Write(m_romBankMid);
+    state.Write(m_romBankHigh);
+    state.Write(m_romBankMask);
+    state.Write(m_ramBankLow);
+    state.Write(m_ramBankHigh);
+    state.Write(m_ramBankMask);
+    state.Write(m_bankMode);
+    state.Write(m_bankModeLocked);
+}
+
+void MemoryBankController_MMM01::LoadState(StateBuffer& state)
+{
+    MemoryBankController::LoadState(state);
+    state.Read(m_ramEnabled);
+    state.Read(m_locked);
+    state.Read(m_romBankLow);
+    state.Read(m_romBankMid);
+    state.Read(m_romBankHigh);
+    state.Read(m_romBankMask);
+    state.Read(m_ramBankLow);
+    state.Read(m_ramBankHigh);
+    state.Read(m_ramBankMask);
+    state.Read(m_bankMode);
+    state.Read(m_bankModeLocked);
+    MapBanks();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+MemoryBankController_Camera::MemoryBankController_Camera(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize) :
+    m_ramWriteEnabled(0x00),
+    m_romBank(0x01),
+    m_ramBank(0x00),
+    m_registers()
+{
+    // Max 1 mb of rom, 128 kb ram
+    DEBUG_ASSERT_N(romSize <= 0x10'0000);
+    DEBUG_ASSERT_N(ramSize <= 0x2'0000);
+
+    if (romSize > 0x10'0000)
+    {
+        romSize = 0x10'0000;
+    }
+
+    if (ramSize > 0x2'0000)
+    {
+        ramSize = 0x2'0000;
+    }
+
+    Initialize(cartridgeBuffer, bufferSize, romSize, ramSize);
+}
+
+MemoryBankController_Camera::~MemoryBankController_Camera()
+{
+}
+
+BYTE MemoryBankController_Camera::ReadMemory(WORD address)
+{
+    if (address >= 0xA000 && address < 0xC000)
+    {
+        // Only A000 of the registers can be read, the rest read as zero. They repeat every 80h.
+        if (m_ramBank & REGISTER_BANK)
+        {
+            return (address & 0x7F) == 0 ? m_registers[0] : 0x00;
+        }
+
+        // Reading RAM doesn't need it to be enabled
+        if (m_ramSize > 0)
+        {
+            return m_ram[(address - 0xA000 + RAM_BANK_SIZE * m_ramBank) % m_ramSize];
+        }
+
+        return 0xFF;
+    }
+
+    DEBUG_ASSERT(false, "Reading from invalid memory");
+    return 0xFF;
+}
+
+void MemoryBankController_Camera::WriteMemory(WORD address, BYTE data)
+{
+    if (address < 0x2000)
+    {
+        m_ramWriteEnabled = (data & 0x0F) == 0x0A;
+        return;
+    }
+
+    // Bank 0 can be mapped at 4000-7FFF
+    if (address < 0x4000)
+    {
+        m_romBank = data & 0x3F;
+        MapRom(0x4000, m_romBank);
+        return;
+    }
+
+    if (address < 0x6000)
+    {
+        m_ramBank = data & 0x1F;
+        return;
+    }
+
+    if (address < 0x8000)
+    {
+        return;
+    }
+
+    if (address >= 0xA000 && address < 0xC000)
+    {
+        if (m_ramBank & REGISTER_BANK)
+        {
+            int index = address & 0x7F;
+            if (index == 0)
+            {
+                m_registers[0] = data & 0x07;
+                if (data & 0x01)
+                {
+                    Capture();
+                    m_registers[0] &= ~0x01;
+                }
+            }
+            else if (index < REGISTER_COUNT)
+            {
+                m_registers[index] = data;
+            }
+            return;
+        }
+
+        if (m_ramWriteEnabled && m_ramSize > 0)
+        {
+            WriteRam((address - 0xA000 + RAM_BANK_SIZE * m_ramBank) % m_ramSize, data);
+        }
+        return;
+    }
+
+    DEBUG_ASSERT(false, "Writing to invalid memory");
+}
+
+void MemoryBankController_Camera::Capture()
+{
+    // The picture is stored as 16x14 tiles of 2 bits per pixel, in RAM bank 0
+    BYTE image[SENSOR_WIDTH * SENSOR_HEIGHT / 4] = {};
+    for (int y = 0; y < SENSOR_HEIGHT; y++)
+    {
+        for (int x = 0; x < SENSOR_WIDTH; x++)
+        {
+            int light = (x + y) * 0xFF / (SENSOR_WIDTH + SENSOR_HEIGHT - 2);
+
+            // Darker than the first threshold is black, lighter than the last is white
+            const BYTE* thresholds = m_registers + DITHER_REGISTER + ((y & 3) * 4 + (x & 3)) * 3;
+            int shade = light < thresholds[0] ? 3 : light < thresholds[1] ? 2 : light < thresholds[2] ? 1 : 0;
+
+            int tile = (y / 8) * (SENSOR_WIDTH / 8) + x / 8;
+            int row = tile * 16 + (y & 7) * 2;
+            BYTE bit = 0x80 >> (x & 7);
+            if (shade & 0x01)
+            {
+                image[row] |= bit;
+            }
+            if (shade & 0x02)
+            {
+                image[row + 1] |= bit;
+            }
+        }
+    }
+
+    if (m_ramSize < IMAGE_ADDRESS + static_cast<int>(sizeof(image)))
+    {
+        return;
+    }
+
+    for (int i = 0; i < static_cast<int>(sizeof(image)); i++)
+    {
+        WriteRam(IMAGE_ADDRESS + i, image[i]);
+    }
+}
+
+void MemoryBankController_Camera::SaveState(StateBuffer& state) const
+{
+    MemoryBankController::SaveState(state);
+    state.Write(m_ramWriteEnabled);
+    state.Write(m_romBank);
+    state.Write(m_ramBank);
+    state.Write(m_registers);
+}
+
+void MemoryBankController_Camera::LoadState(StateBuffer& state)
+{
+    MemoryBankController::LoadState(state);
+    state.Read(m_ramWriteEnabled);
+    state.Read(m_romBank);
+    state.Read(m_ramBank);
+    state.Read(m_registers);
+    MapRom(0x4000, m_romBank);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+MemoryBankController* MemoryBankControllerFactory::CreateMemoryBank(BYTE type, BYTE romSize, BYTE ramSize, char* cartridgeBuffer, int bufferLength)
+{
+    // The odd sized codes 52h-54h were never used, a ROM claiming one is taken at its word on the file's size
+    int actualRomSize = romSize <= 0x08 ? 0x8000 << romSize : (bufferLength + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE * ROM_BANK_SIZE;
+    int actualRamSize = 0;
+
+    switch (ramSize)
+    {
+    case 0x00:
+    case 0x01:
+        actualRamSize = 0;
+        break;
+    case 0x02:
+        actualRamSize = 0x2000;
+        break;
+    case 0x03:
+        actualRamSize = 0x8000;
+        break;
+    case 0x04:
+        actualRamSize = 0x2'0000;
+        break;
+    case 0x05:
+        actualRamSize = 0x1'0000;
+        break;
+    }
+
+    MemoryBankController* mbc = nullptr;
+    switch (type)
+    {
+    case 0x00:
+        actualRamSize = 0;
+        [[fallthrough]];
+    case 0x08:
+    case 0x09:
+        mbc = new MemoryBankController_None(cartridgeBuffer, bufferLength, actualRomSize, actualRamSize);
+        break;
+    case 0x01:
+        actualRamSize = 0;
+        [[fallthrough]];
+    case 0x02:
+    case 0x03:
+        if (MemoryBankController_MBC1M::IsMulticart(cartridgeBuffer, bufferLength))
+        {
+            mbc = new MemoryBankController_MBC1M(cartridgeBuffer, bufferLength, actualRomSize, actualRamSize);
+        }
+        else
+        {
+            mbc = new MemoryBankController_MBC1(cartridgeBuffer, bufferLength, actualRomSize, actualRamSize);
+        }
+        break;
+    case 0x05:
+    case 0x06:
+        mbc = new MemoryBankController_MBC2(cartridgeBuffer, bufferLength, actualRomSize);
+        break;
+    case 0x0B:
+        actualRamSize = 0;
+        [[fallthrough]];
+    case 0x0C:
+    case 0x0D:
+        // The menu's header describes the whole cart, but the whole file is mapped whatever it says
+        mbc = new MemoryBankController_MMM01(cartridgeBuffer, bufferLength, std::max(actualRomSize, bufferLength), actualRamSize);
+        break;
+    case 0x0F:
+    case 0x11:
+        actualRamSize = 0;
+        [[fallthrough]];
+    case 0x10:
+    case 0x12:
+    case 0x13:
+        mbc = new MemoryBankController_MBC3(cartridgeBuffer, bufferLength, actualRomSize, actualRamSize, type == 0x0F || type == 0x10);
+        break;
+    case 0x19:
+    case 0x1C:
+        actualRamSize = 0;
+        [[fallthrough]];
+    case 0x1A:
+    case 0x1B:
+    case 0x1D:
+    case 0x1E:
+        mbc = new MemoryBankController_MBC5(cartridgeBuffer, bufferLength, actualRomSize, actualRamSize);
+        break;
+    case 0x20:
+        mbc = new MemoryBankController_MBC6(cartridgeBuffer, bufferLength, actualRomSize, actualRamSize);
+        break;
+    case 0x22:
+        mbc = new MemoryBankController_MBC7(cartridgeBuffer, bufferLength, actualRomSize);
+        break;
+    case 0xFC:
+        mbc = new MemoryBankController_Camera(cartridgeBuffer, bufferLength, actualRomSize, actualRamSize);
+        break;
+    case 0xFE:
+        mbc = new MemoryBankController_HuC3(cartridgeBuffer, bufferLength, actualRomSize, actualRamSize);
+        break;
+    case 0xFF:
+        mbc = new MemoryBankController_HuC1(cartridgeBuffer, bufferLength, actualRomSize, actualRamSize);
+        break;
+    }
+
+    return mbc;
+}
+
+bool MemoryBankControllerFactory::IsSupported(BYTE type)
+{
+    switch (type)
+    {
+    case 0x00: case 0x01: case 0x02: case 0x03:
+    case 0x05: case 0x06:
+    case 0x08: case 0x09:
+    case 0x0B: case 0x0C: case 0x0D:
+    case 0x0F: case 0x10: case 0x11: case 0x12: case 0x13:
+    case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E:
+    case 0x20:
+    case 0x22:
+    case 0xFC:
+    case 0xFE:
+    case 0xFF:
+        return true;
+    default:
+        return false;
+    }
 }
@@ -0,0 +1,256 @@
+#include "stdafx.h"
+
+#include <cstring>
+#include <fstream>
+
+#include "header/Cartridge.h"
+#include "header/CPU.h"
+#include "header/Hash.h"
+#include "header/Movie.h"
+
+Movie::Movie() :
+	m_romHash(0),
+	m_frameCount(0),
+	m_initialState(),
+	m_writes(),
+	m_recording(false),
+	m_playing(false),
+	m_currentFrame(0),
+	m_nextWrite(0)
+{
+}
+
+void Movie::BeginRecording(CPU& sm83, const Cartridge& cart)
+{
+	m_romHash = GetRomHash(cart);
+	m_frameCount = 0;
+	m_writes.clear();
+	sm83.SaveState(m_initialState);
+
+	m_recording = true;
+	m_playing = false;
+	m_currentFrame = 0;
+}
+
+void Movie::RecordJoypad(const Joypad& joypad)
+{
+	if (m_recording)
+	{
+		m_writes.push_back({ m_currentFrame, PackJoypad(joypad) });
+	}
+}
+
+void Movie::EndFrame()
+{
+	if (m_recording)
+	{
+		++m_currentFrame;
+		m_frameCount = m_currentFrame;
+	}
+}
+
+bool Movie::StopRecording(const std::string& filePath)
+{
+	m_recording = false;
+
+	std::ofstream out(filePath, std::ios_base::out | std::ios_base::binary);
+	if (!out)
+	{
+		return false;
+	}
+
+	out.write("GBMV", 4);
+	WriteUInt32(out, VERSION);
+	WriteUInt32(out, m_romHash);
+	WriteUInt32(out, m_frameCount);
+
+	WriteUInt32(out, static_cast<uint32_t>(m_initialState.GetSize()));
+	out.write(reinterpret_cast<const char*>(m_initialState.GetData()), m_initialState.GetSize());
+
+	WriteUInt32(out, static_cast<uint32_t>(m_writes.size()));
+	uint32_t previousFrame = 0;
+	for (const JoypadWrite& write : m_writes)
+	{
+		WriteVarint(out, write.frame - previousFrame);
+		out.put(static_cast<char>(write.buttons));
+		previousFrame = write.frame;
+	}
+
+	return static_cast<bool>(out);
+}
+
+bool Movie::Load(const std::string& filePath)
+{
+	m_recording = false;
+	m_playing = false;
+
+	std::ifstream in(filePath, std::ios_base::in | std::ios_base::binary);
+
+	char magic[4];
+	uint32_t version;
+	if (!in.read(magic, sizeof(magic)) || memcmp(magic, "GBMV", sizeof(magic)) != 0 || !ReadUInt32(in, version) || version != VERSION)
+	{
+		return false;
+	}
+
+	uint32_t stateSize;
+	if (!ReadUInt32(in, m_romHash) || !ReadUInt32(in, m_frameCount) || !ReadUInt32(in, stateSize) || stateSize > MAX_STATE_SIZE)
+	{
+		return false;
+	}
+
+	std::vector<BYTE> state(stateSize);
+	if (!in.read(reinterpret_cast<char*>(state.data()), stateSize))
+	{
+		return false;
+	}
+	m_initialState.SetData(state.data(), state.size());
+
+	uint32_t writeCount;
+	if (!ReadUInt32(in, writeCount) || writeCount > MAX_WRITES)
+	{
+		return false;
+	}
+
+	m_writes.clear();
+	m_writes.reserve(writeCount);
+	uint32_t frame = 0;
+	for (uint32_t i = 0; i < writeCount; ++i)
+	{
+		uint32_t frameDelta;
+		int buttons;
+		if (!ReadVarint(in, frameDelta) || (buttons = in.get()) == EOF)
+		{
+			return false;
+		}
+
+		frame += frameDelta;
+		m_writes.push_back({ frame, static_cast<BYTE>(buttons) });
+	}
+
+	return true;
+}
+
+bool Movie::BeginPlayback(CPU& sm83, const Cartridge& cart)
+{
+	if (GetRomHash(cart) != m_romHash)
+	{
+		return false;
+	}
+
+	// A short state would leave part of the machine as it was, rather than fail to load
+	StateBuffer currentState;
+	sm83.SaveState(currentState);
+	if (currentState.GetSize() != m_initialState.GetSize())
+	{
+		return false;
+	}
+
+	sm83.LoadState(m_initialState);
+
+	m_recording = false;
+	m_playing = true;
+	m_currentFrame = 0;
+	m_nextWrite = 0;
+	return true;
+}
+
+bool Movie::PlayFrame(CPU& sm83)
+{
+	if (!m_playing || m_currentFrame >= m_frameCount)
+	{
+		m_playing = false;
+		return false;
+	}
+
+	for (; m_nextWrite < m_writes.size() && m_writes[m_nextWrite].frame == m_currentFrame; ++m_nextWrite)
+	{
+		sm83.WriteJoypad(UnpackJoypad(m_writes[m_nextWrite].buttons));
+	}
+
+	++m_currentFrame;
+	return true;
+}
+
+uint32_t Movie::GetRomHash(const Cartridge& cart)
+{
+	BYTE* rom;
+	int romSize = cart.DumpRom(rom);
+	return Hash::CRC32(rom, romSize);
+}
+
+BYTE Movie::PackJoypad(const Joypad& joypad)
+{
+	return (joypad.a		? BIT_0 : 0)
+		| (joypad.b			? BIT_1 : 0)
+		| (joypad.select	? BIT_2 : 0)
+		| (joypad.start		? BIT_3 : 0)
+		| (joypad.right		? BIT_4 : 0)
+		| (joypad.left		? BIT_5 : 0)
+		| (joypad.up		? BIT_6 : 0)
+		| (joypad.down		? BIT_7 : 0);
+}
+
+Joypad Movie::UnpackJoypad(BYTE buttons)
+{
+	Joypad joypad;
+	joypad.a = buttons & BIT_0;
+	joypad.b = buttons & BIT_1;
+	joypad.select = buttons & BIT_2;
+	joypad.start = buttons & BIT_3;
+	joypad.right = buttons & BIT_4;
+	joypad.left = buttons & BIT_5;
+	joypad.up = buttons & BIT_6;
+	joypad.down = buttons & BIT_7;
+	return joypad;
+}
+
+void Movie::WriteUInt32(std::ostream& out, uint32_t value)
+{
+	BYTE bytes[4] = { BYTE(value), BYTE(value >> 8), BYTE(value >> 16), BYTE(value >> 24) };
+	out.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+}
+
+bool Movie::ReadUInt32(std::istream& in, uint32_t& value)
+{
+	BYTE bytes[4];
+	if (!in.read(reinterpret_cast<char*>(bytes), sizeof(bytes)))
+	{
+		return false;
+	}
+
+	value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (uint32_t(bytes[3]) << 24);
+	return true;
+}
+
+// Frame deltas are almost always small, so they are stored 7 bits at a time
+void Movie::WriteVarint(std::ostream& out, uint32_t value)
+{
+	while (value >= 0x80)
+	{
+		out.put(static_cast<char>((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	out.put(static_cast<char>(value));
+}
+
+bool Movie::ReadVarint(std::istream& in, uint32_t& value)
+{
+	value = 0;
+	for (int shift = 0; shift < 35; shift += 7)
+	{
+		int byte = in.get();
+		if (byte == EOF)
+		{
+			return false;
+		}
+
+		value |= uint32_t(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,421 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <random>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define CLOSE_SOCKET closesocket
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define CLOSE_SOCKET close
+#endif
+
+#include "header/Cartridge.h"
+#include "header/CPU.h"
+#include "header/Debug.h"
+#include "header/Hash.h"
+#include "header/Movie.h"
+#include "header/Netplay.h"
+
+Netplay::Netplay() :
+	m_sm83(nullptr),
+	m_inputs(),
+	m_states(),
+	m_frame(0),
+	m_remoteInputFrame(0),
+	m_remoteAckFrame(0),
+	m_rollbackFrame(NO_ROLLBACK),
+	m_rollbackFrames(0),
+	m_rollbackCount(0),
+	m_socket(-1)
+{
+#if defined(_WIN32)
+	static const bool winsockStarted = []()
+	{
+		WSADATA data;
+		return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+	}();
+	(void)winsockStarted;
+#endif
+}
+
+Netplay::~Netplay()
+{
+	Stop();
+}
+
+void Netplay::Start(CPU& sm83)
+{
+	m_sm83 = &sm83;
+	memset(m_inputs, 0, sizeof(m_inputs));
+	m_frame = 0;
+	m_remoteInputFrame = 0;
+	m_remoteAckFrame = 0;
+	m_rollbackFrame = NO_ROLLBACK;
+	m_rollbackFrames = 0;
+	m_rollbackCount = 0;
+}
+
+bool Netplay::Connect(uint16_t localPort, const std::string& remoteAddress, uint16_t remotePort)
+{
+	Stop();
+
+	sockaddr_in localAddress = {};
+	localAddress.sin_family = AF_INET;
+	localAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+	localAddress.sin_port = htons(localPort);
+
+	sockaddr_in peerAddress = {};
+	peerAddress.sin_family = AF_INET;
+	peerAddress.sin_port = htons(remotePort);
+	if (inet_pton(AF_INET, remoteAddress.c_str(), &peerAddress.sin_addr) != 1)
+	{
+		return false;
+	}
+
+	intptr_t udpSocket = static_cast<intptr_t>(socket(AF_INET, SOCK_DGRAM, 0));
+	if (udpSocket == -1)
+	{
+		return false;
+	}
+
+	// Connecting a UDP socket only fixes where packets go, and drops packets from anyone else
+	if (bind(udpSocket, reinterpret_cast<sockaddr*>(&localAddress), sizeof(localAddress)) != 0 ||
+		connect(udpSocket, reinterpret_cast<sockaddr*>(&peerAddress), sizeof(peerAddress)) != 0)
+	{
+		CLOSE_SOCKET(udpSocket);
+		return false;
+	}
+
+	m_socket = udpSocket;
+	return true;
+}
+
+void Netplay::Stop()
+{
+	if (m_socket != -1)
+	{
+		CLOSE_SOCKET(m_socket);
+		m_socket = -1;
+	}
+}
+
+bool Netplay::RunFrame(const Joypad& localJoypad)
+{
+	DEBUG_ASSERT(m_sm83, "Netplay has not been started");
+
+	ReceiveInputs();
+
+	// Running further ahead would need a rollback deeper than the saved states go
+	if (m_frame >= m_remoteInputFrame + MAX_ROLLBACK_FRAMES)
+	{
+		SendInputs(m_frame);
+		return false;
+	}
+
+	m_inputs[m_frame % HISTORY_SIZE].local = Movie::PackJoypad(localJoypad);
+	SendInputs(m_frame + 1);
+
+	if (m_rollbackFrame != NO_ROLLBACK)
+	{
+		Rollback();
+	}
+
+	SimulateFrame(m_frame);
+	++m_frame;
+	return true;
+}
+
+bool Netplay::Synchronize(int timeoutMilliseconds)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMilliseconds);
+	while (m_remoteInputFrame < m_frame || m_remoteAckFrame < m_frame)
+	{
+		if (std::chrono::steady_clock::now() > deadline)
+		{
+			return false;
+		}
+
+		SendInputs(m_frame);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		ReceiveInputs();
+	}
+
+	// The peer may still be waiting to hear that its last inputs arrived
+	SendInputs(m_frame);
+
+	if (m_rollbackFrame != NO_ROLLBACK)
+	{
+		Rollback();
+	}
+	return true;
+}
+
+void Netplay::AddRemoteInput(uint32_t frame, BYTE buttons)
+{
+	if (frame != m_remoteInputFrame)
+	{
+		return;
+	}
+
+	FrameInputs& inputs = m_inputs[frame % HISTORY_SIZE];
+	if (frame < m_frame && inputs.remote != buttons)
+	{
+		m_rollbackFrame = std::min(m_rollbackFrame, frame);
+	}
+
+	inputs.remote = buttons;
+	++m_remoteInputFrame;
+}
+
+void Netplay::SimulateFrame(uint32_t frame)
+{
+	FrameInputs& inputs = m_inputs[frame % HISTORY_SIZE];
+	if (frame >= m_remoteInputFrame)
+	{
+		inputs.remote = PredictRemoteInput();
+	}
+
+	m_sm83->SaveState(m_states[frame % HISTORY_SIZE]);
+	m_sm83->WriteJoypad(Movie::UnpackJoypad(inputs.local | inputs.remote));
+	m_sm83->RunFrame();
+}
+
+void Netplay::Rollback()
+{
+	// The audio of these frames was already played the first time round, and only the last one is shown
+	const bool videoEnabled = m_sm83->IsVideoEnabled();
+	const bool audioOutputEnabled = m_sm83->IsAudioOutputEnabled();
+	m_sm83->SetAudioOutputEnabled(false);
+	m_sm83->LoadState(m_states[m_rollbackFrame % HISTORY_SIZE]);
+	for (uint32_t frame = m_rollbackFrame; frame < m_frame; ++frame)
+	{
+		m_sm83->SetVideoEnabled(videoEnabled && frame + 1 == m_frame);
+		SimulateFrame(frame);
+	}
+	m_sm83->SetVideoEnabled(videoEnabled);
+	m_sm83->SetAudioOutputEnabled(audioOutputEnabled);
+
+	m_rollbackFrames += m_frame - m_rollbackFrame;
+	++m_rollbackCount;
+	m_rollbackFrame = NO_ROLLBACK;
+}
+
+BYTE Netplay::PredictRemoteInput() const
+{
+	// Buttons are usually held for many frames, so the last input is the best guess
+	return m_remoteInputFrame == 0 ? 0 : m_inputs[(m_remoteInputFrame - 1) % HISTORY_SIZE].remote;
+}
+
+void Netplay::SendInputs(uint32_t endFrame)
+{
+	if (m_socket == -1)
+	{
+		return;
+	}
+
+	// Every input the peer hasn't confirmed goes in every packet, so a lost packet costs nothing once the next arrives
+	// A packet with no inputs still carries the acknowledgement
+	uint32_t firstFrame = std::max(m_remoteAckFrame, endFrame > HISTORY_SIZE ? endFrame - HISTORY_SIZE : 0);
+	firstFrame = std::min(firstFrame, endFrame);
+
+	BYTE packet[PACKET_HEADER_SIZE + HISTORY_SIZE];
+	uint32_t count = endFrame - firstFrame;
+	memcpy(packet, "GBNP", 4);
+	for (int i = 0; i < 4; ++i)
+	{
+		packet[4 + i] = static_cast<BYTE>(m_remoteInputFrame >> (i * 8));
+		packet[8 + i] = static_cast<BYTE>(firstFrame >> (i * 8));
+	}
+	packet[12] = static_cast<BYTE>(count);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		packet[PACKET_HEADER_SIZE + i] = m_inputs[(firstFrame + i) % HISTORY_SIZE].local;
+	}
+
+	send(m_socket, reinterpret_cast<const char*>(packet), static_cast<int>(PACKET_HEADER_SIZE + count), 0);
+}
+
+void Netplay::ReceiveInputs()
+{
+	if (m_socket == -1)
+	{
+		return;
+	}
+
+	while (true)
+	{
+		fd_set readSockets;
+		FD_ZERO(&readSockets);
+		FD_SET(m_socket, &readSockets);
+
+		timeval timeout = {};
+		if (select(static_cast<int>(m_socket + 1), &readSockets, nullptr, nullptr, &timeout) <= 0)
+		{
+			return;
+		}
+
+		BYTE packet[PACKET_HEADER_SIZE + HISTORY_SIZE];
+		int size = recv(m_socket, reinterpret_cast<char*>(packet), sizeof(packet), 0);
+		if (size < static_cast<int>(PACKET_HEADER_SIZE) || memcmp(packet, "GBNP", 4) != 0 || size != static_cast<int>(PACKET_HEADER_SIZE + packet[12]))
+		{
+			// Nothing listening on the other side yet shows up as an error on some platforms, it is not fatal
+			continue;
+		}
+
+		uint32_t ackFrame = 0;
+		uint32_t firstFrame = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			ackFrame |= static_cast<uint32_t>(packet[4 + i]) << (i * 8);
+			firstFrame |= static_cast<uint32_t>(packet[8 + i]) << (i * 8);
+		}
+
+		// Packets can arrive out of order, an older one must not move the acknowledgement back
+		m_remoteAckFrame = std::max(m_remoteAckFrame, ackFrame);
+		for (uint32_t i = 0; i < packet[12]; ++i)
+		{
+			AddRemoteInput(firstFrame + i, packet[PACKET_HEADER_SIZE + i]);
+		}
+	}
+}
+
+int Netplay::RunSession(const std::string& romPath, uint16_t localPort, const std::string& remoteAddress, uint16_t remotePort, int frames)
+{
+	Cartridge cart;
+	cart.OpenFile(romPath);
+	if (!cart.IsValid())
+	{
+		std::cerr << "Unable to load " << romPath << std::endl;
+		return 1;
+	}
+
+	CPU sm83(nullptr);
+	sm83.AddCartridge(&cart);
+	sm83.PowerOn();
+	sm83.SetAudioEnabled(false);
+
+	Netplay netplay;
+	netplay.Start(sm83);
+	if (!netplay.Connect(localPort, remoteAddress, remotePort))
+	{
+		std::cerr << "Unable to open a socket on port " << localPort << std::endl;
+		return 1;
+	}
+
+	// Each side presses a different button every so often, seeded by its port
+	std::mt19937 random(localPort);
+	Joypad localJoypad = {};
+	auto start = std::chrono::steady_clock::now();
+	for (int frame = 0; frame < frames; )
+	{
+		if (frame % 8 == 0)
+		{
+			localJoypad = Movie::UnpackJoypad(static_cast<BYTE>(random()));
+		}
+
+		if (netplay.RunFrame(localJoypad))
+		{
+			++frame;
+		}
+		else
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		if (std::chrono::steady_clock::now() - start > std::chrono::seconds(SESSION_TIMEOUT_SECONDS))
+		{
+			std::cerr << "The peer stopped answering at frame " << frame << std::endl;
+			return 1;
+		}
+	}
+
+	if (!netplay.Synchronize(SESSION_TIMEOUT_SECONDS * 1000))
+	{
+		std::cerr << "The peer stopped answering at the end of the session" << std::endl;
+		return 1;
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << frames << " frames in " << std::fixed << std::setprecision(3) << elapsed.count() << " s, "
+		<< netplay.GetRollbackCount() << " rollbacks of " << netplay.GetRollbackFrames() << " frames, last frame CRC32 "
+		<< std::hex << std::setw(8) << std::setfill('0') << Hash::CRC32(sm83.GetFrameBuffer(), SCREEN_WIDTH * SCREEN_HEIGHT) << std::dec << std::endl;
+
+	return 0;
+}
+
+int Netplay::RunStress(const std::string& romPath, int rollbackFrames, int frames)
+{
+	if (rollbackFrames < 1 || rollbackFrames > MAX_ROLLBACK_FRAMES || frames <= 0)
+	{
+		std::cerr << "Rollback must be between 1 and " << MAX_ROLLBACK_FRAMES << " frames" << std::endl;
+		return 1;
+	}
+
+	Cartridge cart;
+	cart.OpenFile(romPath);
+	if (!cart.IsValid())
+	{
+		std::cerr << "Unable to load " << romPath << std::endl;
+		return 1;
+	}
+
+	CPU sm83(nullptr);
+	sm83.AddCartridge(&cart);
+	sm83.PowerOn();
+	sm83.SetAudioEnabled(false);
+
+	Netplay netplay;
+	netplay.Start(sm83);
+
+	// Every remote input differs from the one before and arrives rollbackFrames late, so every prediction is wrong
+	std::mt19937 random(1);
+	std::vector<BYTE> remoteInputs(frames);
+	BYTE remote = 0;
+	for (BYTE& input : remoteInputs)
+	{
+		remote ^= static_cast<BYTE>(1 + random() % 0xFF);
+		input = remote;
+	}
+
+	Joypad localJoypad = {};
+	auto start = std::chrono::steady_clock::now();
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		if (frame >= rollbackFrames)
+		{
+			netplay.AddRemoteInput(frame - rollbackFrames, remoteInputs[frame - rollbackFrames]);
+		}
+		netplay.RunFrame(localJoypad);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	// Each frame costs one frame plus every frame rolled back, along with a state save each and one load
+	const double frameBudget = double(CPU::CYCLES_PER_FRAME) / CPU::CLOCKSPEED;
+	const uint64_t simulatedFrames = frames + netplay.GetRollbackFrames();
+	const double secondsPerFrame = elapsed.count() / frames;
+	const double secondsPerSimulatedFrame = elapsed.count() / simulatedFrames;
+	const int maxRollbackFrames = std::max(0, static_cast<int>(frameBudget / secondsPerSimulatedFrame) - 1);
+
+	std::cout << std::fixed << std::setprecision(1)
+		<< frames << " frames with " << netplay.GetRollbackCount() << " rollbacks of " << rollbackFrames << " frames" << std::endl
+		<< simulatedFrames / elapsed.count() << " frames/s simulated, " << netplay.GetRollbackFrames() / elapsed.count() << " of them rolled back" << std::endl
+		<< "each frame takes " << secondsPerFrame * 1000.0 << " ms, " << 100.0 * secondsPerFrame / frameBudget << "% of a frame" << std::endl
+		<< "deepest rollback within a frame " << maxRollbackFrames << " frames" << std::endl;
+
+	return 0;
+}
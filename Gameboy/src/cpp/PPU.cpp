@@ -1,5 +1,6 @@
 #include "stdafx.h"
 
+#include <cstring>
 #include <iomanip>
 
 #include <SFML/Graphics/RenderTarget.hpp>
@@ -7,22 +8,32 @@
 
 #include "header/PPU.h"
 #include "header/CPU.h"
+#include "header/StateBuffer.h"
 
 PPU::PPU(sf::RenderTarget* screen) :
 	m_sm83(nullptr),
 	m_ioMemory(nullptr),
 	m_oamMemory(nullptr),
 	m_gpuClock(0),
-	m_screenPixelBuffer(),
-	m_displayTexture(),
+	m_hblankCycles(HBLANK_CYCLES),
+	m_frameCompleted(false),
+	m_lastSyncCycle(0),
+	m_display(),
 	m_screen(screen),
 	m_scanline(),
+	m_renderer(Renderer::SCANLINE),
+	m_renderingEnabled(true),
 	m_vram(),
-	m_mode(GPUMode::OAMLOAD)
+	m_mode(GPUMode::OAMLOAD),
+	m_spriteLines(),
+	m_spriteLinesDirty(true),
+	m_spriteLinesHeight(0),
+	m_fifo(),
+	m_windowLine(0),
+	m_windowDrawnThisLine(false)
 {
-	m_screenPixelBuffer.create(SCREEN_WIDTH, SCREEN_HEIGHT);
-	m_displayTexture.create(SCREEN_WIDTH, SCREEN_HEIGHT);
 	m_scanline.resize(SCREEN_WIDTH);
+	memset(m_frameBuffer, 0, sizeof(m_frameBuffer));
 
 	m_vram = new BYTE[0x2000];
 }
@@ -39,93 +50,269 @@ void PPU::Initialize(CPU* sm83, BYTE* ioMemory, BYTE* oamMemory)
 	m_oamMemory = oamMemory;
 }
 
+void PPU::Reset()
+{
+	m_gpuClock = 0;
+	m_hblankCycles = HBLANK_CYCLES;
+	m_mode = GPUMode::OAMLOAD;
+	m_frameCompleted = false;
+	m_lastSyncCycle = 0;
+	m_fifo.active = false;
+	m_windowLine = 0;
+	m_windowDrawnThisLine = false;
+	m_spriteLinesDirty = true;
+
+	memset(m_vram, 0, 0x2000);
+	memset(m_frameBuffer, 0, sizeof(m_frameBuffer));
+}
+
+void PPU::CatchUp(uint64_t clockCycle)
+{
+	if (clockCycle > m_lastSyncCycle)
+	{
+		Step(static_cast<int>(clockCycle - m_lastSyncCycle));
+		m_lastSyncCycle = clockCycle;
+	}
+}
+
+uint64_t PPU::GetNextEventCycle() const
+{
+	// Walk the mode sequence forward from the start of the current mode without changing anything.
+	// A frame always completes within 154 lines, so this is bounded.
+	const bool lcdInterruptEnabled = m_sm83->IsInterruptEnabled(CPU::INTERRUPT_LCD);
+
+	GPUMode mode = m_mode;
+	int y = m_ioMemory[LCDC_Y_BYTE];
+	uint64_t cycle = m_lastSyncCycle - m_gpuClock;
+
+	// The pixel FIFO outputs at most one pixel per dot, so the end of its mode 3 is at least this far away.
+	// Mode 3 and HBLANK always add up to the same length, so later lines are unaffected.
+	if (m_mode == GPUMode::DRAWING && m_fifo.active && lcdInterruptEnabled)
+	{
+		return m_lastSyncCycle + (SCREEN_WIDTH - m_fifo.x);
+	}
+
+	bool isCurrentMode = true;
+	while (true)
+	{
+		cycle += isCurrentMode ? GetCurrentModeCycles() : GetModeCycles(mode);
+		isCurrentMode = false;
+
+		switch (mode)
+		{
+		case GPUMode::HBLANK:
+			if (++y >= VBLANK_START)
+			{
+				return cycle;
+			}
+			mode = GPUMode::OAMLOAD;
+			break;
+		case GPUMode::VBLANK:
+			if (++y > VBLANK_END)
+			{
+				mode = GPUMode::OAMLOAD;
+				y = 0;
+			}
+			break;
+		case GPUMode::OAMLOAD:
+			mode = GPUMode::DRAWING;
+			break;
+		case GPUMode::DRAWING:
+			if (lcdInterruptEnabled)
+			{
+				return cycle;
+			}
+			mode = GPUMode::HBLANK;
+			break;
+		}
+	}
+}
+
 void PPU::Step(int clockCycles)
 {
-	m_gpuClock += clockCycles;
+	// Catching up can cover any number of mode changes, left over cycles carry into the next mode
+	while (clockCycles > 0)
+	{
+		// Mode 3 of the pixel FIFO ends when the line is complete rather than after a fixed time
+		if (m_mode == GPUMode::DRAWING && m_fifo.active)
+		{
+			clockCycles -= StepPixelFifo(clockCycles);
+			continue;
+		}
+
+		int remainingCycles = GetCurrentModeCycles() - m_gpuClock;
+		if (clockCycles < remainingCycles)
+		{
+			m_gpuClock += clockCycles;
+			break;
+		}
+
+		clockCycles -= remainingCycles;
+		m_gpuClock = 0;
+		AdvanceMode();
+	}
+}
+
+int PPU::GetModeCycles(GPUMode mode)
+{
+	switch (mode)
+	{
+	case GPUMode::HBLANK:
+		return HBLANK_CYCLES;
+	case GPUMode::VBLANK:
+		return VBLANK_CYCLES;
+	case GPUMode::OAMLOAD:
+		return OAMLOAD_CYCLES;
+	case GPUMode::DRAWING:
+		return LCD_CYCLES;
+	}
 
+	return HBLANK_CYCLES;
+}
+
+void PPU::AdvanceMode()
+{
 	bool lcdEnabled = m_ioMemory[LCDC_BYTE] & LCD_ENABLE;
 	switch (m_mode)
 	{
 	case GPUMode::HBLANK:
-		if (m_gpuClock >= HBLANK_CYCLES)
+	{
+		if (m_windowDrawnThisLine)
 		{
-			m_gpuClock = 0;
+			++m_windowLine;
+			m_windowDrawnThisLine = false;
+		}
 
-			BYTE y = ++m_ioMemory[LCDC_Y_BYTE];
-			if (y >= VBLANK_START)
-			{
-				m_mode = GPUMode::VBLANK;
+		BYTE y = ++m_ioMemory[LCDC_Y_BYTE];
+		if (y >= VBLANK_START)
+		{
+			m_mode = GPUMode::VBLANK;
+			m_frameCompleted = true;
 
-				// Trigger a VBLANK interrupt after rendering the image
-				if (m_sm83->IsInterruptEnabled(CPU::INTERRUPT_VBLANK))
-				{
-					m_sm83->RequestInterrupt(CPU::INTERRUPT_VBLANK);
-				}
-			}
-			else
+			// Trigger a VBLANK interrupt after rendering the image
+			if (m_sm83->IsInterruptEnabled(CPU::INTERRUPT_VBLANK))
 			{
-				// If we aren't at a VBLANK yet we restart the process
-				m_mode = GPUMode::OAMLOAD;
+				m_sm83->RequestInterrupt(CPU::INTERRUPT_VBLANK);
 			}
 		}
+		else
+		{
+			// If we aren't at a VBLANK yet we restart the process
+			m_mode = GPUMode::OAMLOAD;
+		}
 		break;
+	}
 	case GPUMode::VBLANK:
-		if (m_gpuClock >= VBLANK_CYCLES)
+	{
+		BYTE y = ++m_ioMemory[LCDC_Y_BYTE];
+		if (y > VBLANK_END)
 		{
-			m_gpuClock = 0;
-			BYTE y = ++m_ioMemory[LCDC_Y_BYTE];
-
-			if (y > VBLANK_END)
-			{
-				// Restart
-				m_mode = GPUMode::OAMLOAD;
-				m_ioMemory[LCDC_Y_BYTE] = 0;
-			}
+			// Restart
+			m_mode = GPUMode::OAMLOAD;
+			m_ioMemory[LCDC_Y_BYTE] = 0;
+			m_windowLine = 0;
 		}
 		break;
+	}
 	case GPUMode::OAMLOAD:
-		if (m_gpuClock >= OAMLOAD_CYCLES)
+		m_mode = GPUMode::DRAWING;
+		m_hblankCycles = HBLANK_CYCLES;
+
+		// The scanline renderer's timing doesn't depend on what it draws, the pixel FIFO's does so it still runs
+		if (lcdEnabled && (m_renderingEnabled || m_renderer == Renderer::PIXEL_FIFO))
 		{
-			m_gpuClock = 0;
-			m_mode = GPUMode::DRAWING;
+			int spriteYSize = (m_ioMemory[LCDC_BYTE] & SPRITE_SIZE) ? 16 : 8;
+			if (m_spriteLinesDirty || m_spriteLinesHeight != spriteYSize)
+			{
+				RebuildSpriteLines();
+			}
 
-			if (lcdEnabled)
+			if (m_renderer == Renderer::PIXEL_FIFO)
+			{
+				StartPixelFifo();
+			}
+			else
 			{
 				ProcessScanline();
 			}
 		}
 		break;
 	case GPUMode::DRAWING:
-		if (m_gpuClock >= LCD_CYCLES)
-		{
-			m_gpuClock = 0;
-			m_mode = GPUMode::HBLANK;
+		m_mode = GPUMode::HBLANK;
 
+		if (m_renderingEnabled)
+		{
 			RenderScanline();
-			
-			// Trigger an LCD interrupt after rendering the line
-			if (m_sm83->IsInterruptEnabled(CPU::INTERRUPT_LCD))
-			{
-				m_sm83->RequestInterrupt(CPU::INTERRUPT_LCD);
-			}
+		}
+
+		// Trigger an LCD interrupt after rendering the line
+		if (m_sm83->IsInterruptEnabled(CPU::INTERRUPT_LCD))
+		{
+			m_sm83->RequestInterrupt(CPU::INTERRUPT_LCD);
 		}
 		break;
 	}
+
+	UpdateStatus();
+}
+
+void PPU::UpdateStatus()
+{
+	BYTE status = m_ioMemory[STAT_REG] & ~STAT_READ_ONLY;
+	if (m_ioMemory[LCDC_BYTE] & LCD_ENABLE)
+	{
+		status |= static_cast<BYTE>(m_mode);
+	}
+	if (m_ioMemory[LCDC_Y_BYTE] == m_ioMemory[LY_COMPARE_BYTE])
+	{
+		status |= STAT_COINCIDENCE;
+	}
+	m_ioMemory[STAT_REG] = status;
 }
 
 void PPU::DrawToScreen()
 {
-	m_displayTexture.update(m_screenPixelBuffer);
+	m_display.Draw(*m_screen, m_frameBuffer);
+}
+
+bool PPU::ConsumeFrameCompleted()
+{
+	bool frameCompleted = m_frameCompleted;
+	m_frameCompleted = false;
+	return frameCompleted;
+}
 
-	sf::Vector2 screenSize = m_screen->getView().getSize();
-	sf::Sprite drawSprite(m_displayTexture);
-	drawSprite.setScale(
-		screenSize.x / SCREEN_WIDTH,
-		screenSize.y / SCREEN_HEIGHT
-	);
-	drawSprite.setPosition(0, 19);
+void PPU::SaveState(StateBuffer& state) const
+{
+	state.Write(m_mode);
+	state.Write(m_gpuClock);
+	state.Write(m_hblankCycles);
+	state.Write(m_frameCompleted);
+	state.Write(m_lastSyncCycle);
+	state.WriteBytes(m_vram, 0x2000);
+	state.WriteBytes(m_scanline.data(), m_scanline.size());
+	state.Write(m_frameBuffer);
+	state.Write(m_fifo);
+	state.Write(m_windowLine);
+	state.Write(m_windowDrawnThisLine);
+}
 
-	m_screen->draw(drawSprite);
+void PPU::LoadState(StateBuffer& state)
+{
+	state.Read(m_mode);
+	state.Read(m_gpuClock);
+	state.Read(m_hblankCycles);
+	state.Read(m_frameCompleted);
+	state.Read(m_lastSyncCycle);
+	state.ReadBytes(m_vram, 0x2000);
+	state.ReadBytes(m_scanline.data(), m_scanline.size());
+	state.Read(m_frameBuffer);
+	state.Read(m_fifo);
+	state.Read(m_windowLine);
+	state.Read(m_windowDrawnThisLine);
+
+	// OAM is restored by the CPU
+	m_spriteLinesDirty = true;
 }
 
 BYTE PPU::ReadVRAM(WORD address) const
@@ -148,9 +335,15 @@ void PPU::WriteVRAM(WORD address, BYTE data)
 void PPU::RenderScanline()
 {
 	BYTE currentLine = m_ioMemory[LCDC_Y_BYTE];
+	if (currentLine >= SCREEN_HEIGHT)
+	{
+		return;
+	}
+
+	BYTE* row = &m_frameBuffer[currentLine * SCREEN_WIDTH];
 	for (int x = 0; x < SCREEN_WIDTH; x++)
 	{
-		m_screenPixelBuffer.setPixel(x, currentLine, m_colourPalette[(m_scanline[x] >> 4) & 0x3]);
+		row[x] = (m_scanline[x] >> 4) & 0x3;
 	}
 }
 
@@ -184,7 +377,7 @@ void PPU::DumpTiles(sf::RenderTarget& renderWindow)
 				BYTE pixel = ((upperTileBits >> currentXPosition) & 0x1) + ((lowerTileBits >> currentXPosition) & 0x1) * 2;
 				BYTE palette = (m_ioMemory[PALETTE_DATA] >> (pixel * 2)) & (BIT_0 | BIT_1);
 
-				im.setPixel(x * 8 + (7 - currentXPosition), currentYPosition, m_colourPalette[palette]);
+				im.setPixel(x * 8 + (7 - currentXPosition), currentYPosition, Display::GetColour(palette));
 			}
 
 			++bgTileMapAddress;
@@ -206,255 +399,444 @@ void PPU::ProcessBackgroundLayer()
 {
 	BYTE LCDC = m_ioMemory[LCDC_BYTE];
 	BYTE scrollX = m_ioMemory[SCROLL_X_BYTE];
-	BYTE scrollY = m_ioMemory[SCROLL_Y_BYTE];
-	BYTE currentLine = m_ioMemory[LCDC_Y_BYTE];
-
-	WORD bgTileMapAddress = 0x1800 + ((currentLine / 8) * 32);
-	for (int x = 0; x < 20; x++)
-	{
-		BYTE tileAddress = m_vram[bgTileMapAddress + x];
-		WORD address = (tileAddress * 0x10) + ((currentLine % 8) * 2);
+	int pixelRow = (m_ioMemory[LCDC_Y_BYTE] + m_ioMemory[SCROLL_Y_BYTE]) & 0xFF;
 
-		BYTE upperTileBits = m_vram[address];
-		BYTE lowerTileBits = m_vram[address + 1];
+	// Same addressing as the pixel FIFO, with the registers as they are at the start of the line
+	WORD tileMapAddress = ((LCDC & BG_TILEMAP) ? 0x1C00 : 0x1800) + (pixelRow / 8) * 32;
 
-		for (int currentXPosition = 7; currentXPosition >= 0; currentXPosition--)
+	WORD tileRow = 0;
+	for (int x = 0; x < SCREEN_WIDTH; x++)
+	{
+		int mapX = (scrollX + x) & 0xFF;
+		if (x == 0 || (mapX & 0x7) == 0)
 		{
-			BYTE pixel = ((upperTileBits >> currentXPosition) & 0x1) + ((lowerTileBits >> currentXPosition) & 0x1) * 2;
-			BYTE palette = (m_ioMemory[PALETTE_DATA] >> (pixel * 2)) & (BIT_0 | BIT_1);
-
-			m_scanline[x * 8 + (7 - currentXPosition)] = (palette & 0x3) << 4 | pixel & 0x3;
+			tileRow = ReadTileRow(m_vram[tileMapAddress + mapX / 8], pixelRow);
 		}
+
+		BYTE pixel = (LCDC & BG_ENABLE) ? GetTileRowPixel(tileRow, mapX & 0x7) : 0;
+		BYTE palette = (m_ioMemory[PALETTE_DATA] >> (pixel * 2)) & (BIT_0 | BIT_1);
+
+		m_scanline[x] = (palette & 0x3) << 4 | (pixel & 0x3);
 	}
 }
 
 void PPU::ProcessWindowLayer()
 {
 	BYTE LCDC = m_ioMemory[LCDC_BYTE];
-	BYTE winY = m_ioMemory[WINDOW_X]; // 0 <= WY <= 143
-	BYTE winX = m_ioMemory[WINDOW_Y]; // 7 <= WX <= 166. A value between 0-6 should not be allowed for WX
 
-	if (winX < 7)
+	// The window needs the background on as well, and starts at WX - 7 on lines at or below WY
+	if (!(LCDC & WINDOW_ENABLE) || !(LCDC & BG_ENABLE) || m_ioMemory[LCDC_Y_BYTE] < m_ioMemory[WINDOW_Y])
 	{
-		winX = 7;
+		return;
 	}
-	winX -= 7;
-
-	BYTE currentLine = m_ioMemory[LCDC_Y_BYTE];
 
-	// Our window is only drawn within the bounds of winY, winX
-	if (currentLine < winY)
+	int windowX = m_ioMemory[WINDOW_X] - 7;
+	int startX = windowX > 0 ? windowX : 0;
+	if (startX >= SCREEN_WIDTH)
 	{
 		return;
 	}
 
-	// Bit 0 and bit 5 tells us if we need to draw the window layer, if they're not enabled we leave
-	if (!((LCDC & BIT_0) || (LCDC & BIT_5)))
+	// The window has its own line counter, which only moves on lines it was drawn on
+	int pixelRow = m_windowLine & 0xFF;
+	WORD tileMapAddress = ((LCDC & WINDOW_TILEMAP) ? 0x1C00 : 0x1800) + (pixelRow / 8) * 32;
+	m_windowDrawnThisLine = true;
+
+	WORD tileRow = 0;
+	for (int x = startX; x < SCREEN_WIDTH; x++)
+	{
+		int windowColumn = x - startX;
+		if ((windowColumn & 0x7) == 0)
+		{
+			tileRow = ReadTileRow(m_vram[tileMapAddress + ((windowColumn / 8) & 0x1F)], pixelRow);
+		}
+
+		BYTE pixel = GetTileRowPixel(tileRow, windowColumn & 0x7);
+		BYTE palette = (m_ioMemory[PALETTE_DATA] >> (pixel * 2)) & (BIT_0 | BIT_1);
+
+		m_scanline[x] = (palette & 0x3) << 4 | (pixel & 0x3);
+	}
+}
+
+void PPU::ProcessSpriteLayer()
+{
+	BYTE LCDC = m_ioMemory[LCDC_BYTE];
+
+	// Bit 1 of LCDC tells us if the sprite display is on, return if not
+	if (!(LCDC & SPRITE_ENABLE))
 	{
 		return;
 	}
 
-	// Bit 6 of LCDC tells us the address range for the Window Tile Map
-	WORD windowTileMapAddress = 0x1800 + ((LCDC >> 6 & 0x1) * 0x400);
+	// Store our current line so we don't have to access the array each time
+	BYTE currentYPosition = m_ioMemory[LCDC_Y_BYTE];
+	const SpriteLine& spriteLine = m_spriteLines[currentYPosition];
 
-	/*
-	  We need our current screen x and y position, handled by scrollX and scrollY
-	  Our tiles are 8x8 pixels. scroll is a pixel location, so scroll % 8 gives us our tiles positions
-	  The upper left of our screen (which is where we start) is set by 7 - scrollX
-	*/
-	SIGNED_BYTE currentXPosition = 7;
-	BYTE currentYPosition = currentLine % 8;
+	// A pixel belongs to the first sprite in priority order that is opaque there, even when that sprite ends up behind the background
+	bool pixelTaken[SCREEN_WIDTH] = {};
 
-	BYTE pixelsWritten = 0;
-	while (pixelsWritten < SCREEN_WIDTH)
+	for (int i = 0; i < spriteLine.count; i++)
 	{
-		// Do nothing while we pass through invalid draw zones
-		if (pixelsWritten < winX)
+		const SpriteOAM& currentSprite = spriteLine.sprites[i];
+
+		/*
+			The tileAddress we get from our tile map are ordered from 0x00 - 0xFF. In memory, this address corresponds to a value 0x10 times bigger
+			0x8000 would be tileAddress 0x00, 0x8010 would be tile address 0x01 and so on. The reason for this is that there is 16 bytes for each tile (0x10)
+			and 2 bytes for each row of pixels, which gives us our 8x8 tiles.
+
+			The row of the sprite on this line tells us which row of pixels we are currently looking at, we multiply by 2 since there are 2 bytes per row.
+		*/
+		int row = currentYPosition - (currentSprite.yCoord - 16);
+		if (currentSprite.ShouldFlipY())
 		{
-			pixelsWritten++;
-			currentXPosition--;
+			row = m_spriteLinesHeight - 1 - row;
+		}
+
+		// 8x16 sprites ignore the lowest bit of the tile number
+		BYTE tileNumber = m_spriteLinesHeight == 16 ? (currentSprite.tileNumber & 0xFE) : currentSprite.tileNumber;
+		WORD address = tileNumber * 0x10 + row * 2;
+
+		BYTE upperTileBits = m_vram[address];
+		BYTE lowerTileBits = m_vram[address + 1];
 
-			if (currentXPosition < 0)
+		for (int j = 0; j < 8; j++)
+		{
+			int currentPixel = currentSprite.xCoord - 8 + j;
+			if (currentPixel < 0 || currentPixel >= SCREEN_WIDTH || pixelTaken[currentPixel])
 			{
-				currentXPosition = 7;
-				windowTileMapAddress++;
+				continue;
 			}
-		}
-		else
-		{
-			// Get the address of our tile from the tileSet
-			BYTE tileAddress = m_vram[windowTileMapAddress];
 
-			BYTE upperTileBits;
-			BYTE lowerTileBits;
-
-			// Bit 4 of LCDC tells us where and how to find our tile pattern
 			/*
-			  Tile patterns are
-			  taken from the Tile Data Table located either at
-			  $8000-8FFF or $8800-97FF. In the first case, patterns
-			  are numbered with unsigned numbers from 0 to 255 (i.e.
-			  pattern #0 lies at address $8000). In the second case,
-			  patterns have signed numbers from -128 to 127 (i.e.
-			  pattern #0 lies at address $9000).
+				Tile data is stored in 16 bytes where every 2 bytes represents a line in the tile
+				The values inside these 2 bytes represents the colour of each pixel in the 8x8 tile
+				The data of 2 lines translates into one line of pixels of various colours
+				upper bits: 010001  ->  030001
+				lower bits: 010000
+				We receive a value between 0 and 3 for our pixel.
 			*/
+			int bit = currentSprite.ShouldFlipX() ? j : 7 - j;
+			int pixel = ((upperTileBits >> bit) & 0x1) + ((lowerTileBits >> bit) & 0x1) * 2;
 
-			bool isFirstPattern = (LCDC >> 4 & 0x1);
-			WORD address = 0;
+			// Colour 0 is transparent
+			if (pixel == 0)
+			{
+				continue;
+			}
 
-			/*
-			  The tileAddress we get from our bgTileMap are ordered from 0x00 - 0xFF. In memory, this address corresponds to a value 0x10 times bigger
-			  0x8000 would be tileAddress 0x00, 0x8010 would be tile address 0x01 and so on. The reason for this is that there is 16 bytes for each tile (0x10)
-			  and 2 bytes for each row of pixels, which gives us our 8x8 tiles.
+			pixelTaken[currentPixel] = true;
 
-			  The currentYPosition will tell us which row of pixels we are currently looking at, we multiply by 2 since there are 2 bytes per row.
-			*/
-			if (isFirstPattern)
+			// Background prioritized sprites only show over background colour 0
+			if (currentSprite.IsBackgroundPrioritized() && (m_scanline[currentPixel] & 0x3) != 0)
 			{
-				address = (tileAddress * 0x10) + (currentYPosition * 2);
+				continue;
 			}
-			else
+
+			BYTE palette = ((m_ioMemory[SPRITE_PALETTE_DATA + currentSprite.UseObjectPalette1()]) >> (pixel * 2)) & (BIT_0 | BIT_1);
+			m_scanline[currentPixel] = (palette & 0x3) << 4 | (pixel & 0x3);
+		}
+	}
+}
+
+void PPU::RebuildSpriteLines()
+{
+	m_spriteLinesHeight = (m_ioMemory[LCDC_BYTE] & SPRITE_SIZE) ? 16 : 8;
+	m_spriteLinesDirty = false;
+
+	for (int line = 0; line < SCREEN_HEIGHT; line++)
+	{
+		m_spriteLines[line].count = 0;
+	}
+
+	// Sprites are visited in OAM order, so the 10 sprite limit keeps the lowest indices and a sprite with the same X
+	// as one already in the list goes after it
+	for (int i = 0; i < 40; i++)
+	{
+		const BYTE* oamEntry = &m_oamMemory[i * 4];
+		int spriteTop = oamEntry[0] - 16;
+		int firstLine = spriteTop > 0 ? spriteTop : 0;
+		int lastLine = spriteTop + m_spriteLinesHeight < SCREEN_HEIGHT ? spriteTop + m_spriteLinesHeight : SCREEN_HEIGHT;
+
+		for (int line = firstLine; line < lastLine; line++)
+		{
+			SpriteLine& spriteLine = m_spriteLines[line];
+			if (spriteLine.count >= MAX_SPRITES_PER_LINE)
 			{
-				address = 0x1000 + (((SIGNED_BYTE)tileAddress) * 0x10) + (currentYPosition * 2);
+				continue;
 			}
 
-			// We need a total of 2 bytes for each pixel row in our tiles
-			upperTileBits = m_vram[address];
-			lowerTileBits = m_vram[address + 1];
-
-			// Each time this loops, a new tile is written. The entire screen is 20 8x8 tiles wide.
-			while (currentXPosition >= 0)
+			// Sprites off the sides of the screen still count towards the limit
+			int position = spriteLine.count;
+			while (position > 0 && spriteLine.sprites[position - 1].xCoord > oamEntry[1])
 			{
-				/*
-				  Tile data is stored in 16 bytes where every 2 bytes represents a line in the tile
-				  The values inside these 2 bytes represents the colour of each pixel in the 8x8 tile
-				  The data of 2 lines translates into one line of pixels of various colours
-					upper bits: 010001  ->  030021
-					lower bits: 010010
-				  We receive a value between 0 and 3 for our pixel.
-				*/
+				spriteLine.sprites[position] = spriteLine.sprites[position - 1];
+				--position;
+			}
 
-				BYTE pixel = ((upperTileBits >> currentXPosition) & 0x1) + ((lowerTileBits >> currentXPosition) & 0x1) * 2;
-				BYTE palette = (m_ioMemory[PALETTE_DATA] >> (pixel * 2)) & (BIT_0 | BIT_1);
-				m_scanline[pixelsWritten] = (palette & 0x3) << 4 | (pixel & 0x3);
+			SpriteOAM& sprite = spriteLine.sprites[position];
+			sprite.yCoord = oamEntry[0];
+			sprite.xCoord = oamEntry[1];
+			sprite.tileNumber = oamEntry[2];
+			sprite.options = oamEntry[3];
+			++spriteLine.count;
+		}
+	}
+}
+
+void PPU::StartPixelFifo()
+{
+	BYTE currentLine = m_ioMemory[LCDC_Y_BYTE];
+
+	m_fifo.active = true;
+	m_fifo.x = 0;
+	m_fifo.discard = m_ioMemory[SCROLL_X_BYTE] & 0x7;
+	// The first fetch of every line is thrown away
+	m_fifo.stallDots = FIFO_FETCH_DOTS;
+
+	m_fifo.fetcherX = 0;
+	m_fifo.fetcherDots = 0;
+	m_fifo.fetchingWindow = false;
+
+	m_fifo.backgroundHead = 0;
+	m_fifo.backgroundSize = 0;
+	memset(m_fifo.spriteColours, 0, sizeof(m_fifo.spriteColours));
+	memset(m_fifo.spriteOptions, 0, sizeof(m_fifo.spriteOptions));
+
+	// The line's sprites are copied so that OAM changes during mode 3 don't affect the line being drawn
+	const SpriteLine& spriteLine = m_spriteLines[currentLine];
+	m_fifo.spriteCount = spriteLine.count;
+	memcpy(m_fifo.sprites, spriteLine.sprites, spriteLine.count * sizeof(SpriteOAM));
+	memset(m_fifo.spriteFetched, 0, sizeof(m_fifo.spriteFetched));
+}
+
+int PPU::StepPixelFifo(int clockCycles)
+{
+	int dots = 0;
+	while (dots < clockCycles)
+	{
+		++dots;
+		++m_gpuClock;
+		PixelFifoDot();
 
-				++pixelsWritten;
-				--currentXPosition;
+		if (m_fifo.x >= SCREEN_WIDTH)
+		{
+			// HBLANK takes whatever is left of the line
+			m_fifo.active = false;
+			m_hblankCycles = (LCD_CYCLES + HBLANK_CYCLES) - m_gpuClock;
+			if (m_hblankCycles < 0)
+			{
+				m_hblankCycles = 0;
 			}
 
-			currentXPosition = 7;
-			++windowTileMapAddress;
+			m_gpuClock = 0;
+			AdvanceMode();
+			break;
 		}
 	}
+
+	return dots;
 }
 
-void PPU::ProcessSpriteLayer()
+void PPU::PixelFifoDot()
 {
+	if (m_fifo.stallDots > 0)
+	{
+		--m_fifo.stallDots;
+		return;
+	}
+
 	BYTE LCDC = m_ioMemory[LCDC_BYTE];
 
-	// Bit 1 of LCDC tells us if the sprite display is on, return if not
-	if (!(LCDC & BIT_1))
+	// The window starts when the LCD reaches WX - 7 on a line at or below WY, the background FIFO is thrown away
+	// and the fetcher starts over on the window tile map
+	if (!m_fifo.fetchingWindow && (LCDC & WINDOW_ENABLE) && (LCDC & BG_ENABLE) && m_fifo.discard == 0)
+	{
+		int windowX = m_ioMemory[WINDOW_X] - 7;
+		if (m_ioMemory[LCDC_Y_BYTE] >= m_ioMemory[WINDOW_Y] && m_fifo.x >= windowX)
+		{
+			m_fifo.fetchingWindow = true;
+			m_fifo.fetcherX = 0;
+			m_fifo.fetcherDots = 0;
+			m_fifo.backgroundSize = 0;
+			m_windowDrawnThisLine = true;
+			return;
+		}
+	}
+
+	if ((LCDC & SPRITE_ENABLE) && TryStartPixelFifoSprite())
 	{
 		return;
 	}
 
-	// Width is always 8, but bit 2 will tell us if we need to increase the height by 8
-	BYTE spriteXSize = 8;
-	BYTE spriteYSize = 8 + ((LCDC >> 2 & 0x1) * 8);
+	// The fetcher needs FIFO_FETCH_DOTS to read a tile row, and waits for the FIFO to empty before pushing it
+	if (m_fifo.fetcherDots < FIFO_FETCH_DOTS)
+	{
+		++m_fifo.fetcherDots;
+	}
 
-	// Store our current line so we don't have to access the array each time
-	BYTE currentYPosition = m_ioMemory[LCDC_Y_BYTE];
+	if (m_fifo.fetcherDots >= FIFO_FETCH_DOTS && m_fifo.backgroundSize == 0)
+	{
+		FetchPixelFifoTile();
+		m_fifo.fetcherDots = 0;
+		++m_fifo.fetcherX;
+	}
+
+	if (m_fifo.backgroundSize == 0)
+	{
+		return;
+	}
+
+	BYTE backgroundColour = m_fifo.backgroundColours[m_fifo.backgroundHead];
+	m_fifo.backgroundHead = (m_fifo.backgroundHead + 1) % FIFO_SIZE;
+	--m_fifo.backgroundSize;
+
+	BYTE spriteColour = m_fifo.spriteColours[0];
+	BYTE spriteOptions = m_fifo.spriteOptions[0];
+	memmove(&m_fifo.spriteColours[0], &m_fifo.spriteColours[1], FIFO_SIZE - 1);
+	memmove(&m_fifo.spriteOptions[0], &m_fifo.spriteOptions[1], FIFO_SIZE - 1);
+	m_fifo.spriteColours[FIFO_SIZE - 1] = 0;
+	m_fifo.spriteOptions[FIFO_SIZE - 1] = 0;
+
+	if (m_fifo.discard > 0)
+	{
+		--m_fifo.discard;
+		return;
+	}
 
-	int i;
-	SpriteOAM currentSprite;
+	if (!m_renderingEnabled)
+	{
+		++m_fifo.x;
+		return;
+	}
 
-	// Cycle through each of the 40 possible sprites and display them if applicable
-	for (i = 0; i < 40; i++)
+	// Palettes are read as the pixel leaves the FIFO, so mid-line palette changes land on the right pixel
+	if (!(LCDC & BG_ENABLE))
 	{
-		int currentOAMSpriteNum = i * 4;
-		currentSprite.yCoord = m_oamMemory[currentOAMSpriteNum];
-		currentSprite.xCoord = m_oamMemory[currentOAMSpriteNum + 1];
-		currentSprite.tileNumber = m_oamMemory[currentOAMSpriteNum + 2];
-		currentSprite.options = m_oamMemory[currentOAMSpriteNum + 3];
+		backgroundColour = 0;
+	}
 
-		// Check if the current sprite is on the line we are drawing.
-		if ((currentSprite.yCoord - (16 - spriteYSize) > currentYPosition) && (currentSprite.yCoord - 16 <= currentYPosition))
-		{
-			//draw it on the line
-			WORD tileAddr = currentSprite.tileNumber * 0x10;
+	BYTE pixel = backgroundColour;
+	BYTE shade = (m_ioMemory[PALETTE_DATA] >> (backgroundColour * 2)) & (BIT_0 | BIT_1);
 
-			BYTE upperTileBits;
-			BYTE lowerTileBits;
+	// Sprites marked as background prioritized only show over background colour 0
+	bool spriteVisible = spriteColour != 0 && (LCDC & SPRITE_ENABLE) && !((spriteOptions & BIT_7) && backgroundColour != 0);
+	if (spriteVisible)
+	{
+		BYTE palette = m_ioMemory[SPRITE_PALETTE_DATA + ((spriteOptions & BIT_4) ? 1 : 0)];
+		pixel = spriteColour;
+		shade = (palette >> (spriteColour * 2)) & (BIT_0 | BIT_1);
+	}
 
-			BYTE curSpriteX = currentSprite.xCoord - 8;
-			BYTE curSpriteY = currentSprite.yCoord - 16;
+	m_scanline[m_fifo.x] = (shade & 0x3) << 4 | (pixel & 0x3);
+	++m_fifo.x;
+}
 
-			int address;
+bool PPU::TryStartPixelFifoSprite()
+{
+	for (int i = 0; i < m_fifo.spriteCount; i++)
+	{
+		const SpriteOAM& sprite = m_fifo.sprites[i];
+		if (m_fifo.spriteFetched[i])
+		{
+			continue;
+		}
 
-			/*
-				The tileAddress we get from our tile map are ordered from 0x00 - 0xFF. In memory, this address corresponds to a value 0x10 times bigger
-				0x8000 would be tileAddress 0x00, 0x8010 would be tile address 0x01 and so on. The reason for this is that there is 16 bytes for each tile (0x10)
-				and 2 bytes for each row of pixels, which gives us our 8x8 tiles.
+		// Sprites are sorted by X, so nothing later in the list can start here either
+		if (sprite.xCoord > m_fifo.x + 8)
+		{
+			break;
+		}
 
-				The currentYPosition will tell us which row of pixels we are currently looking at, we multiply by 2 since there are 2 bytes per row.
-			*/
-			int currentSpriteYPosition;
-			currentSpriteYPosition = currentYPosition - curSpriteY;
+		m_fifo.spriteFetched[i] = true;
 
-			if (currentSprite.ShouldFlipY())
-			{
-				address = tileAddr + ((7 - currentSpriteYPosition) * 2);
-			}
-			else
-			{
-				address = tileAddr + (currentSpriteYPosition * 2);
-			}
+		BYTE LCDC = m_ioMemory[LCDC_BYTE];
+		int spriteYSize = (LCDC & SPRITE_SIZE) ? 16 : 8;
+		int row = m_ioMemory[LCDC_Y_BYTE] - (sprite.yCoord - 16);
+		if (sprite.ShouldFlipY())
+		{
+			row = spriteYSize - 1 - row;
+		}
 
-			upperTileBits = m_vram[address];
-			lowerTileBits = m_vram[address + 1];
+		// 8x16 sprites ignore the lowest bit of the tile number
+		BYTE tileNumber = spriteYSize == 16 ? (sprite.tileNumber & 0xFE) : sprite.tileNumber;
+		WORD address = tileNumber * 0x10 + row * 2;
+		BYTE upperTileBits = m_vram[address];
+		BYTE lowerTileBits = m_vram[address + 1];
 
-			int j;
-			for (j = 0; j < 8; j++)
+		// Sprites fetched earlier keep their opaque pixels, which gives lower X and then lower OAM index priority
+		for (int j = 0; j < 8; j++)
+		{
+			int slot = sprite.xCoord - 8 + j - m_fifo.x;
+			if (slot < 0 || slot >= FIFO_SIZE || m_fifo.spriteColours[slot] != 0)
 			{
-				/*
-					Tile data is stored in 16 bytes where every 2 bytes represents a line in the tile
-					The values inside these 2 bytes represents the colour of each pixel in the 8x8 tile
-					The data of 2 lines translates into one line of pixels of various colours
-					upper bits: 010001  ->  030001
-					lower bits: 010000
-					We receive a value between 0 and 3 for our pixel.
-				*/
-				int pixel;
-				if (currentSprite.ShouldFlipX())
-				{
-					pixel = ((upperTileBits >> j) & 0x1) + ((lowerTileBits >> j) & 0x1) * 2;
-				}
-				else
-				{
-					pixel = ((upperTileBits >> (7 - j)) & 0x1) + ((lowerTileBits >> (7 - j)) & 0x1) * 2;
-				}
-
-				BYTE palette = ((m_ioMemory[SPRITE_PALETTE_DATA + currentSprite.UseObjectPalette1()]) >> (pixel * 2)) & (BIT_0 | BIT_1);
-				int currentPixel = (curSpriteX + j);
-
-				// Draw the sprite if it's within our screen size
-				if ((curSpriteX >= 0) && (curSpriteX <= SCREEN_WIDTH) && (curSpriteY >= 0) && (curSpriteY < SCREEN_HEIGHT))
-				{
-					// We draw bgPriority pixels only if the background colour is white
-					bool bgPixelDrawn = currentSprite.IsBackgroundPrioritized() && (m_scanline[currentPixel] & 0x3) == 0;
-
-					// We draw fgPixels so long as they are not transparent
-					// TODO for some reason sprites 10, 11, 12, 13, 14 are all using a transparent pixel of 1 instead of 0 on the level select of Dr Mario
-					int fgPixelDrawn = !currentSprite.IsBackgroundPrioritized() && pixel != 0;
-
-					if (bgPixelDrawn || fgPixelDrawn)
-					{
-						m_scanline[currentPixel] = (palette & 0x3) << 4 | (pixel & 0x3);
-					}
-				}
+				continue;
 			}
+
+			int bit = sprite.ShouldFlipX() ? j : 7 - j;
+			m_fifo.spriteColours[slot] = ((upperTileBits >> bit) & 0x1) | (((lowerTileBits >> bit) & 0x1) << 1);
+			m_fifo.spriteOptions[slot] = sprite.options;
 		}
+
+		// The fetch itself takes 6 dots, plus however long the background fetcher needs to finish its current tile
+		int fetcherWait = 5 - ((m_fifo.x + m_ioMemory[SCROLL_X_BYTE]) & 0x7);
+		m_fifo.stallDots = FIFO_FETCH_DOTS - 1 + (fetcherWait > 0 ? fetcherWait : 0);
+		return true;
+	}
+
+	return false;
+}
+
+void PPU::FetchPixelFifoTile()
+{
+	BYTE LCDC = m_ioMemory[LCDC_BYTE];
+
+	WORD tileMapAddress;
+	int tileColumn;
+	int pixelRow;
+	if (m_fifo.fetchingWindow)
+	{
+		tileMapAddress = (LCDC & WINDOW_TILEMAP) ? 0x1C00 : 0x1800;
+		tileColumn = m_fifo.fetcherX & 0x1F;
+		pixelRow = m_windowLine & 0xFF;
+	}
+	else
+	{
+		tileMapAddress = (LCDC & BG_TILEMAP) ? 0x1C00 : 0x1800;
+		tileColumn = ((m_ioMemory[SCROLL_X_BYTE] >> 3) + m_fifo.fetcherX) & 0x1F;
+		pixelRow = (m_ioMemory[LCDC_Y_BYTE] + m_ioMemory[SCROLL_Y_BYTE]) & 0xFF;
+	}
+
+	WORD tileRow = ReadTileRow(m_vram[tileMapAddress + (pixelRow / 8) * 32 + tileColumn], pixelRow);
+	for (int i = 0; i < FIFO_SIZE; i++)
+	{
+		m_fifo.backgroundColours[i] = GetTileRowPixel(tileRow, i);
+	}
+
+	m_fifo.backgroundHead = 0;
+	m_fifo.backgroundSize = FIFO_SIZE;
+}
+
+WORD PPU::ReadTileRow(BYTE tileNumber, int pixelRow) const
+{
+	// Bit 4 of LCDC picks between unsigned tile numbers from 0x8000 and signed tile numbers around 0x9000
+	WORD address;
+	if (m_ioMemory[LCDC_BYTE] & TILE_LOCATION)
+	{
+		address = tileNumber * 0x10;
+	}
+	else
+	{
+		address = 0x1000 + static_cast<SIGNED_BYTE>(tileNumber) * 0x10;
 	}
+	address += (pixelRow % 8) * 2;
+
+	return m_vram[address] | (m_vram[address + 1] << 8);
+}
+
+BYTE PPU::GetTileRowPixel(WORD tileRow, int x)
+{
+	int bit = 7 - x;
+	return ((tileRow >> bit) & 0x1) | (((tileRow >> (bit + 8)) & 0x1) << 1);
 }
 
 bool PPU::SpriteOAM::IsBackgroundPrioritized() const
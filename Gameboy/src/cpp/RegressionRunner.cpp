@@ -0,0 +1,253 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+
+#include "header/Cartridge.h"
+#include "header/CPU.h"
+#include "header/Hash.h"
+#include "header/Movie.h"
+#include "header/RegressionRunner.h"
+
+int RegressionRunner::Run(const std::string& directory, int interval, bool update)
+{
+	if (interval <= 0)
+	{
+		std::cerr << "Hash interval must be positive" << std::endl;
+		return 1;
+	}
+
+	std::error_code errorCode;
+	std::vector<std::filesystem::path> movies;
+	for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, errorCode))
+	{
+		if (entry.is_regular_file() && entry.path().extension() == ".gbm")
+		{
+			movies.push_back(entry.path());
+		}
+	}
+
+	if (errorCode || movies.empty())
+	{
+		std::cerr << "No movies found in " << directory << std::endl;
+		return 1;
+	}
+
+	std::sort(movies.begin(), movies.end());
+
+	struct RendererGolden
+	{
+		const char* name;
+		PPU::Renderer renderer;
+	};
+
+	const RendererGolden renderers[] =
+	{
+		{ "scanline",	PPU::Renderer::SCANLINE },
+		{ "fifo",		PPU::Renderer::PIXEL_FIFO },
+	};
+
+	int failures = 0;
+	uint64_t totalFrames = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	for (const std::filesystem::path& moviePath : movies)
+	{
+		std::string romPath = FindRom(moviePath.string());
+
+		for (const RendererGolden& renderer : renderers)
+		{
+			std::filesystem::path goldenPath = moviePath;
+			goldenPath.replace_extension(std::string(".") + renderer.name + ".golden");
+			std::string name = moviePath.stem().string() + " (" + renderer.name + ")";
+
+			std::vector<uint64_t> hashes;
+			std::string error;
+			if (romPath.empty())
+			{
+				std::cout << "ERROR    " << name << ": no ROM named after the movie" << std::endl;
+				++failures;
+				continue;
+			}
+			if (!HashMovie(romPath, moviePath.string(), renderer.renderer, hashes, error))
+			{
+				std::cout << "ERROR    " << name << ": " << error << std::endl;
+				++failures;
+				continue;
+			}
+
+			totalFrames += hashes.size();
+
+			if (update)
+			{
+				if (!WriteGoldenFile(goldenPath.string(), hashes))
+				{
+					std::cout << "ERROR    " << name << ": unable to write " << goldenPath.string() << std::endl;
+					++failures;
+					continue;
+				}
+
+				std::cout << "UPDATED  " << name << ": " << hashes.size() << " frames" << std::endl;
+				continue;
+			}
+
+			std::vector<uint64_t> golden;
+			if (!ReadGoldenFile(goldenPath.string(), golden))
+			{
+				std::cout << "MISSING  " << name << ": no golden file, run with --update to create it" << std::endl;
+				++failures;
+				continue;
+			}
+
+			// The first mismatch is the one worth looking at, the blocks after it show whether the difference lasts
+			size_t count = std::min(hashes.size(), golden.size());
+			size_t mismatch = 0;
+			while (mismatch < count && hashes[mismatch] == golden[mismatch])
+			{
+				++mismatch;
+			}
+
+			if (mismatch < count)
+			{
+				size_t differing = 0;
+				std::vector<size_t> blocks;
+				for (size_t frame = mismatch; frame < count; ++frame)
+				{
+					if (hashes[frame] != golden[frame])
+					{
+						++differing;
+						size_t block = frame / interval;
+						if (blocks.empty() || blocks.back() != block)
+						{
+							blocks.push_back(block);
+						}
+					}
+				}
+
+				std::cout << "FAIL     " << name << ": first diverging frame is " << mismatch + 1 << ", " << differing << " of " << count
+					<< " frames differ, in";
+				for (size_t i = 0; i < blocks.size() && i < MAX_REPORTED_BLOCKS; ++i)
+				{
+					std::cout << (i ? ", " : " ") << blocks[i] * interval + 1 << "-" << std::min<size_t>((blocks[i] + 1) * interval, count);
+				}
+				if (blocks.size() > MAX_REPORTED_BLOCKS)
+				{
+					std::cout << " and " << blocks.size() - MAX_REPORTED_BLOCKS << " more blocks";
+				}
+				std::cout << std::endl;
+				++failures;
+			}
+			else if (hashes.size() != golden.size())
+			{
+				std::cout << "FAIL     " << name << ": " << hashes.size() << " frames but the golden file has " << golden.size() << std::endl;
+				++failures;
+			}
+			else
+			{
+				std::cout << "PASS     " << name << ": " << hashes.size() << " frames" << std::endl;
+			}
+		}
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << movies.size() << " movies, " << totalFrames << " frames in " << std::fixed << std::setprecision(2) << elapsed.count() << " s, "
+		<< failures << (failures == 1 ? " failure" : " failures") << std::endl;
+
+	return failures == 0 ? 0 : 1;
+}
+
+bool RegressionRunner::HashMovie(const std::string& romPath, const std::string& moviePath, PPU::Renderer renderer,
+	std::vector<uint64_t>& hashes, std::string& error)
+{
+	Cartridge cart;
+	cart.OpenFile(romPath);
+	if (!cart.IsValid())
+	{
+		error = "unable to load " + romPath;
+		return false;
+	}
+
+	Movie movie;
+	if (!movie.Load(moviePath))
+	{
+		error = "unable to load " + moviePath;
+		return false;
+	}
+
+	CPU sm83(nullptr);
+	sm83.AddCartridge(&cart);
+	sm83.PowerOn();
+	sm83.SetRenderer(renderer);
+	sm83.SetAudioEnabled(false);
+	if (!movie.BeginPlayback(sm83, cart))
+	{
+		error = "the movie was recorded with a different ROM or is corrupt";
+		return false;
+	}
+
+	hashes.reserve(movie.GetFrameCount());
+	while (movie.PlayFrame(sm83))
+	{
+		sm83.RunFrame();
+		hashes.push_back(Hash::XXHash64(sm83.GetFrameBuffer(), SCREEN_WIDTH * SCREEN_HEIGHT));
+	}
+
+	return true;
+}
+
+std::string RegressionRunner::FindRom(const std::string& moviePath)
+{
+	// The same formats RomFile reads
+	static const char* const EXTENSIONS[] = { ".gb", ".gbc", ".gz", ".zip" };
+	for (const char* extension : EXTENSIONS)
+	{
+		std::filesystem::path romPath = moviePath;
+		romPath.replace_extension(extension);
+
+		std::error_code errorCode;
+		if (std::filesystem::is_regular_file(romPath, errorCode))
+		{
+			return romPath.string();
+		}
+	}
+
+	return std::string();
+}
+
+bool RegressionRunner::ReadGoldenFile(const std::string& filePath, std::vector<uint64_t>& hashes)
+{
+	std::ifstream in(filePath, std::ios_base::in | std::ios_base::binary);
+	char magic[sizeof(GOLDEN_MAGIC)];
+	uint32_t version;
+	uint16_t byteOrder;
+	uint32_t count;
+	if (!in.read(magic, sizeof(magic)) || memcmp(magic, GOLDEN_MAGIC, sizeof(magic)) != 0 ||
+		!in.read(reinterpret_cast<char*>(&version), sizeof(version)) || version != GOLDEN_VERSION ||
+		!in.read(reinterpret_cast<char*>(&byteOrder), sizeof(byteOrder)) || byteOrder != GOLDEN_BYTE_ORDER ||
+		!in.read(reinterpret_cast<char*>(&count), sizeof(count)) || count > MAX_GOLDEN_FRAMES)
+	{
+		return false;
+	}
+
+	hashes.resize(count);
+	return static_cast<bool>(in.read(reinterpret_cast<char*>(hashes.data()), static_cast<std::streamsize>(count) * sizeof(uint64_t)));
+}
+
+bool RegressionRunner::WriteGoldenFile(const std::string& filePath, const std::vector<uint64_t>& hashes)
+{
+	std::ofstream out(filePath, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+	const uint32_t version = GOLDEN_VERSION;
+	const uint16_t byteOrder = GOLDEN_BYTE_ORDER;
+	const uint32_t count = static_cast<uint32_t>(hashes.size());
+	out.write(GOLDEN_MAGIC, sizeof(GOLDEN_MAGIC));
+	out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+	out.write(reinterpret_cast<const char*>(&byteOrder), sizeof(byteOrder));
+	out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+	out.write(reinterpret_cast<const char*>(hashes.data()), static_cast<std::streamsize>(hashes.size()) * sizeof(uint64_t));
+
+	return static_cast<bool>(out);
+}
@@ -0,0 +1,266 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "header/Hash.h"
+#include "header/Inflate.h"
+#include "header/RomFile.h"
+
+bool RomFile::Read(const std::string& filePath, std::vector<char>& rom)
+{
+	std::ifstream in(filePath, std::ios_base::in | std::ios_base::binary);
+	if (!in)
+	{
+		std::cerr << "Unable to open " << filePath << std::endl;
+		return false;
+	}
+
+	in.seekg(0, std::ios::end);
+	uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+	in.seekg(0, std::ios::beg);
+
+	BYTE magic[4] = {};
+	in.read(reinterpret_cast<char*>(magic), sizeof(magic));
+	in.clear();
+	in.seekg(0, std::ios::beg);
+
+	bool read;
+	if (magic[0] == 0x1F && magic[1] == 0x8B)
+	{
+		read = ReadGzip(in, fileSize, rom);
+	}
+	else if (ReadUInt32(magic) == ZIP_LOCAL_HEADER_SIGNATURE || ReadUInt32(magic) == ZIP_END_SIGNATURE)
+	{
+		read = ReadZip(in, fileSize, rom);
+	}
+	else
+	{
+		read = ReadPlain(in, fileSize, rom);
+	}
+
+	if (!read)
+	{
+		std::cerr << "Unable to read a ROM from " << filePath << std::endl;
+		rom.clear();
+	}
+	return read;
+}
+
+bool RomFile::ReadPlain(std::ifstream& in, uint64_t fileSize, std::vector<char>& rom)
+{
+	if (fileSize > MAX_ROM_SIZE)
+	{
+		return false;
+	}
+
+	rom.resize(static_cast<size_t>(fileSize));
+	in.read(rom.data(), rom.size());
+	return static_cast<uint64_t>(in.gcount()) == fileSize;
+}
+
+bool RomFile::ReadGzip(std::ifstream& in, uint64_t fileSize, std::vector<char>& rom)
+{
+	BYTE header[GZIP_HEADER_SIZE];
+	if (fileSize < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE || !in.read(reinterpret_cast<char*>(header), sizeof(header)) || header[2] != ZIP_DEFLATED)
+	{
+		return false;
+	}
+
+	BYTE flags = header[3];
+	if (flags & GZIP_EXTRA)
+	{
+		BYTE extraSize[2];
+		in.read(reinterpret_cast<char*>(extraSize), sizeof(extraSize));
+		in.seekg(ReadUInt16(extraSize), std::ios::cur);
+	}
+	// The original name and the comment are zero terminated
+	if (flags & GZIP_NAME)
+	{
+		in.ignore(std::numeric_limits<std::streamsize>::max(), '\0');
+	}
+	if (flags & GZIP_COMMENT)
+	{
+		in.ignore(std::numeric_limits<std::streamsize>::max(), '\0');
+	}
+	if (flags & GZIP_HEADER_CRC)
+	{
+		in.seekg(2, std::ios::cur);
+	}
+
+	uint64_t dataStart = static_cast<uint64_t>(in.tellg());
+	if (!in || dataStart + GZIP_TRAILER_SIZE > fileSize)
+	{
+		return false;
+	}
+
+	// The trailer has the size, so the buffer can be made once and decoded into
+	BYTE trailer[GZIP_TRAILER_SIZE];
+	in.seekg(fileSize - GZIP_TRAILER_SIZE, std::ios::beg);
+	if (!in.read(reinterpret_cast<char*>(trailer), sizeof(trailer)))
+	{
+		return false;
+	}
+
+	in.seekg(dataStart, std::ios::beg);
+	return ReadEntry(in, fileSize - GZIP_TRAILER_SIZE - dataStart, ZIP_DEFLATED, ReadUInt32(trailer + 4), ReadUInt32(trailer), rom);
+}
+
+bool RomFile::ReadZip(std::ifstream& in, uint64_t fileSize, std::vector<char>& rom)
+{
+	// The end of central directory record is last, followed only by a comment of up to 64 KiB
+	uint64_t tailSize = std::min<uint64_t>(fileSize, ZIP_END_SIZE + ZIP_MAX_COMMENT);
+	std::vector<BYTE> tail(static_cast<size_t>(tailSize));
+	in.seekg(fileSize - tailSize, std::ios::beg);
+	if (tailSize < ZIP_END_SIZE || !in.read(reinterpret_cast<char*>(tail.data()), tail.size()))
+	{
+		return false;
+	}
+
+	const BYTE* end = nullptr;
+	for (size_t offset = tail.size() - ZIP_END_SIZE + 1; offset-- > 0;)
+	{
+		if (ReadUInt32(tail.data() + offset) == ZIP_END_SIGNATURE)
+		{
+			end = tail.data() + offset;
+			break;
+		}
+	}
+
+	if (!end)
+	{
+		return false;
+	}
+
+	uint16_t entryCount = ReadUInt16(end + 10);
+	uint32_t directorySize = ReadUInt32(end + 12);
+	uint32_t directoryOffset = ReadUInt32(end + 16);
+	if (static_cast<uint64_t>(directoryOffset) + directorySize > fileSize)
+	{
+		return false;
+	}
+
+	std::vector<BYTE> directory(directorySize);
+	in.seekg(directoryOffset, std::ios::beg);
+	if (!in.read(reinterpret_cast<char*>(directory.data()), directory.size()))
+	{
+		return false;
+	}
+
+	// The first entry named like a ROM is used, an archive of one file is taken to be a ROM whatever its name
+	const BYTE* chosen = nullptr;
+	size_t offset = 0;
+	for (int i = 0; i < entryCount && offset + ZIP_CENTRAL_HEADER_SIZE <= directory.size(); ++i)
+	{
+		const BYTE* entry = directory.data() + offset;
+		if (ReadUInt32(entry) != ZIP_CENTRAL_HEADER_SIGNATURE)
+		{
+			return false;
+		}
+
+		uint16_t nameSize = ReadUInt16(entry + 28);
+		uint16_t extraSize = ReadUInt16(entry + 30);
+		uint16_t commentSize = ReadUInt16(entry + 32);
+		if (offset + ZIP_CENTRAL_HEADER_SIZE + nameSize > directory.size())
+		{
+			return false;
+		}
+
+		std::string name(reinterpret_cast<const char*>(entry + ZIP_CENTRAL_HEADER_SIZE), nameSize);
+		if (IsRomName(name) || (entryCount == 1 && !name.empty() && name.back() != '/'))
+		{
+			chosen = entry;
+			break;
+		}
+		offset += ZIP_CENTRAL_HEADER_SIZE + nameSize + extraSize + commentSize;
+	}
+
+	if (!chosen)
+	{
+		std::cerr << "The archive has no .gb or .gbc file" << std::endl;
+		return false;
+	}
+
+	// Encrypted entries and zip64 sizes are never needed for ROMs
+	uint16_t flags = ReadUInt16(chosen + 8);
+	uint16_t method = ReadUInt16(chosen + 10);
+	uint32_t crc = ReadUInt32(chosen + 16);
+	uint32_t compressedSize = ReadUInt32(chosen + 20);
+	uint32_t size = ReadUInt32(chosen + 24);
+	uint32_t localHeaderOffset = ReadUInt32(chosen + 42);
+	if ((flags & 0x01) || compressedSize == 0xFFFFFFFF || size == 0xFFFFFFFF)
+	{
+		return false;
+	}
+
+	// The local header's name and extra field can differ in size from the central directory's
+	BYTE localHeader[ZIP_LOCAL_HEADER_SIZE];
+	in.seekg(localHeaderOffset, std::ios::beg);
+	if (!in.read(reinterpret_cast<char*>(localHeader), sizeof(localHeader)) || ReadUInt32(localHeader) != ZIP_LOCAL_HEADER_SIGNATURE)
+	{
+		return false;
+	}
+
+	uint64_t dataStart = static_cast<uint64_t>(localHeaderOffset) + ZIP_LOCAL_HEADER_SIZE + ReadUInt16(localHeader + 26) + ReadUInt16(localHeader + 28);
+	if (dataStart + compressedSize > fileSize)
+	{
+		return false;
+	}
+
+	in.seekg(dataStart, std::ios::beg);
+	return ReadEntry(in, compressedSize, method, size, crc, rom);
+}
+
+bool RomFile::ReadEntry(std::ifstream& in, uint64_t compressedSize, int method, uint32_t size, uint32_t crc, std::vector<char>& rom)
+{
+	if (size > MAX_ROM_SIZE)
+	{
+		return false;
+	}
+
+	rom.resize(size);
+	BYTE* out = reinterpret_cast<BYTE*>(rom.data());
+	switch (method)
+	{
+	case ZIP_STORED:
+		if (compressedSize != size || !in.read(rom.data(), size))
+		{
+			return false;
+		}
+		break;
+	case ZIP_DEFLATED:
+		if (!Inflate(in, compressedSize).Decompress(out, size))
+		{
+			std::cerr << "The compressed data is corrupt" << std::endl;
+			return false;
+		}
+		break;
+	default:
+		std::cerr << "Unsupported compression method " << method << std::endl;
+		return false;
+	}
+
+	if (Hash::CRC32(out, size) != crc)
+	{
+		std::cerr << "The decompressed ROM doesn't match its checksum" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool RomFile::IsRomName(const std::string& name)
+{
+	std::string extension = name.substr(std::min(name.size(), name.find_last_of('.')));
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+	return extension == ".gb" || extension == ".gbc";
+}
+
+uint16_t RomFile::ReadUInt16(const BYTE* data)
+{
+	return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+uint32_t RomFile::ReadUInt32(const BYTE* data)
+{
+	return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) | (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
@@ -0,0 +1,241 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <unordered_map>
+
+#include "header/RomFile.h"
+#include "header/RomLibrary.h"
+
+RomLibrary::RomLibrary(const std::string& directory) :
+	m_directory(directory)
+{
+}
+
+int RomLibrary::Scan()
+{
+	std::vector<Entry> indexed;
+	bool indexLoaded = LoadIndex(indexed);
+
+	std::unordered_map<std::string, const Entry*> previous;
+	for (const Entry& entry : indexed)
+	{
+		previous.emplace(entry.path, &entry);
+	}
+
+	// Only the directory is walked here, no file is opened unless it changed
+	std::vector<Entry> entries;
+	std::vector<size_t> changed;
+	std::error_code errorCode;
+	const std::filesystem::path root(m_directory);
+	for (std::filesystem::recursive_directory_iterator it(root, errorCode), end; !errorCode && it != end; it.increment(errorCode))
+	{
+		std::string extension = it->path().extension().string();
+		if (!it->is_regular_file(errorCode) || !IsLibraryFile(extension))
+		{
+			continue;
+		}
+
+		Entry entry = {};
+		entry.path = it->path().lexically_relative(root).generic_string();
+		entry.modifiedTime = static_cast<int64_t>(it->last_write_time(errorCode).time_since_epoch().count());
+		entry.fileSize = static_cast<uint64_t>(it->file_size(errorCode));
+
+		auto found = previous.find(entry.path);
+		if (found != previous.end() && found->second->modifiedTime == entry.modifiedTime && found->second->fileSize == entry.fileSize)
+		{
+			entries.push_back(*found->second);
+			continue;
+		}
+
+		changed.push_back(entries.size());
+		entries.push_back(entry);
+	}
+
+	if (errorCode)
+	{
+		std::cerr << "Unable to read " << m_directory << ": " << errorCode.message() << std::endl;
+	}
+
+	// Each worker takes the next file that nobody has started yet
+	std::atomic<size_t> nextFile(0);
+	std::vector<std::thread> workers;
+	size_t jobs = std::min<size_t>(changed.size(), std::max(1u, std::thread::hardware_concurrency()));
+	for (size_t i = 0; i < jobs; ++i)
+	{
+		workers.emplace_back([&]()
+		{
+			for (size_t index = nextFile++; index < changed.size(); index = nextFile++)
+			{
+				Entry& entry = entries[changed[index]];
+				ReadEntry((root / entry.path).string(), entry);
+			}
+		});
+	}
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.path < b.path; });
+
+	// Deleted files drop out of the count of entries, so that is checked as well as what was read
+	bool modified = !indexLoaded || !changed.empty() || entries.size() != indexed.size();
+	m_entries = std::move(entries);
+	if (modified)
+	{
+		SaveIndex();
+	}
+
+	return static_cast<int>(changed.size());
+}
+
+void RomLibrary::ReadEntry(const std::string& filePath, Entry& entry)
+{
+	std::vector<char> rom;
+	if (!RomFile::Read(filePath, rom) || !Cartridge::ReadHeader(reinterpret_cast<const BYTE*>(rom.data()), rom.size(), entry.header))
+	{
+		// Kept in the index anyway, so a broken file isn't read again until it changes
+		entry.romSize = 0;
+		return;
+	}
+
+	const BYTE* data = reinterpret_cast<const BYTE*>(rom.data());
+	entry.romSize = static_cast<uint32_t>(rom.size());
+	entry.crc32 = Hash::CRC32(data, rom.size());
+	entry.sha1 = Hash::SHA1(data, rom.size());
+}
+
+bool RomLibrary::IsLibraryFile(const std::string& extension)
+{
+	std::string lower = extension;
+	std::transform(lower.begin(), lower.end(), lower.begin(), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+	return lower == ".gb" || lower == ".gbc" || lower == ".gz" || lower == ".zip";
+}
+
+bool RomLibrary::LoadIndex(std::vector<Entry>& entries) const
+{
+	std::ifstream in((std::filesystem::path(m_directory) / INDEX_NAME).string(), std::ios_base::in | std::ios_base::binary);
+	char magic[sizeof(INDEX_MAGIC)];
+	uint32_t version;
+	uint16_t byteOrder;
+	uint32_t count;
+	if (!in.read(magic, sizeof(magic)) || memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0 || !Read(in, version) || version != INDEX_VERSION ||
+		!Read(in, byteOrder) || byteOrder != INDEX_BYTE_ORDER || !Read(in, count))
+	{
+		return false;
+	}
+
+	entries.clear();
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		Entry entry = {};
+		BYTE flags;
+		if (!ReadString(in, entry.path) || !Read(in, entry.modifiedTime) || !Read(in, entry.fileSize) || !Read(in, entry.romSize) ||
+			!Read(in, entry.crc32) || !Read(in, entry.sha1) || !ReadString(in, entry.header.title) || !Read(in, entry.header.cartridgeType) ||
+			!Read(in, entry.header.romSizeCode) || !Read(in, entry.header.ramSizeCode) || !Read(in, flags))
+		{
+			std::cerr << "The library index is corrupt, every ROM will be read again" << std::endl;
+			entries.clear();
+			return false;
+		}
+
+		entry.header.isColor = flags & FLAG_COLOR;
+		entry.header.headerChecksumValid = flags & FLAG_HEADER_CHECKSUM;
+		entry.header.globalChecksumValid = flags & FLAG_GLOBAL_CHECKSUM;
+		entry.header.sizeValid = flags & FLAG_SIZE;
+		entries.push_back(std::move(entry));
+	}
+
+	return true;
+}
+
+bool RomLibrary::SaveIndex() const
+{
+	const std::string indexPath = (std::filesystem::path(m_directory) / INDEX_NAME).string();
+	const std::string tempPath = indexPath + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		out.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+		Write(out, INDEX_VERSION);
+		Write(out, INDEX_BYTE_ORDER);
+		Write(out, static_cast<uint32_t>(m_entries.size()));
+
+		for (const Entry& entry : m_entries)
+		{
+			BYTE flags = (entry.header.isColor ? FLAG_COLOR : 0) | (entry.header.headerChecksumValid ? FLAG_HEADER_CHECKSUM : 0) |
+				(entry.header.globalChecksumValid ? FLAG_GLOBAL_CHECKSUM : 0) | (entry.header.sizeValid ? FLAG_SIZE : 0);
+
+			WriteString(out, entry.path);
+			Write(out, entry.modifiedTime);
+			Write(out, entry.fileSize);
+			Write(out, entry.romSize);
+			Write(out, entry.crc32);
+			Write(out, entry.sha1);
+			WriteString(out, entry.header.title);
+			Write(out, entry.header.cartridgeType);
+			Write(out, entry.header.romSizeCode);
+			Write(out, entry.header.ramSizeCode);
+			Write(out, flags);
+		}
+
+		if (!out)
+		{
+			std::cerr << "Unable to write " << tempPath << std::endl;
+			return false;
+		}
+	}
+
+	std::error_code errorCode;
+	std::filesystem::rename(tempPath, indexPath, errorCode);
+	if (errorCode)
+	{
+		std::cerr << "Unable to replace " << indexPath << ": " << errorCode.message() << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+void RomLibrary::WriteString(std::ostream& out, const std::string& value)
+{
+	// Lengths are stored 7 bits at a time, so the usual short path takes a single byte
+	size_t length = value.size();
+	do
+	{
+		BYTE next = length & 0x7F;
+		length >>= 7;
+		Write(out, static_cast<BYTE>(next | (length ? 0x80 : 0)));
+	} while (length);
+
+	out.write(value.data(), value.size());
+}
+
+bool RomLibrary::ReadString(std::istream& in, std::string& value)
+{
+	size_t length = 0;
+	BYTE next;
+	int shift = 0;
+	do
+	{
+		if (!Read(in, next) || shift > 28)
+		{
+			return false;
+		}
+		length |= static_cast<size_t>(next & 0x7F) << shift;
+		shift += 7;
+	} while (next & 0x80);
+
+	// A corrupt length mustn't turn into a huge allocation
+	if (length > 0xFFFF)
+	{
+		return false;
+	}
+
+	value.resize(length);
+	return static_cast<bool>(in.read(&value[0], length));
+}
@@ -0,0 +1,47 @@
+#include "stdafx.h"
+
+#include <cstring>
+
+#include "header/CPU.h"
+#include "header/RunAhead.h"
+
+RunAhead::RunAhead() :
+	m_frames(0),
+	m_state()
+{
+}
+
+int RunAhead::RunFrame(CPU& sm83, BYTE* frameBuffer)
+{
+	sm83.RunFrame();
+	if (m_frames == 0)
+	{
+		memcpy(frameBuffer, sm83.GetFrameBuffer(), SCREEN_WIDTH * SCREEN_HEIGHT);
+		return 1;
+	}
+
+	// The frames run ahead are thrown away, so the link port is unplugged to keep them from sending bytes twice
+	// and their audio is never mixed in
+	SerialDevice* serialDevice = sm83.GetSerialDevice();
+	sm83.SetSerialDevice(nullptr);
+	const bool audioOutputEnabled = sm83.IsAudioOutputEnabled();
+	sm83.SetAudioOutputEnabled(false);
+
+	sm83.SaveState(m_state);
+
+	// Only the last frame run ahead is shown, the ones before it don't need drawing
+	const bool videoEnabled = sm83.IsVideoEnabled();
+	for (int i = 0; i < m_frames; ++i)
+	{
+		sm83.SetVideoEnabled(videoEnabled && i == m_frames - 1);
+		sm83.RunFrame();
+	}
+
+	memcpy(frameBuffer, sm83.GetFrameBuffer(), SCREEN_WIDTH * SCREEN_HEIGHT);
+	sm83.LoadState(m_state);
+	sm83.SetSerialDevice(serialDevice);
+	sm83.SetVideoEnabled(videoEnabled);
+	sm83.SetAudioOutputEnabled(audioOutputEnabled);
+
+	return m_frames + 1;
+}
@@ -0,0 +1,79 @@
+#include "stdafx.h"
+
+#include "header/Scheduler.h"
+#include "header/StateBuffer.h"
+
+Scheduler::Scheduler() :
+	m_nextEventCycle(NEVER)
+{
+	Reset();
+}
+
+void Scheduler::Reset()
+{
+	for (int i = 0; i < EVENT_COUNT; ++i)
+	{
+		m_eventCycles[i] = NEVER;
+	}
+
+	m_nextEventCycle = NEVER;
+}
+
+void Scheduler::Schedule(Event event, uint64_t clockCycle)
+{
+	m_eventCycles[static_cast<int>(event)] = clockCycle;
+	UpdateNextEvent();
+}
+
+void Scheduler::Cancel(Event event)
+{
+	m_eventCycles[static_cast<int>(event)] = NEVER;
+	UpdateNextEvent();
+}
+
+bool Scheduler::PopDueEvent(uint64_t currentCycle, Event& event)
+{
+	if (m_nextEventCycle > currentCycle)
+	{
+		return false;
+	}
+
+	int earliest = 0;
+	for (int i = 1; i < EVENT_COUNT; ++i)
+	{
+		if (m_eventCycles[i] < m_eventCycles[earliest])
+		{
+			earliest = i;
+		}
+	}
+
+	event = static_cast<Event>(earliest);
+	m_eventCycles[earliest] = NEVER;
+	UpdateNextEvent();
+
+	return true;
+}
+
+void Scheduler::UpdateNextEvent()
+{
+	m_nextEventCycle = NEVER;
+	for (int i = 0; i < EVENT_COUNT; ++i)
+	{
+		if (m_eventCycles[i] < m_nextEventCycle)
+		{
+			m_nextEventCycle = m_eventCycles[i];
+		}
+	}
+}
+
+void Scheduler::SaveState(StateBuffer& state) const
+{
+	state.Write(m_eventCycles);
+	state.Write(m_nextEventCycle);
+}
+
+void Scheduler::LoadState(StateBuffer& state)
+{
+	state.Read(m_eventCycles);
+	state.Read(m_nextEventCycle);
+}
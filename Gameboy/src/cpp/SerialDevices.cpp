@@ -0,0 +1,365 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <afunix.h>
+#define CLOSE_SOCKET closesocket
+#else
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define CLOSE_SOCKET close
+#endif
+
+// A peer that went away must show up as a failed send rather than a signal that ends the process
+#if defined(MSG_NOSIGNAL)
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+#include "header/CPU.h"
+#include "header/SerialDevices.h"
+
+SerialDevice::~SerialDevice()
+{
+}
+
+bool SerialDevice::TransferExternalClock(BYTE, BYTE&, uint64_t)
+{
+	// Most devices never drive the clock, so the Game Boy waits forever just like with nothing plugged in
+	return false;
+}
+
+void SerialDevice::SetListening(bool, BYTE, uint64_t)
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+SerialDevice_RingBuffer::SerialDevice_RingBuffer(size_t capacity) :
+	m_buffer(),
+	m_mask(0),
+	m_writeCount(0),
+	m_readCount(0)
+{
+	size_t size = 1;
+	while (size < capacity)
+	{
+		size <<= 1;
+	}
+
+	m_buffer.resize(size);
+	m_mask = size - 1;
+}
+
+SerialDevice_RingBuffer::~SerialDevice_RingBuffer()
+{
+}
+
+BYTE SerialDevice_RingBuffer::TransferInternalClock(BYTE outgoing, uint64_t)
+{
+	m_buffer[m_writeCount & m_mask] = outgoing;
+	++m_writeCount;
+
+	// The oldest unread byte was just overwritten
+	if (m_writeCount - m_readCount > m_buffer.size())
+	{
+		m_readCount = m_writeCount - m_buffer.size();
+	}
+
+	return DISCONNECTED;
+}
+
+size_t SerialDevice_RingBuffer::Read(BYTE* data, size_t size)
+{
+	size_t count = 0;
+	for (; count < size && m_readCount < m_writeCount; ++count)
+	{
+		data[count] = m_buffer[m_readCount & m_mask];
+		++m_readCount;
+	}
+
+	return count;
+}
+
+void SerialDevice_RingBuffer::ReadAll(std::string& text)
+{
+	for (; m_readCount < m_writeCount; ++m_readCount)
+	{
+		text.push_back(static_cast<char>(m_buffer[m_readCount & m_mask]));
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+SerialDevice_File::SerialDevice_File(const std::string& filePath) :
+	m_file(filePath, std::ios_base::out | std::ios_base::binary | std::ios_base::app)
+{
+}
+
+SerialDevice_File::~SerialDevice_File()
+{
+}
+
+BYTE SerialDevice_File::TransferInternalClock(BYTE outgoing, uint64_t)
+{
+	// The stream buffers the bytes, so a ROM that prints a lot doesn't pay for a write per character
+	m_file.put(static_cast<char>(outgoing));
+	return DISCONNECTED;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+SerialDevice_LinkSocket::SerialDevice_LinkSocket() :
+	m_listenSocket(-1),
+	m_peerSocket(-1),
+	m_socketPath(),
+	m_waitFrame(0),
+	m_waitBudgetMicroseconds(REPLY_BUDGET_MICROSECONDS)
+{
+#if defined(_WIN32)
+	static const bool winsockStarted = []()
+	{
+		WSADATA data;
+		return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+	}();
+	(void)winsockStarted;
+#endif
+}
+
+SerialDevice_LinkSocket::~SerialDevice_LinkSocket()
+{
+	Close();
+}
+
+bool SerialDevice_LinkSocket::Listen(const std::string& socketPath)
+{
+	Close();
+
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(address.sun_path))
+	{
+		return false;
+	}
+	memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+
+	// A socket file left behind by a previous run would make bind fail
+	std::error_code errorCode;
+	std::filesystem::remove(socketPath, errorCode);
+
+	intptr_t listenSocket = static_cast<intptr_t>(socket(AF_UNIX, SOCK_STREAM, 0));
+	if (listenSocket == -1)
+	{
+		return false;
+	}
+
+	if (bind(listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listenSocket, 1) != 0)
+	{
+		CLOSE_SOCKET(listenSocket);
+		return false;
+	}
+
+	m_listenSocket = listenSocket;
+	m_socketPath = socketPath;
+	return true;
+}
+
+bool SerialDevice_LinkSocket::Connect(const std::string& socketPath)
+{
+	Close();
+
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(address.sun_path))
+	{
+		return false;
+	}
+	memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+
+	intptr_t peerSocket = static_cast<intptr_t>(socket(AF_UNIX, SOCK_STREAM, 0));
+	if (peerSocket == -1)
+	{
+		return false;
+	}
+
+	if (connect(peerSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		CLOSE_SOCKET(peerSocket);
+		return false;
+	}
+
+	SetNoSignal(peerSocket);
+	m_peerSocket = peerSocket;
+	return true;
+}
+
+void SerialDevice_LinkSocket::Close()
+{
+	ClosePeer();
+
+	if (m_listenSocket != -1)
+	{
+		CLOSE_SOCKET(m_listenSocket);
+		m_listenSocket = -1;
+
+		std::error_code errorCode;
+		std::filesystem::remove(m_socketPath, errorCode);
+	}
+}
+
+bool SerialDevice_LinkSocket::IsConnected()
+{
+	return m_peerSocket != -1 || AcceptPeer();
+}
+
+BYTE SerialDevice_LinkSocket::TransferInternalClock(BYTE outgoing, uint64_t clockCycle)
+{
+	BYTE incoming;
+	if (!IsConnected() || !SendMessage(MESSAGE_TRANSFER, outgoing))
+	{
+		return DISCONNECTED;
+	}
+
+	// The budget for waiting on replies starts over with every frame the Game Boy runs
+	uint64_t frame = clockCycle / CPU::CYCLES_PER_FRAME;
+	if (frame != m_waitFrame)
+	{
+		m_waitFrame = frame;
+		m_waitBudgetMicroseconds = REPLY_BUDGET_MICROSECONDS;
+	}
+
+	// If both sides started a transfer with their own clock at once, each one takes the other's byte as the answer
+	std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+	bool replied = ReceiveMessage(MESSAGE_REPLY, incoming, m_waitBudgetMicroseconds);
+	long long waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - waitStart).count();
+	m_waitBudgetMicroseconds -= static_cast<int>(std::min<long long>(waited, m_waitBudgetMicroseconds));
+
+	return replied ? incoming : DISCONNECTED;
+}
+
+bool SerialDevice_LinkSocket::TransferExternalClock(BYTE outgoing, BYTE& incoming, uint64_t)
+{
+	if (!IsConnected() || !ReceiveMessage(MESSAGE_TRANSFER, incoming, 0))
+	{
+		return false;
+	}
+
+	SendMessage(MESSAGE_REPLY, outgoing);
+	return true;
+}
+
+bool SerialDevice_LinkSocket::SendMessage(MessageType type, BYTE data)
+{
+	const char message[2] = { static_cast<char>(type), static_cast<char>(data) };
+	int sent = 0;
+	while (sent < static_cast<int>(sizeof(message)))
+	{
+		int result = send(m_peerSocket, message + sent, static_cast<int>(sizeof(message)) - sent, SEND_FLAGS);
+		if (result <= 0)
+		{
+			ClosePeer();
+			return false;
+		}
+		sent += result;
+	}
+
+	return true;
+}
+
+bool SerialDevice_LinkSocket::ReceiveMessage(MessageType type, BYTE& data, int timeoutMicroseconds)
+{
+	while (true)
+	{
+		fd_set readSockets;
+		FD_ZERO(&readSockets);
+		FD_SET(m_peerSocket, &readSockets);
+
+		timeval timeout;
+		timeout.tv_sec = timeoutMicroseconds / 1000000;
+		timeout.tv_usec = timeoutMicroseconds % 1000000;
+		if (select(static_cast<int>(m_peerSocket + 1), &readSockets, nullptr, nullptr, &timeout) <= 0)
+		{
+			return false;
+		}
+
+		// Messages are two bytes, the second one is never far behind the first
+		char message[2];
+		int received = 0;
+		while (received < static_cast<int>(sizeof(message)))
+		{
+			int result = recv(m_peerSocket, message + received, static_cast<int>(sizeof(message)) - received, 0);
+			if (result <= 0)
+			{
+				ClosePeer();
+				return false;
+			}
+			received += result;
+		}
+
+		// A transfer from the peer answers our own when both sides drive the clock, a late reply is dropped
+		BYTE receivedType = static_cast<BYTE>(message[0]);
+		if (receivedType == type || (type == MESSAGE_REPLY && receivedType == MESSAGE_TRANSFER))
+		{
+			data = static_cast<BYTE>(message[1]);
+			return true;
+		}
+	}
+}
+
+bool SerialDevice_LinkSocket::AcceptPeer()
+{
+	if (m_listenSocket == -1)
+	{
+		return false;
+	}
+
+	fd_set readSockets;
+	FD_ZERO(&readSockets);
+	FD_SET(m_listenSocket, &readSockets);
+
+	timeval timeout = {};
+	if (select(static_cast<int>(m_listenSocket + 1), &readSockets, nullptr, nullptr, &timeout) <= 0)
+	{
+		return false;
+	}
+
+	intptr_t peerSocket = static_cast<intptr_t>(accept(m_listenSocket, nullptr, nullptr));
+	if (peerSocket == -1)
+	{
+		return false;
+	}
+
+	SetNoSignal(peerSocket);
+	m_peerSocket = peerSocket;
+	return true;
+}
+
+void SerialDevice_LinkSocket::ClosePeer()
+{
+	if (m_peerSocket != -1)
+	{
+		CLOSE_SOCKET(m_peerSocket);
+		m_peerSocket = -1;
+	}
+}
+
+void SerialDevice_LinkSocket::SetNoSignal(intptr_t peerSocket)
+{
+	// Platforms without MSG_NOSIGNAL set it on the socket instead
+#if defined(SO_NOSIGPIPE)
+	int enabled = 1;
+	setsockopt(peerSocket, SOL_SOCKET, SO_NOSIGPIPE, &enabled, sizeof(enabled));
+#else
+	(void)peerSocket;
+#endif
+}
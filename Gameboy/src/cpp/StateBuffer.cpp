@@ -0,0 +1,59 @@
+#include "stdafx.h"
+
+#include <cstring>
+
+#include "header/Debug.h"
+#include "header/StateBuffer.h"
+
+StateBuffer::StateBuffer() :
+	m_data(),
+	m_size(0),
+	m_readPosition(0)
+{
+}
+
+void StateBuffer::BeginWrite()
+{
+	m_size = 0;
+}
+
+void StateBuffer::BeginRead()
+{
+	m_readPosition = 0;
+}
+
+void StateBuffer::SetData(const BYTE* data, size_t size)
+{
+	BeginWrite();
+	WriteBytes(data, size);
+	BeginRead();
+}
+
+void StateBuffer::WriteBytes(const void* data, size_t size)
+{
+	// memcpy mustn't be given the null pointer an empty source or buffer can have, even to copy nothing
+	if (size == 0)
+	{
+		return;
+	}
+
+	if (m_size + size > m_data.size())
+	{
+		m_data.resize(m_size + size);
+	}
+
+	memcpy(&m_data[m_size], data, size);
+	m_size += size;
+}
+
+void StateBuffer::ReadBytes(void* data, size_t size)
+{
+	DEBUG_ASSERT_N(m_readPosition + size <= m_size);
+	if (size == 0 || m_readPosition + size > m_size)
+	{
+		return;
+	}
+
+	memcpy(data, &m_data[m_readPosition], size);
+	m_readPosition += size;
+}
@@ -0,0 +1,232 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+
+#if defined(_WIN32)
+#include <process.h>
+#define GET_PROCESS_ID _getpid
+#else
+#include <unistd.h>
+#define GET_PROCESS_ID getpid
+#endif
+
+#include "header/Cartridge.h"
+#include "header/CPU.h"
+#include "header/MemoryBankControllers.h"
+#include "header/SerialDevices.h"
+#include "header/TestRomRunner.h"
+
+int TestRomRunner::RunRom(const std::string& romPath, int timeoutSeconds)
+{
+	Cartridge cart;
+	cart.OpenFile(romPath);
+	if (!cart.IsValid())
+	{
+		BYTE cartridgeType = cart.GetHeader().cartridgeType;
+		std::cout << GetResultName(Result::NO_RESULT);
+		if (MemoryBankControllerFactory::IsSupported(cartridgeType))
+		{
+			std::cout << " unable to load " << romPath << std::endl;
+		}
+		else
+		{
+			std::cout << " unsupported cartridge type " << std::hex << std::uppercase << static_cast<int>(cartridgeType) << "h" << std::dec
+				<< std::nouppercase << std::endl;
+		}
+		return static_cast<int>(Result::NO_RESULT);
+	}
+
+	SerialDevice_RingBuffer serialDevice;
+	std::string serialOutput;
+	CPU sm83(nullptr);
+	sm83.AddCartridge(&cart);
+	sm83.PowerOn();
+	sm83.SetSerialDevice(&serialDevice);
+	// Results come through the serial port and the registers, nothing is shown or played
+	sm83.SetVideoEnabled(false);
+	sm83.SetAudioEnabled(false);
+
+	// The timeout is in emulated time so a result doesn't depend on how busy the machine is
+	const int frames = static_cast<int>(timeoutSeconds * double(CPU::CLOCKSPEED) / CPU::CYCLES_PER_FRAME);
+	Result result = Result::TIMED_OUT;
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		sm83.RunFrame();
+		serialDevice.ReadAll(serialOutput);
+		if (CheckFinished(sm83, serialOutput, result))
+		{
+			break;
+		}
+	}
+
+	std::string lastLine = GetLastLine(serialOutput);
+	std::cout << GetResultName(result) << (lastLine.empty() ? "" : " ") << lastLine << std::endl;
+	return static_cast<int>(result);
+}
+
+int TestRomRunner::RunDirectory(const std::string& executablePath, const std::string& directory, int jobs, int timeoutSeconds)
+{
+	std::vector<RomResult> results;
+	std::error_code errorCode;
+	for (const std::filesystem::directory_entry& entry : std::filesystem::recursive_directory_iterator(directory, errorCode))
+	{
+		if (entry.is_regular_file() && (entry.path().extension() == ".gb" || entry.path().extension() == ".gbc"))
+		{
+			results.push_back({ entry.path().string(), Result::NO_RESULT, std::string() });
+		}
+	}
+
+	if (errorCode || results.empty())
+	{
+		std::cerr << "No test ROMs found in " << directory << std::endl;
+		return 1;
+	}
+
+	std::sort(results.begin(), results.end(), [](const RomResult& a, const RomResult& b) { return a.romPath < b.romPath; });
+
+	if (jobs <= 0)
+	{
+		jobs = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// Each worker takes the next ROM that nobody has started yet
+	std::atomic<size_t> nextRom(0);
+	std::vector<std::thread> workers;
+	for (int i = 0; i < jobs; ++i)
+	{
+		workers.emplace_back([&]()
+		{
+			for (size_t index = nextRom++; index < results.size(); index = nextRom++)
+			{
+				RunChildProcess(executablePath, results[index], timeoutSeconds, static_cast<int>(index));
+			}
+		});
+	}
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	int passed = 0;
+	for (const RomResult& romResult : results)
+	{
+		passed += romResult.result == Result::PASSED;
+		std::cout << std::left << std::setw(8) << GetResultName(romResult.result) << romResult.romPath;
+		if (romResult.result != Result::PASSED && !romResult.output.empty())
+		{
+			std::cout << ": " << romResult.output;
+		}
+		std::cout << std::endl;
+	}
+
+	std::cout << passed << " of " << results.size() << " test ROMs passed (" << std::fixed << std::setprecision(1)
+		<< 100.0 * passed / results.size() << "%)" << std::endl;
+	return passed == static_cast<int>(results.size()) ? 0 : 1;
+}
+
+bool TestRomRunner::CheckFinished(CPU& sm83, const std::string& serialOutput, Result& result)
+{
+	if (sm83.ConsumeDebugBreakpoint())
+	{
+		CPU::RegisterSnapshot registers = sm83.GetRegisters();
+		if (registers.BC == 0x0305 && registers.DE == 0x080D && registers.HL == 0x1522)
+		{
+			result = Result::PASSED;
+			return true;
+		}
+
+		if (registers.BC == 0x4242 && registers.DE == 0x4242 && registers.HL == 0x4242)
+		{
+			result = Result::FAILED;
+			return true;
+		}
+	}
+
+	if (serialOutput.find("Passed") != std::string::npos)
+	{
+		result = Result::PASSED;
+		return true;
+	}
+
+	if (serialOutput.find("Failed") != std::string::npos)
+	{
+		result = Result::FAILED;
+		return true;
+	}
+
+	return false;
+}
+
+std::string TestRomRunner::GetLastLine(const std::string& text)
+{
+	size_t end = text.find_last_not_of("\r\n ");
+	if (end == std::string::npos)
+	{
+		return std::string();
+	}
+
+	size_t start = text.find_last_of('\n', end);
+	start = start == std::string::npos ? 0 : start + 1;
+	return text.substr(start, end - start + 1);
+}
+
+const char* TestRomRunner::GetResultName(Result result)
+{
+	switch (result)
+	{
+	case Result::PASSED:		return "PASS";
+	case Result::FAILED:		return "FAIL";
+	case Result::TIMED_OUT:		return "TIMEOUT";
+	default:				return "ERROR";
+	}
+}
+
+void TestRomRunner::RunChildProcess(const std::string& executablePath, RomResult& romResult, int timeoutSeconds, int index)
+{
+	// The process id keeps two runners going at once from writing each other's output
+	std::filesystem::path outputPath = std::filesystem::temp_directory_path()
+		/ ("gb_test_rom_" + std::to_string(GET_PROCESS_ID()) + "_" + std::to_string(index) + ".txt");
+
+	std::string command = "\"" + executablePath + "\" --test-rom \"" + romResult.romPath + "\" " + std::to_string(timeoutSeconds)
+		+ " > \"" + outputPath.string() + "\" 2>&1";
+#if defined(_WIN32)
+	// cmd strips the outer quotes from the line, which would otherwise take the executable's quotes with them
+	command = "\"" + command + "\"";
+#endif
+
+	std::system(command.c_str());
+
+	// Warnings about the ROM, such as a bad header, may come before the result
+	std::ifstream in(outputPath);
+	std::string line;
+	romResult.result = Result::NO_RESULT;
+	romResult.output.clear();
+	while (romResult.result == Result::NO_RESULT && std::getline(in, line))
+	{
+		romResult.output = line;
+		for (Result result : { Result::PASSED, Result::FAILED, Result::TIMED_OUT })
+		{
+			std::string name = GetResultName(result);
+			if (line.compare(0, name.size(), name) == 0)
+			{
+				romResult.result = result;
+				romResult.output = line.size() > name.size() ? line.substr(name.size() + 1) : std::string();
+				break;
+			}
+		}
+	}
+	in.close();
+	std::filesystem::remove(outputPath);
+
+	if (romResult.result == Result::NO_RESULT && romResult.output.empty())
+	{
+		romResult.output = "the emulator exited without a result";
+	}
+}
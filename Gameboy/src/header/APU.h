@@ -0,0 +1,157 @@
+#pragma once
+#include "BlipBuffer.h"
+
+class StateBuffer;
+
+/*
+	The four sound channels, two square waves, a wave table and noise, mixed into a stereo pair of blip buffers.
+
+	Like the PPU the APU only runs when something needs to observe it. CatchUp runs every channel forward to a
+	clock cycle, one timer step at a time, and each change in a channel's output becomes a step in the blip buffers.
+	Between steps there is nothing to compute, so the cost follows the pitch of the channels rather than the clock.
+	The frame sequencer clocks length counters, sweep and envelopes on the falling edge of bit 12 of the divider.
+*/
+class APU
+{
+public:
+	APU();
+
+	void Initialize(BYTE* ioMemory);
+	// Registers are left as the boot ROM leaves them
+	void Reset();
+
+	void CatchUp(uint64_t clockCycle);
+	// Finishes the audio up to clockCycle so it can be read, call once a frame
+	void EndFrame(uint64_t clockCycle);
+
+	// Both expect CatchUp to the current cycle first. Addresses are offsets from 0xFF00.
+	BYTE ReadRegister(WORD address) const;
+	void WriteRegister(WORD address, BYTE data, uint64_t clockCycle);
+	// DIV was written at clockCycle, which restarts the frame sequencer's clock
+	void ResetDivider(uint64_t clockCycle);
+
+	// Settings rather than state, neither is changed when a state is loaded
+	void SetSampleRate(int sampleRate);
+	int GetSampleRate() const { return m_sampleRate; }
+	// Scales the sample rate by a ratio close to one from the next frame on, without a break in the sound.
+	// Lets the player speed up or slow down the audio slightly to keep its buffer from running dry or filling up.
+	void SetRateAdjustment(double ratio) { m_rateAdjustment = ratio; }
+	void SetQuality(BlipBuffer::Quality quality);
+	BlipBuffer::Quality GetQuality() const { return m_left.GetQuality(); }
+	// With output off the channels still run but nothing reaches the blip buffers, for frames that are thrown away
+	void SetOutputEnabled(bool enabled);
+	bool IsOutputEnabled() const { return m_outputEnabled; }
+	// For instances nobody listens to. The frame sequencer still runs, so NR52, length counters, sweep and envelopes
+	// behave as the game expects, but the channels' timers stand still and nothing is mixed.
+	void SetRegistersOnly(bool registersOnly);
+	bool IsRegistersOnly() const { return m_registersOnly; }
+
+	int GetSamplesAvailable() const { return m_left.GetSamplesAvailable(); }
+	// Reads up to count stereo samples, interleaved left then right, and returns how many were read
+	int ReadSamples(int16_t* out, int count);
+
+	void SaveState(StateBuffer& state) const;
+	void LoadState(StateBuffer& state);
+
+	static constexpr int DEFAULT_SAMPLE_RATE = 48000;
+
+private:
+	enum ChannelIndex
+	{
+		SQUARE_1,
+		SQUARE_2,
+		WAVE,
+		NOISE,
+		CHANNEL_COUNT
+	};
+
+	struct Channel
+	{
+		bool enabled;
+		bool dacEnabled;
+		int lengthCounter;
+		bool lengthEnabled;
+
+		int envelopeVolume;
+		int envelopePeriod;
+		int envelopeTimer;
+		bool envelopeIncrease;
+
+		int frequency;
+		// The clock cycle of the next timer step, and the duty step, wave sample or noise shift register it moves
+		uint64_t timerCycle;
+		int position;
+		WORD lfsr;
+
+		// Square 1 only
+		int sweepPeriod;
+		int sweepTimer;
+		int sweepShift;
+		bool sweepNegate;
+		bool sweepEnabled;
+		int sweepFrequency;
+	};
+
+	void RunChannel(int index, uint64_t clockCycle);
+	static WORD StepNoise(WORD lfsr, bool narrow);
+	int GetTimerPeriod(int index) const;
+	// The channel's output, 0 to 15, before panning and master volume
+	int GetChannelLevel(int index) const;
+	void UpdateOutput(int index, uint64_t clockCycle);
+	void UpdateOutputs(uint64_t clockCycle);
+
+	void StepFrameSequencer(uint64_t clockCycle);
+	void ClockLength(Channel& channel);
+	void ClockEnvelope(Channel& channel);
+	void ClockSweep();
+	int CalculateSweepFrequency();
+
+	void Trigger(int index, uint64_t clockCycle);
+	void PowerOff();
+	// Makes the audio up to clockCycle readable and starts the next blip buffer frame there
+	void FinishBlipFrame(uint64_t clockCycle);
+	// Runs through up to count samples nobody read, so the output carries on from where they leave off
+	void DropSamples(int count);
+	int GetRegisterBase(int index) const { return 0x10 + index * 5; }
+
+	// Offsets from 0xFF00
+	static constexpr WORD NR10 = 0x10;
+	static constexpr WORD NR30 = 0x1A;
+	static constexpr WORD NR32 = 0x1C;
+	static constexpr WORD NR43 = 0x22;
+	static constexpr WORD NR50 = 0x24;
+	static constexpr WORD NR51 = 0x25;
+	static constexpr WORD NR52 = 0x26;
+	static constexpr WORD WAVE_RAM = 0x30;
+	static constexpr WORD LAST_REGISTER = 0x3F;
+
+	// The frame sequencer steps at 512 Hz
+	static constexpr uint64_t FRAME_SEQUENCER_PERIOD = 8192;
+	// All four channels at full volume on one side, times the largest master volume, stays within a 16-bit sample
+	static constexpr int AMPLITUDE_SCALE = 64;
+	// One video frame, the longest a blip buffer frame gets before it is finished early
+	static constexpr uint64_t MAX_FRAME_CYCLES = 70224;
+	// About a tenth of a second, anything older is dropped if nobody reads the samples
+	static constexpr int MAX_BUFFERED_SAMPLES = 4800;
+
+	BYTE* m_ioMemory;
+	Channel m_channels[CHANNEL_COUNT];
+	bool m_powered;
+
+	uint64_t m_lastSyncCycle;
+	uint64_t m_frameSequencerCycle;
+	int m_frameSequencerStep;
+
+	BlipBuffer m_left;
+	BlipBuffer m_right;
+	// The clock cycle the blip buffers' frame started at
+	uint64_t m_frameStartCycle;
+	// What each channel last added to each side, so only changes are turned into steps
+	int m_outputLeft[CHANNEL_COUNT];
+	int m_outputRight[CHANNEL_COUNT];
+	int m_sampleRate;
+	double m_rateAdjustment;
+	double m_appliedRateAdjustment;
+	bool m_outputEnabled;
+	bool m_registersOnly;
+};
@@ -0,0 +1,25 @@
+#pragma once
+#include <SFML/Audio/SoundStream.hpp>
+
+#include "EmulationThread.h"
+
+// Plays the samples the emulation thread queues. SFML calls onGetData from its own thread whenever it wants more.
+class AudioStream : public sf::SoundStream
+{
+public:
+	explicit AudioStream(EmulationThread::AudioQueue& queue);
+	~AudioStream() override;
+
+protected:
+	bool onGetData(Chunk& data) override;
+	void onSeek(sf::Time timeOffset) override;
+
+private:
+	// Stereo samples handed over per call, about 10 ms
+	static constexpr size_t CHUNK_SAMPLES = 512;
+
+	EmulationThread::AudioQueue& m_queue;
+	int16_t m_chunk[CHUNK_SAMPLES * 2];
+	int16_t m_lastLeft;
+	int16_t m_lastRight;
+};
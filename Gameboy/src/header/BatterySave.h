@@ -0,0 +1,74 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Cartridge;
+
+/*
+	Keeps a cartridge's battery-backed RAM in a .sav file next to the ROM. Once a frame the emulation thread hands over
+	the pages of RAM the game changed, and a writer thread saves the file a little after the game stops writing. The
+	file is written to a temporary file that is then renamed over the old one, so a crash never leaves half a save.
+	Handing over the pages never waits on the writer, if it is busy they are picked up on a later frame instead.
+	Cartridges with a real time clock get the 48 byte footer most emulators use after the RAM: the running and the
+	latched registers as 32 bit values, then the host time as a 64 bit UNIX timestamp, all little endian.
+*/
+class BatterySave
+{
+public:
+	BatterySave();
+	~BatterySave();
+
+	// Loads the .sav file into the cartridge's RAM if there is one and starts saving. Cartridges without a battery are
+	// ignored. The previous cartridge is detached first.
+	void Attach(Cartridge* cart);
+	// Moves the clock on by the time that passed since the save was written, like the real cartridge's would.
+	// Off keeps the clock where it was saved, so runs are repeatable. Takes effect on the next Attach.
+	void SetClockCatchUp(bool catchUp) { m_clockCatchUp = catchUp; }
+	bool GetClockCatchUp() const { return m_clockCatchUp; }
+	// Writes anything outstanding and lets go of the cartridge, which can then be closed or reopened
+	void Detach();
+
+	// Emulation thread only, call once a frame
+	void Update();
+	// Writes whatever the game changed now rather than after the delay, without waiting for it to finish.
+	// The emulation thread must not be running.
+	void Flush();
+
+	static std::string GetSavePath(const std::string& romPath);
+
+private:
+	void Run();
+	bool WriteFile(const std::vector<BYTE>& image) const;
+	// Clock footers are read and written while the emulation thread is between frames or stopped
+	void WriteClockFooter();
+	void ReadClockFooter(const BYTE* footer, int size);
+	static void WriteLittleEndian(BYTE* out, uint64_t value, int size);
+	static uint64_t ReadLittleEndian(const BYTE* in, int size);
+
+	// Games often write a save in several bursts, this waits for them all
+	static constexpr std::chrono::seconds WRITE_DELAY = std::chrono::seconds(2);
+	static constexpr int CLOCK_FOOTER_SIZE = 48;
+	// Some emulators write the timestamp as 32 bits
+	static constexpr int SHORT_CLOCK_FOOTER_SIZE = 44;
+
+	Cartridge* m_cartridge;
+	std::string m_path;
+	int m_ramSize;
+	bool m_clockCatchUp;
+	std::thread m_thread;
+	// Writer thread only, the copy of the image being written
+	std::vector<BYTE> m_writeImage;
+
+	// Everything below is guarded by m_mutex
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	// The RAM as it should be saved, pages are copied in as the game changes them
+	std::vector<BYTE> m_image;
+	bool m_pending;
+	bool m_flushRequested;
+	bool m_stopping;
+	std::chrono::steady_clock::time_point m_lastChange;
+};
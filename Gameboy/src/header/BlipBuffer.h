@@ -0,0 +1,75 @@
+#pragma once
+#include <vector>
+
+/*
+	Band-limited step synthesis. Instead of generating one sample per clock cycle, each change in the output level is
+	added as a step at the clock cycle it happened, and the buffer turns the steps into samples at the output rate.
+	Every step is a band-limited impulse drawn from a table of sub-sample phases and summed into the buffer, reading
+	integrates them back into a waveform. The cost is per step rather than per cycle, and there is no aliasing.
+
+	The impulses are a polyphase windowed sinc. Quality picks how many taps each one has, adding a step is a multiply and
+	add over that many samples, done with SSE2 or AVX2 where the compiler targets them.
+*/
+class BlipBuffer
+{
+public:
+	// Taps per impulse: 8, 16 or 32. More taps keep more of the treble and let less alias through.
+	enum class Quality
+	{
+		FAST,
+		NORMAL,
+		HIGH,
+		COUNT
+	};
+
+	BlipBuffer();
+
+	// maxSamples is how many samples can be waiting to be read
+	void SetRates(double clockRate, double sampleRate, int maxSamples);
+	// Changes the ratio alone and keeps what is buffered, only between frames
+	void SetRatio(double clockRate, double sampleRate);
+	void Clear();
+	// Takes effect from the next step, what is already buffered keeps the impulses it was added with
+	void SetQuality(Quality quality);
+	Quality GetQuality() const { return m_quality; }
+
+	// Adds a change in level at clockTime, counted from the end of the last frame. delta has to fit in 16 bits.
+	void AddDelta(uint32_t clockTime, int delta);
+	// Makes every sample up to clockTime available to read, further times are counted from there
+	void EndFrame(uint32_t clockTime);
+
+	int GetSamplesAvailable() const { return static_cast<int>(m_offset >> TIME_BITS); }
+	// Reads up to count samples, each stride samples apart in out, and returns how many were read
+	int ReadSamples(int16_t* out, int count, int stride);
+	void RemoveSamples(int count);
+
+	// The widest impulse, which the buffer always leaves room for
+	static constexpr int MAX_KERNEL_WIDTH = 32;
+
+private:
+	static constexpr int TIME_BITS = 32;
+	static constexpr int PHASE_BITS = 5;
+	static constexpr int PHASE_COUNT = 1 << PHASE_BITS;
+	// Each phase of the kernel sums to 1 << KERNEL_BITS, so a step comes out exactly as high as it went in
+	static constexpr int KERNEL_BITS = 14;
+	// The high-pass filter of the output capacitor, about 15 Hz at 48 kHz
+	static constexpr int HIGH_PASS_SHIFT = 9;
+
+	// Taps are kept as 32 bits so a vector of them lines up with the buffer, each row is padded to the widest kernel
+	using Kernel = int32_t[PHASE_COUNT][MAX_KERNEL_WIDTH];
+	static const Kernel& GetKernel(Quality quality);
+	static int GetKernelWidth(Quality quality) { return 8 << static_cast<int>(quality); }
+	static void BuildKernel(Kernel& kernel, int width, double cutoff);
+
+	// Samples per clock cycle and the position of the end of the last frame, both with TIME_BITS of fraction
+	uint64_t m_factor;
+	uint64_t m_offset;
+	int m_maxSamples;
+	// One extra kernel width past the last sample that can be waiting, for the tails of the latest steps
+	std::vector<int32_t> m_buffer;
+	int32_t m_integrator;
+
+	Quality m_quality;
+	const Kernel* m_kernel;
+	int m_kernelWidth;
+};
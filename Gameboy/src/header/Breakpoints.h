@@ -0,0 +1,53 @@
+#pragma once
+#include <bitset>
+#include <vector>
+
+/*
+	The execution breakpoints and memory watchpoints given to a CPU. This only keeps the lists and answers whether an
+	address is on them, the CPU works out from them which instructions and pages of memory it needs to trap.
+*/
+class Breakpoints
+{
+public:
+	// Breakpoints in ROM can be limited to one 16 KiB bank, those outside of ROM always match any bank
+	static constexpr int ANY_BANK = -1;
+
+	static constexpr BYTE WATCH_READ = BIT_0;
+	static constexpr BYTE WATCH_WRITE = BIT_1;
+
+	struct Breakpoint
+	{
+		WORD address;
+		int bank;
+	};
+
+	struct Watchpoint
+	{
+		WORD first;
+		WORD last;
+		// WATCH_READ, WATCH_WRITE or both
+		BYTE access;
+	};
+
+	void AddBreakpoint(WORD address, int bank = ANY_BANK);
+	void RemoveBreakpoint(WORD address, int bank = ANY_BANK);
+	void AddWatchpoint(WORD first, WORD last, BYTE access);
+	void RemoveWatchpoint(WORD first, WORD last, BYTE access);
+	void Clear();
+
+	bool IsEmpty() const { return m_breakpoints.empty() && m_watchpoints.empty(); }
+	const std::vector<Breakpoint>& GetBreakpoints() const { return m_breakpoints; }
+	const std::vector<Watchpoint>& GetWatchpoints() const { return m_watchpoints; }
+
+	// bank is the ROM bank the address is mapped to, or ANY_BANK outside of ROM
+	bool IsBreakpoint(WORD address, int bank) const;
+	bool IsWatched(WORD address, BYTE access) const;
+	// Whether a watchpoint for the access covers any of the 256 bytes from page << 8
+	bool IsPageWatched(BYTE page, BYTE access) const;
+
+private:
+	std::vector<Breakpoint> m_breakpoints;
+	std::vector<Watchpoint> m_watchpoints;
+	// Addresses with a breakpoint in any bank, so the list is only searched when one is likely to match
+	std::bitset<0x10000> m_breakpointAddresses;
+};
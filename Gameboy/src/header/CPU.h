@@ -1,10 +1,16 @@
 #pragma once
 
+#include "APU.h"
+#include "Breakpoints.h"
+#include "InstructionTrace.h"
 #include "Joypad.h"
 #include "PPU.h"
+#include "Scheduler.h"
 
 class Cartridge;
 class PPU;
+class SerialDevice;
+class StateBuffer;
 
 struct CPU_Register
 {
@@ -31,11 +37,15 @@ struct DMATransfer
 	{
 		from = 0;
 		currentIndex = 0;
+		startCycle = 0;
 		active = false;
 	}
 
 	WORD from;
+	// Number of bytes that have already been copied into OAM
 	WORD currentIndex;
+	// Clock cycle at which the first byte is copied, one byte is copied every machine cycle after that
+	uint64_t startCycle;
 	bool active;
 };
 
@@ -47,9 +57,15 @@ public:
 
 	void AddCartridge(Cartridge* cart);
 	void PowerOn();
+	// The buttons stay held until the next call, so only changes have to be written
 	void WriteJoypad(const Joypad& joypad);
 	void CPU_Step();
 
+	// Runs instructions until at least clockCycles have elapsed, returns the number of cycles actually executed
+	unsigned long RunFor(unsigned long clockCycles);
+	// Runs instructions until the PPU reaches VBLANK or a full frame of cycles has elapsed, returns the number of cycles actually executed
+	unsigned long RunFrame();
+
 	void DumpGPU(sf::RenderTarget& renderWindow);
 
 	static constexpr BYTE INTERRUPT_VBLANK = BIT_0;
@@ -58,6 +74,10 @@ public:
 	static constexpr BYTE INTERRUPT_SERIAL = BIT_3;
 	static constexpr BYTE INTERRUPT_JOYPAD = BIT_4;
 
+	static constexpr int CLOCKSPEED  = 4194304;
+	// 154 scanlines of 456 cycles each
+	static constexpr unsigned long CYCLES_PER_FRAME = 70224;
+
 	bool IsInterruptEnabled(BYTE interrupt) const;
 	void RequestInterrupt(BYTE interrupt);
 	void ServiceInterrupts();
@@ -65,13 +85,125 @@ public:
 	BYTE Read(WORD address) const;
 
 	inline const bool IsRunning() { return m_isRunning; }
-	inline unsigned long GetTotalClockCycles() { return m_totalClockCycles; }
-	inline void ResetTotalClockCycles() { m_totalClockCycles = 0; }
+	inline uint64_t GetTotalClockCycles() { return m_totalClockCycles; }
 	inline void Draw() { m_ppu.DrawToScreen(); }
 
+	// The screen passed to the constructor can be null, the frames can still be read from here
+	inline const BYTE* GetFrameBuffer() const { return m_ppu.GetFrameBuffer(); }
+	void SetRenderer(PPU::Renderer renderer);
+
+	// Audio of every completed frame, interleaved left and right at the sample rate. Samples nobody reads for about a
+	// tenth of a second are dropped.
+	int ReadAudioSamples(int16_t* out, int count) { return m_apu.ReadSamples(out, count); }
+	int GetAudioSamplesAvailable() const { return m_apu.GetSamplesAvailable(); }
+	void SetAudioSampleRate(int sampleRate) { m_apu.SetSampleRate(sampleRate); }
+	void SetAudioRateAdjustment(double ratio) { m_apu.SetRateAdjustment(ratio); }
+	void SetAudioQuality(BlipBuffer::Quality quality) { m_apu.SetQuality(quality); }
+
+	// Settings for instances whose picture or sound nobody uses, such as headless runs. Everything the game can see
+	// behaves the same, only the frame buffer stops updating or the audio stops being generated. Unlike frames run
+	// with audio output off, a state saved with either of these off can differ from one saved with both on.
+	void SetVideoEnabled(bool enabled) { m_ppu.SetRenderingEnabled(enabled); }
+	bool IsVideoEnabled() const { return m_ppu.IsRenderingEnabled(); }
+	void SetAudioEnabled(bool enabled) { m_apu.SetRegistersOnly(!enabled); }
+	bool IsAudioEnabled() const { return !m_apu.IsRegistersOnly(); }
+	// Frames run with audio output off make no sound, for frames that are run again or thrown away
+	void SetAudioOutputEnabled(bool enabled) { m_apu.SetOutputEnabled(enabled); }
+	bool IsAudioOutputEnabled() const { return m_apu.IsOutputEnabled(); }
+
+	// Saves or restores the whole machine, including the PPU and the cartridge. Loading a state taken from a
+	// different cartridge is not supported.
+	void SaveState(StateBuffer& state);
+	void LoadState(StateBuffer& state);
+
+	struct RegisterSnapshot
+	{
+		WORD AF;
+		WORD BC;
+		WORD DE;
+		WORD HL;
+		WORD SP;
+		WORD PC;
+	};
+
+	RegisterSnapshot GetRegisters() const;
+
+	// Returns true once after the program executes LD B, B, which test ROMs use as a breakpoint to signal they are done
+	bool ConsumeDebugBreakpoint();
+
+	// RunFor and RunFrame stop before an instruction at a breakpoint runs, and after an instruction that reads or
+	// writes a watched address. Running again carries on from there. Only the instructions and pages of memory the
+	// breakpoints cover are trapped, with none set nothing is checked at all.
+	void SetBreakpoints(const Breakpoints& breakpoints);
+	const Breakpoints& GetBreakpoints() const { return m_breakpoints; }
+
+	struct DebugStop
+	{
+		enum Reason
+		{
+			NONE,
+			BREAKPOINT,
+			READ_WATCHPOINT,
+			WRITE_WATCHPOINT,
+		};
+
+		Reason reason;
+		WORD address;
+		// The ROM bank of a breakpoint, ANY_BANK for watchpoints
+		int bank;
+		// The opcode at a breakpoint, or the value that was read or written
+		BYTE value;
+	};
+
+	// Returns true once after a run stopped for a breakpoint or watchpoint
+	bool ConsumeDebugStop(DebugStop& stop);
+
+	// Records every instruction into the trace from now on, turning it on empties the trace first. Like breakpoints
+	// this swaps the opcode handlers, so instructions are only slowed down while it is on.
+	void SetTracing(bool enabled);
+	bool IsTracing() const { return m_tracing; }
+	const InstructionTrace& GetTrace() const { return m_trace; }
+
+	// Plugs a device into the link port, nullptr unplugs it. The CPU doesn't take ownership.
+	void SetSerialDevice(SerialDevice* device) { m_serialDevice = device; }
+	SerialDevice* GetSerialDevice() const { return m_serialDevice; }
+
 private:
 	bool m_isRunning;
 	PPU m_ppu;
+	APU m_apu;
+
+	bool m_debugBreakpointHit;
+
+	///////////////// Breakpoints /////////////////
+private:
+	// What has to happen before a read or write to a page of memory, most pages have nothing to do
+	static constexpr BYTE TRAP_SYNC = BIT_0;
+	static constexpr BYTE TRAP_DMA = BIT_1;
+	static constexpr BYTE TRAP_WATCH = BIT_2;
+
+	// Rebuilds the page traps and the opcode table from the breakpoints
+	void UpdateTraps();
+	void SetDMATraps(bool trapped);
+	BYTE TrappedRead(WORD address, BYTE traps);
+	void TrappedWrite(WORD address, BYTE data, BYTE traps);
+	// Takes the place of the handlers of the opcodes at breakpoints
+	void BreakpointTrap(BYTE opcode);
+	// Takes the place of every handler while tracing, then runs the one it replaced
+	void TraceTrap(BYTE opcode);
+	void StopRun(DebugStop::Reason reason, WORD address, int bank, BYTE value);
+
+	Breakpoints m_breakpoints;
+	BYTE m_readTraps[0x100];
+	BYTE m_writeTraps[0x100];
+	DebugStop m_debugStop;
+	// The breakpoint the last run stopped at, which lets its instruction run once when the run carries on
+	int m_resumeAddress;
+	// The run loops end when the clock reaches this, a stop moves it back to end them after the current instruction
+	uint64_t m_stopCycle;
+
+	InstructionTrace m_trace;
+	bool m_tracing;
 
 	///////////////// Registers /////////////////
 private:
@@ -133,8 +265,32 @@ private:
 	void SpinCycle(int numMachineCycles = 1);
 	void FlushClockCycles();
 
+	void ProcessScheduledEvents();
+
+	// Runs the PPU forward to the current clock cycle
+	void SyncPPU();
+	void SchedulePPUEvent();
+	static bool IsPPURegister(WORD address) { return address >= 0xFF40 && address <= 0xFF4B; }
+	// Runs the APU forward to the current clock cycle
+	void SyncAPU() { m_apu.CatchUp(m_totalClockCycles); }
+	static bool IsAPURegister(WORD address) { return address >= 0xFF10 && address <= 0xFF3F; }
+
 	int m_clockCycles;
-	unsigned int m_totalClockCycles;
+	uint64_t m_totalClockCycles;
+
+	Scheduler m_scheduler;
+
+	///////////////// OAM DMA /////////////////
+private:
+	// 160 bytes are copied, one per machine cycle, after a single machine cycle of setup
+	static constexpr WORD DMA_LENGTH = 0xA0;
+	static constexpr int DMA_SETUP_CYCLES = 4;
+	static constexpr int DMA_CYCLES_PER_BYTE = 4;
+
+	void StartDMATransfer(BYTE sourcePage);
+	// Copies every byte that the transfer would have reached by clockCycle
+	void CatchUpDMATransfer(uint64_t clockCycle);
+	bool IsDMASourceAddress(WORD address) const;
 
 	DMATransfer m_dmaTransferProgress;
 
@@ -145,19 +301,45 @@ private:
 	static constexpr WORD TIMER_MODULO = 0x0006;
 	static constexpr WORD TIMER_CONTROL = 0x0007;
 
-	static constexpr int CLOCKSPEED  = 4194304;
-
-	static constexpr int FREQUENCY_0 = 4096;
-	static constexpr int FREQUENCY_1 = 262144;
-	static constexpr int FREQUENCY_2 = 65536;
-	static constexpr int FREQUENCY_3 = 16382;
+	// DIV is the upper byte of a 16-bit counter that increments every clock cycle.
+	// TIMA increments on the falling edge of one of the counter bits, selected by bits 0 and 1 of TAC:
+	//		0 - bit 9 (4096 Hz), 1 - bit 3 (262144 Hz), 2 - bit 5 (65536 Hz), 3 - bit 7 (16384 Hz)
+	static constexpr BYTE TIMER_COUNTER_BITS[4] = { 9, 3, 5, 7 };
+
+	WORD GetInternalCounter(uint64_t clockCycle) const;
+	BYTE GetTimerCounter(uint64_t clockCycle) const;
+	bool IsTimerEnabled() const;
+	// Clock cycles between two increments of TIMA
+	uint64_t GetTimerPeriod() const;
+	// Whether the counter bit selected by TAC is currently feeding a 1 into TIMA
+	bool IsTimerInputHigh(uint64_t clockCycle) const;
+
+	void SyncTimer();
+	void IncrementTimerCounter();
+	void ScheduleTimerOverflow();
+	void TimerOverflow();
+	void WriteTimerRegister(WORD internalAddress, BYTE data);
+
+	// Clock cycle at which a write to DIV last reset the internal counter
+	uint64_t m_dividerResetCycle;
+	// The value of TIMA at m_timerSyncCycle, the current value is derived from the clock cycles since then
+	BYTE m_timerCounter;
+	uint64_t m_timerSyncCycle;
+	uint64_t m_timerOverflowCycle;
+
+	///////////////// Serial /////////////////
+private:
+	static constexpr WORD SERIAL_DATA = 0x0001;
+	static constexpr WORD SERIAL_CONTROL = 0x0002;
+	static constexpr BYTE SERIAL_TRANSFER_START = BIT_7;
+	static constexpr BYTE SERIAL_INTERNAL_CLOCK = BIT_0;
+	// The internal clock runs at 8192 Hz and a transfer shifts 8 bits
+	static constexpr uint64_t SERIAL_TRANSFER_CYCLES = 8 * (CLOCKSPEED / 8192);
 
-	void TimerStep(int cycles);
-	BYTE GetFrequency() const;
-	void SetFrequency();
+	void WriteSerialControl(BYTE data);
+	void SerialTransfer();
 
-	BYTE m_dividerCounter;
-	int m_timerCounter;
+	SerialDevice* m_serialDevice;
 
 	///////////////// Interrupts /////////////////
 private:
@@ -206,6 +388,10 @@ private:
 	BYTE m_interruptEnableRegister;
 
 	bool m_isStopped;
+
+	// The buttons last given to WriteJoypad, P1 is worked out from them whenever it is written
+	Joypad m_joypad;
+	void UpdateJoypadRegister(BYTE select);
 	bool m_isHalted;
 
 	///////////////// Opcode Helpers /////////////////
@@ -230,6 +416,10 @@ private:
 
 	typedef void (CPU::* func_opcode)(BYTE);
 	func_opcode m_opcodes[256];
+	// The handlers as SetupOpcodes made them, m_opcodes has traps in place of some while breakpoints are set
+	func_opcode m_instructions[256];
+	// The handlers TraceTrap runs, which are the breakpoint traps where there are any
+	func_opcode m_tracedOpcodes[256];
 	void SetupOpcodes();
 
 #pragma region 8-bit Arithmetic and Logic Instructions
@@ -291,6 +481,8 @@ private:
 #pragma region Load Instructions
 
 	void LD_R_R		(BYTE opcode);
+	// LD B, B does nothing, so it gets its own handler to catch test ROM breakpoints without slowing down the others
+	void LD_B_B		(BYTE opcode);
 	void LD_R_n8	(BYTE opcode);
 
 	void LD_RR_n16	(BYTE opcode);
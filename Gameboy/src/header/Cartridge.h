@@ -1,12 +1,31 @@
 #pragma once
 
 class MemoryBankController;
+class StateBuffer;
+struct ClockRegisters;
 class Cartridge
 {
 public:
+	// What a ROM's header says about it and which of its checks pass, see CartridgeHeader
+	struct HeaderInfo
+	{
+		std::string title;
+		BYTE cartridgeType;
+		BYTE romSizeCode;
+		BYTE ramSizeCode;
+		bool isColor;
+		// The boot ROM locks up if this one is wrong
+		bool headerChecksumValid;
+		// Nothing checks this one, hacks and homebrew often get it wrong
+		bool globalChecksumValid;
+		// The ROM is as large as the header's size code says
+		bool sizeValid;
+	};
+
 	explicit Cartridge();
 	~Cartridge();
 
+	// The ROM may be inside a .gz or .zip archive, see RomFile
 	void OpenFile(std::string filePath);
 
 	// Addresses should be in the range 0x0000 - 0x7FFF for rom memory or 0xA000 to 0xBFFF for ram memory
@@ -14,10 +33,36 @@ public:
 	// Addresses should be in the range 0x0000 - 0x7FFF for rom memory or 0xA000 to 0xBFFF for ram memory
 	void WriteMemory(WORD address, BYTE data);
 
-	const std::string& GetTitle() const { return m_title; }
+	const std::string& GetTitle() const { return m_header.title; }
+	const HeaderInfo& GetHeader() const { return m_header; }
+	const std::string& GetFilePath() const { return m_filePath; }
 	const bool IsValid() const { return m_mbc; }
 
 	int DumpRom(BYTE*& rom) const;
+	// See MemoryBankController::GetRomBank
+	int GetRomBank(WORD address) const;
+
+	// Returns false if the ROM is too small to have a header
+	static bool ReadHeader(const BYTE* rom, size_t size, HeaderInfo& info);
+
+	// Cartridges with a battery keep their RAM when the power is off, which is what a .sav file holds
+	bool HasBattery() const { return m_hasBattery; }
+	int DumpRam(BYTE*& ram) const;
+	void LoadRam(const BYTE* data, int size);
+	// See MemoryBankController::CopyDirtyRam
+	bool CopyDirtyRam(BYTE* image);
+
+	// See MemoryBankController, these do nothing for cartridges without a real time clock
+	bool HasClock() const { return m_hasClock; }
+	void SyncClock(uint64_t clockCycle);
+	void RebaseClock(uint64_t clockCycle);
+	void GetClock(ClockRegisters& current, ClockRegisters& latched) const;
+	void SetClock(const ClockRegisters& current, const ClockRegisters& latched);
+	void AdvanceClock(uint64_t seconds);
+
+	// Only the memory bank controller's RAM and registers are saved, the ROM is expected to be the same when loading
+	void SaveState(StateBuffer& state) const;
+	void LoadState(StateBuffer& state);
 
 private:
 	/*
@@ -65,6 +110,8 @@ private:
 			0x10  MBC3+TIMER+RAM+BATTERY   0xFE  HuC3
 			0x11  MBC3                     0xFF  HuC1+RAM+BATTERY
 			0x12  MBC3+RAM
+			0x20  MBC6
+			0x22  MBC7+SENSOR+RUMBLE+RAM+BATTERY
 
 		0x0148				- ROM Size			
 			0x00 -  32KByte (no ROM banking)
@@ -119,6 +166,16 @@ private:
 		BYTE		globalChecksum	[0x02];	// 0x014E - 0x014F
 	};
 
+	static bool IsBatteryType(BYTE cartridgeType);
+	// Returns 0 for size codes no cartridge uses
+	static size_t GetRomSize(BYTE romSizeCode);
+
+	static constexpr size_t HEADER_START = 0x100;
+	static constexpr size_t HEADER_END = 0x150;
+
 	MemoryBankController* m_mbc;
-	std::string m_title;
+	HeaderInfo m_header;
+	std::string m_filePath;
+	bool m_hasBattery;
+	bool m_hasClock;
 };
\ No newline at end of file
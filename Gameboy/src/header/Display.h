@@ -0,0 +1,20 @@
+#pragma once
+#include <SFML/Graphics/Image.hpp>
+#include <SFML/Graphics/RenderTarget.hpp>
+#include <SFML/Graphics/Texture.hpp>
+
+// Turns a framebuffer of shades into a texture and draws it scaled to fill the window below the menu bar
+class Display
+{
+public:
+	Display();
+
+	// frameBuffer holds SCREEN_WIDTH * SCREEN_HEIGHT shades, from 0 (white) to 3 (black), row by row
+	void Draw(sf::RenderTarget& target, const BYTE* frameBuffer);
+
+	static const sf::Color& GetColour(BYTE shade);
+
+private:
+	sf::Image m_pixelBuffer;
+	sf::Texture m_texture;
+};
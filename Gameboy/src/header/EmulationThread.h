@@ -0,0 +1,128 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "BatterySave.h"
+#include "CPU.h"
+#include "Joypad.h"
+#include "Movie.h"
+#include "RunAhead.h"
+#include "SPSCQueue.h"
+#include "TripleBuffer.h"
+
+class Cartridge;
+class SerialDevice;
+
+/*
+	Runs the emulator on its own thread so that presenting a frame never takes time away from emulating the next one.
+	Completed frames are handed to the UI thread through a triple buffer, and joypad changes come back through a queue.
+
+	The thread keeps time against the Game Boy's refresh rate, not the sound card's, so the two clocks drift apart.
+	Audio goes out through a queue, and the sample rate is nudged by up to half a percent each frame to keep the queue
+	near its target, which is too small a change in pitch to hear.
+*/
+class EmulationThread
+{
+public:
+	static constexpr int AUDIO_SAMPLE_RATE = APU::DEFAULT_SAMPLE_RATE;
+	static constexpr size_t AUDIO_QUEUE_SIZE = 16384;
+	// Interleaved left and right samples
+	using AudioQueue = SPSCQueue<int16_t, AUDIO_QUEUE_SIZE>;
+
+	EmulationThread();
+	~EmulationThread();
+
+	// Powers on with the cartridge and starts emulating. The cartridge must not be touched until Eject is called.
+	void Start(Cartridge* cart);
+	// Stopping also writes out the battery save without waiting for it to finish
+	void Stop();
+	// Stops and lets go of the cartridge once its battery save is written, so it can be closed
+	void Eject();
+	bool IsRunning() const { return m_running.load(std::memory_order_relaxed); }
+
+	// UI thread only, takes effect when the next ROM starts. See BatterySave::SetClockCatchUp.
+	void SetClockCatchUp(bool catchUp) { m_batterySave.SetClockCatchUp(catchUp); }
+	bool GetClockCatchUp() const { return m_batterySave.GetClockCatchUp(); }
+
+	// Movies start from the current frame. While one is playing, input sent from the UI is ignored.
+	// Playing a movie stops battery saves until the ROM is opened again.
+	void StartRecording();
+	bool StopRecording(const std::string& filePath);
+	bool IsRecording() const { return m_movie.IsRecording(); }
+	bool PlayMovie(const std::string& filePath);
+	bool IsPlayingMovie() const { return m_moviePlaying.load(std::memory_order_relaxed); }
+
+	// Records every instruction into a ring of the last ones run, see InstructionTrace. Turning it on empties the trace.
+	void SetTracing(bool enabled);
+	// Only the UI thread changes it, and only while the thread is paused
+	bool IsTracing() const { return m_sm83.IsTracing(); }
+	// Writes the trace out and carries on tracing, returns false if the file couldn't be written
+	bool SaveTrace(const std::string& filePath);
+
+	// Plugs a device into the link port, nullptr unplugs it. The device must stay alive until it is unplugged.
+	void SetSerialDevice(SerialDevice* device);
+
+	// UI thread only. Returns false if the emulation thread has fallen too far behind to take more input.
+	bool SendJoypad(const Joypad& joypad);
+
+	// UI thread only. Returns the newest completed frame, which stays valid until the next call.
+	const BYTE* GetLatestFrame();
+
+	// The audio device's thread is the only consumer
+	AudioQueue& GetAudioQueue() { return m_audioQueue; }
+	// The ratio the sample rate was last scaled by to keep the audio queue near its target
+	double GetAudioRateAdjustment() const { return m_audioRateAdjustment.load(std::memory_order_relaxed); }
+	// Takes effect from the next frame
+	void SetAudioQuality(BlipBuffer::Quality quality) { m_audioQuality.store(quality, std::memory_order_relaxed); }
+	BlipBuffer::Quality GetAudioQuality() const { return m_audioQuality.load(std::memory_order_relaxed); }
+
+	// Takes effect from the next frame, see RunAhead
+	void SetRunAheadFrames(int frames) { m_runAheadFrames.store(frames, std::memory_order_relaxed); }
+	int GetRunAheadFrames() const { return m_runAheadFrames.load(std::memory_order_relaxed); }
+
+	// How many times faster than real time the core emulates frames, measured once a second. Run-ahead of N frames
+	// needs this to stay above N + 1.
+	double GetSpeed() const { return m_speed.load(std::memory_order_relaxed); }
+
+private:
+	void Resume();
+	void Run();
+	void QueueAudio();
+
+	using FrameBuffer = std::array<BYTE, SCREEN_WIDTH * SCREEN_HEIGHT>;
+
+	// CPU::CYCLES_PER_FRAME at 4194304 Hz
+	static constexpr std::chrono::nanoseconds FRAME_PERIOD = std::chrono::nanoseconds(16742706);
+	static constexpr size_t JOYPAD_QUEUE_SIZE = 64;
+	static constexpr int SPEED_SAMPLE_FRAMES = 60;
+	// Stereo samples, two frames of audio. Enough that the player's reads, which don't line up with frames, never find it empty.
+	static constexpr size_t AUDIO_TARGET_SAMPLES = 1600;
+	// More than this waiting means nobody is playing it, new audio is dropped rather than adding latency
+	static constexpr size_t AUDIO_MAX_SAMPLES = 4 * AUDIO_TARGET_SAMPLES;
+	static constexpr double MAX_RATE_ADJUSTMENT = 0.005;
+
+	CPU m_sm83;
+	Cartridge* m_cartridge;
+	std::thread m_thread;
+	std::atomic<bool> m_running;
+
+	TripleBuffer<FrameBuffer> m_frames;
+	SPSCQueue<Joypad, JOYPAD_QUEUE_SIZE> m_joypadQueue;
+
+	Movie m_movie;
+	std::atomic<bool> m_moviePlaying;
+
+	BatterySave m_batterySave;
+
+	RunAhead m_runAhead;
+	std::atomic<int> m_runAheadFrames;
+	std::atomic<double> m_speed;
+
+	AudioQueue m_audioQueue;
+	std::vector<int16_t> m_audioSamples;
+	std::atomic<double> m_audioRateAdjustment;
+	std::atomic<BlipBuffer::Quality> m_audioQuality;
+};
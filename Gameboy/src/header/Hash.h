@@ -0,0 +1,36 @@
+#pragma once
+#include <array>
+
+// Checksums used to identify ROMs and compare frames between runs
+class Hash
+{
+public:
+	static uint32_t CRC32(const BYTE* data, size_t size);
+	// XXH64, much faster than CRC32 on large inputs such as frames
+	static uint64_t XXHash64(const BYTE* data, size_t size, uint64_t seed = 0);
+
+	// SHA-1, which ROM databases identify dumps by
+	typedef std::array<BYTE, 20> SHA1Digest;
+	static SHA1Digest SHA1(const BYTE* data, size_t size);
+
+private:
+	// One table per byte of an 8 byte step, see CRC32
+	typedef std::array<std::array<uint32_t, 256>, 8> CRC32Tables;
+	static CRC32Tables BuildCRC32Tables();
+
+	static void SHA1Blocks(uint32_t state[5], const BYTE* data, size_t blockCount);
+
+	static uint64_t XXHashRound(uint64_t accumulator, uint64_t input);
+	static uint64_t XXHashMergeRound(uint64_t accumulator, uint64_t value);
+	static uint64_t ReadUInt64(const BYTE* data);
+	static uint32_t ReadUInt32(const BYTE* data);
+	static uint32_t ReadUInt32BigEndian(const BYTE* data);
+	static uint32_t RotateLeft32(uint32_t value, int bits) { return (value << bits) | (value >> (32 - bits)); }
+	static uint64_t RotateLeft(uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); }
+
+	static constexpr uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+	static constexpr uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+	static constexpr uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+	static constexpr uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+	static constexpr uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+};
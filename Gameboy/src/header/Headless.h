@@ -0,0 +1,53 @@
+#pragma once
+
+#include "BlipBuffer.h"
+#include "Breakpoints.h"
+#include "PPU.h"
+
+// Command line modes that run the emulator without a window
+class Headless
+{
+public:
+	// Returns false when the arguments don't ask for a headless mode, the window should be opened instead
+	static bool RunCommandLine(int argc, char* argv[], int& exitCode);
+
+	// Runs the ROM for the given number of frames with each renderer and prints the speed of each,
+	// along with how many frames of run-ahead it could keep up with
+	static int RunBenchmark(const std::string& romPath, int frames);
+
+	// Plays the movie back as fast as possible and prints the speed and a checksum of the last frame
+	static int RunMovie(const std::string& romPath, const std::string& moviePath);
+
+	// Runs two instances linked by a LinkCable, then the same two unlinked, and prints the speed of both
+	static int RunLinked(const std::string& firstRomPath, const std::string& secondRomPath, int frames);
+
+	// Runs the APU on its own with all four channels playing at each quality and prints how much of a frame it takes,
+	// then if a ROM is given the ROM's speed with audio output on and off
+	static int RunAPUBenchmark(int seconds, const std::string& romPath);
+
+	// Scans the directory with a RomLibrary and prints each ROM's hashes, failed checks, title and path
+	static int RunLibrary(const std::string& directory);
+
+	// Times the ROM for the given number of frames with and without tracing, then writes the trace to tracePath
+	static int RunTrace(const std::string& romPath, int frames, const std::string& tracePath);
+
+	// Runs the ROM for the given number of frames and prints where it was and the registers every time it stops
+	static int RunDebug(const std::string& romPath, int frames, const Breakpoints& breakpoints);
+
+private:
+	// Returns the number of frames emulated per second, and the time a state save and load takes
+	static double BenchmarkRenderer(const std::string& romPath, int frames, PPU::Renderer renderer, bool outputEnabled,
+		double& stateSeconds);
+	// Returns how many times faster than real time the APU ran with every channel playing
+	static double BenchmarkAPU(int frames, BlipBuffer::Quality quality);
+	// Returns the number of frames emulated per second
+	static double BenchmarkAudioOutput(const std::string& romPath, int frames, bool outputEnabled);
+	// Adds the breakpoint or watchpoint written as --debug takes them, returns false if it can't be read
+	static bool ParseBreakpoint(const std::string& text, Breakpoints& breakpoints);
+	static void PrintUsage();
+
+	// The Game Boy refreshes at 4194304 / 70224 Hz
+	static constexpr double FRAMES_PER_SECOND = 59.7275;
+	// A watchpoint on a busy address would otherwise print for as long as the ROM runs
+	static constexpr int MAX_DEBUG_STOPS = 1000;
+};
@@ -0,0 +1,70 @@
+#pragma once
+#include <istream>
+#include <vector>
+
+/*
+	Decodes DEFLATE data (RFC 1951), the compression used by gzip and zip. The compressed data is read from the
+	stream a chunk at a time and decoded straight into the caller's buffer. Back references are copied from that
+	buffer too, so it has to hold the whole output rather than going through a separate window. Stored blocks are
+	read from the stream directly into the output.
+*/
+class Inflate
+{
+public:
+	// Reads no more than compressedSize bytes from the current position of in
+	Inflate(std::istream& in, uint64_t compressedSize);
+
+	// Returns false if the data is corrupt, or doesn't decode to exactly outSize bytes
+	bool Decompress(BYTE* out, size_t outSize);
+
+private:
+	static constexpr int MAX_BITS = 15;
+	static constexpr int MAX_LITERAL_CODES = 288;
+	static constexpr int MAX_DISTANCE_CODES = 30;
+	// Codes this long or shorter are decoded with a single lookup, longer ones are walked bit by bit
+	static constexpr int FAST_BITS = 10;
+	static constexpr size_t CHUNK_SIZE = 0x10000;
+
+	struct HuffmanTable
+	{
+		// An entry is the symbol << 4 | the code's length, or 0 if the code is longer than FAST_BITS
+		uint16_t fast[1 << FAST_BITS];
+		uint16_t counts[MAX_BITS + 1];
+		// Symbols ordered by their codes
+		uint16_t symbols[MAX_LITERAL_CODES];
+
+		// Returns false if there are more codes than the lengths allow
+		bool Build(const BYTE* lengths, int count);
+	};
+
+	struct FixedTables
+	{
+		HuffmanTable literals;
+		HuffmanTable distances;
+	};
+
+	bool InflateStored(BYTE* out, size_t outSize, size_t& position);
+	bool InflateCodes(const HuffmanTable& literals, const HuffmanTable& distances, BYTE* out, size_t outSize, size_t& position);
+	bool ReadDynamicTables(HuffmanTable& literals, HuffmanTable& distances);
+	static FixedTables BuildFixedTables();
+
+	// Returns -1 if the bits don't make a code
+	int Decode(const HuffmanTable& table);
+	uint32_t ReadBits(int count);
+	void ConsumeBits(int count);
+	void Refill();
+	bool ReadChunk();
+
+	std::istream& m_in;
+	uint64_t m_remainingInput;
+	std::vector<BYTE> m_chunk;
+	size_t m_chunkPosition;
+	size_t m_chunkEnd;
+
+	// Bits are read from the least significant end. Past the end of the input zeros are shifted in, decoding
+	// may look ahead into them but reading any of them means the data was cut short.
+	uint64_t m_bits;
+	int m_bitCount;
+	int m_paddingBits;
+	bool m_error;
+};
@@ -0,0 +1,93 @@
+#pragma once
+#include <vector>
+
+/*
+	A ring of the last instructions the CPU ran, each with the registers it started with. Recording one is a copy of
+	a few fields into a fixed block of memory, cheap enough to leave on while playing, and the file is written and
+	decoded into text only when somebody wants to read it.
+
+	File layout, in the byte order of the machine that wrote it:
+		char[4]		"GBTR"
+		uint32		version
+		uint16		0x0102, to tell the byte order
+		uint16		size of a record
+		uint32		number of records, followed by the records from oldest to newest
+*/
+class InstructionTrace
+{
+public:
+	struct Record
+	{
+		// The cycle the instruction's opcode was fetched on, 48 bits of it
+		uint32_t cycleLow;
+		WORD cycleHigh;
+		WORD pc;
+		// The 16 KiB ROM bank pc was in, NO_BANK outside of ROM
+		WORD bank;
+		WORD af;
+		WORD bc;
+		WORD de;
+		WORD hl;
+		WORD sp;
+		// The opcode and as many of the bytes after it as the instruction uses
+		BYTE bytes[3];
+		BYTE flags;
+
+		uint64_t GetCycle() const { return (static_cast<uint64_t>(cycleHigh) << 32) | cycleLow; }
+	};
+
+	static constexpr WORD NO_BANK = 0xFFFF;
+	static constexpr BYTE FLAG_IME = BIT_0;
+	static constexpr BYTE FLAG_HALTED = BIT_1;
+	// 24 MiB, about two seconds of instructions
+	static constexpr size_t DEFAULT_CAPACITY = 1 << 20;
+
+	// The capacity is rounded up to a power of two
+	explicit InstructionTrace(size_t capacity = DEFAULT_CAPACITY);
+
+	// Empties the ring. Nothing is allocated until the first time this is called, so an unused trace costs no memory.
+	void Clear();
+
+	// Returns the next record to fill in, which takes the place of the oldest once the ring is full. Clear has to
+	// have been called first.
+	Record& Add()
+	{
+		Record& record = m_records[m_next];
+		m_next = (m_next + 1) & (m_capacity - 1);
+		m_count += m_count < m_capacity;
+		return record;
+	}
+
+	// Takes back the newest record, for an instruction that didn't run after all
+	void RemoveLast();
+	size_t GetCount() const { return m_count; }
+	// 0 is the oldest record
+	const Record& GetRecord(size_t index) const { return m_records[(m_next - m_count + index) & (m_capacity - 1)]; }
+
+	// Returns false if the file couldn't be written
+	bool Save(const std::string& filePath) const;
+	// Returns false if the file is not a trace written on a machine with the same byte order
+	bool Load(const std::string& filePath);
+
+	// Writes every record as a line of text with the instruction disassembled
+	void Decode(std::ostream& out) const;
+
+	// Returns how many bytes the instruction starting with opcode takes, including the opcode
+	static int GetLength(BYTE opcode);
+	// Disassembles the instruction in bytes, which has to hold GetLength of them. address is where it was read from,
+	// relative jumps are shown with the address they go to.
+	static std::string Disassemble(const BYTE* bytes, WORD address);
+
+private:
+	size_t m_capacity;
+	std::vector<Record> m_records;
+	// Where the next record goes
+	size_t m_next;
+	size_t m_count;
+
+	static constexpr char FILE_MAGIC[4] = { 'G', 'B', 'T', 'R' };
+	static constexpr uint32_t FILE_VERSION = 1;
+	static constexpr uint16_t FILE_BYTE_ORDER = 0x0102;
+	// A corrupt count mustn't turn into a huge allocation
+	static constexpr uint32_t MAX_FILE_RECORDS = 1 << 26;
+};
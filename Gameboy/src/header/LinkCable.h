@@ -0,0 +1,89 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "SerialDevices.h"
+
+class CPU;
+class LinkCable;
+
+/*
+	One end of a LinkCable, plugged into the link port of one instance. Both instances run freely on their own
+	threads. A side that starts a transfer with the external clock publishes a listening window from the cycle it
+	wrote SC, and a side driving the clock resolves its transfer against the windows of the other side by cycle,
+	once the other side has run at least that far. Windows are kept until the driving side has run past them, so
+	neither side has to stop for the other unless a transfer is in flight.
+*/
+class SerialDevice_LinkCable : public SerialDevice
+{
+public:
+	SerialDevice_LinkCable();
+	~SerialDevice_LinkCable() override;
+
+	BYTE TransferInternalClock(BYTE outgoing, uint64_t clockCycle) override;
+	bool TransferExternalClock(BYTE outgoing, BYTE& incoming, uint64_t clockCycle) override;
+	void SetListening(bool listening, BYTE outgoing, uint64_t clockCycle) override;
+
+	// Lets the other end know this instance has run up to clockCycle, in case it is waiting on a transfer
+	void AdvanceTo(uint64_t clockCycle);
+	// The other end stops waiting on this one and sees an unplugged port from then on
+	void Unplug();
+
+private:
+	friend class LinkCable;
+
+	static constexpr uint64_t NEVER = ~0ull;
+
+	// The cycles from start up to but not including end that this end was listening, with the byte it offered
+	struct ListenWindow
+	{
+		uint64_t start;
+		uint64_t end;
+		BYTE outgoing;
+	};
+
+	void PlugIn(LinkCable* cable, SerialDevice_LinkCable* other, uint64_t clockCycle);
+	// Publishes how far this end has run and resolves the other end's transfer if it is now known how it went.
+	// The cable's mutex has to be held.
+	void PublishClockCycle(uint64_t clockCycle);
+	// Exchanges bytes between an end driving the clock and the window of listener open on the cycle it drives
+	// the transfer, or shifts in all 1s if there is none. listener has to have run up to that cycle.
+	static void Resolve(SerialDevice_LinkCable& driver, SerialDevice_LinkCable& listener);
+
+	LinkCable* m_cable;
+	SerialDevice_LinkCable* m_other;
+	bool m_pluggedIn;
+	// How far this end's instance has run, as far as the other end knows
+	uint64_t m_clockCycle;
+
+	// Set while this end drives the clock for a transfer that completes on m_driveCycle and hasn't been resolved
+	bool m_driving;
+	uint64_t m_driveCycle;
+	BYTE m_driveOutgoing;
+	bool m_resolved;
+	BYTE m_driveIncoming;
+
+	// From oldest to newest, only the newest can still be open with an end of NEVER
+	std::vector<ListenWindow> m_windows;
+	// Set once the other end answered the open window, until the CPU picks the byte up
+	bool m_answered;
+	BYTE m_answerIncoming;
+};
+
+// Two instances in one process connected through their link ports
+class LinkCable
+{
+public:
+	LinkCable();
+
+	// Plugs the ends into both instances and runs each one for the given number of frames on its own thread
+	void RunFrames(CPU& first, CPU& second, int frames);
+
+private:
+	friend class SerialDevice_LinkCable;
+
+	SerialDevice_LinkCable m_ends[2];
+	std::mutex m_mutex;
+	std::condition_variable m_changed;
+};
@@ -1,17 +1,52 @@
 #pragma once
+#include <vector>
 
 #define ROM_BANK_SIZE 0x4000
 #define RAM_BANK_SIZE 0x2000
 
+class StateBuffer;
+
+// The registers of a real time clock, laid out like the MBC3's
+struct ClockRegisters
+{
+	BYTE seconds;
+	BYTE minutes;
+	BYTE hours;
+	BYTE daysLow;
+	// Bit 0 is bit 8 of the day counter, bit 6 halts the clock and bit 7 is set when the day counter overflows
+	BYTE daysHigh;
+};
+
 class MemoryBankController
 {
 public:
 	MemoryBankController();
 	virtual ~MemoryBankController();
 
+	// ROM is read straight through the bank pointers, only 0xA000 - 0xBFFF goes to the controller
+	BYTE Read(WORD address)
+	{
+		if (address < 0x8000)
+		{
+			return m_romMap[address / ROM_SLOT_SIZE][address & (ROM_SLOT_SIZE - 1)];
+		}
+		return ReadMemory(address);
+	}
+
+	static constexpr int NO_ROM_BANK = -1;
+
+	// The 16 KiB bank of ROM the byte at an address below 0x8000 currently comes from, NO_ROM_BANK if the controller
+	// mapped something other than ROM there
+	int GetRomBank(WORD address) const { return m_romMapBanks[address / ROM_SLOT_SIZE]; }
+
+	// Reads cartridge RAM or registers in 0xA000 - 0xBFFF
 	virtual BYTE ReadMemory (WORD address) = 0;
 	virtual void WriteMemory(WORD address, BYTE data) = 0;
 
+	// Saves the cartridge RAM, controllers with banking registers save those as well
+	virtual void SaveState(StateBuffer& state) const;
+	virtual void LoadState(StateBuffer& state);
+
 	int DumpRom(BYTE*& rom) const 
 	{
 		rom = m_rom;
@@ -24,14 +59,61 @@ public:
 		return m_ramSize;
 	}
 
+	// Replaces the start of RAM, such as with a battery save. Nothing is marked as written.
+	void LoadRam(const BYTE* data, int size);
+	// Copies every page of RAM the game changed since the last call to the same place in image, which must be as
+	// large as RAM. Returns false if nothing changed.
+	bool CopyDirtyRam(BYTE* image);
+
+	// Controllers with a real time clock count emulated cycles rather than host time, so fast forward, rewind and
+	// movies see the same time every run. The CPU syncs the clock before every write to the cartridge.
+	virtual bool HasClock() const { return false; }
+	virtual void SyncClock(uint64_t clockCycle) {}
+	// Counts from clockCycle on without ticking, for when the CPU's cycle counter starts over
+	virtual void RebaseClock(uint64_t clockCycle) {}
+	virtual void GetClock(ClockRegisters& current, ClockRegisters& latched) const {}
+	virtual void SetClock(const ClockRegisters& current, const ClockRegisters& latched) {}
+	// Moves the clock on by whole seconds at once, such as the time a game was switched off
+	virtual void AdvanceClock(uint64_t seconds) {}
+
 protected:
+	// Controllers map ROM in 8 KiB slots, most only ever map a pair of them at once
+	static constexpr int ROM_SLOT_SIZE = 0x2000;
+
+	// Maps bank 0 at 0x0000 and bank 1 at 0x4000 to start with
 	void Initialize(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize);
+	// Points the bankSize bytes from address at that bank of ROM, which wraps around the end of the ROM like the
+	// address lines do. Controllers call this whenever a bank register changes, and after loading a state.
+	void MapRom(WORD address, int bank, int bankSize = ROM_BANK_SIZE);
+	// Points the slot at address at ROM_SLOT_SIZE bytes of memory that isn't ROM
+	void MapOther(WORD address, const BYTE* data);
+	// All writes to RAM go through here so the battery save knows which pages to write
+	void WriteRam(int ramAddress, BYTE data)
+	{
+		if (m_ram[ramAddress] != data)
+		{
+			m_ram[ramAddress] = data;
+			m_dirtyPages[ramAddress / RAM_PAGE_SIZE] = true;
+			m_ramDirty = true;
+		}
+	}
 
 	int m_romSize;
 	int m_ramSize;
 
 	BYTE* m_rom;
 	BYTE* m_ram;
+	const BYTE* m_romMap[0x8000 / ROM_SLOT_SIZE];
+	// The 16 KiB bank each slot's pointer is in, kept alongside so nothing has to work it out from the pointer
+	int m_romMapBanks[0x8000 / ROM_SLOT_SIZE];
+
+private:
+	static constexpr int RAM_PAGE_SIZE = 0x100;
+
+	std::vector<bool> m_dirtyPages;
+	bool m_ramDirty;
+	// Where a state's RAM is read to, so only the pages that differ are marked
+	std::vector<BYTE> m_loadedRam;
 };
 
 class MemoryBankController_None : public MemoryBankController
@@ -53,6 +135,9 @@ public:
 	BYTE ReadMemory(WORD address) override;
 	void WriteMemory(WORD address, BYTE data) override;
 
+	void SaveState(StateBuffer& state) const override;
+	void LoadState(StateBuffer& state) override;
+
 private:
 	BYTE m_ramEnabled;
 	BYTE m_ramBank;
@@ -71,6 +156,9 @@ public:
 	BYTE ReadMemory(WORD address) override;
 	void WriteMemory(WORD address, BYTE data) override;
 
+	void SaveState(StateBuffer& state) const override;
+	void LoadState(StateBuffer& state) override;
+
 private:
 	BYTE m_romBank;
 	BYTE m_ramEnabled;
@@ -79,18 +167,39 @@ private:
 class MemoryBankController_MBC3 : public MemoryBankController
 {
 public:
-	MemoryBankController_MBC3(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize);
+	MemoryBankController_MBC3(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize, bool hasClock);
 	~MemoryBankController_MBC3() override;
 
 	BYTE ReadMemory(WORD address) override;
 	void WriteMemory(WORD address, BYTE data) override;
 
+	void SaveState(StateBuffer& state) const override;
+	void LoadState(StateBuffer& state) override;
+
+	bool HasClock() const override { return m_hasClock; }
+	void SyncClock(uint64_t clockCycle) override;
+	void RebaseClock(uint64_t clockCycle) override;
+	void GetClock(ClockRegisters& current, ClockRegisters& latched) const override;
+	void SetClock(const ClockRegisters& current, const ClockRegisters& latched) override;
+	void AdvanceClock(uint64_t seconds) override;
+
 private:
+	void TickSecond();
+	void AddDays(uint64_t days);
+	bool IsClockHalted() const { return m_rtc.daysHigh & RTC_HALT; }
+
+	// The clock runs off a 32768 Hz crystal, which divides the CPU clock evenly
+	static constexpr uint64_t RTC_CYCLES_PER_SECOND = 4194304;
+	static constexpr BYTE RTC_DAY_HIGH_BIT = 0x01;
+	static constexpr BYTE RTC_HALT = 0x40;
+	static constexpr BYTE RTC_DAY_CARRY = 0x80;
+
 	BYTE m_ramAndTimerEnabled;
 	BYTE m_ramBank;
 	BYTE m_romBank;
 
 	bool m_isRTCMode;
+	bool m_hasClock;
 
 	// Timer
 	// 08h  RTC S   Seconds   0 - 59 (0 - 3Bh)
@@ -102,11 +211,14 @@ private:
 	//	Bit 6  Halt(0 = Active, 1 = Stop Timer)
 	//	Bit 7  Day Counter Carry Bit(1 = Counter Overflow)
 
-	BYTE m_rtc_s;
-	BYTE m_rtc_m;
-	BYTE m_rtc_h;
-	BYTE m_rtc_dl;
-	BYTE m_rtc_dh;
+	ClockRegisters m_rtc;
+	// What the game reads, a copy of the clock taken when it writes 00h then 01h to 6000-7FFF
+	ClockRegisters m_latchedRtc;
+	BYTE m_lastLatchWrite;
+
+	// The clock is brought up to date lazily, cycles that didn't make up a whole second yet carry over
+	uint64_t m_rtcSyncCycle;
+	uint64_t m_rtcSubSecondCycles;
 };
 
 class MemoryBankController_MBC5 : public MemoryBankController
@@ -118,14 +230,298 @@ public:
 	BYTE ReadMemory(WORD address) override;
 	void WriteMemory(WORD address, BYTE data) override;
 
+	void SaveState(StateBuffer& state) const override;
+	void LoadState(StateBuffer& state) override;
+
 private:
 	BYTE m_ramEnabled;
 	BYTE m_ramBank;
 	WORD m_romBank;
 };
 
+// An MBC1 wired for multicarts, where the upper bank bits start one bit lower so each game gets 256 KiB to itself
+class MemoryBankController_MBC1M : public MemoryBankController
+{
+public:
+	MemoryBankController_MBC1M(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize);
+	~MemoryBankController_MBC1M() override;
+
+	BYTE ReadMemory(WORD address) override;
+	void WriteMemory(WORD address, BYTE data) override;
+
+	void SaveState(StateBuffer& state) const override;
+	void LoadState(StateBuffer& state) override;
+
+	// The header says MBC1 either way, but each game on a multicart starts with its own copy of the Nintendo logo
+	static bool IsMulticart(const char* cartridgeBuffer, int bufferSize);
+
+private:
+	void MapBanks();
+	int GetRamAddress(WORD address) const { return (address - 0xA000 + RAM_BANK_SIZE * (m_bankMode ? m_upperBank : 0)) % m_ramSize; }
+
+	BYTE m_ramEnabled;
+	// 5 bits written to 2000-3FFF, of which only the lower 4 reach the ROM
+	BYTE m_lowerBank;
+	// 2 bits written to 4000-5FFF, the game's number on the cart
+	BYTE m_upperBank;
+	BYTE m_bankMode;
+};
+
+/*
+	Only used by Net de Get. ROM and flash are mapped in 8 KiB banks at 4000-5FFF and 6000-7FFF, RAM in 4 KiB banks at
+	A000-AFFF and B000-BFFF. Flash reads as erased, writing it isn't emulated.
+*/
+class MemoryBankController_MBC6 : public MemoryBankController
+{
+public:
+	MemoryBankController_MBC6(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize);
+	~MemoryBankController_MBC6() override;
+
+	BYTE ReadMemory(WORD address) override;
+	void WriteMemory(WORD address, BYTE data) override;
+
+	void SaveState(StateBuffer& state) const override;
+	void LoadState(StateBuffer& state) override;
+
+private:
+	static constexpr int BANK_SIZE = 0x2000;
+	static constexpr int RAM_HALF_BANK_SIZE = 0x1000;
+	static constexpr BYTE SELECT_FLASH = 0x08;
+
+	void MapBanks();
+	int GetRamAddress(WORD address) const;
+
+	BYTE m_ramEnabled;
+	BYTE m_ramBanks[2];
+	BYTE m_romBanks[2];
+	// SELECT_FLASH maps flash instead of ROM
+	BYTE m_romSelects[2];
+
+	std::vector<BYTE> m_erasedFlash;
+};
+
+/*
+	Has an accelerometer and a 256 byte 93LC56 EEPROM in place of RAM, both seen through registers at A000-AFFF. The
+	EEPROM is driven bit by bit through its chip select, clock and data pins. No tilt input is connected yet, so the
+	accelerometer always reads level.
+*/
+class MemoryBankController_MBC7 : public MemoryBankController
+{
+public:
+	MemoryBankController_MBC7(char* cartridgeBuffer, int bufferSize, int romSize);
+	~MemoryBankController_MBC7() override;
+
+	BYTE ReadMemory(WORD address) override;
+	void WriteMemory(WORD address, BYTE data) override;
+
+	void SaveState(StateBuffer& state) const override;
+	void LoadState(StateBuffer& state) override;
+
+private:
+	enum class EepromState : BYTE
+	{
+		// Waiting for the start bit
+		IDLE,
+		// Shifting in the opcode and address
+		COMMAND,
+		// Shifting in the word to write
+		DATA,
+		// Shifting out the word read
+		READ,
+	};
+
+	void WriteEeprom(BYTE pins);
+	void RunEepromCommand();
+	void FinishEepromWrite();
+	void WriteEepromWord(int wordAddress, WORD value);
+
+	static constexpr int EEPROM_SIZE = 0x100;
+	static constexpr int EEPROM_COMMAND_BITS = 10;
+	static constexpr BYTE EEPROM_CHIP_SELECT = 0x80;
+	static constexpr BYTE EEPROM_CLOCK = 0x40;
+	static constexpr BYTE EEPROM_DATA_IN = 0x02;
+	static constexpr BYTE EEPROM_DATA_OUT = 0x01;
+	// What the accelerometer reads when level, 1 g of tilt moves it by about 0x70
+	static constexpr WORD ACCELEROMETER_CENTER = 0x81D0;
+
+	BYTE m_ramEnabled;
+	// Both this and m_ramEnabled have to be set for the registers to respond
+	BYTE m_registersEnabled;
+	BYTE m_romBank;
+
+	WORD m_accelerometerX;
+	WORD m_accelerometerY;
+	// 55h erases the latched values and AAh latches new ones
+	bool m_accelerometerErased;
+
+	BYTE m_eepromPins;
+	BYTE m_eepromDataOut;
+	EepromState m_eepromState;
+	BYTE m_eepromBits;
+	WORD m_eepromShift;
+	// The opcode and address of a write, kept while its data is shifted in
+	WORD m_eepromCommand;
+	bool m_eepromWriteEnabled;
+};
+
+// Hudson's MBC1 with an infrared port, which can be mapped at A000-BFFF in place of RAM
+class MemoryBankController_HuC1 : public MemoryBankController
+{
+public:
+	MemoryBankController_HuC1(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize);
+	~MemoryBankController_HuC1() override;
+
+	BYTE ReadMemory(WORD address) override;
+	void WriteMemory(WORD address, BYTE data) override;
+
+	void SaveState(StateBuffer& state) const override;
+	void LoadState(StateBuffer& state) override;
+
+private:
+	BYTE m_infraredMode;
+	BYTE m_romBank;
+	BYTE m_ramBank;
+};
+
+/*
+	Hudson's later controller, with an infrared port and a clock that counts minutes and days. The clock has its own
+	nibble wide memory, which the game reaches one command at a time through A000: the command is written in one mode,
+	run by clearing the semaphore in another and its result read back in a third.
+
+	The clock runs on emulated cycles like the MBC3's and is saved through the same ClockRegisters, with bits 0-3 of
+	daysHigh holding the upper 4 bits of its 12 bit day counter.
+*/
+class MemoryBankController_HuC3 : public MemoryBankController
+{
+public:
+	MemoryBankController_HuC3(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize);
+	~MemoryBankController_HuC3() override;
+
+	BYTE ReadMemory(WORD address) override;
+	void WriteMemory(WORD address, BYTE data) override;
+
+	void SaveState(StateBuffer& state) const override;
+	void LoadState(StateBuffer& state) override;
+
+	bool HasClock() const override { return true; }
+	void SyncClock(uint64_t clockCycle) override;
+	void RebaseClock(uint64_t clockCycle) override;
+	void GetClock(ClockRegisters& current, ClockRegisters& latched) const override;
+	void SetClock(const ClockRegisters& current, const ClockRegisters& latched) override;
+	void AdvanceClock(uint64_t seconds) override;
+
+private:
+	// What 0000-1FFF maps at A000-BFFF
+	enum Mode : BYTE
+	{
+		MODE_RAM_READ = 0x00,
+		MODE_RAM_WRITE = 0x0A,
+		MODE_CLOCK_COMMAND = 0x0B,
+		MODE_CLOCK_RESULT = 0x0C,
+		MODE_CLOCK_SEMAPHORE = 0x0D,
+		MODE_INFRARED = 0x0E,
+	};
+
+	void RunClockCommand();
+	// Copies the time to or from the first 6 nibbles of the clock's memory, minutes first then days
+	void ReadTime();
+	void WriteTime();
+
+	static constexpr uint64_t CLOCK_CYCLES_PER_SECOND = 4194304;
+	static constexpr int MINUTES_PER_DAY = 24 * 60;
+	static constexpr int DAY_MASK = 0xFFF;
+
+	BYTE m_mode;
+	BYTE m_romBank;
+	BYTE m_ramBank;
+
+	BYTE m_clockCommand;
+	BYTE m_clockResult;
+	BYTE m_clockAddress;
+	BYTE m_clockMemory[0x100];
+
+	BYTE m_seconds;
+	WORD m_minutes;
+	WORD m_days;
+	uint64_t m_clockSyncCycle;
+	uint64_t m_clockSubSecondCycles;
+};
+
+/*
+	Multicart controller that boots into the menu in the last 32 KiB of the ROM. The menu sets up which part of the
+	ROM and RAM the chosen game sees, then locks those registers and leaves the game an MBC1 within its own part.
+	Bits set in the ROM bank mask are taken from the menu's bank number rather than the game's. The multiplexed
+	wiring that a few carts use is not emulated.
+*/
+class MemoryBankController_MMM01 : public MemoryBankController
+{
+public:
+	MemoryBankController_MMM01(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize);
+	~MemoryBankController_MMM01() override;
+
+	BYTE ReadMemory(WORD address) override;
+	void WriteMemory(WORD address, BYTE data) override;
+
+	void SaveState(StateBuffer& state) const override;
+	void LoadState(StateBuffer& state) override;
+
+	// The menu's header, which describes the whole cart, is at the start of the last 32 KiB
+	static bool IsMulticart(const char* cartridgeBuffer, int bufferSize);
+
+private:
+	void MapBanks();
+	int GetRamAddress(WORD address) const;
+
+	BYTE m_ramEnabled;
+	bool m_locked;
+	BYTE m_romBankLow;
+	BYTE m_romBankMid;
+	BYTE m_romBankHigh;
+	BYTE m_romBankMask;
+	BYTE m_ramBankLow;
+	BYTE m_ramBankHigh;
+	BYTE m_ramBankMask;
+	BYTE m_bankMode;
+	bool m_bankModeLocked;
+};
+
+/*
+	The Game Boy Camera. Bank 10h of RAM is the camera's registers, writing bit 0 of A000 takes a picture into RAM bank 0.
+	There is no sensor to read, so pictures are of a fixed gradient put through the game's dithering thresholds, and
+	they are finished the moment they are started. Exposure and edge enhancement aren't applied.
+*/
+class MemoryBankController_Camera : public MemoryBankController
+{
+public:
+	MemoryBankController_Camera(char* cartridgeBuffer, int bufferSize, int romSize, int ramSize);
+	~MemoryBankController_Camera() override;
+
+	BYTE ReadMemory(WORD address) override;
+	void WriteMemory(WORD address, BYTE data) override;
+
+	void SaveState(StateBuffer& state) const override;
+	void LoadState(StateBuffer& state) override;
+
+private:
+	void Capture();
+
+	static constexpr BYTE REGISTER_BANK = 0x10;
+	static constexpr int REGISTER_COUNT = 0x36;
+	// A 4x4 matrix of three thresholds each, one per shade
+	static constexpr int DITHER_REGISTER = 0x06;
+	static constexpr int SENSOR_WIDTH = 128;
+	static constexpr int SENSOR_HEIGHT = 112;
+	static constexpr int IMAGE_ADDRESS = 0x0100;
+
+	BYTE m_ramWriteEnabled;
+	BYTE m_romBank;
+	BYTE m_ramBank;
+	BYTE m_registers[REGISTER_COUNT];
+};
+
 class MemoryBankControllerFactory
 {
 public:
 	static MemoryBankController* CreateMemoryBank(BYTE type, BYTE romSize, BYTE ramSize, char* cartridgeBuffer, int bufferLength);
+	static bool IsSupported(BYTE type);
 };
\ No newline at end of file
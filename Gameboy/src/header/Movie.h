@@ -0,0 +1,84 @@
+#pragma once
+#include <iosfwd>
+#include <vector>
+
+#include "Joypad.h"
+#include "StateBuffer.h"
+
+class Cartridge;
+class CPU;
+
+/*
+	An input movie is the machine state it starts from plus every joypad write, tagged with the frame it happened
+	before. The emulator has no other inputs, so playing a movie back on the same ROM reproduces every frame exactly,
+	however fast or slow the host ran while it was recorded.
+
+	File layout, little endian:
+		char[4]		"GBMV"
+		uint32		version
+		uint32		CRC32 of the ROM
+		uint32		number of frames
+		uint32		size of the initial state, followed by the state
+		uint32		number of joypad writes, followed by a frame delta (LEB128) and packed buttons for each
+*/
+class Movie
+{
+public:
+	Movie();
+
+	// Starts a movie from the machine's current state
+	void BeginRecording(CPU& sm83, const Cartridge& cart);
+	// Call with every joypad state given to CPU::WriteJoypad, and EndFrame after every frame
+	void RecordJoypad(const Joypad& joypad);
+	void EndFrame();
+	bool IsRecording() const { return m_recording; }
+	// Stops recording and writes the movie out, returns false if the file couldn't be written
+	bool StopRecording(const std::string& filePath);
+
+	// Returns false if the file is not a movie
+	bool Load(const std::string& filePath);
+	// Puts the machine into the movie's initial state. Returns false when the movie was recorded on a different ROM,
+	// or its state isn't the size this machine saves, which a state of the same version only is when it's corrupt.
+	bool BeginPlayback(CPU& sm83, const Cartridge& cart);
+	// Writes this frame's joypad states to the machine, call before every frame. Returns false once the movie has ended.
+	bool PlayFrame(CPU& sm83);
+	bool IsPlaying() const { return m_playing; }
+
+	uint32_t GetFrameCount() const { return m_frameCount; }
+
+	// One bit per button
+	static BYTE PackJoypad(const Joypad& joypad);
+	static Joypad UnpackJoypad(BYTE buttons);
+
+private:
+	static uint32_t GetRomHash(const Cartridge& cart);
+
+	static void WriteUInt32(std::ostream& out, uint32_t value);
+	static bool ReadUInt32(std::istream& in, uint32_t& value);
+	static void WriteVarint(std::ostream& out, uint32_t value);
+	static bool ReadVarint(std::istream& in, uint32_t& value);
+
+	// Bumped whenever the save state layout changes, since every movie starts from one
+	static constexpr uint32_t VERSION = 6;
+	// A corrupt file mustn't turn into a huge allocation. States are well under a megabyte even with the largest
+	// cartridge RAM, and a joypad write per frame for three days stays under the limit.
+	static constexpr uint32_t MAX_STATE_SIZE = 4 << 20;
+	static constexpr uint32_t MAX_WRITES = 1 << 24;
+
+	struct JoypadWrite
+	{
+		uint32_t frame;
+		BYTE buttons;
+	};
+
+	uint32_t m_romHash;
+	uint32_t m_frameCount;
+	StateBuffer m_initialState;
+	std::vector<JoypadWrite> m_writes;
+
+	bool m_recording;
+	bool m_playing;
+	// Frame being recorded or played, and the next write to play
+	uint32_t m_currentFrame;
+	size_t m_nextWrite;
+};
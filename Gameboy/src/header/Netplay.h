@@ -0,0 +1,105 @@
+#pragma once
+#include <string>
+
+#include "Joypad.h"
+#include "StateBuffer.h"
+
+class CPU;
+
+/*
+	Rollback netplay between two processes over UDP. Both players share the one Game Boy, its joypad sees the buttons
+	held by either of them.
+
+	Every frame runs straight away with the local input and a prediction of the remote one, which repeats the last
+	input that arrived. When the real input turns out to differ, the machine goes back to the state saved before the
+	first wrong frame and runs every frame since again, all within the current frame. Each side stops and waits
+	once it is MAX_ROLLBACK_FRAMES ahead of the inputs it has received.
+
+	Packets, little endian:
+		char[4]		"GBNP"
+		uint32		the sender has every input of ours before this frame
+		uint32		frame of the first input
+		uint8		number of inputs, followed by the packed buttons of each
+*/
+class Netplay
+{
+public:
+	Netplay();
+	~Netplay();
+
+	// Starts a session from the machine's current state, which must be the same on both sides.
+	// Without a socket the remote inputs are only what is given to AddRemoteInput.
+	void Start(CPU& sm83);
+	// Binds localPort and exchanges inputs with remoteAddress:remotePort. Returns false if the socket couldn't be set up.
+	bool Connect(uint16_t localPort, const std::string& remoteAddress, uint16_t remotePort);
+	void Stop();
+
+	// Runs the next frame with the local input. Returns false without running it while waiting for the peer.
+	bool RunFrame(const Joypad& localJoypad);
+
+	// Keeps exchanging inputs until both sides have every input before the current frame, then runs again whatever was
+	// predicted wrong. Returns false if the peer stopped answering.
+	bool Synchronize(int timeoutMilliseconds);
+
+	// Remote inputs have to arrive in frame order, inputs that were already received are ignored
+	void AddRemoteInput(uint32_t frame, BYTE buttons);
+
+	uint32_t GetFrame() const { return m_frame; }
+	// Frames run again because of a wrong prediction, and how many rollbacks that took
+	uint64_t GetRollbackFrames() const { return m_rollbackFrames; }
+	uint64_t GetRollbackCount() const { return m_rollbackCount; }
+
+	// Plays a session against the peer with scripted local input, then prints a CRC32 of the last frame which has to
+	// match the peer's
+	static int RunSession(const std::string& romPath, uint16_t localPort, const std::string& remoteAddress, uint16_t remotePort, int frames);
+
+	// Runs the ROM with a wrong prediction every frame, so each frame rolls back rollbackFrames frames, and prints how
+	// many frames are run per second and the deepest rollback that fits in one frame
+	static int RunStress(const std::string& romPath, int rollbackFrames, int frames);
+
+	static constexpr int MAX_ROLLBACK_FRAMES = 8;
+
+private:
+	// Saves the state, applies the inputs and runs one frame, predicting the remote input if it hasn't arrived
+	void SimulateFrame(uint32_t frame);
+	void Rollback();
+	BYTE PredictRemoteInput() const;
+
+	// Sends every local input before endFrame that the peer hasn't confirmed
+	void SendInputs(uint32_t endFrame);
+	void ReceiveInputs();
+
+	// Covers every frame that can be rolled back to and every frame the peer can be ahead by
+	static constexpr uint32_t HISTORY_SIZE = 32;
+	static_assert(HISTORY_SIZE > 2 * MAX_ROLLBACK_FRAMES, "History must cover both players' rollback windows");
+	static constexpr uint32_t NO_ROLLBACK = UINT32_MAX;
+	static constexpr size_t PACKET_HEADER_SIZE = 13;
+	static constexpr int SESSION_TIMEOUT_SECONDS = 10;
+
+	struct FrameInputs
+	{
+		BYTE local;
+		// The real input once it has arrived, until then the prediction the frame was run with
+		BYTE remote;
+	};
+
+	CPU* m_sm83;
+	FrameInputs m_inputs[HISTORY_SIZE];
+	// The state at the start of each frame
+	StateBuffer m_states[HISTORY_SIZE];
+
+	// The next frame to run
+	uint32_t m_frame;
+	// Every remote input before this frame has arrived
+	uint32_t m_remoteInputFrame;
+	// The peer has every local input before this frame
+	uint32_t m_remoteAckFrame;
+	// The earliest frame that was run with a wrong prediction
+	uint32_t m_rollbackFrame;
+
+	uint64_t m_rollbackFrames;
+	uint64_t m_rollbackCount;
+
+	// Native socket handle, -1 when there is none
+	intptr_t m_socket;
+};
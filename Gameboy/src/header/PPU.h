@@ -1,19 +1,61 @@
 #pragma once
-#include <SFML/Graphics/Texture.hpp>
+#include "Display.h"
 
 class CPU;
+class StateBuffer;
 class PPU
 {
 public:
+	enum class Renderer
+	{
+		// Renders a whole line at the start of mode 3, which always lasts 172 cycles. This is the fastest option.
+		SCANLINE,
+		// Renders dot by dot through the pixel FIFO. Mid-line register changes and the length of mode 3 are accurate.
+		PIXEL_FIFO,
+	};
+
+	// The screen can be null when running headless, frames are then only available through GetFrameBuffer
 	PPU(sf::RenderTarget* screen);
 	~PPU();
 
 	void DumpTiles(sf::RenderTarget& renderWindow);
 
 	void Initialize(CPU* sm83, BYTE* ioMemory, BYTE* oamMemory);
-	void Step(int clockCycles);
+	void Reset();
 	void DrawToScreen();
 
+	// The PPU only runs when something needs to observe it. CatchUp renders forward to the given clock cycle,
+	// and must be called before anything that affects rendering changes so that it is applied at the right cycle.
+	void CatchUp(uint64_t clockCycle);
+	// The next clock cycle at which the PPU raises an interrupt or completes a frame if it is left alone
+	uint64_t GetNextEventCycle() const;
+
+	// Returns true once after each transition into VBLANK
+	bool ConsumeFrameCompleted();
+
+	// Puts the current mode and whether LY matches LYC into STAT bits 0-2, the mode reads as HBLANK while the LCD is
+	// off. Done on every mode change, and by the CPU after it writes a register that affects them.
+	void UpdateStatus();
+
+	// The renderer is a setting rather than state, so it is left as it is when a state is loaded
+	void SaveState(StateBuffer& state) const;
+	void LoadState(StateBuffer& state);
+
+	// The renderer change takes effect from the next line
+	void SetRenderer(Renderer renderer) { m_renderer = renderer; }
+	Renderer GetRenderer() const { return m_renderer; }
+
+	// For instances nobody watches. LY, STAT, interrupts and the length of mode 3 carry on as before, but no pixels
+	// are produced and the frame buffer keeps whatever it last held. Takes effect from the next line.
+	void SetRenderingEnabled(bool enabled) { m_renderingEnabled = enabled; }
+	bool IsRenderingEnabled() const { return m_renderingEnabled; }
+
+	// SCREEN_WIDTH * SCREEN_HEIGHT shades, from 0 (white) to 3 (black), row by row
+	const BYTE* GetFrameBuffer() const { return m_frameBuffer; }
+
+	// OAM was written, the per-line sprite lists are rebuilt before the next line is drawn
+	void InvalidateSprites() { m_spriteLinesDirty = true; }
+
 	BYTE ReadVRAM(WORD address) const;
 	void WriteVRAM(WORD address, BYTE data);
 
@@ -24,6 +66,18 @@ private:
 	void ProcessBackgroundLayer();
 	void ProcessWindowLayer();
 	void ProcessSpriteLayer();
+	void RebuildSpriteLines();
+	// The two bitplanes of one pixel row of a background or window tile, low plane in the low byte
+	WORD ReadTileRow(BYTE tileNumber, int pixelRow) const;
+	static BYTE GetTileRowPixel(WORD tileRow, int x);
+
+	// Pixel FIFO renderer
+	void StartPixelFifo();
+	// Runs the FIFO for up to clockCycles dots and returns how many it used, the line may finish before then
+	int StepPixelFifo(int clockCycles);
+	void PixelFifoDot();
+	bool TryStartPixelFifoSprite();
+	void FetchPixelFifoTile();
 
 public:
 	static constexpr WORD LCDC_BYTE = 0x40;
@@ -31,10 +85,11 @@ public:
 	static constexpr WORD SCROLL_Y_BYTE = 0x42;
 	static constexpr WORD SCROLL_X_BYTE = 0x43;
 	static constexpr WORD LCDC_Y_BYTE = 0x44;
+	static constexpr WORD LY_COMPARE_BYTE = 0x45;
 	static constexpr WORD PALETTE_DATA = 0x47;
 	static constexpr WORD SPRITE_PALETTE_DATA = 0x48;
-	static constexpr WORD WINDOW_X = 0x4A;
-	static constexpr WORD WINDOW_Y = 0x4B;
+	static constexpr WORD WINDOW_Y = 0x4A;
+	static constexpr WORD WINDOW_X = 0x4B;
 
 	static constexpr BYTE LCD_ENABLE = BIT_7;
 	static constexpr BYTE WINDOW_TILEMAP = BIT_6;
@@ -45,6 +100,11 @@ public:
 	static constexpr BYTE SPRITE_ENABLE = BIT_1;
 	static constexpr BYTE BG_ENABLE = BIT_0;
 
+	// STAT bits 0-1 are the mode and bit 2 is set while LY equals LYC, the CPU can't write them
+	static constexpr BYTE STAT_MODE = BIT_0 | BIT_1;
+	static constexpr BYTE STAT_COINCIDENCE = BIT_2;
+	static constexpr BYTE STAT_READ_ONLY = STAT_MODE | STAT_COINCIDENCE;
+
 	enum class GPUMode
 	{
 		// Send head to first row (204 cycles)
@@ -59,14 +119,22 @@ public:
 	};
 
 private:
+	void Step(int clockCycles);
+	void AdvanceMode();
+	// HBLANK can be shorter than HBLANK_CYCLES when the pixel FIFO made mode 3 longer
+	int GetCurrentModeCycles() const { return m_mode == GPUMode::HBLANK ? m_hblankCycles : GetModeCycles(m_mode); }
+	static int GetModeCycles(GPUMode mode);
+
 	CPU* m_sm83;
 	BYTE* m_ioMemory;
 	BYTE* m_oamMemory;
-	sf::Image m_screenPixelBuffer;
-	sf::Texture m_displayTexture;
+	Display m_display;
 	sf::RenderTarget* m_screen;
 
+	BYTE m_frameBuffer[SCREEN_WIDTH * SCREEN_HEIGHT];
 	std::vector<BYTE> m_scanline;
+	Renderer m_renderer;
+	bool m_renderingEnabled;
 
 	GPUMode m_mode;
 	BYTE* m_vram;
@@ -102,16 +170,10 @@ private:
 	static constexpr int LCD_CYCLES = 172;
 
 	int m_gpuClock;
-
-	// The gameboy handles four different colours. Black (Pixel OFF), White (Pixel ON),
-	// Dark Grey (33% ON) and Light Grey (66% ON).
-	sf::Color m_colourPalette[4] =
-	{
-		sf::Color(0xFF, 0xFF, 0xFF, 0xFF),
-		sf::Color(0xAA, 0xAA, 0xAA, 0xFF),
-		sf::Color(0x55, 0x55, 0x55, 0xFF),
-		sf::Color(0x00, 0x00, 0x00, 0xFF)
-	};
+	int m_hblankCycles;
+	bool m_frameCompleted;
+	// Clock cycle up to which the PPU has been run
+	uint64_t m_lastSyncCycle;
 
 	/*
 		Tile map is simply 32*32 bytes refering to a certain tile in the tileset (results to a 256*256 display)
@@ -155,4 +217,62 @@ private:
 		// Options Bit 4 - Palette (0: OBJ Palette 0, 1: OBJ Palette 1)
 		bool UseObjectPalette1() const;
 	};
+
+	/*
+		The pixel FIFO renderer follows the hardware closely. A fetcher reads a row of 8 background or window pixels
+		every 6 dots and pushes them into the background FIFO once it is empty, and one pixel is shifted out to the LCD
+		every dot. The first SCX % 8 pixels of a line are dropped. When a sprite starts at the current position the
+		background is paused while its row is fetched and merged into the sprite FIFO, which stretches mode 3.
+	*/
+	static constexpr int FIFO_SIZE = 8;
+	static constexpr int FIFO_FETCH_DOTS = 6;
+	static constexpr int MAX_SPRITES_PER_LINE = 10;
+
+	struct PixelFifo
+	{
+		bool active;
+		// Pixels sent to the LCD on this line
+		int x;
+		// Pixels still to be dropped for the fine horizontal scroll
+		int discard;
+		// Dots where the fetcher and the FIFO are stalled, by the initial fetch or a sprite fetch
+		int stallDots;
+
+		int fetcherX;
+		int fetcherDots;
+		bool fetchingWindow;
+
+		BYTE backgroundColours[FIFO_SIZE];
+		int backgroundHead;
+		int backgroundSize;
+
+		// Slot 0 is mixed with the next background pixel, colour 0 is transparent
+		BYTE spriteColours[FIFO_SIZE];
+		BYTE spriteOptions[FIFO_SIZE];
+
+		SpriteOAM sprites[MAX_SPRITES_PER_LINE];
+		bool spriteFetched[MAX_SPRITES_PER_LINE];
+		int spriteCount;
+	};
+
+	/*
+		OAM is bucketed into a list per line instead of being scanned for every line. Each line keeps the first
+		10 sprites in OAM order that cover it, as the hardware does, sorted by X and then OAM index so that the
+		first sprite with an opaque pixel is the one that is drawn.
+	*/
+	struct SpriteLine
+	{
+		SpriteOAM sprites[MAX_SPRITES_PER_LINE];
+		int count;
+	};
+
+	SpriteLine m_spriteLines[SCREEN_HEIGHT];
+	bool m_spriteLinesDirty;
+	// Sprite height the lists were built for, changing LCDC bit 2 changes which lines a sprite covers
+	int m_spriteLinesHeight;
+
+	PixelFifo m_fifo;
+	// The window keeps its own line counter which only moves on lines where the window was drawn
+	int m_windowLine;
+	bool m_windowDrawnThisLine;
 };
\ No newline at end of file
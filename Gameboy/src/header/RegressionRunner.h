@@ -0,0 +1,45 @@
+#pragma once
+#include <vector>
+
+#include "PPU.h"
+
+/*
+	Plays every movie in a directory with each renderer and hashes the framebuffer after every frame. The hashes are
+	compared against golden files kept next to the movies, so a change to the core or the renderers can be shown to
+	be pixel exact over thousands of frames, and the first frame that differs can be named exactly.
+
+	A movie name.gbm is played on the ROM name.gb, name.gbc, name.gz or name.zip, whichever is found first, and its
+	hashes live in name.scanline.golden and name.fifo.golden.
+
+	Golden file layout, in the byte order of the machine that wrote it:
+		char[4]		"GBRG"
+		uint32		version
+		uint16		0x0102, to tell the byte order
+		uint32		number of frames, followed by the XXH64 of every frame in order
+*/
+class RegressionRunner
+{
+public:
+	// Returns the process exit code, non zero if any movie diverged or has no golden file. interval is how many
+	// frames each block covers when listing where the frames differ after the first one.
+	// With update set the golden files are rewritten from this build instead of being compared.
+	static int Run(const std::string& directory, int interval, bool update);
+
+private:
+	// Hashes every frame, returns false with an error if the movie can't be played
+	static bool HashMovie(const std::string& romPath, const std::string& moviePath, PPU::Renderer renderer,
+		std::vector<uint64_t>& hashes, std::string& error);
+	// Returns an empty string if the movie has no ROM next to it
+	static std::string FindRom(const std::string& moviePath);
+
+	static bool ReadGoldenFile(const std::string& filePath, std::vector<uint64_t>& hashes);
+	static bool WriteGoldenFile(const std::string& filePath, const std::vector<uint64_t>& hashes);
+
+	static constexpr char GOLDEN_MAGIC[4] = { 'G', 'B', 'R', 'G' };
+	static constexpr uint32_t GOLDEN_VERSION = 2;
+	static constexpr uint16_t GOLDEN_BYTE_ORDER = 0x0102;
+	// About three days of play, a corrupt count mustn't turn into a huge allocation
+	static constexpr uint32_t MAX_GOLDEN_FRAMES = 1 << 24;
+	// Blocks listed after the first diverging frame before the rest are only counted
+	static constexpr size_t MAX_REPORTED_BLOCKS = 8;
+};
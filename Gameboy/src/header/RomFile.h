@@ -0,0 +1,47 @@
+#pragma once
+#include <fstream>
+#include <vector>
+
+/*
+	Reads a ROM from a plain file or from inside a gzip or zip archive, which is told apart by its first bytes rather
+	than the extension. Compressed ROMs are decoded straight into the returned buffer. A zip is found through its
+	central directory at the end of the file, so only the ROM's own entry is read no matter what else the archive
+	holds. Entries may be stored or deflated.
+*/
+class RomFile
+{
+public:
+	// Returns false and reports why on std::cerr if the file can't be read
+	static bool Read(const std::string& filePath, std::vector<char>& rom);
+
+private:
+	static bool ReadPlain(std::ifstream& in, uint64_t fileSize, std::vector<char>& rom);
+	static bool ReadGzip(std::ifstream& in, uint64_t fileSize, std::vector<char>& rom);
+	static bool ReadZip(std::ifstream& in, uint64_t fileSize, std::vector<char>& rom);
+	// Decodes into a buffer of the size the archive promises, then compares its CRC32
+	static bool ReadEntry(std::ifstream& in, uint64_t compressedSize, int method, uint32_t size, uint32_t crc, std::vector<char>& rom);
+
+	static bool IsRomName(const std::string& name);
+	static uint16_t ReadUInt16(const BYTE* data);
+	static uint32_t ReadUInt32(const BYTE* data);
+
+	// The largest ROM any memory bank controller can map, anything claiming to be larger is corrupt
+	static constexpr uint32_t MAX_ROM_SIZE = 0x80'0000;
+
+	static constexpr int GZIP_HEADER_SIZE = 10;
+	static constexpr int GZIP_TRAILER_SIZE = 8;
+	static constexpr BYTE GZIP_EXTRA = 0x04;
+	static constexpr BYTE GZIP_NAME = 0x08;
+	static constexpr BYTE GZIP_COMMENT = 0x10;
+	static constexpr BYTE GZIP_HEADER_CRC = 0x02;
+
+	static constexpr uint32_t ZIP_LOCAL_HEADER_SIGNATURE = 0x04034B50;
+	static constexpr uint32_t ZIP_CENTRAL_HEADER_SIGNATURE = 0x02014B50;
+	static constexpr uint32_t ZIP_END_SIGNATURE = 0x06054B50;
+	static constexpr int ZIP_LOCAL_HEADER_SIZE = 30;
+	static constexpr int ZIP_CENTRAL_HEADER_SIZE = 46;
+	static constexpr int ZIP_END_SIZE = 22;
+	static constexpr int ZIP_MAX_COMMENT = 0xFFFF;
+	static constexpr int ZIP_STORED = 0;
+	static constexpr int ZIP_DEFLATED = 8;
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <vector>
+
+#include "Cartridge.h"
+#include "Hash.h"
+
+/*
+	Indexes every ROM in a directory and its subdirectories by header and content hash.
+
+	What was learned about each file is kept in library.gbi in the directory, so opening the library again only reads
+	files whose modification time or size changed since, along with any that are new. Files that do need reading are
+	decompressed, validated and hashed on every core at once.
+*/
+class RomLibrary
+{
+public:
+	struct Entry
+	{
+		// Relative to the library's directory, with / between directories so the index can move between systems
+		std::string path;
+		int64_t modifiedTime;
+		uint64_t fileSize;
+		// Decompressed, 0 if the file couldn't be read as a ROM
+		uint32_t romSize;
+		uint32_t crc32;
+		Hash::SHA1Digest sha1;
+		Cartridge::HeaderInfo header;
+	};
+
+	explicit RomLibrary(const std::string& directory);
+
+	// Loads the index, reads whatever changed and saves the index again if anything did.
+	// Returns the number of files that had to be read.
+	int Scan();
+
+	// Sorted by path
+	const std::vector<Entry>& GetEntries() const { return m_entries; }
+
+private:
+	bool LoadIndex(std::vector<Entry>& entries) const;
+	bool SaveIndex() const;
+	static void ReadEntry(const std::string& filePath, Entry& entry);
+	static bool IsLibraryFile(const std::string& extension);
+
+	template <typename T> static void Write(std::ostream& out, const T& value) { out.write(reinterpret_cast<const char*>(&value), sizeof(T)); }
+	template <typename T> static bool Read(std::istream& in, T& value) { return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T))); }
+	static void WriteString(std::ostream& out, const std::string& value);
+	static bool ReadString(std::istream& in, std::string& value);
+
+	std::string m_directory;
+	std::vector<Entry> m_entries;
+
+	static constexpr const char* INDEX_NAME = "library.gbi";
+	static constexpr char INDEX_MAGIC[4] = { 'G', 'B', 'L', 'I' };
+	// Fields are written in the host's byte order, an index from anywhere else is just rebuilt
+	static constexpr uint32_t INDEX_VERSION = 1;
+	static constexpr uint16_t INDEX_BYTE_ORDER = 0x0102;
+
+	static constexpr BYTE FLAG_COLOR = 0x01;
+	static constexpr BYTE FLAG_HEADER_CHECKSUM = 0x02;
+	static constexpr BYTE FLAG_GLOBAL_CHECKSUM = 0x04;
+	static constexpr BYTE FLAG_SIZE = 0x08;
+};
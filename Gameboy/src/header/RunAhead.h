@@ -0,0 +1,27 @@
+#pragma once
+
+#include "StateBuffer.h"
+
+class CPU;
+
+/*
+	Hides the input lag of games that read the joypad a frame or more before the result shows up. After each real
+	frame the machine is saved, run ahead with the same input, and the last of those frames is shown before the
+	machine is put back. Input then appears on screen that many frames sooner, at the cost of emulating every frame
+	that many more times.
+*/
+class RunAhead
+{
+public:
+	RunAhead();
+
+	void SetFrames(int frames) { m_frames = frames > 0 ? frames : 0; }
+	int GetFrames() const { return m_frames; }
+
+	// Emulates one real frame and copies the frame to show into frameBuffer, returns the number of frames emulated
+	int RunFrame(CPU& sm83, BYTE* frameBuffer);
+
+private:
+	int m_frames;
+	StateBuffer m_state;
+};
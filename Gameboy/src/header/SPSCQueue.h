@@ -0,0 +1,88 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+
+// Lock-free bounded queue for exactly one producer thread and one consumer thread
+template <typename T, size_t CAPACITY>
+class SPSCQueue
+{
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0, "SPSCQueue capacity must be a power of two");
+
+public:
+	SPSCQueue() :
+		m_items(),
+		m_head(0),
+		m_tail(0)
+	{
+	}
+
+	// Producer side, returns false when the queue is full
+	bool Push(const T& item)
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head - m_tail.load(std::memory_order_acquire) == CAPACITY)
+		{
+			return false;
+		}
+
+		m_items[head & (CAPACITY - 1)] = item;
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Producer side, pushes as many of the items as fit and returns how many that was
+	size_t Push(const T* items, size_t count)
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		count = std::min(count, CAPACITY - (head - m_tail.load(std::memory_order_acquire)));
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_items[(head + i) & (CAPACITY - 1)] = items[i];
+		}
+
+		m_head.store(head + count, std::memory_order_release);
+		return count;
+	}
+
+	// Consumer side, returns false when the queue is empty
+	bool Pop(T& item)
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail == m_head.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+
+		item = m_items[tail & (CAPACITY - 1)];
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, pops up to count items and returns how many there were
+	size_t Pop(T* items, size_t count)
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		count = std::min(count, m_head.load(std::memory_order_acquire) - tail);
+		for (size_t i = 0; i < count; ++i)
+		{
+			items[i] = m_items[(tail + i) & (CAPACITY - 1)];
+		}
+
+		m_tail.store(tail + count, std::memory_order_release);
+		return count;
+	}
+
+	// Either side, though it is only a snapshot while the other side is still running
+	size_t GetSize() const
+	{
+		// The tail is read first so the head can only have moved further ahead of it
+		size_t tail = m_tail.load(std::memory_order_acquire);
+		return m_head.load(std::memory_order_acquire) - tail;
+	}
+
+private:
+	T m_items[CAPACITY];
+	// Kept on separate cache lines so the two threads don't fight over them
+	alignas(64) std::atomic<size_t> m_head;
+	alignas(64) std::atomic<size_t> m_tail;
+};
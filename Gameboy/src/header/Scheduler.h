@@ -0,0 +1,45 @@
+#pragma once
+
+class StateBuffer;
+
+// Keeps track of the clock cycle at which each of the timed hardware events next needs attention.
+// Components schedule their own events and the CPU dispatches them as the clock passes them,
+// which avoids having to step every component after every instruction.
+class Scheduler
+{
+public:
+	enum class Event
+	{
+		PPU,
+		TIMER_OVERFLOW,
+		DMA_TRANSFER,
+		SERIAL_TRANSFER,
+		EVENT_COUNT
+	};
+
+	static constexpr uint64_t NEVER = UINT64_MAX;
+
+	Scheduler();
+
+	void Reset();
+	void Schedule(Event event, uint64_t clockCycle);
+	void Cancel(Event event);
+
+	bool IsScheduled(Event event) const { return m_eventCycles[static_cast<int>(event)] != NEVER; }
+	uint64_t GetEventCycle(Event event) const { return m_eventCycles[static_cast<int>(event)]; }
+	uint64_t GetNextEventCycle() const { return m_nextEventCycle; }
+
+	// Removes the earliest event due at or before currentCycle, returns false if there are none
+	bool PopDueEvent(uint64_t currentCycle, Event& event);
+
+	void SaveState(StateBuffer& state) const;
+	void LoadState(StateBuffer& state);
+
+private:
+	void UpdateNextEvent();
+
+	static constexpr int EVENT_COUNT = static_cast<int>(Event::EVENT_COUNT);
+
+	uint64_t m_eventCycles[EVENT_COUNT];
+	uint64_t m_nextEventCycle;
+};
@@ -0,0 +1,117 @@
+#pragma once
+#include <fstream>
+#include <vector>
+
+/*
+	Whatever is plugged into the link port. The CPU shifts a byte out and one in over 8 bits of the serial clock, and
+	asks the device for the incoming byte once a transfer completes. With nothing plugged in every bit reads as 1.
+*/
+class SerialDevice
+{
+public:
+	virtual ~SerialDevice();
+
+	// The Game Boy drives the clock. outgoing has been shifted out, returns the byte the device shifted back in.
+	// clockCycle is when the transfer completes on the Game Boy's clock.
+	virtual BYTE TransferInternalClock(BYTE outgoing, uint64_t clockCycle) = 0;
+
+	// The Game Boy waits for the device to drive the clock. Returns true once the device has clocked a whole byte,
+	// incoming is then what it sent and outgoing is what the Game Boy sent back.
+	virtual bool TransferExternalClock(BYTE outgoing, BYTE& incoming, uint64_t clockCycle);
+
+	// The Game Boy wrote SC on clockCycle. listening is whether it now waits for the device to drive the clock,
+	// outgoing is the byte it offers if so.
+	virtual void SetListening(bool listening, BYTE outgoing, uint64_t clockCycle);
+
+	static constexpr BYTE DISCONNECTED = 0xFF;
+};
+
+// Keeps the most recent bytes sent by the Game Boy, older bytes are overwritten once it fills up.
+// Test ROMs print their results this way.
+class SerialDevice_RingBuffer : public SerialDevice
+{
+public:
+	// Capacity is rounded up to a power of two
+	explicit SerialDevice_RingBuffer(size_t capacity = 0x10000);
+	~SerialDevice_RingBuffer() override;
+
+	BYTE TransferInternalClock(BYTE outgoing, uint64_t clockCycle) override;
+
+	// Moves up to size of the oldest unread bytes into data, returns how many were read
+	size_t Read(BYTE* data, size_t size);
+	// Appends every unread byte to text
+	void ReadAll(std::string& text);
+
+private:
+	std::vector<BYTE> m_buffer;
+	size_t m_mask;
+	// Total bytes written and read, their difference is how many are waiting
+	size_t m_writeCount;
+	size_t m_readCount;
+};
+
+// Appends every byte sent by the Game Boy to a file
+class SerialDevice_File : public SerialDevice
+{
+public:
+	explicit SerialDevice_File(const std::string& filePath);
+	~SerialDevice_File() override;
+
+	bool IsOpen() const { return m_file.is_open(); }
+
+	BYTE TransferInternalClock(BYTE outgoing, uint64_t clockCycle) override;
+
+private:
+	std::ofstream m_file;
+};
+
+/*
+	Links to another emulator on this machine through a UNIX domain socket. One side listens and the other connects.
+	Every transfer is a message of two bytes, a type and the data. The side that drives the clock sends its byte
+	and waits for the other side to answer with its own.
+*/
+class SerialDevice_LinkSocket : public SerialDevice
+{
+public:
+	SerialDevice_LinkSocket();
+	~SerialDevice_LinkSocket() override;
+
+	// Both return false if the socket couldn't be set up. A listening device connects once the peer arrives.
+	bool Listen(const std::string& socketPath);
+	bool Connect(const std::string& socketPath);
+	void Close();
+
+	bool IsConnected();
+
+	BYTE TransferInternalClock(BYTE outgoing, uint64_t clockCycle) override;
+	bool TransferExternalClock(BYTE outgoing, BYTE& incoming, uint64_t clockCycle) override;
+
+private:
+	enum MessageType : BYTE
+	{
+		MESSAGE_TRANSFER = 0x01,
+		MESSAGE_REPLY = 0x02,
+	};
+
+	bool SendMessage(MessageType type, BYTE data);
+	// Waits up to timeoutMicroseconds for a message, zero only checks what has already arrived
+	bool ReceiveMessage(MessageType type, BYTE& data, int timeoutMicroseconds);
+	bool AcceptPeer();
+	// Drops the peer but keeps listening for the next one
+	void ClosePeer();
+	static void SetNoSignal(intptr_t peerSocket);
+
+	// How long the emulation thread may wait on replies over one emulated frame, a quarter of a frame at normal
+	// speed. A reply that doesn't come within what is left of it reads as unplugged, so a slow or dead link can't
+	// make the thread miss frames.
+	static constexpr int REPLY_BUDGET_MICROSECONDS = 4000;
+
+	// Native socket handles, -1 when closed
+	intptr_t m_listenSocket;
+	intptr_t m_peerSocket;
+	std::string m_socketPath;
+
+	// The emulated frame the last reply was waited for in, and how much of its budget is left
+	uint64_t m_waitFrame;
+	int m_waitBudgetMicroseconds;
+};
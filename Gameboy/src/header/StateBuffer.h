@@ -0,0 +1,44 @@
+#pragma once
+#include <type_traits>
+#include <vector>
+
+// A snapshot of the machine as a flat block of bytes. Components write their state in a fixed order and read it back in
+// the same order. Saving and loading only copy memory, so a state can be taken and restored every frame.
+class StateBuffer
+{
+public:
+	StateBuffer();
+
+	// Starts a new snapshot, the memory from the previous one is reused
+	void BeginWrite();
+	// Starts reading from the beginning of the snapshot
+	void BeginRead();
+
+	void WriteBytes(const void* data, size_t size);
+	void ReadBytes(void* data, size_t size);
+
+	template <typename T>
+	void Write(const T& value)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be written to a StateBuffer");
+		WriteBytes(&value, sizeof(T));
+	}
+
+	template <typename T>
+	void Read(T& value)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be read from a StateBuffer");
+		ReadBytes(&value, sizeof(T));
+	}
+
+	// Replaces the snapshot with one that was saved elsewhere, such as a file
+	void SetData(const BYTE* data, size_t size);
+
+	size_t GetSize() const { return m_size; }
+	const BYTE* GetData() const { return m_data.data(); }
+
+private:
+	std::vector<BYTE> m_data;
+	size_t m_size;
+	size_t m_readPosition;
+};
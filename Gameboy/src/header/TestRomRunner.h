@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+
+class CPU;
+
+/*
+	Runs CPU test ROMs headless and decides whether they passed.
+
+	Blargg's tests print their results over the serial port and finish with "Passed" or "Failed". Mooneye's tests
+	execute LD B, B when they are done, with the Fibonacci numbers 3, 5, 8, 13, 21, 34 in B, C, D, E, H and L on a pass
+	and 0x42 in all of them on a failure.
+
+	A directory is run with one child process per ROM, so a test that crashes or hangs the emulator only takes down its
+	own process.
+*/
+class TestRomRunner
+{
+public:
+	enum class Result
+	{
+		PASSED = 0,
+		FAILED = 1,
+		TIMED_OUT = 2,
+		// The ROM couldn't be loaded or the emulator crashed
+		NO_RESULT = 3,
+	};
+
+	// Runs a single ROM in this process, prints one line with the result and returns the result as an exit code
+	static int RunRom(const std::string& romPath, int timeoutSeconds);
+
+	// Runs every .gb and .gbc file in the directory through executablePath --test-rom, up to jobs at a time, and
+	// reports how many passed
+	static int RunDirectory(const std::string& executablePath, const std::string& directory, int jobs, int timeoutSeconds);
+
+	static constexpr int DEFAULT_TIMEOUT_SECONDS = 120;
+
+private:
+	// Returns true once the ROM has reported a result
+	static bool CheckFinished(CPU& sm83, const std::string& serialOutput, Result& result);
+	static std::string GetLastLine(const std::string& text);
+	static const char* GetResultName(Result result);
+
+	struct RomResult
+	{
+		std::string romPath;
+		Result result;
+		std::string output;
+	};
+
+	// The child prints a line starting with the result name, without one it crashed
+	static void RunChildProcess(const std::string& executablePath, RomResult& romResult, int timeoutSeconds, int index);
+};
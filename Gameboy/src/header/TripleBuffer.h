@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+
+// Lock-free triple buffer for one producer thread and one consumer thread. The producer always has a buffer of its own
+// to write into and the consumer always reads the most recently published one, so neither side ever waits.
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() :
+		m_buffers(),
+		m_writeIndex(0),
+		m_readIndex(1),
+		m_middle(2)
+	{
+	}
+
+	// Producer side
+	T& GetWriteBuffer() { return m_buffers[m_writeIndex]; }
+
+	void Publish()
+	{
+		// The written buffer becomes the fresh middle buffer, and whichever buffer was in the middle is written next
+		m_writeIndex = m_middle.exchange(m_writeIndex | FRESH_BIT, std::memory_order_acq_rel) & INDEX_MASK;
+	}
+
+	// Consumer side, returns true when something was published since the last call and the read buffer was swapped for it
+	bool Consume()
+	{
+		if (!(m_middle.load(std::memory_order_relaxed) & FRESH_BIT))
+		{
+			return false;
+		}
+
+		m_readIndex = m_middle.exchange(m_readIndex, std::memory_order_acq_rel) & INDEX_MASK;
+		return true;
+	}
+
+	const T& GetReadBuffer() const { return m_buffers[m_readIndex]; }
+
+private:
+	static constexpr int INDEX_MASK = 0x3;
+	static constexpr int FRESH_BIT = 0x4;
+
+	T m_buffers[3];
+	int m_writeIndex;
+	int m_readIndex;
+	// Index of the buffer in between the two threads, with FRESH_BIT set when it has not been consumed yet
+	std::atomic<int> m_middle;
+};
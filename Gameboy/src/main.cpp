@@ -1,29 +1,40 @@
 #include "stdafx.h"
 
 #include <fstream>
+#include <initializer_list>
+#include <memory>
+#include <vector>
 
 #include <imgui.h>
 #include <imgui-SFML.h>
 #include <SFML/Graphics.hpp>
 #include <tinyfiledialogs/tinyfiledialogs.h>
 
+#include "header/AudioStream.h"
 #include "header/Cartridge.h"
 #include "header/CPU.h"
 #include "header/Debug.h"
+#include "header/Display.h"
+#include "header/EmulationThread.h"
+#include "header/Headless.h"
 #include "header/PPU.h"
+#include "header/SerialDevices.h"
 
-std::string OpenFile()
+static constexpr int MAX_RUN_AHEAD_FRAMES = 4;
+static constexpr const char* DEFAULT_LINK_SOCKET_PATH = "gameboy-link.sock";
+
+std::string OpenFile(const char* title, std::initializer_list<const char*> filterPatterns, const char* filterDescription)
 {
     char const* lTheOpenFileName;
-    char const* lFilterPatterns[1] = { "*.gb" };
+    std::vector<char const*> lFilterPatterns(filterPatterns);
 
     FILE* lIn;
     lTheOpenFileName = tinyfd_openFileDialog(
-        "Select a ROM",
+        title,
         "../",
-        1,
-        lFilterPatterns,
-        "gb files",
+        static_cast<int>(lFilterPatterns.size()),
+        lFilterPatterns.data(),
+        filterDescription,
         1);
 
     std::string file;
@@ -35,14 +46,44 @@ std::string OpenFile()
     return file;
 }
 
+std::string SaveFile(const char* title, const char* filterPattern, const char* filterDescription)
+{
+    char const* lFilterPatterns[1] = { filterPattern };
+    char const* lTheSaveFileName = tinyfd_saveFileDialog(
+        title,
+        "../",
+        1,
+        lFilterPatterns,
+        filterDescription);
+
+    std::string file;
+    if (lTheSaveFileName)
+    {
+        file = lTheSaveFileName;
+    }
+
+    return file;
+}
+
 int main(int argc, char* argv[])
 {
+    int exitCode = 0;
+    if (Headless::RunCommandLine(argc, argv, exitCode))
+    {
+        return exitCode;
+    }
+
     sf::RenderWindow window(sf::VideoMode(160 * 2, 144 * 2 + 19), "EMULATOR");
     window.setFramerateLimit(60);
     ImGui::SFML::Init(window);
 
     Cartridge cart;
-    CPU sm83(&window);
+    // Declared before the emulator so it is still plugged in while the emulator shuts down
+    std::unique_ptr<SerialDevice> serialDevice;
+    EmulationThread emulator;
+    // Declared after the emulator, it reads from the emulator's audio queue until it is destroyed
+    AudioStream audio(emulator.GetAudioQueue());
+    Display display;
 
     Joypad joypad;
     joypad.a = false;
@@ -53,6 +94,7 @@ int main(int argc, char* argv[])
     joypad.down = false;
     joypad.left = false;
     joypad.right = false;
+    Joypad sentJoypad = joypad;
 
     sf::Clock deltaClock;
     while (window.isOpen())
@@ -95,6 +137,11 @@ int main(int argc, char* argv[])
             break;
         }
 
+        if (memcmp(&joypad, &sentJoypad, sizeof(Joypad)) != 0 && emulator.SendJoypad(joypad))
+        {
+            sentJoypad = joypad;
+        }
+
         sf::Time dt = deltaClock.restart();
         ImGui::SFML::Update(window, dt);
 
@@ -120,40 +167,190 @@ int main(int argc, char* argv[])
             {
                 if (ImGui::MenuItem("Open"))
                 {
-                    std::string fileName = OpenFile();
-                    cart.OpenFile(fileName);
-                    if (cart.IsValid())
+                    std::string fileName = OpenFile("Select a ROM", { "*.gb", "*.gbc", "*.gz", "*.zip" }, "Game Boy ROMs and archives");
+                    if (!fileName.empty())
                     {
-                        window.setTitle(cart.GetTitle());
-                        sm83.AddCartridge(&cart);
-                        sm83.PowerOn();
+                        // The emulation thread reads the cartridge, so it has to let go of it before a new one is loaded
+                        emulator.Eject();
+                        cart.OpenFile(fileName);
+                        if (cart.IsValid())
+                        {
+                            window.setTitle(cart.GetTitle());
+                            emulator.Start(&cart);
+                            if (audio.getStatus() != sf::SoundSource::Playing)
+                            {
+                                audio.play();
+                            }
+                        }
                     }
                 }
+
+                if (ImGui::BeginMenu("Movie", emulator.IsRunning()))
+                {
+                    if (emulator.IsRecording())
+                    {
+                        if (ImGui::MenuItem("Stop recording"))
+                        {
+                            std::string fileName = SaveFile("Save movie", "*.gbm", "movie files");
+                            if (!fileName.empty())
+                            {
+                                emulator.StopRecording(fileName);
+                            }
+                        }
+                    }
+                    else if (ImGui::MenuItem("Record", nullptr, false, !emulator.IsPlayingMovie()))
+                    {
+                        emulator.StartRecording();
+                    }
+
+                    if (ImGui::MenuItem("Play", nullptr, emulator.IsPlayingMovie(), !emulator.IsRecording()))
+                    {
+                        std::string fileName = OpenFile("Select a movie", { "*.gbm" }, "movie files");
+                        if (!fileName.empty() && !emulator.PlayMovie(fileName))
+                        {
+                            tinyfd_messageBox("Movie", "The movie could not be loaded or was recorded with a different ROM", "ok", "error", 1);
+                        }
+                    }
+                    ImGui::EndMenu();
+                }
+
+                if (ImGui::BeginMenu("Trace", emulator.IsRunning()))
+                {
+                    // Every instruction goes into a ring in memory, nothing is written until the trace is saved
+                    if (ImGui::MenuItem("Record instructions", nullptr, emulator.IsTracing()))
+                    {
+                        emulator.SetTracing(!emulator.IsTracing());
+                    }
+
+                    if (ImGui::MenuItem("Save", nullptr, false, emulator.IsTracing()))
+                    {
+                        std::string fileName = SaveFile("Save trace", "*.gbt", "instruction traces");
+                        if (!fileName.empty() && !emulator.SaveTrace(fileName))
+                        {
+                            tinyfd_messageBox("Trace", "The trace could not be written", "ok", "error", 1);
+                        }
+                    }
+                    ImGui::EndMenu();
+                }
+
+                if (ImGui::BeginMenu("Link"))
+                {
+                    std::unique_ptr<SerialDevice> newDevice;
+                    if (ImGui::MenuItem("Listen"))
+                    {
+                        const char* path = tinyfd_inputBox("Link", "Socket to listen on", DEFAULT_LINK_SOCKET_PATH);
+                        auto link = std::make_unique<SerialDevice_LinkSocket>();
+                        if (path && link->Listen(path))
+                        {
+                            newDevice = std::move(link);
+                        }
+                        else if (path)
+                        {
+                            tinyfd_messageBox("Link", "Unable to listen on the socket", "ok", "error", 1);
+                        }
+                    }
+
+                    if (ImGui::MenuItem("Connect"))
+                    {
+                        const char* path = tinyfd_inputBox("Link", "Socket to connect to", DEFAULT_LINK_SOCKET_PATH);
+                        auto link = std::make_unique<SerialDevice_LinkSocket>();
+                        if (path && link->Connect(path))
+                        {
+                            newDevice = std::move(link);
+                        }
+                        else if (path)
+                        {
+                            tinyfd_messageBox("Link", "Nothing is listening on the socket", "ok", "error", 1);
+                        }
+                    }
+
+                    if (ImGui::MenuItem("Log to file"))
+                    {
+                        std::string fileName = SaveFile("Serial log", "*.txt", "text files");
+                        if (!fileName.empty())
+                        {
+                            newDevice = std::make_unique<SerialDevice_File>(fileName);
+                        }
+                    }
+
+                    if (ImGui::MenuItem("Unplug", nullptr, false, serialDevice != nullptr))
+                    {
+                        emulator.SetSerialDevice(nullptr);
+                        serialDevice.reset();
+                    }
+
+                    // The old device is only destroyed once the emulator has stopped using it
+                    if (newDevice)
+                    {
+                        emulator.SetSerialDevice(newDevice.get());
+                        serialDevice = std::move(newDevice);
+                    }
+                    ImGui::EndMenu();
+                }
+
+                if (ImGui::BeginMenu("Run-ahead"))
+                {
+                    // Each frame of run-ahead costs a full extra frame of emulation
+                    double speed = emulator.GetSpeed();
+                    for (int frames = 0; frames <= MAX_RUN_AHEAD_FRAMES; ++frames)
+                    {
+                        std::string label = frames == 0 ? "Off" : std::to_string(frames) + (frames == 1 ? " frame" : " frames");
+                        bool enoughHeadroom = speed == 0.0 || speed >= frames + 1;
+                        if (ImGui::MenuItem(label.c_str(), nullptr, emulator.GetRunAheadFrames() == frames, enoughHeadroom))
+                        {
+                            emulator.SetRunAheadFrames(frames);
+                        }
+                    }
+                    ImGui::EndMenu();
+                }
+
+                if (ImGui::BeginMenu("Audio"))
+                {
+                    // Fewer taps per step are cheaper but dull the treble
+                    static const char* const QUALITY_NAMES[] = { "Fast", "Normal", "High" };
+                    for (int quality = 0; quality < static_cast<int>(BlipBuffer::Quality::COUNT); ++quality)
+                    {
+                        BlipBuffer::Quality setting = static_cast<BlipBuffer::Quality>(quality);
+                        if (ImGui::MenuItem(QUALITY_NAMES[quality], nullptr, emulator.GetAudioQuality() == setting))
+                        {
+                            emulator.SetAudioQuality(setting);
+                        }
+                    }
+                    ImGui::EndMenu();
+                }
+
+                if (ImGui::BeginMenu("Clock"))
+                {
+                    // Off keeps cartridge clocks where the save left them, which makes runs repeatable
+                    if (ImGui::MenuItem("Catch up with real time", nullptr, emulator.GetClockCatchUp()))
+                    {
+                        emulator.SetClockCatchUp(!emulator.GetClockCatchUp());
+                    }
+                    ImGui::EndMenu();
+                }
+
+                if (emulator.IsRunning())
+                {
+                    ImGui::Text("%.1fx", emulator.GetSpeed());
+                }
                 ImGui::EndMainMenuBar();
             }
         }
         ImGui::End();
         ImGui::SFML::Render(window);
 
-        if (sm83.IsRunning())
+        if (emulator.IsRunning())
         {
-            sm83.WriteJoypad(joypad);
-            while (sm83.GetTotalClockCycles() < 17480)
-            {
-                sm83.CPU_Step();
-                if (deltaClock.getElapsedTime().asMicroseconds() > 16740)
-                {
-                    break;
-                }
-            }
-
-            sm83.ResetTotalClockCycles();
-            sm83.Draw();
+            // Emulation runs and paces itself on its own thread, we only show whichever frame it finished last
+            display.Draw(window, emulator.GetLatestFrame());
         }
-        
+
+
         window.display();
     }
 
+    // Waits for the battery save to be written
+    emulator.Eject();
     ImGui::SFML::Shutdown(window);
     return 0;
 }
\ No newline at end of file